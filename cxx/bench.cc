@@ -0,0 +1,404 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+double median_of_sorted(const vector<double> &v) {
+  size_t n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+void json_string(string &out, absl::string_view str) {
+  out += '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  out += '"';
+}
+
+void json_number(string &out, double val) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", val);
+  out += buf;
+}
+
+// Json is just enough of a JSON reader to read back what to_json
+// writes.
+struct Json {
+  enum Type { Null, Number, String, Array, Object } type = Null;
+  double number = 0;
+  string str;
+  vector<Json> array;
+  map<string, Json> object;
+
+  const Json *get(const string &key) const {
+    auto it = object.find(key);
+    return it == object.end() ? nullptr : &it->second;
+  }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(absl::string_view in) : in_(in) {}
+
+  bool parse(Json &out) {
+    if (!value(out)) {
+      return false;
+    }
+    space();
+    return pos_ == in_.size();
+  }
+
+private:
+  void space() {
+    while (pos_ < in_.size() && isspace(in_[pos_])) {
+      ++pos_;
+    }
+  }
+
+  bool eat(char c) {
+    space();
+    if (pos_ < in_.size() && in_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool string_value(string &out) {
+    if (!eat('"')) {
+      return false;
+    }
+    while (pos_ < in_.size() && in_[pos_] != '"') {
+      if (in_[pos_] == '\\' && ++pos_ == in_.size()) {
+        return false;
+      }
+      out += in_[pos_++];
+    }
+    return eat('"');
+  }
+
+  bool value(Json &out) {
+    space();
+    if (pos_ == in_.size()) {
+      return false;
+    }
+    char c = in_[pos_];
+    if (c == '"') {
+      out.type = Json::String;
+      return string_value(out.str);
+    }
+    if (c == '[') {
+      ++pos_;
+      out.type = Json::Array;
+      if (eat(']')) {
+        return true;
+      }
+      do {
+        out.array.emplace_back();
+        if (!value(out.array.back())) {
+          return false;
+        }
+      } while (eat(','));
+      return eat(']');
+    }
+    if (c == '{') {
+      ++pos_;
+      out.type = Json::Object;
+      if (eat('}')) {
+        return true;
+      }
+      do {
+        string key;
+        if (!string_value(key) || !eat(':') || !value(out.object[key])) {
+          return false;
+        }
+      } while (eat(','));
+      return eat('}');
+    }
+    if (in_.substr(pos_, 4) == "null") {
+      pos_ += 4;
+      return true;
+    }
+    string num(in_.substr(pos_, 32));
+    char *end;
+    out.number = strtod(num.c_str(), &end);
+    if (end == num.c_str()) {
+      return false;
+    }
+    out.type = Json::Number;
+    pos_ += end - num.c_str();
+    return true;
+  }
+
+  absl::string_view in_;
+  size_t pos_ = 0;
+};
+
+bool json_number_field(const Json &obj, const string &key, double &out) {
+  auto *v = obj.get(key);
+  if (v == nullptr || v->type != Json::Number) {
+    return false;
+  }
+  out = v->number;
+  return true;
+}
+}; // namespace
+
+Estimate estimate(vector<double> samples) {
+  if (samples.empty()) {
+    return Estimate{0, 0, 0, 0};
+  }
+  sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  Estimate est;
+  est.median = median_of_sorted(samples);
+
+  vector<double> dev;
+  for (double s : samples) {
+    dev.push_back(fabs(s - est.median));
+  }
+  sort(dev.begin(), dev.end());
+  est.mad = median_of_sorted(dev);
+
+  // The median lies between the j'th and k'th smallest samples with
+  // 95% confidence, by the normal approximation to the binomial.
+  double half = 1.96 * sqrt(double(n)) / 2;
+  long j = long(floor(n / 2.0 - half));
+  long k = long(ceil(1 + n / 2.0 + half));
+  if (n < 6 || j < 1) {
+    j = 1;
+  }
+  if (n < 6 || k > long(n)) {
+    k = n;
+  }
+  est.ci_low = samples[j - 1];
+  est.ci_high = samples[k - 1];
+  return est;
+}
+
+string to_json(const vector<BenchResult> &results) {
+  string out = "{\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto &r = results[i];
+    out += i ? ",\n    {" : "\n    {";
+    out += "\"name\": ";
+    json_string(out, r.name);
+    out += ", \"iterations\": ";
+    json_number(out, r.iterations);
+    out += ",\n     \"median_ns\": ";
+    json_number(out, r.ns_per_op.median);
+    out += ", \"mad_ns\": ";
+    json_number(out, r.ns_per_op.mad);
+    out += ", \"ci_low_ns\": ";
+    json_number(out, r.ns_per_op.ci_low);
+    out += ", \"ci_high_ns\": ";
+    json_number(out, r.ns_per_op.ci_high);
+    out += ",\n     \"trials_ns\": [";
+    for (size_t t = 0; t < r.trials.size(); ++t) {
+      if (t) {
+        out += ", ";
+      }
+      json_number(out, r.trials[t]);
+    }
+    out += "],\n     \"counters\": {";
+    for (size_t c = 0; c < r.counters.size(); ++c) {
+      if (c) {
+        out += ", ";
+      }
+      json_string(out, r.counters[c].first);
+      out += ": ";
+      json_number(out, r.counters[c].second);
+    }
+    out += "}}";
+  }
+  out += "\n  ]\n}\n";
+  return out;
+}
+
+absl::variant<vector<BenchResult>, Error>
+results_from_json(absl::string_view json) {
+  Json doc;
+  if (!JsonParser(json).parse(doc) || doc.type != Json::Object) {
+    return Error{"bad JSON"};
+  }
+  auto *benchmarks = doc.get("benchmarks");
+  if (benchmarks == nullptr || benchmarks->type != Json::Array) {
+    return Error{"missing \"benchmarks\" array"};
+  }
+  vector<BenchResult> out;
+  for (auto &b : benchmarks->array) {
+    BenchResult r;
+    auto *name = b.get("name");
+    double iterations = 0;
+    if (name == nullptr || name->type != Json::String ||
+        !json_number_field(b, "median_ns", r.ns_per_op.median) ||
+        !json_number_field(b, "mad_ns", r.ns_per_op.mad) ||
+        !json_number_field(b, "ci_low_ns", r.ns_per_op.ci_low) ||
+        !json_number_field(b, "ci_high_ns", r.ns_per_op.ci_high)) {
+      return Error{"benchmark without a name and time estimate"};
+    }
+    r.name = name->str;
+    json_number_field(b, "iterations", iterations);
+    r.iterations = iterations;
+    if (auto *trials = b.get("trials_ns")) {
+      for (auto &t : trials->array) {
+        r.trials.push_back(t.number);
+      }
+    }
+    if (auto *counters = b.get("counters")) {
+      for (auto &c : counters->object) {
+        r.counters.emplace_back(c.first, c.second.number);
+      }
+    }
+    out.push_back(move(r));
+  }
+  return out;
+}
+
+Comparison compare(const BenchResult &baseline, const BenchResult &current,
+                   double threshold) {
+  auto &base = baseline.ns_per_op, &cur = current.ns_per_op;
+  Comparison cmp{Comparison::Unchanged, cur.median / base.median};
+  if (cmp.ratio > 1 + threshold && cur.ci_low > base.ci_high) {
+    cmp.verdict = Comparison::Slower;
+  } else if (cmp.ratio < 1 - threshold && cur.ci_high < base.ci_low) {
+    cmp.verdict = Comparison::Faster;
+  }
+  return cmp;
+}
+
+PerfCounters::PerfCounters() {
+  struct {
+    const char *name;
+    uint64_t config;
+  } const events[] = {
+      {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+      {"llc-misses", PERF_COUNT_HW_CACHE_MISSES},
+      {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES},
+  };
+  for (auto &ev : events) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = ev.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0) {
+      names_.push_back(ev.name);
+      fds_.push_back(fd);
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    close(fd);
+  }
+}
+
+vector<uint64_t> PerfCounters::read() const {
+  vector<uint64_t> vals;
+  for (int fd : fds_) {
+    uint64_t val = 0;
+    if (::read(fd, &val, sizeof(val)) != sizeof(val)) {
+      val = 0;
+    }
+    vals.push_back(val);
+  }
+  return vals;
+}
+
+bool Bench::enabled(const string &name) const {
+  return !opts_.pattern.has_value() || regex_search(name, *opts_.pattern);
+}
+
+void Bench::measure(const string &name,
+                    const function<void(uint64_t)> &batch) {
+  // Calibration doubles as the first warmup.
+  uint64_t n = 1;
+  for (;; n *= 2) {
+    auto before = chrono::steady_clock::now();
+    batch(n);
+    if (chrono::steady_clock::now() - before >= opts_.min_time) {
+      break;
+    }
+  }
+  for (int i = 1; i < opts_.warmup; ++i) {
+    batch(n);
+  }
+
+  absl::optional<PerfCounters> perf;
+  if (opts_.counters) {
+    perf.emplace();
+  }
+  size_t ncounters = perf ? perf->names().size() : 0;
+  BenchResult r{name, n, {}, {}, {}};
+  vector<vector<double>> counts(ncounters);
+  for (int t = 0; t < max(opts_.trials, 1); ++t) {
+    vector<uint64_t> start;
+    if (perf) {
+      start = perf->read();
+    }
+    auto before = chrono::steady_clock::now();
+    batch(n);
+    auto after = chrono::steady_clock::now();
+    if (perf) {
+      auto end = perf->read();
+      for (size_t c = 0; c < ncounters; ++c) {
+        counts[c].push_back(double(end[c] - start[c]) / n);
+      }
+    }
+    r.trials.push_back(
+        double(chrono::duration_cast<chrono::nanoseconds>(after - before)
+                   .count()) /
+        n);
+  }
+  r.ns_per_op = estimate(r.trials);
+  for (size_t c = 0; c < ncounters; ++c) {
+    r.counters.emplace_back(perf->names()[c], estimate(counts[c]).median);
+  }
+
+  auto &est = r.ns_per_op;
+  cout << name << ": " << format_duration(est.median) << "/op";
+  char spread[32];
+  snprintf(spread, sizeof(spread), " ±%.1f%%",
+           est.median > 0 ? 100 * est.mad / est.median : 0.0);
+  cout << spread << " [" << format_duration(est.ci_low) << ", "
+       << format_duration(est.ci_high) << "]";
+  for (auto &c : r.counters) {
+    cout << " " << uint64_t(c.second) << " " << c.first << "/op";
+  }
+  cout << " (" << r.trials.size() << "x" << n << ")\n";
+  results_.push_back(move(r));
+}
+
+string format_duration(double ns) {
+  static const char *units[] = {"ns", "us", "ms", "s"};
+  size_t unit = 0;
+  while (ns >= 10000 && unit + 1 < sizeof(units) / sizeof(*units)) {
+    ns /= 1000;
+    ++unit;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), ns < 10 ? "%.2f%s" : "%.0f%s", ns, units[unit]);
+  return buf;
+}
+
+}; // namespace rubik
@@ -0,0 +1,130 @@
+#ifndef RUBIK_BENCH_H
+#define RUBIK_BENCH_H
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/variant.h"
+
+#include "rubik.h"
+
+namespace rubik {
+// Estimate summarizes repeated measurements of one quantity.
+struct Estimate {
+  double median;
+  // The median absolute deviation from the median.
+  double mad;
+  // A distribution-free 95% confidence interval for the median, taken
+  // from the order statistics. With fewer than six samples it is just
+  // the range of the samples.
+  double ci_low, ci_high;
+};
+
+Estimate estimate(std::vector<double> samples);
+
+struct BenchResult {
+  std::string name;
+  // Iterations of the body per trial.
+  uint64_t iterations;
+  // Nanoseconds per iteration, for each trial.
+  std::vector<double> trials;
+  Estimate ns_per_op;
+  // Hardware counters per iteration (the median over trials), for the
+  // counters the kernel would give us.
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+std::string to_json(const std::vector<BenchResult> &results);
+// results_from_json reads results written by to_json. It needs only
+// the names and time estimates; trials and counters are read if present.
+absl::variant<std::vector<BenchResult>, Error>
+results_from_json(absl::string_view json);
+
+struct Comparison {
+  enum Verdict { Unchanged, Faster, Slower };
+  Verdict verdict;
+  // Current median time over the baseline's.
+  double ratio;
+};
+
+// compare calls a benchmark Slower (or Faster) than its baseline only
+// if its median moved by more than `threshold` (a fraction) and the two
+// confidence intervals don't overlap, so that a noisy run isn't flagged
+// on its median alone.
+Comparison compare(const BenchResult &baseline, const BenchResult &current,
+                   double threshold);
+
+// PerfCounters counts instructions, last-level cache misses and branch
+// misses in this thread using perf_event_open. Counters the kernel
+// won't give us (no PMU, or perf_event_paranoid is too strict) are left
+// out.
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  const std::vector<std::string> &names() const { return names_; }
+  // Current values, in the order of names().
+  std::vector<uint64_t> read() const;
+
+private:
+  std::vector<std::string> names_;
+  std::vector<int> fds_;
+};
+
+struct BenchOptions {
+  // Run only benchmarks whose names match.
+  absl::optional<std::regex> pattern;
+  // Each trial runs the body enough times to take at least min_time.
+  std::chrono::nanoseconds min_time = std::chrono::milliseconds(100);
+  // Untimed trials before the timed ones.
+  int warmup = 1;
+  int trials = 10;
+  bool counters = true;
+};
+
+// Bench runs benchmarks and collects their results. Each one is
+// calibrated by doubling its iteration count until a batch takes
+// min_time, warmed up, and then timed over `trials` batches of that
+// many iterations.
+class Bench {
+public:
+  explicit Bench(BenchOptions opts = BenchOptions()) : opts_(std::move(opts)) {}
+
+  bool enabled(const std::string &name) const;
+
+  template <typename T> void run(const std::string &name, T body) {
+    if (!enabled(name)) {
+      return;
+    }
+    measure(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i) {
+        body();
+      }
+    });
+  }
+
+  const std::vector<BenchResult> &results() const { return results_; }
+
+private:
+  void measure(const std::string &name,
+               const std::function<void(uint64_t)> &batch);
+
+  BenchOptions opts_;
+  std::vector<BenchResult> results_;
+};
+
+// format_duration writes `ns` with a unit that keeps it under 10000.
+std::string format_duration(double ns);
+}; // namespace rubik
+
+#endif
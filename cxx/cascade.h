@@ -0,0 +1,89 @@
+#ifndef RUBIK_CASCADE_H
+#define RUBIK_CASCADE_H
+#include <stdint.h>
+
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// A HeuristicCascade prunes a search node with a list of lower bounds,
+// evaluated in order until one exceeds the moves left. The cheap bounds
+// need only a few instructions on the position's registers, so putting
+// them first saves the inverse, conjugates and table probes of the
+// pattern database for the nodes they prune.
+//
+// Searches given a cascade (see SearchOptions::cascade) count how many
+// nodes each stage saw and pruned, and add their counts to it when they
+// finish; one cascade can be shared by concurrent searches.
+class HeuristicCascade {
+public:
+  enum Stage {
+    // The flipped edges: register only.
+    kFlip,
+    // The edges out of place: register only.
+    kEdges,
+    // pair0_dist, on the inverse and its conjugates: a 1KB table.
+    kPair0,
+    // The quad table, as searches without a cascade probe it: 1MB.
+    kQuad,
+  };
+  static constexpr int kStages = 4;
+  static const char *name(Stage stage);
+
+  struct StageStats {
+    // Nodes that reached the stage, and that it pruned.
+    uint64_t calls = 0;
+    uint64_t prunes = 0;
+  };
+  using Stats = std::array<StageStats, kStages>;
+
+  struct StageCost {
+    // What calibrate() measured for the stage on its own: the time per
+    // node, and the fraction of nodes pruned.
+    double ns = 0;
+    double prune_rate = 0;
+  };
+
+  // The default order is cheapest first, as listed in Stage.
+  HeuristicCascade();
+  // A cascade of some stages, in this order. Leaving out kQuad weakens
+  // the bound, and the search visits many more nodes.
+  explicit HeuristicCascade(std::vector<Stage> order);
+  HeuristicCascade(const HeuristicCascade &) = delete;
+  HeuristicCascade &operator=(const HeuristicCascade &) = delete;
+
+  // The order and costs must not change while a search is using the
+  // cascade.
+  const std::vector<Stage> &order() const { return order_; }
+  void set_order(std::vector<Stage> order) { order_ = std::move(order); }
+
+  Stats stats() const;
+  void reset_stats();
+  void add_stats(const Stats &stats);
+
+  // calibrate collects the nodes that searches of `sample` visit, and
+  // reorders the stages greedily: first the stage that spends the least
+  // time per node it prunes, then the one that does among the nodes the
+  // first passes, and so on. Stages that prune none of the nodes left
+  // are dropped. costs() are each stage's on all of the nodes. It
+  // resets the stats.
+  void calibrate(const std::vector<Cube> &sample);
+  const std::array<StageCost, kStages> &costs() const { return costs_; }
+
+private:
+  std::vector<Stage> order_;
+  std::array<StageCost, kStages> costs_;
+  mutable std::mutex mu_;
+  Stats stats_;
+};
+
+// flip_heuristic and edge_heuristic bound the quarter turns to solve a
+// position by counting its flipped edges, and its edges out of place.
+int flip_heuristic(const Cube &pos);
+int edge_heuristic(const Cube &pos);
+}; // namespace rubik
+
+#endif
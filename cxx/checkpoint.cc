@@ -0,0 +1,126 @@
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
+#include "io.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr char kMagic[8] = {'R', 'U', 'B', 'I', 'K', 'C', 'K', 'P'};
+constexpr uint32_t kVersion = 1;
+
+// A checkpoint file is a FileHeader, then `path_size` move indices,
+// then the `jobs` done bits, eight to a byte.
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  Cube::Packed start;
+  int32_t max_depth;
+  int32_t depth;
+  uint64_t nodes;
+  uint64_t reported;
+  uint32_t path_size;
+  uint32_t jobs;
+};
+}; // namespace
+
+Result<size_t, Error> SearchCheckpoint::save(const string &path) const {
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.kind = kind;
+  header.start = start.pack();
+  header.max_depth = max_depth;
+  header.depth = depth;
+  header.nodes = nodes;
+  header.reported = reported;
+  header.path_size = this->path.size();
+  header.jobs = done.size();
+
+  string buf(reinterpret_cast<const char *>(&header), sizeof(header));
+  buf.append(this->path.begin(), this->path.end());
+  string bits((done.size() + 7) / 8, '\0');
+  for (size_t i = 0; i < done.size(); ++i) {
+    if (done[i]) {
+      bits[i / 8] |= 1 << (i % 8);
+    }
+  }
+  buf += bits;
+
+  string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Error{absl::StrCat(tmp, ": ", strerror(errno))};
+  }
+  bool ok = write_all(fd, buf.data(), buf.size()) && fsync(fd) == 0;
+  if (::close(fd) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return Error{absl::StrCat(path, ": write failed")};
+  }
+  return buf.size();
+}
+
+Result<SearchCheckpoint, Error> SearchCheckpoint::load(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  string buf;
+  char chunk[4096];
+  ssize_t n;
+  while ((n = ::read(fd, chunk, sizeof(chunk))) != 0) {
+    if (n < 0 && errno != EINTR) {
+      break;
+    }
+    if (n > 0) {
+      buf.append(chunk, n);
+    }
+  }
+  int err = errno;
+  ::close(fd);
+  if (n < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(err))};
+  }
+
+  auto bad = Error{absl::StrCat(path, ": not a search checkpoint")};
+  FileHeader header;
+  if (buf.size() < sizeof(header)) {
+    return bad;
+  }
+  memcpy(&header, buf.data(), sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      (header.kind != kSolve && header.kind != kEnumerate) ||
+      buf.size() != sizeof(header) + header.path_size +
+                        (uint64_t(header.jobs) + 7) / 8) {
+    return bad;
+  }
+
+  SearchCheckpoint cp;
+  cp.kind = Kind(header.kind);
+  cp.start = Cube::unpack(header.start);
+  cp.max_depth = header.max_depth;
+  cp.depth = header.depth;
+  cp.nodes = header.nodes;
+  cp.reported = header.reported;
+  const char *p = buf.data() + sizeof(header);
+  cp.path.assign(p, p + header.path_size);
+  p += header.path_size;
+  cp.done.resize(header.jobs);
+  for (size_t i = 0; i < cp.done.size(); ++i) {
+    cp.done[i] = (p[i / 8] >> (i % 8)) & 1;
+  }
+  return cp;
+}
+}; // namespace rubik
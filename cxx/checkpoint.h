@@ -0,0 +1,81 @@
+#ifndef RUBIK_CHECKPOINT_H
+#define RUBIK_CHECKPOINT_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// A SearchCheckpoint records how far a long search has got, so that a
+// later process can pick it up where it left off.
+struct SearchCheckpoint {
+  enum Kind : uint32_t {
+    // solve_resumable, or the optimal-depth solve of enumerate_resumable.
+    kSolve = 1,
+    // enumerate_resumable, once its depth is known.
+    kEnumerate = 2,
+  };
+  Kind kind = kSolve;
+  // The search: its start and its max_depth argument.
+  Cube start;
+  int max_depth = 0;
+  // The depth bound the search was at.
+  int depth = 0;
+  // For a search on one thread, the node it was about to visit, as the
+  // index of each move on its path in its node's list of moves. Every
+  // node before it in depth-first order has been searched.
+  std::vector<uint8_t> path;
+  // For an enumeration split into jobs, which jobs are finished and
+  // their solutions all reported.
+  std::vector<bool> done;
+  // Nodes visited and solutions reported, up to the checkpoint.
+  uint64_t nodes = 0;
+  uint64_t reported = 0;
+
+  // save writes the checkpoint to a temporary file and renames it over
+  // `path`, so that the file always holds a whole checkpoint. It returns
+  // the size written.
+  Result<size_t, Error> save(const std::string &path) const;
+  static Result<SearchCheckpoint, Error> load(const std::string &path);
+};
+
+struct CheckpointOptions {
+  // The checkpoint file. If it exists when the search starts, the search
+  // resumes from it; once the search finishes, it's removed.
+  std::string path;
+  // How often to save. Searches check the clock every few thousand
+  // nodes, and a cancelled search saves before it returns.
+  std::chrono::steady_clock::duration interval = std::chrono::seconds(60);
+};
+
+// solve_resumable is solve() that saves its progress to a checkpoint
+// file. If the file already holds a checkpoint of the same search, it
+// resumes exactly where that left off: at the same depth, skipping every
+// subtree the checkpointed search had finished. It searches like solve()
+// without order_moves or prefetch, which it ignores, as it does
+// dual_search.
+Result<SearchResult, Error>
+solve_resumable(Cube start, int max_depth, const CheckpointOptions &checkpoint,
+                const SearchOptions &opts = SearchOptions());
+
+// enumerate_resumable is enumerate_solutions() with checkpoints. On one
+// thread it checkpoints its position in the tree; on several, which of
+// the jobs the tree is split into are finished. A checkpoint resumes the
+// same way, whatever opts.threads is now. A resumed enumeration
+// reports only the solutions that the checkpoint hadn't: those found
+// since the last checkpoint before the process stopped are reported
+// again. It returns the number of solutions reported, counting those
+// reported before the checkpoint.
+Result<size_t, Error> enumerate_resumable(
+    Cube start, int max_depth,
+    const std::function<bool(const std::vector<Cube> &)> &found,
+    const CheckpointOptions &checkpoint,
+    const EnumerateOptions &opts = EnumerateOptions());
+}; // namespace rubik
+
+#endif
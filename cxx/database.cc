@@ -0,0 +1,407 @@
+#include "database.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
+#include "io.h"
+#include "rubik_impl.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr uint64_t kBase = 19;
+// The fanout index splits the entries by the top kFanoutBits of their
+// hash.
+constexpr int kFanoutBits = 16;
+constexpr size_t kFanout = size_t(1) << kFanoutBits;
+// Entries to buffer per file when streaming runs in and out.
+constexpr size_t kIOEntries = 1 << 16;
+
+constexpr char kMagic[8] = {'R', 'U', 'B', 'I', 'K', 'A', 'L', 'G'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t depth;
+  uint64_t size;
+  uint64_t fanout_bits;
+};
+
+// The whole-cube rotations, as (rotation, inverse) pairs, with the
+// identity first: the group the search symmetries generate.
+const vector<pair<Cube, Cube>> &cube_rotations() {
+  static const vector<pair<Cube, Cube>> rotations = [] {
+    vector<Cube> group{Cube()};
+    for (size_t i = 0; i < group.size(); ++i) {
+      for (auto &sym : symmetries) {
+        Cube next = group[i].apply(sym.first);
+        if (find(group.begin(), group.end(), next) == group.end()) {
+          group.push_back(next);
+        }
+      }
+    }
+    assert(group.size() == 24);
+    vector<pair<Cube, Cube>> out;
+    for (auto &r : group) {
+      out.emplace_back(r, r.invert());
+    }
+    return out;
+  }();
+  return rotations;
+}
+
+// enumerate calls visit(pos, code) for every path of up to `depth`
+// moves down the tree from `pos`, where digits[list][i] is the face-turn
+// digit of (*list)[i].
+template <typename Visit>
+void enumerate(
+    const Cube &pos, const search_moves &moves,
+    const unordered_map<const search_moves *, vector<uint64_t>> &digits,
+    uint64_t code, uint64_t place, int depth, const Visit &visit) {
+  visit(pos, code);
+  if (depth == 0) {
+    return;
+  }
+  auto &mine = digits.at(&moves);
+  for (size_t i = 0; i < moves.size(); ++i) {
+    enumerate(pos.apply(moves[i].rotation), *moves[i].next, digits,
+              code + mine[i] * place, place * kBase, depth - 1, visit);
+  }
+}
+
+// run_reader streams the entries of one sorted run back in.
+struct run_reader {
+  int fd;
+  vector<char> buf;
+  size_t pos = 0, len = 0;
+
+  bool next(void *entry, size_t size) {
+    if (pos == len) {
+      ssize_t n = ::read(fd, buf.data(), buf.size());
+      if (n <= 0) {
+        return false;
+      }
+      pos = 0;
+      len = n;
+    }
+    memcpy(entry, buf.data() + pos, size);
+    pos += size;
+    return true;
+  }
+};
+}; // namespace
+
+constexpr int AlgorithmDatabase::kMaxDepth;
+
+Result<size_t, Error>
+AlgorithmDatabase::build(const string &path, int depth,
+                         const DatabaseBuildOptions &opts) {
+  if (depth < 0 || depth > kMaxDepth) {
+    return Error{absl::StrCat("depth must be between 0 and ", kMaxDepth)};
+  }
+  const search_moves *root = opts.moves ? opts.moves : qtm_root;
+
+  // Map every move in the tree to its face-turn digit up front, so that
+  // enumeration is a hash lookup per node.
+  unordered_map<const search_moves *, vector<uint64_t>> digits;
+  vector<const search_moves *> todo{root};
+  while (!todo.empty()) {
+    auto *list = todo.back();
+    todo.pop_back();
+    if (digits.count(list)) {
+      continue;
+    }
+    auto &mine = digits[list];
+    for (auto &node : *list) {
+      auto &turns = face_turns();
+      auto it = std::find(turns.begin(), turns.end(), node.rotation);
+      if (it == turns.end()) {
+        return Error{"the search tree's moves must be face turns"};
+      }
+      mine.push_back(it - turns.begin() + 1);
+      todo.push_back(node.next);
+    }
+  }
+
+  // Sort the entries in runs of opts.run_entries. If they all fit in
+  // one, we write it straight out; otherwise each run goes to a
+  // temporary file for the merge.
+  const size_t run_limit = max<size_t>(1, opts.run_entries);
+  vector<Entry> run;
+  vector<string> run_paths;
+  auto cleanup = [&] {
+    for (auto &p : run_paths) {
+      unlink(p.c_str());
+    }
+  };
+  auto by_key = [](const Entry &a, const Entry &b) {
+    return a.hash != b.hash ? a.hash < b.hash : a.moves < b.moves;
+  };
+  bool failed = false;
+  auto flush = [&] {
+    sort(run.begin(), run.end(), by_key);
+    string run_path = absl::StrCat(path, ".run", run_paths.size());
+    run_paths.push_back(run_path);
+    int fd = ::open(run_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    bool ok = fd >= 0 && write_all(fd, run.data(), run.size() * sizeof(Entry));
+    if (fd >= 0 && ::close(fd) != 0) {
+      ok = false;
+    }
+    failed = failed || !ok;
+    run.clear();
+  };
+  size_t size = 0;
+  enumerate(Cube(), *root, digits, 0, 1, depth,
+            [&](const Cube &pos, uint64_t code) {
+              if (failed) {
+                return;
+              }
+              run.push_back(Entry{stable_hash(pos), code});
+              ++size;
+              if (run.size() == run_limit) {
+                flush();
+              }
+            });
+  if (!run_paths.empty() && !run.empty()) {
+    flush();
+  }
+  if (failed) {
+    cleanup();
+    return Error{absl::StrCat(path, ": writing sorted runs failed")};
+  }
+  sort(run.begin(), run.end(), by_key);
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cleanup();
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  const off_t index_offset = sizeof(FileHeader);
+  const off_t entries_offset = index_offset + (kFanout + 1) * sizeof(uint64_t);
+  bool ok = lseek(fd, entries_offset, SEEK_SET) == entries_offset;
+
+  // Merge the runs (or pass the one in memory through), counting the
+  // entries in each bucket of the fanout.
+  vector<uint64_t> fanout(kFanout + 1);
+  vector<Entry> out;
+  out.reserve(kIOEntries);
+  auto emit = [&](const Entry &e) {
+    ++fanout[(e.hash >> (64 - kFanoutBits)) + 1];
+    out.push_back(e);
+    if (out.size() == kIOEntries) {
+      ok = ok && write_all(fd, out.data(), out.size() * sizeof(Entry));
+      out.clear();
+    }
+  };
+  if (run_paths.empty()) {
+    for (auto &e : run) {
+      emit(e);
+    }
+  } else {
+    vector<Entry>().swap(run);
+    vector<run_reader> readers;
+    for (auto &p : run_paths) {
+      readers.push_back(run_reader{::open(p.c_str(), O_RDONLY),
+                                   vector<char>(kIOEntries * sizeof(Entry))});
+      ok = ok && readers.back().fd >= 0;
+    }
+    using head = pair<Entry, size_t>;
+    auto later = [&](const head &a, const head &b) {
+      return by_key(b.first, a.first);
+    };
+    priority_queue<head, vector<head>, decltype(later)> heads(later);
+    for (size_t i = 0; ok && i < readers.size(); ++i) {
+      Entry e;
+      if (readers[i].next(&e, sizeof(e))) {
+        heads.emplace(e, i);
+      }
+    }
+    while (ok && !heads.empty()) {
+      auto top = heads.top();
+      heads.pop();
+      emit(top.first);
+      Entry e;
+      if (readers[top.second].next(&e, sizeof(e))) {
+        heads.emplace(e, top.second);
+      }
+    }
+    for (auto &r : readers) {
+      if (r.fd >= 0) {
+        ::close(r.fd);
+      }
+    }
+  }
+  cleanup();
+  ok = ok && write_all(fd, out.data(), out.size() * sizeof(Entry));
+
+  for (size_t b = 0; b < kFanout; ++b) {
+    fanout[b + 1] += fanout[b];
+  }
+  ok = ok && fanout[kFanout] == size;
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.depth = depth;
+  header.size = size;
+  header.fanout_bits = kFanoutBits;
+  ok = ok &&
+       pwrite_all(fd, fanout.data(), fanout.size() * sizeof(uint64_t),
+                  index_offset) &&
+       pwrite_all(fd, &header, sizeof(header), 0);
+  if (::close(fd) != 0 || !ok) {
+    unlink(path.c_str());
+    return Error{absl::StrCat(path, ": write failed")};
+  }
+  return size;
+}
+
+Result<AlgorithmDatabase, Error>
+AlgorithmDatabase::open(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+    ::close(fd);
+    return Error{absl::StrCat(path, ": not an algorithm database")};
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+
+  // Lookups trust the fanout index to bound their binary searches, so
+  // it must be sorted and end at the last entry.
+  auto *header = static_cast<const FileHeader *>(map);
+  auto *fanout = reinterpret_cast<const uint64_t *>(header + 1);
+  size_t index_bytes = (kFanout + 1) * sizeof(uint64_t);
+  size_t entry_bytes = size - sizeof(FileHeader) - index_bytes;
+  bool ok = memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+            header->version == kVersion && header->depth <= kMaxDepth &&
+            header->fanout_bits == kFanoutBits &&
+            size >= sizeof(FileHeader) + index_bytes &&
+            entry_bytes % sizeof(Entry) == 0 &&
+            header->size == entry_bytes / sizeof(Entry) && fanout[0] == 0 &&
+            fanout[kFanout] == header->size;
+  for (size_t i = 0; ok && i < kFanout; ++i) {
+    ok = fanout[i] <= fanout[i + 1];
+  }
+  if (!ok) {
+    munmap(map, size);
+    return Error{absl::StrCat(path, ": not an algorithm database")};
+  }
+
+  AlgorithmDatabase db;
+  db.depth_ = header->depth;
+  db.size_ = header->size;
+  db.fanout_ = fanout;
+  db.entries_ = reinterpret_cast<const Entry *>(fanout + kFanout + 1);
+  db.map_ = map;
+  db.map_size_ = size;
+  return move(db);
+}
+
+template <typename Visit>
+void AlgorithmDatabase::for_each_match(const Cube &pos,
+                                       const Visit &visit) const {
+  uint64_t hash = stable_hash(pos);
+  size_t bucket = hash >> (64 - kFanoutBits);
+  auto *it = lower_bound(entries_ + fanout_[bucket],
+                         entries_ + fanout_[bucket + 1], hash,
+                         [](const Entry &e, uint64_t h) { return e.hash < h; });
+  for (auto *end = entries_ + fanout_[bucket + 1]; it != end && it->hash == hash;
+       ++it) {
+    if (replay_face_turns(it->moves) == pos) {
+      visit(it->moves);
+    }
+  }
+}
+
+vector<AlgorithmMatch>
+AlgorithmDatabase::lookup(const Cube &pos,
+                          const DatabaseLookupOptions &opts) const {
+  static const Rotations r;
+  // U^-k for k quarter turns.
+  static const Cube unturn[4] = {Cube(), r.Uinv, r.U2, r.U};
+  auto &rotations = cube_rotations();
+
+  vector<AlgorithmMatch> out;
+  size_t nrot = opts.rotations ? rotations.size() : 1;
+  int nauf = opts.auf ? 4 : 1;
+  for (size_t ri = 0; ri < nrot; ++ri) {
+    auto &rot = rotations[ri];
+    for (int pre = 0; pre < nauf; ++pre) {
+      for (int post = 0; post < nauf; ++post) {
+        // A sequence S fits if U^pre S U^post = pos; we look up the
+        // rotated case and rotate S's moves back.
+        Cube target = unturn[pre].apply(pos).apply(unturn[post]);
+        Cube rotated = rot.second.apply(target).apply(rot.first);
+        for_each_match(rotated, [&](uint64_t code) {
+          AlgorithmMatch m;
+          m.pre_u = pre;
+          m.post_u = post;
+          m.rotation = ri;
+          for (; code != 0; code /= kBase) {
+            auto &turn = face_turns()[code % kBase - 1];
+            m.moves.push_back(rot.first.apply(turn).apply(rot.second));
+          }
+          out.push_back(move(m));
+        });
+      }
+    }
+  }
+  return out;
+}
+
+size_t AlgorithmDatabase::count(const Cube &pos) const {
+  size_t n = 0;
+  for_each_match(pos, [&](uint64_t) { ++n; });
+  return n;
+}
+
+AlgorithmDatabase::AlgorithmDatabase(AlgorithmDatabase &&other) {
+  *this = move(other);
+}
+
+AlgorithmDatabase &AlgorithmDatabase::operator=(AlgorithmDatabase &&other) {
+  if (this == &other) {
+    return *this;
+  }
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+  depth_ = other.depth_;
+  size_ = other.size_;
+  fanout_ = other.fanout_;
+  entries_ = other.entries_;
+  map_ = other.map_;
+  map_size_ = other.map_size_;
+  other.map_ = nullptr;
+  other.fanout_ = nullptr;
+  other.entries_ = nullptr;
+  other.size_ = 0;
+  return *this;
+}
+
+AlgorithmDatabase::~AlgorithmDatabase() {
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+}
+
+}; // namespace rubik
@@ -0,0 +1,115 @@
+#ifndef RUBIK_DATABASE_H
+#define RUBIK_DATABASE_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// Options for AlgorithmDatabase::build().
+struct DatabaseBuildOptions {
+  // The tree to enumerate, whose moves must be face turns; nullptr is
+  // qtm_root.
+  const search_moves *moves = nullptr;
+  // Entries to sort in memory at once. build() writes each sorted run
+  // of this many to a temporary file next to the output and merges
+  // them, so a database can be larger than memory.
+  size_t run_entries = size_t(1) << 24;
+};
+
+// A sequence AlgorithmDatabase::lookup() found.
+struct AlgorithmMatch {
+  // Face turns whose product, after `pre_u` quarter turns of U and
+  // followed by `post_u` more, is the position looked up.
+  std::vector<Cube> moves;
+  int pre_u = 0;
+  int post_u = 0;
+  // Which whole-cube rotation of the stored sequence this is; 0 is
+  // the sequence as stored, and `moves` are always in the frame of
+  // the position looked up.
+  int rotation = 0;
+};
+
+// Options for AlgorithmDatabase::lookup().
+struct DatabaseLookupOptions {
+  // Also find the sequences for the 23 other whole-cube rotations of
+  // the case, rotated back.
+  bool rotations = false;
+  // Also find the sequences that produce the case up to a turn of U
+  // before and after.
+  bool auf = false;
+};
+
+// An AlgorithmDatabase indexes every canonical sequence of up to
+// `depth` moves of a search tree (by default qtm_root) by the position
+// it produces, to answer "which short sequences produce this case"
+// without searching.
+//
+// The file is a list of (position hash, sequence) entries sorted by
+// hash, behind a fanout index on the top bits of the hash, so that
+// open() can map it as-is and a lookup is two index reads and a short
+// binary search. Each entry takes 16 bytes: the sequence is stored as
+// face-turn digits, which is also its ID, and a hash match is confirmed
+// by replaying it. Depth 7 of the qtm tree (9.5M sequences) takes 150MB
+// and builds in a couple of seconds; each further move multiplies both
+// by about 9.4.
+class AlgorithmDatabase {
+public:
+  // 19^15 < 2^64, which limits the depth to 15.
+  static constexpr int kMaxDepth = 15;
+
+  // build enumerates the sequences, writes the database to `path`, and
+  // returns the number of sequences in it.
+  static Result<size_t, Error>
+  build(const std::string &path, int depth,
+        const DatabaseBuildOptions &opts = DatabaseBuildOptions());
+  // open maps a database that build() wrote, read-only.
+  static Result<AlgorithmDatabase, Error> open(const std::string &path);
+
+  AlgorithmDatabase(AlgorithmDatabase &&other);
+  AlgorithmDatabase &operator=(AlgorithmDatabase &&other);
+  AlgorithmDatabase(const AlgorithmDatabase &) = delete;
+  AlgorithmDatabase &operator=(const AlgorithmDatabase &) = delete;
+  ~AlgorithmDatabase();
+
+  int depth() const { return depth_; }
+  // The number of sequences in the database.
+  size_t size() const { return size_; }
+
+  // lookup returns every sequence in the database for `pos`, in order
+  // of rotation, then pre_u, then post_u, then sequence. A sequence that
+  // matches under several transformations (because the case is
+  // symmetric) is reported once for each.
+  std::vector<AlgorithmMatch>
+  lookup(const Cube &pos,
+         const DatabaseLookupOptions &opts = DatabaseLookupOptions()) const;
+  // The number of sequences for `pos` exactly.
+  size_t count(const Cube &pos) const;
+
+private:
+  struct Entry {
+    uint64_t hash;
+    // The moves, as base-19 digits holding face-turn index + 1, first
+    // move lowest.
+    uint64_t moves;
+  };
+
+  AlgorithmDatabase() = default;
+  // for_each_match calls visit(moves) for each sequence whose product
+  // is `pos`.
+  template <typename Visit>
+  void for_each_match(const Cube &pos, const Visit &visit) const;
+
+  int depth_ = 0;
+  size_t size_ = 0;
+  const uint64_t *fanout_ = nullptr;
+  const Entry *entries_ = nullptr;
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+};
+}; // namespace rubik
+
+#endif
@@ -0,0 +1,307 @@
+#include "dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
+#include "io.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr int kMoves = 18;
+constexpr uint32_t kBase = kMoves + 1;
+
+// The number of positions within each depth of solved, in the
+// half-turn metric.
+constexpr uint64_t kPositionsWithin[] = {
+    1, 19, 262, 3502, 46741, 621649, 8240087, 109043123,
+};
+
+// kDigits[n] is kBase^n: a code is less than kDigits[n] iff it holds at
+// most n moves.
+constexpr uint32_t kDigits[] = {
+    1, 19, 361, 6859, 130321, 2476099, 47045881, 893871739,
+};
+
+constexpr char kMagic[8] = {'R', 'U', 'B', 'I', 'K', 'D', 'I', 'C'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t depth;
+  uint64_t size;
+  uint64_t slots;
+};
+
+int code_length(uint32_t code) {
+  // Branch-free: the loop's trip count is as unpredictable as the code.
+  int n = 0;
+  for (int i = 0; i < MoveDictionary::kMaxDepth; ++i) {
+    n += code >= kDigits[i];
+  }
+  return n;
+}
+
+void decode(uint32_t code, vector<Cube> &out) {
+  out.clear();
+  for (; code != 0; code /= kBase) {
+    out.push_back(face_turns()[code % kBase - 1]);
+  }
+}
+
+// enumerate visits every canonical sequence of exactly `depth` more
+// moves: no two consecutive turns of the same face, and turns of
+// opposite faces only in one order.
+template <typename Visit>
+void enumerate(const Cube &pos, uint32_t code, uint32_t digit, int last_face,
+               int depth, const Visit &visit) {
+  if (depth == 0) {
+    visit(pos, code);
+    return;
+  }
+  for (int m = 0; m < kMoves; ++m) {
+    int face = m / 3;
+    if (last_face >= 0 &&
+        (face == last_face || (face / 2 == last_face / 2 && face < last_face))) {
+      continue;
+    }
+    enumerate(pos.apply(face_turns()[m]), code + (m + 1) * digit,
+              digit * kBase, face, depth - 1, visit);
+  }
+}
+}; // namespace
+
+constexpr int MoveDictionary::kMaxDepth;
+constexpr uint32_t MoveDictionary::kEmpty;
+
+MoveDictionary MoveDictionary::build(int depth) {
+  depth = max(0, min(depth, kMaxDepth));
+  MoveDictionary dict;
+  dict.depth_ = depth;
+  // Keep the table at most half full.
+  uint64_t slots = 1;
+  while (slots < 2 * kPositionsWithin[depth]) {
+    slots *= 2;
+  }
+  // Probes land all over the table, so back it with huge pages where
+  // we can to save a TLB miss on each.
+  dict.map_size_ = slots * sizeof(Slot);
+  dict.map_ = mmap(nullptr, dict.map_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (dict.map_ == MAP_FAILED) {
+    throw bad_alloc();
+  }
+  madvise(dict.map_, dict.map_size_, MADV_HUGEPAGE);
+  auto *owned = static_cast<Slot *>(dict.map_);
+  fill(owned, owned + slots, Slot{0, kEmpty});
+  dict.slots_ = owned;
+  dict.mask_ = slots - 1;
+  // Deepen one move at a time, so that the first sequence we see for a
+  // position is a shortest one.
+  for (int d = 0; d <= depth; ++d) {
+    enumerate(Cube(), 0, 1, -1, d,
+              [&](const Cube &pos, uint32_t code) { dict.insert(pos, code); });
+  }
+  return dict;
+}
+
+bool MoveDictionary::insert(const Cube &pos, uint32_t moves) {
+  uint64_t hash = stable_hash(pos);
+  if (find(pos, hash) != nullptr) {
+    return false;
+  }
+  auto *slots = const_cast<Slot *>(slots_);
+  uint64_t i = hash & mask_;
+  while (slots[i].moves != kEmpty) {
+    i = (i + 1) & mask_;
+  }
+  slots[i] = Slot{uint32_t(hash >> 32), moves};
+  ++size_;
+  return true;
+}
+
+const MoveDictionary::Slot *MoveDictionary::find(const Cube &pos,
+                                                 uint64_t hash) const {
+  uint32_t tag = hash >> 32;
+  for (uint64_t i = hash & mask_; slots_[i].moves != kEmpty;
+       i = (i + 1) & mask_) {
+    if (slots_[i].tag == tag && replay_face_turns(slots_[i].moves) == pos) {
+      return &slots_[i];
+    }
+  }
+  return nullptr;
+}
+
+bool MoveDictionary::lookup(const Cube &pos, vector<Cube> &moves) const {
+  auto *slot = find(pos, stable_hash(pos));
+  if (slot == nullptr) {
+    return false;
+  }
+  decode(slot->moves, moves);
+  return true;
+}
+
+vector<Cube> MoveDictionary::shorten(const vector<Cube> &moves,
+                                     int window) const {
+  if (window <= 0) {
+    window = depth_;
+  }
+  vector<Cube> seq = moves;
+  vector<Cube> products(window + 1);
+  vector<uint64_t> hashes(window + 1);
+
+  // Scan the start of the window left to right. A replacement can only
+  // make windows that overlap it shorter, so after one we back up far
+  // enough to recheck those, and a single scan leaves nothing to do.
+  for (size_t i = 0; i + 1 < seq.size();) {
+    size_t n = min<size_t>(window, seq.size() - i);
+    // Hash the product of every window starting at i and prefetch
+    // their slots before probing any of them.
+    products[1] = seq[i];
+    for (size_t len = 2; len <= n; ++len) {
+      products[len] = products[len - 1].apply(seq[i + len - 1]);
+      hashes[len] = stable_hash(products[len]);
+      __builtin_prefetch(&slots_[hashes[len] & mask_]);
+    }
+
+    // Take the window whose replacement saves the most moves. Only a
+    // sequence that would beat the best so far is worth replaying to
+    // confirm that it matches; we take any other slot with the right
+    // tag to be the window's, which at worst (one time in 2^32) misses
+    // a saving.
+    size_t best_len = 0;
+    uint32_t best = 0;
+    int best_saving = 0;
+    for (size_t len = 2; len <= n; ++len) {
+      uint32_t tag = hashes[len] >> 32;
+      for (uint64_t s = hashes[len] & mask_; slots_[s].moves != kEmpty;
+           s = (s + 1) & mask_) {
+        if (slots_[s].tag != tag) {
+          continue;
+        }
+        int saving = int(len) - code_length(slots_[s].moves);
+        if (saving <= best_saving) {
+          break;
+        }
+        if (replay_face_turns(slots_[s].moves) == products[len]) {
+          best_len = len;
+          best = slots_[s].moves;
+          best_saving = saving;
+          break;
+        }
+      }
+    }
+    if (best_len == 0) {
+      ++i;
+      continue;
+    }
+    vector<Cube> replacement;
+    decode(best, replacement);
+    seq.erase(seq.begin() + i, seq.begin() + i + best_len);
+    seq.insert(seq.begin() + i, replacement.begin(), replacement.end());
+    i = i >= size_t(window) ? i - window + 1 : 0;
+  }
+  return seq;
+}
+
+Result<size_t, Error> MoveDictionary::save(const string &path) const {
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.depth = depth_;
+  header.size = size_;
+  header.slots = mask_ + 1;
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  size_t bytes = (mask_ + 1) * sizeof(Slot);
+  bool ok = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, slots_, bytes);
+  if (::close(fd) != 0 || !ok) {
+    return Error{absl::StrCat(path, ": write failed")};
+  }
+  return sizeof(header) + bytes;
+}
+
+Result<MoveDictionary, Error> MoveDictionary::open(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+    ::close(fd);
+    return Error{absl::StrCat(path, ": not a move dictionary")};
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+
+  auto *header = static_cast<const FileHeader *>(map);
+  uint64_t slots = header->slots;
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->depth > kMaxDepth ||
+      slots == 0 || (slots & (slots - 1)) != 0 ||
+      size != sizeof(FileHeader) + slots * sizeof(Slot)) {
+    munmap(map, size);
+    return Error{absl::StrCat(path, ": not a move dictionary")};
+  }
+  madvise(map, size, MADV_WILLNEED);
+
+  MoveDictionary dict;
+  dict.depth_ = header->depth;
+  dict.size_ = header->size;
+  dict.mask_ = slots - 1;
+  dict.slots_ = reinterpret_cast<const Slot *>(header + 1);
+  dict.map_ = map;
+  dict.map_size_ = size;
+  return move(dict);
+}
+
+MoveDictionary::MoveDictionary(MoveDictionary &&other) {
+  *this = move(other);
+}
+
+MoveDictionary &MoveDictionary::operator=(MoveDictionary &&other) {
+  if (this == &other) {
+    return *this;
+  }
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+  depth_ = other.depth_;
+  size_ = other.size_;
+  mask_ = other.mask_;
+  slots_ = other.slots_;
+  map_ = other.map_;
+  map_size_ = other.map_size_;
+  other.map_ = nullptr;
+  other.slots_ = nullptr;
+  other.size_ = 0;
+  other.mask_ = 0;
+  return *this;
+}
+
+MoveDictionary::~MoveDictionary() {
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+}
+
+}; // namespace rubik
@@ -0,0 +1,84 @@
+#ifndef RUBIK_DICTIONARY_H
+#define RUBIK_DICTIONARY_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// A MoveDictionary maps every position within `depth` face turns of
+// solved to an optimal sequence of face turns that produces it. Here a
+// half turn is one move (the half-turn metric), as it is to the
+// hardware that replays our algorithms.
+//
+// The dictionary is a flat open-addressed hash table, so that save()
+// can write it as-is and open() can map it back without parsing. Depth
+// 6 (8.2M positions) takes 128MB; depth 7 takes 2GB.
+class MoveDictionary {
+public:
+  static constexpr int kMaxDepth = 7;
+
+  // build enumerates every sequence of up to `depth` face turns.
+  static MoveDictionary build(int depth);
+  // open maps a dictionary that save() wrote, read-only.
+  static Result<MoveDictionary, Error> open(const std::string &path);
+  // save writes the dictionary to `path` and returns its size in bytes.
+  Result<size_t, Error> save(const std::string &path) const;
+
+  MoveDictionary(MoveDictionary &&other);
+  MoveDictionary &operator=(MoveDictionary &&other);
+  MoveDictionary(const MoveDictionary &) = delete;
+  MoveDictionary &operator=(const MoveDictionary &) = delete;
+  ~MoveDictionary();
+
+  int depth() const { return depth_; }
+  // The number of positions in the dictionary.
+  size_t size() const { return size_; }
+
+  // lookup sets `moves` to an optimal sequence for `pos`, and returns
+  // false if `pos` is more than depth() moves from solved.
+  bool lookup(const Cube &pos, std::vector<Cube> &moves) const;
+
+  // shorten rewrites `moves`, a sequence of face turns, into an
+  // equivalent sequence that is no longer, by repeatedly replacing
+  // windows of up to `window` consecutive moves (by default depth())
+  // with the dictionary's sequence for their product, until no window
+  // can be shortened. The result is locally optimal: no run of up to
+  // depth() moves in it has a shorter equivalent. Windows longer than
+  // depth() are found only when they collapse to within depth() moves;
+  // on random sequences they save a few more moves in a thousand, at
+  // half again the cost.
+  std::vector<Cube> shorten(const std::vector<Cube> &moves,
+                            int window = 0) const;
+
+private:
+  struct Slot {
+    // High bits of the position's hash, as a cheap first check; lookup
+    // confirms a match by replaying the moves.
+    uint32_t tag;
+    // The moves, as base-19 digits holding move index + 1, first move
+    // lowest. 19^7 < 2^32, which limits the depth to 7. kEmpty marks an
+    // unused slot.
+    uint32_t moves;
+  };
+  static constexpr uint32_t kEmpty = ~0u;
+
+  MoveDictionary() = default;
+  bool insert(const Cube &pos, uint32_t moves);
+  const Slot *find(const Cube &pos, uint64_t hash) const;
+
+  int depth_ = 0;
+  size_t size_ = 0;
+  uint64_t mask_ = 0;
+  const Slot *slots_ = nullptr;
+  // The mapping holding the slots: anonymous memory that build() fills
+  // in, or the file open() maps.
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+};
+}; // namespace rubik
+
+#endif
@@ -0,0 +1,461 @@
+#include "distributed.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "rubik_impl.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+// The longest prefix or path a message holds.
+constexpr int kMaxMoves = 32;
+
+enum wire_type : uint8_t {
+  kJob = 1,
+  kResult = 2,
+  kCancel = 3,
+};
+
+// Result flags.
+constexpr uint8_t kFound = 1;
+constexpr uint8_t kCancelled = 2;
+
+// Every message is one wire_message.
+//  - kJob: search the subtree below the `count` moves of `moves` (each
+//    an index into its node's list of moves, from qtm_root) from
+//    `start`, for a solution `depth` moves long in all.
+//  - kResult: the job `id` is done. With kFound, `moves` holds the
+//    `count` moves below the prefix, as indices into face_turns().
+//  - kCancel: a solution `depth` moves long has been found; stop every
+//    job sent so far that is at least that deep.
+struct wire_message {
+  uint8_t type;
+  uint8_t depth;
+  uint8_t flags;
+  uint8_t count;
+  uint32_t id;
+  uint64_t nodes;
+  Cube::Packed start;
+  uint8_t moves[kMaxMoves];
+};
+static_assert(sizeof(wire_message) == 64, "wire_message is padded");
+
+bool read_message(int fd, wire_message &msg) {
+  auto *p = reinterpret_cast<char *>(&msg);
+  size_t left = sizeof(msg);
+  while (left > 0) {
+    ssize_t n = read(fd, p, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    left -= n;
+  }
+  return true;
+}
+
+// write_message never raises SIGPIPE: a worker that has gone away is an
+// error to handle, not a reason to die.
+bool write_message(int fd, const wire_message &msg) {
+  auto *p = reinterpret_cast<const char *>(&msg);
+  size_t left = sizeof(msg);
+  while (left > 0) {
+    ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    left -= n;
+  }
+  return true;
+}
+
+// valid_result checks that a reply is the result of job `id`, and that
+// any path it holds is made of face turns.
+bool valid_result(const wire_message &msg, size_t id) {
+  if (msg.type != kResult || msg.id != id || msg.count > kMaxMoves) {
+    return false;
+  }
+  return all_of(msg.moves, msg.moves + msg.count,
+                [](uint8_t m) { return m < face_turns().size(); });
+}
+
+int face_turn_index(const Cube &move) {
+  auto &turns = face_turns();
+  return find(turns.begin(), turns.end(), move) - turns.begin();
+}
+
+// run_job searches a kJob message's subtree. A prefix that doesn't name
+// a node of the tree fails the job.
+SearchResult run_job(const wire_message &msg, const SearchOptions &opts,
+                     bool &ok) {
+  Cube pos = Cube::unpack(msg.start);
+  const search_moves *moves = qtm_root;
+  ok = msg.count <= msg.depth && msg.count <= kMaxMoves;
+  for (int i = 0; ok && i < msg.count; ++i) {
+    ok = msg.moves[i] < moves->size();
+    if (ok) {
+      auto &node = (*moves)[msg.moves[i]];
+      pos = pos.apply(node.rotation);
+      moves = node.next;
+    }
+  }
+  if (!ok) {
+    return SearchResult();
+  }
+  return search_subtree(pos, *moves, msg.depth - msg.count, opts);
+}
+}; // namespace
+
+int serve_search_jobs(int fd, const SearchOptions &opts) {
+  // A reader thread takes messages off the socket, so that a cancel can
+  // stop the job we are searching; this thread searches and replies.
+  mutex mu;
+  condition_variable cv;
+  deque<wire_message> queue;
+  bool closed = false;
+  CancelToken *running = nullptr;
+  int running_depth = 0;
+
+  thread reader([&] {
+    wire_message msg;
+    while (read_message(fd, msg)) {
+      lock_guard<mutex> guard(mu);
+      if (msg.type == kJob) {
+        queue.push_back(msg);
+        cv.notify_one();
+      } else if (msg.type == kCancel) {
+        for (auto &queued : queue) {
+          if (queued.depth >= msg.depth) {
+            queued.flags |= kCancelled;
+          }
+        }
+        if (running != nullptr && running_depth >= msg.depth) {
+          running->cancel();
+        }
+      } else {
+        break;
+      }
+    }
+    lock_guard<mutex> guard(mu);
+    closed = true;
+    if (running != nullptr) {
+      running->cancel();
+    }
+    cv.notify_one();
+  });
+
+  int status = 0;
+  for (;;) {
+    unique_lock<mutex> lock(mu);
+    cv.wait(lock, [&] { return closed || !queue.empty(); });
+    if (closed) {
+      break;
+    }
+    wire_message job = queue.front();
+    queue.pop_front();
+    CancelToken token;
+    if (job.flags & kCancelled) {
+      token.cancel();
+    }
+    running = &token;
+    running_depth = job.depth;
+    lock.unlock();
+
+    SearchOptions job_opts = opts;
+    job_opts.cancel = &token;
+    bool ok;
+    auto result = run_job(job, job_opts, ok);
+
+    lock.lock();
+    running = nullptr;
+    lock.unlock();
+
+    wire_message reply{};
+    reply.type = kResult;
+    reply.id = job.id;
+    reply.depth = job.depth;
+    reply.nodes = result.nodes;
+    if (!ok) {
+      status = -1;
+      break;
+    }
+    if (result.solved) {
+      reply.flags = kFound;
+      reply.count = result.path.size();
+      for (size_t i = 0; i < result.path.size(); ++i) {
+        reply.moves[i] = face_turn_index(result.path[i]);
+      }
+    } else if (result.cancelled) {
+      reply.flags = kCancelled;
+    }
+    if (!write_message(fd, reply)) {
+      status = -1;
+      break;
+    }
+  }
+  // Wake the reader, if it's still waiting on the coordinator.
+  shutdown(fd, SHUT_RDWR);
+  reader.join();
+  return status;
+}
+
+namespace {
+// A job is the subtree below one path of split_depth moves: the path,
+// and the index of each of its moves in its node's list.
+struct split_job {
+  vector<Cube> prefix;
+  vector<uint8_t> indices;
+};
+
+void split_jobs(const search_moves &moves, int depth, split_job &path,
+                vector<split_job> &out) {
+  if (depth == 0) {
+    out.push_back(path);
+    return;
+  }
+  for (size_t i = 0; i < moves.size(); ++i) {
+    path.prefix.push_back(moves[i].rotation);
+    path.indices.push_back(i);
+    split_jobs(*moves[i].next, depth - 1, path, out);
+    path.indices.pop_back();
+    path.prefix.pop_back();
+  }
+}
+}; // namespace
+
+SearchCoordinator::~SearchCoordinator() {
+  for (auto &w : workers_) {
+    if (w.fd >= 0) {
+      close(w.fd);
+    }
+  }
+  for (auto &w : workers_) {
+    if (w.pid > 0) {
+      waitpid(w.pid, nullptr, 0);
+    }
+  }
+}
+
+void SearchCoordinator::add_worker(int fd) {
+  workers_.push_back(worker{fd, -1, false, 0});
+}
+
+Result<pid_t, Error>
+SearchCoordinator::spawn_worker(const SearchOptions &opts) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return Error{string("socketpair: ") + strerror(errno)};
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    int err = errno;
+    close(fds[0]);
+    close(fds[1]);
+    return Error{string("fork: ") + strerror(err)};
+  }
+  if (pid == 0) {
+    // The child serves jobs and exits without running the parent's
+    // atexit handlers. It closes its copies of the other workers'
+    // sockets, so that they see the coordinator hang up.
+    close(fds[0]);
+    for (auto &w : workers_) {
+      if (w.fd >= 0) {
+        close(w.fd);
+      }
+    }
+    _exit(serve_search_jobs(fds[1], opts) == 0 ? 0 : 1);
+  }
+  close(fds[1]);
+  workers_.push_back(worker{fds[0], pid, false, 0});
+  return pid;
+}
+
+size_t SearchCoordinator::live_workers() const {
+  return count_if(workers_.begin(), workers_.end(),
+                  [](const worker &w) { return w.fd >= 0; });
+}
+
+void SearchCoordinator::drop(worker &w) {
+  close(w.fd);
+  w.fd = -1;
+  w.busy = false;
+}
+
+Result<SearchResult, Error>
+SearchCoordinator::solve(Cube start, int max_depth,
+                         const DistributedOptions &opts) {
+  if (opts.search.weight != 1) {
+    return Error{"distributed searches are unweighted"};
+  }
+  if (max_depth >= kMaxMoves || opts.split_depth < 0 ||
+      opts.split_depth >= kMaxMoves) {
+    return Error{"depths must be less than " + to_string(kMaxMoves)};
+  }
+  SearchOptions local = opts.search;
+  local.cancel = opts.cancel;
+  local.dual_search = false;
+  // With no room to deepen, solve() reports the start's heuristic bound
+  // (or solves it, if it's already solved).
+  SearchResult result = rubik::solve(start, 0, local);
+  if (result.solved) {
+    return result;
+  }
+  vector<split_job> jobs;
+  split_job path;
+  split_jobs(*qtm_root, opts.split_depth, path, jobs);
+  wire_message job_msg{};
+  job_msg.type = kJob;
+  job_msg.start = start.pack();
+
+  for (int depth = result.lower_bound; depth <= max_depth; ++depth) {
+    if (depth <= opts.split_depth) {
+      auto found = search_subtree(start, *qtm_root, depth, local);
+      result.nodes += found.nodes;
+      result.cancelled = found.cancelled;
+      if (found.solved) {
+        result.solved = true;
+        result.path = move(found.path);
+      }
+    } else {
+      deque<size_t> todo;
+      for (size_t i = 0; i < jobs.size(); ++i) {
+        todo.push_back(i);
+      }
+      size_t outstanding = 0;
+      bool stopping = false;
+      // cancel tells the busy workers to abandon their jobs.
+      auto cancel = [&](int at) {
+        stopping = true;
+        wire_message msg{};
+        msg.type = kCancel;
+        msg.depth = at;
+        for (auto &w : workers_) {
+          if (w.busy && !write_message(w.fd, msg)) {
+            drop(w);
+            --outstanding;
+          }
+        }
+      };
+
+      while ((!stopping && !todo.empty()) || outstanding > 0) {
+        for (auto &w : workers_) {
+          if (stopping || todo.empty()) {
+            break;
+          }
+          if (w.fd < 0 || w.busy) {
+            continue;
+          }
+          size_t i = todo.front();
+          job_msg.id = i;
+          job_msg.depth = depth;
+          job_msg.count = jobs[i].indices.size();
+          copy(jobs[i].indices.begin(), jobs[i].indices.end(), job_msg.moves);
+          if (!write_message(w.fd, job_msg)) {
+            drop(w);
+            continue;
+          }
+          todo.pop_front();
+          w.busy = true;
+          w.job = i;
+          ++outstanding;
+        }
+        if (outstanding == 0) {
+          if (!stopping && !todo.empty()) {
+            return Error{"every worker was lost"};
+          }
+          break;
+        }
+
+        vector<pollfd> fds;
+        vector<worker *> polled;
+        for (auto &w : workers_) {
+          if (w.busy) {
+            fds.push_back(pollfd{w.fd, POLLIN, 0});
+            polled.push_back(&w);
+          }
+        }
+        // With a cancel token to watch, wake up now and then to poll it.
+        int timeout = opts.cancel != nullptr && !stopping ? 10 : -1;
+        int ready = ::poll(fds.data(), fds.size(), timeout);
+        if (ready < 0 && errno != EINTR) {
+          return Error{string("poll: ") + strerror(errno)};
+        }
+        if (!stopping && opts.cancel != nullptr && opts.cancel->cancelled()) {
+          result.cancelled = true;
+          cancel(0);
+        }
+        for (size_t i = 0; ready > 0 && i < fds.size(); ++i) {
+          worker &w = *polled[i];
+          if (fds[i].revents == 0 || !w.busy) {
+            continue;
+          }
+          wire_message msg;
+          if (!read_message(w.fd, msg) || !valid_result(msg, w.job)) {
+            // The worker is gone, or confused: its job goes back on the
+            // queue for someone else.
+            if (!stopping) {
+              todo.push_front(w.job);
+            }
+            drop(w);
+            --outstanding;
+            continue;
+          }
+          w.busy = false;
+          --outstanding;
+          result.nodes += msg.nodes;
+          if ((msg.flags & kFound) && !result.solved) {
+            result.solved = true;
+            result.path = jobs[msg.id].prefix;
+            for (int m = 0; m < msg.count; ++m) {
+              result.path.push_back(face_turns()[msg.moves[m]]);
+            }
+            cancel(depth);
+          }
+        }
+      }
+    }
+    if (result.solved || result.cancelled) {
+      break;
+    }
+    result.lower_bound = max(result.lower_bound, depth + 1);
+  }
+  return result;
+}
+
+Result<SearchResult, Error> solve_distributed(Cube start, int max_depth,
+                                              const DistributedOptions &opts) {
+  int processes = opts.processes;
+  if (processes <= 0) {
+    processes = max(1u, thread::hardware_concurrency());
+  }
+  SearchCoordinator coordinator;
+  for (int i = 0; i < processes; ++i) {
+    auto pid = coordinator.spawn_worker(opts.search);
+    if (auto err = absl::get_if<Error>(&pid)) {
+      return *err;
+    }
+  }
+  return coordinator.solve(start, max_depth, opts);
+}
+}; // namespace rubik
@@ -0,0 +1,88 @@
+#ifndef RUBIK_DISTRIBUTED_H
+#define RUBIK_DISTRIBUTED_H
+#include <sys/types.h>
+
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// A distributed search spreads one solve() over worker processes. The
+// coordinator enumerates the qtm tree to a split depth, and at each
+// depth of the iterative deepening hands out the subtrees below the
+// split as jobs, one at a time to each worker, over a stream socket.
+// Workers search their jobs with their own copy of the tables.
+//
+// When a worker finds a solution, the coordinator tells every worker
+// that one exists at that depth, so that they abandon their jobs. If a
+// worker dies or its connection breaks, its job goes to another worker.
+//
+// The protocol is fixed-size messages in host byte order, so a
+// coordinator and its workers must run on the same architecture.
+
+struct DistributedOptions {
+  // Worker processes for solve_distributed to fork; 0 is one per core.
+  int processes = 0;
+  // How many moves deep to split the tree into jobs. Two moves gives
+  // ~100 jobs per depth. Depths no deeper than this are searched by the
+  // coordinator itself.
+  int split_depth = 2;
+  // Options for the coordinator's own searches, and for the workers
+  // that solve_distributed forks. Searches are unweighted: a `weight`
+  // other than 1 is an error. dual_search and cancel are ignored.
+  SearchOptions search;
+  // Give up, returning what has been proven so far, once this token is
+  // cancelled.
+  const CancelToken *cancel = nullptr;
+};
+
+// serve_search_jobs runs a worker: it searches the jobs a coordinator
+// sends over `fd` with `opts`, and returns once the coordinator closes
+// the connection (0) or the connection fails (-1). The caller owns fd.
+int serve_search_jobs(int fd, const SearchOptions &opts = SearchOptions());
+
+class SearchCoordinator {
+public:
+  SearchCoordinator() = default;
+  SearchCoordinator(const SearchCoordinator &) = delete;
+  SearchCoordinator &operator=(const SearchCoordinator &) = delete;
+  // Closes every connection, which stops the workers, and waits for the
+  // processes spawn_worker started.
+  ~SearchCoordinator();
+
+  // add_worker takes ownership of `fd`, a stream socket connected to a
+  // worker running serve_search_jobs.
+  void add_worker(int fd);
+  // spawn_worker forks a worker process serving jobs over a socketpair,
+  // and returns its pid.
+  Result<pid_t, Error> spawn_worker(const SearchOptions &opts = SearchOptions());
+  // The workers that haven't died or disconnected so far.
+  size_t live_workers() const;
+
+  // solve is rubik::solve() spread over the workers. It fails only if
+  // every worker is lost before the search ends.
+  Result<SearchResult, Error>
+  solve(Cube start, int max_depth,
+        const DistributedOptions &opts = DistributedOptions());
+
+private:
+  struct worker {
+    int fd;
+    pid_t pid;
+    // The job the worker is searching, if busy.
+    bool busy;
+    size_t job;
+  };
+  void drop(worker &w);
+
+  std::vector<worker> workers_;
+};
+
+// solve_distributed forks opts.processes workers, solves `start` with
+// them, and stops them again.
+Result<SearchResult, Error>
+solve_distributed(Cube start, int max_depth,
+                  const DistributedOptions &opts = DistributedOptions());
+}; // namespace rubik
+
+#endif
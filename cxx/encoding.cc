@@ -0,0 +1,188 @@
+#include "rubik.h"
+#include "rubik_impl.h"
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <tmmintrin.h>
+
+#include <cassert>
+
+using namespace std;
+
+namespace rubik {
+
+const absl::uint128 kCubeStates =
+    absl::MakeUint128(2, 6358515127070752768ull);
+
+namespace {
+constexpr uint32_t kFactorial[13] = {
+    1,      1,       2,        6,        24,        120,      720,
+    5040,   40320,   362880,   3628800,  39916800,  479001600,
+};
+
+constexpr uint32_t kCornerOrients = 2187; // 3^7
+constexpr uint32_t kEdgeOrients = 2048;   // 2^11
+
+// lehmer_rank returns the lexicographic rank of the permutation held in
+// the low `n` bytes of `perm`. For each element we count the later
+// elements smaller than it with one compare and a movemask. The sum of
+// those digits is the inversion count, whose low bit is returned in
+// `parity`.
+template <int n> uint32_t lehmer_rank(__m128i perm, int &parity) {
+  union {
+    __m128i mm;
+    uint8_t arr[16];
+  } p;
+  p.mm = perm;
+  uint32_t rank = 0;
+  int inversions = 0;
+  for (int i = 0; i < n - 1; ++i) {
+    int less = _mm_movemask_epi8(_mm_cmplt_epi8(perm, _mm_set1_epi8(p.arr[i])));
+    int d = __builtin_popcount(less & ((1 << n) - 1) & ~((2 << i) - 1));
+    rank += d * kFactorial[n - 1 - i];
+    inversions += d;
+  }
+  parity = inversions & 1;
+  return rank;
+}
+
+// lehmer_unrank is the inverse of lehmer_rank, writing the permutation
+// into out[0..n). The elements not yet placed are kept in order as a
+// list of nibbles, so picking and removing the d'th is a few shifts.
+template <int n>
+void lehmer_unrank(uint32_t rank, uint8_t *out, int &parity) {
+  static_assert(n <= 16, "the nibble list holds at most 16 elements");
+  uint64_t avail = 0xfedcba9876543210ull;
+  int inversions = 0;
+  for (int i = 0; i < n; ++i) {
+    uint32_t d = rank / kFactorial[n - 1 - i];
+    rank %= kFactorial[n - 1 - i];
+    inversions += d;
+    int shift = 4 * d;
+    out[i] = (avail >> shift) & 0xf;
+    uint64_t below = avail & ((1ull << shift) - 1);
+    avail = below | ((avail >> shift >> 4) << shift);
+  }
+  parity = inversions & 1;
+}
+}; // namespace
+
+Cube::Packed Cube::pack() const {
+  // Pairs of edge permutation nibbles: e[2i] + 16 * e[2i+1].
+  auto perm = _mm_and_si128(edges, _mm_set1_epi8(kEdgePermMask));
+  auto pairs = _mm_maddubs_epi16(perm, _mm_set1_epi16(0x1001));
+  auto out = _mm_packus_epi16(pairs, _mm_setzero_si128());
+  int flips = _mm_movemask_epi8(_mm_slli_epi16(edges, 7 - kEdgeAlignShift));
+  out = _mm_insert_epi16(out, flips & 0x0fff, 3);
+  out = _mm_unpacklo_epi64(out, corners);
+
+  Packed packed;
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(packed.data()), out);
+  return packed;
+}
+
+Cube Cube::unpack(const Packed &packed) {
+  auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(packed.data()));
+
+  auto lo = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+  auto hi = _mm_and_si128(_mm_srli_epi16(in, 4), _mm_set1_epi8(0x0f));
+  auto perm = _mm_unpacklo_epi8(lo, hi);
+
+  // Spread the 12 flip bits back out to one byte per edge.
+  auto flips = _mm_shuffle_epi8(
+      in, _mm_setr_epi8(6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7));
+  auto bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32,
+                           64, -128);
+  flips = _mm_cmpeq_epi8(_mm_and_si128(flips, bit), bit);
+  flips = _mm_and_si128(flips, _mm_set1_epi8(kEdgeAlignMask));
+
+  auto keep = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0,
+                            0, 0, 0);
+  auto edges = _mm_and_si128(_mm_or_si128(perm, flips), keep);
+  auto corners = _mm_srli_si128(in, 8);
+  return Cube(edges, corners);
+}
+
+CubeCoordinates Cube::coordinates() const {
+  CubeCoordinates c;
+  int eparity, cparity;
+  c.edge_perm = lehmer_rank<12>(
+                    _mm_and_si128(edges, _mm_set1_epi8(kEdgePermMask)),
+                    eparity) >>
+                1;
+  c.corner_perm = lehmer_rank<8>(
+      _mm_and_si128(corners, _mm_set1_epi8(kCornerPermMask)), cparity);
+  assert(eparity == cparity);
+
+  c.edge_orient =
+      _mm_movemask_epi8(_mm_slli_epi16(edges, 7 - kEdgeAlignShift)) & 0x07ff;
+
+  corner_union cu;
+  cu.mm = corners;
+  c.corner_orient = 0;
+  for (int i = 0; i < 7; ++i) {
+    c.corner_orient = 3 * c.corner_orient + (cu.arr[i] >> kCornerAlignShift);
+  }
+  return c;
+}
+
+Cube Cube::from_coordinates(const CubeCoordinates &c) {
+  assert(c.edge_perm < kFactorial[12] / 2);
+  assert(c.corner_perm < kFactorial[8]);
+  assert(c.edge_orient < kEdgeOrients);
+  assert(c.corner_orient < kCornerOrients);
+
+  edge_union eu;
+  corner_union cu;
+  eu.mm = _mm_setzero_si128();
+  cu.mm = _mm_setzero_si128();
+
+  int cparity, eparity;
+  lehmer_unrank<8>(c.corner_perm, cu.arr.data(), cparity);
+  // Permutations whose ranks differ only in the lowest bit differ by
+  // swapping the last two elements; pick the one with matching parity.
+  lehmer_unrank<12>(c.edge_perm << 1, eu.arr.data(), eparity);
+  if (eparity != cparity) {
+    swap(eu.arr[10], eu.arr[11]);
+  }
+
+  int flips = c.edge_orient;
+  flips |= (__builtin_popcount(flips) & 1) << 11;
+  for (int i = 0; i < 12; ++i) {
+    eu.arr[i] |= ((flips >> i) & 1) << kEdgeAlignShift;
+  }
+
+  int twists = c.corner_orient, total = 0;
+  for (int i = 6; i >= 0; --i) {
+    int t = twists % 3;
+    twists /= 3;
+    total += t;
+    cu.arr[i] |= t << kCornerAlignShift;
+  }
+  cu.arr[7] |= ((3 - total % 3) % 3) << kCornerAlignShift;
+
+  return Cube(eu.mm, cu.mm);
+}
+
+// kEdgeOrients is a power of two, so the rank splits into the edge
+// orientation in the low 11 bits and a 64-bit rest.
+absl::uint128 Cube::rank() const {
+  auto c = coordinates();
+  uint64_t r = uint64_t(c.edge_perm) * kFactorial[8] + c.corner_perm;
+  r = r * kCornerOrients + c.corner_orient;
+  return (absl::uint128(r) << 11) | c.edge_orient;
+}
+
+Cube Cube::unrank(absl::uint128 rank) {
+  assert(rank < kCubeStates);
+  CubeCoordinates c;
+  c.edge_orient = absl::Uint128Low64(rank) & (kEdgeOrients - 1);
+  uint64_t r = absl::Uint128Low64(rank >> 11);
+  c.corner_orient = r % kCornerOrients;
+  r /= kCornerOrients;
+  c.corner_perm = r % kFactorial[8];
+  c.edge_perm = r / kFactorial[8];
+  return from_coordinates(c);
+}
+
+}; // namespace rubik
@@ -0,0 +1,41 @@
+#include "io.h"
+
+#include <cerrno>
+
+#include <unistd.h>
+
+namespace rubik {
+
+bool write_all(int fd, const void *data, size_t len) {
+  auto *p = static_cast<const char *>(data);
+  while (len > 0) {
+    ssize_t n = ::write(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool pwrite_all(int fd, const void *data, size_t len, off_t offset) {
+  auto *p = static_cast<const char *>(data);
+  while (len > 0) {
+    ssize_t n = ::pwrite(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+}; // namespace rubik
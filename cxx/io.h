@@ -0,0 +1,15 @@
+#ifndef RUBIK_IO_H
+#define RUBIK_IO_H
+#include <stddef.h>
+
+#include <sys/types.h>
+
+namespace rubik {
+// write_all and pwrite_all write all `len` bytes of `data`, resuming
+// after short writes and signals. They fail on any other error, leaving
+// it in errno.
+bool write_all(int fd, const void *data, size_t len);
+bool pwrite_all(int fd, const void *data, size_t len, off_t offset);
+}; // namespace rubik
+
+#endif
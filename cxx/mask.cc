@@ -0,0 +1,339 @@
+#include "mask.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <future>
+#include <map>
+#include <mutex>
+
+#include "rubik_impl.h"
+#include "tables.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr int kPieceBits = 5;
+constexpr uint8_t kEdgeBits = Cube::kEdgePermMask | Cube::kEdgeAlignMask;
+constexpr uint8_t kCornerBits = Cube::kCornerPermMask | Cube::kCornerAlignMask;
+}; // namespace
+
+constexpr int CubeMask::kEdges;
+constexpr int CubeMask::kCorners;
+constexpr int MaskTable::kMaxPieces;
+
+CubeMask::CubeMask() { update_bits(); }
+
+CubeMask CubeMask::all(bool orientation) {
+  CubeMask mask;
+  for (int i = 0; i < kEdges; ++i) {
+    mask.edge(i, orientation);
+  }
+  for (int i = 0; i < kCorners; ++i) {
+    mask.corner(i, orientation);
+  }
+  return mask;
+}
+
+CubeMask CubeMask::layer(Face face, bool orientation) {
+  Rotations r;
+  const Cube *turn = nullptr;
+  switch (face) {
+  case Face::Up:
+    turn = &r.U;
+    break;
+  case Face::Down:
+    turn = &r.D;
+    break;
+  case Face::Left:
+    turn = &r.L;
+    break;
+  case Face::Right:
+    turn = &r.R;
+    break;
+  case Face::Front:
+    turn = &r.F;
+    break;
+  case Face::Back:
+    turn = &r.B;
+    break;
+  }
+  edge_union eu;
+  corner_union cu;
+  eu.mm = turn->getEdges();
+  cu.mm = turn->getCorners();
+  CubeMask mask;
+  for (int i = 0; i < kEdges; ++i) {
+    if ((eu.arr[i] & Cube::kEdgePermMask) != i) {
+      mask.edge(i, orientation);
+    }
+  }
+  for (int i = 0; i < kCorners; ++i) {
+    if ((cu.arr[i] & Cube::kCornerPermMask) != i) {
+      mask.corner(i, orientation);
+    }
+  }
+  return mask;
+}
+
+CubeMask &CubeMask::edge(int i, bool orientation) {
+  assert(i >= 0 && i < kEdges);
+  edges_ |= 1 << i;
+  edge_orient_ = (edge_orient_ & ~(1 << i)) | (orientation << i);
+  update_bits();
+  return *this;
+}
+
+CubeMask &CubeMask::corner(int i, bool orientation) {
+  assert(i >= 0 && i < kCorners);
+  corners_ |= 1 << i;
+  corner_orient_ = (corner_orient_ & ~(1 << i)) | (orientation << i);
+  update_bits();
+  return *this;
+}
+
+CubeMask CubeMask::edges() const {
+  CubeMask out = *this;
+  out.corners_ = out.corner_orient_ = 0;
+  out.update_bits();
+  return out;
+}
+
+CubeMask CubeMask::corners() const {
+  CubeMask out = *this;
+  out.edges_ = out.edge_orient_ = 0;
+  out.update_bits();
+  return out;
+}
+
+CubeMask CubeMask::operator|(const CubeMask &other) const {
+  CubeMask out = *this;
+  out.edges_ |= other.edges_;
+  out.edge_orient_ |= other.edge_orient_;
+  out.corners_ |= other.corners_;
+  out.corner_orient_ |= other.corner_orient_;
+  out.update_bits();
+  return out;
+}
+
+CubeMask CubeMask::without(const CubeMask &other) const {
+  CubeMask out = *this;
+  out.edges_ &= ~other.edges_;
+  out.edge_orient_ &= out.edges_;
+  out.corners_ &= ~other.corners_;
+  out.corner_orient_ &= out.corners_;
+  out.update_bits();
+  return out;
+}
+
+int CubeMask::pieces() const {
+  return __builtin_popcount(edges_) + __builtin_popcount(corners_);
+}
+
+void CubeMask::update_bits() {
+  edge_union eu;
+  corner_union cu;
+  eu.mm = _mm_setzero_si128();
+  cu.mm = _mm_setzero_si128();
+  for (int i = 0; i < kEdges; ++i) {
+    if (has_edge(i)) {
+      eu.arr[i] = edge_oriented(i) ? kEdgeBits : Cube::kEdgePermMask;
+    }
+  }
+  for (int i = 0; i < kCorners; ++i) {
+    if (has_corner(i)) {
+      cu.arr[i] = corner_oriented(i) ? kCornerBits : Cube::kCornerPermMask;
+    }
+  }
+  edge_bits_ = eu.mm;
+  corner_bits_ = cu.mm;
+}
+
+namespace {
+vector<Cube> quarter_turns() {
+  vector<Cube> moves;
+  for (auto &node : *qtm_root) {
+    moves.push_back(node.rotation);
+  }
+  return moves;
+}
+}; // namespace
+
+MaskTable::MaskTable(const CubeMask &mask)
+    : MaskTable(mask, quarter_turns()) {}
+
+MaskTable::MaskTable(const CubeMask &mask, const vector<Cube> &moves)
+    : mask_(mask) {
+  assert(mask.pieces() <= kMaxPieces);
+  for (int i = 0; i < CubeMask::kEdges; ++i) {
+    if (mask.has_edge(i)) {
+      pieces_.push_back(piece{uint8_t(i), uint8_t(mask.edge_oriented(i)
+                                                      ? kEdgeBits
+                                                      : Cube::kEdgePermMask)});
+    }
+  }
+  for (int i = 0; i < CubeMask::kCorners; ++i) {
+    if (mask.has_corner(i)) {
+      pieces_.push_back(
+          piece{uint8_t(CubeMask::kEdges + i),
+                uint8_t(mask.corner_oriented(i) ? kCornerBits
+                                                : Cube::kCornerPermMask)});
+    }
+  }
+  packed_.assign((size() + 1) / 2, 0xff);
+  auto set = [&](size_t i, int v) {
+    int shift = (i & 1) << 2;
+    packed_[i >> 1] = (packed_[i >> 1] & ~(0xf << shift)) | (v << shift);
+  };
+
+  // The pieces' bytes of the inverse are where each piece is. A move m
+  // takes the inverse X to m^-1 X, whose byte for each piece depends
+  // only on X's byte for it, so we can search over just those bytes;
+  // and since the moves include their inverses, searching by m X from
+  // solved finds the same distances. next[m][kind][v] is m X's byte
+  // where X's is v, for edges (kind 0) and corners (kind 1).
+  vector<array<array<uint8_t, 32>, 2>> next;
+  for (auto &rotation : moves) {
+    edge_union eu;
+    corner_union cu;
+    eu.mm = rotation.getEdges();
+    cu.mm = rotation.getCorners();
+    array<array<uint8_t, 32>, 2> move{};
+    for (int v = 0; v < 32; ++v) {
+      int e = v & Cube::kEdgePermMask;
+      if (e < CubeMask::kEdges) {
+        move[0][v] = eu.arr[e] ^ (v & Cube::kEdgeAlignMask);
+      }
+      int c = v & Cube::kCornerPermMask;
+      int twist = (cu.arr[c] >> Cube::kCornerAlignShift) +
+                  (v >> Cube::kCornerAlignShift);
+      move[1][v] = (cu.arr[c] & Cube::kCornerPermMask) |
+                   (twist % 3) << Cube::kCornerAlignShift;
+    }
+    next.push_back(move);
+  }
+
+  const size_t n = pieces_.size();
+  vector<uint32_t> frontier{uint32_t(index(Cube()))}, following;
+  set(frontier.front(), 0);
+  for (int depth = 1; !frontier.empty(); ++depth) {
+    int dist = min(depth, kUnknownDist - 1);
+    following.clear();
+    for (uint32_t idx : frontier) {
+      for (auto &move : next) {
+        uint32_t j = 0;
+        for (size_t k = 0; k < n; ++k) {
+          auto &p = pieces_[k];
+          uint8_t v = (idx >> (kPieceBits * (n - 1 - k))) & 0x1f;
+          v = move[p.byte >= CubeMask::kEdges][v] & p.bits;
+          j = (j << kPieceBits) | v;
+        }
+        if ((*this)[j] == kUnknownDist) {
+          set(j, dist);
+          following.push_back(j);
+        }
+      }
+    }
+    frontier.swap(following);
+  }
+}
+
+size_t MaskTable::index(const Cube &inv) const {
+  edge_union eu;
+  corner_union cu;
+  eu.mm = inv.getEdges();
+  cu.mm = inv.getCorners();
+  size_t idx = 0;
+  for (auto &p : pieces_) {
+    uint8_t v = p.byte < CubeMask::kEdges ? eu.arr[p.byte]
+                                           : cu.arr[p.byte - CubeMask::kEdges];
+    idx = (idx << kPieceBits) | (v & p.bits);
+  }
+  return idx;
+}
+
+MaskedHeuristic::MaskedHeuristic(const CubeMask &mask)
+    : MaskedHeuristic(mask, quarter_turns()) {}
+
+MaskedHeuristic::MaskedHeuristic(const CubeMask &mask,
+                                 const vector<Cube> &moves)
+    : mask_(mask) {
+  // Split the pieces into groups small enough for a MaskTable, mixing
+  // edges and corners, whose tables tend to bound each other's
+  // distances less than tables of one kind do.
+  vector<CubeMask> edges, corners;
+  for (int i = 0; i < CubeMask::kEdges; ++i) {
+    if (mask.has_edge(i)) {
+      edges.push_back(CubeMask().edge(i, mask.edge_oriented(i)));
+    }
+  }
+  for (int i = 0; i < CubeMask::kCorners; ++i) {
+    if (mask.has_corner(i)) {
+      corners.push_back(CubeMask().corner(i, mask.corner_oriented(i)));
+    }
+  }
+  vector<CubeMask> order;
+  for (size_t i = 0; i < max(edges.size(), corners.size()); ++i) {
+    if (i < edges.size()) {
+      order.push_back(edges[i]);
+    }
+    if (i < corners.size()) {
+      order.push_back(corners[i]);
+    }
+  }
+  for (size_t i = 0; i < order.size(); i += MaskTable::kMaxPieces) {
+    CubeMask group;
+    for (size_t j = i; j < min(order.size(), i + MaskTable::kMaxPieces); ++j) {
+      group = group | order[j];
+    }
+    tables_.emplace_back(group, moves);
+  }
+}
+
+shared_ptr<const MaskedHeuristic> MaskedHeuristic::get(const CubeMask &mask) {
+  using entry = shared_future<shared_ptr<const MaskedHeuristic>>;
+  static mutex mu;
+  static map<uint64_t, entry> cache;
+  // The first caller for a mask builds it, outside the lock so that
+  // callers for other masks don't wait; later callers wait on its future.
+  promise<shared_ptr<const MaskedHeuristic>> built;
+  entry found;
+  {
+    lock_guard<mutex> lock(mu);
+    auto it = cache.find(mask.key());
+    if (it != cache.end()) {
+      found = it->second;
+    } else {
+      cache.emplace(mask.key(), built.get_future().share());
+    }
+  }
+  if (found.valid()) {
+    return found.get();
+  }
+  auto heuristic = make_shared<const MaskedHeuristic>(mask);
+  built.set_value(heuristic);
+  return heuristic;
+}
+
+int MaskedHeuristic::operator()(const Cube &pos) const {
+  auto inv = pos.invert();
+  int h = 0;
+  for (auto &table : tables_) {
+    h = max(h, table[table.index(inv)]);
+  }
+  return h;
+}
+
+bool MaskedHeuristic::prune(const Cube &pos, int depth) const {
+  auto inv = pos.invert();
+  for (auto &table : tables_) {
+    if (table[table.index(inv)] > depth) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}; // namespace rubik
@@ -0,0 +1,180 @@
+#ifndef RUBIK_MASK_H
+#define RUBIK_MASK_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+
+#include "rubik.h"
+
+namespace rubik {
+// A CubeMask selects the pieces of a partial goal, e.g. the cross or
+// the first two layers. Pieces are named by their home slot: edges
+// 0-11 and corners 0-7, in Cube's order. A piece can be selected with
+// or without its orientation; without, it only has to be in its slot.
+class CubeMask {
+public:
+  static constexpr int kEdges = 12;
+  static constexpr int kCorners = 8;
+
+  // The empty mask.
+  CubeMask();
+  static CubeMask all(bool orientation = true);
+  // The pieces that a turn of `face` moves.
+  static CubeMask layer(Face face, bool orientation = true);
+
+  CubeMask &edge(int i, bool orientation = true);
+  CubeMask &corner(int i, bool orientation = true);
+
+  CubeMask edges() const;
+  CubeMask corners() const;
+  // The pieces in either mask; a piece is oriented if it is in either.
+  CubeMask operator|(const CubeMask &other) const;
+  // The pieces of this mask that aren't in `other`.
+  CubeMask without(const CubeMask &other) const;
+
+  bool has_edge(int i) const { return edges_ >> i & 1; }
+  bool has_corner(int i) const { return corners_ >> i & 1; }
+  bool edge_oriented(int i) const { return edge_orient_ >> i & 1; }
+  bool corner_oriented(int i) const { return corner_orient_ >> i & 1; }
+  int pieces() const;
+  bool empty() const { return pieces() == 0; }
+
+  // solved tests whether every piece of the mask is home (and oriented,
+  // if it asks for orientation) in `pos`.
+  bool solved(const Cube &pos) const {
+    return _mm_test_all_zeros(_mm_xor_si128(pos.getEdges(), solved_edges()),
+                              edge_bits_) &&
+           _mm_test_all_zeros(
+               _mm_xor_si128(pos.getCorners(), solved_corners()),
+               corner_bits_);
+  }
+
+  // The bits of each cubie byte the mask compares.
+  const __m128i &edge_bits() const { return edge_bits_; }
+  const __m128i &corner_bits() const { return corner_bits_; }
+
+  // A dense key, for caching per-mask tables.
+  uint64_t key() const {
+    return uint64_t(edges_) | uint64_t(edge_orient_) << 12 |
+           uint64_t(corners_) << 24 | uint64_t(corner_orient_) << 32;
+  }
+  bool operator==(const CubeMask &other) const { return key() == other.key(); }
+  bool operator!=(const CubeMask &other) const { return key() != other.key(); }
+
+private:
+  static __m128i solved_edges() {
+    return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 0, 0, 0);
+  }
+  static __m128i solved_corners() {
+    return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 0, 0, 0, 0, 0, 0, 0, 0);
+  }
+  void update_bits();
+
+  uint16_t edges_ = 0, edge_orient_ = 0;
+  uint8_t corners_ = 0, corner_orient_ = 0;
+  __m128i edge_bits_, corner_bits_;
+};
+
+// A MaskTable is a pattern database for at most kMaxPieces pieces: the
+// exact number of quarter turns it takes to solve just those pieces,
+// for every place (and orientation) they can be in. Like quad01_dist,
+// it is indexed by the pieces' bytes of the inverse cube, five bits per
+// piece, edges first; so the table for edge 0 and corner 0 is laid out
+// exactly like pair0_dist.
+class MaskTable {
+public:
+  static constexpr int kMaxPieces = 4;
+
+  // Builds the table with a breadth-first search from solved.
+  explicit MaskTable(const CubeMask &mask);
+  // Builds the table for a search with `moves`, which must include the
+  // inverse of each move, instead of the quarter turns. Distances past
+  // kUnknownDist - 1 are stored as kUnknownDist - 1, which still bounds
+  // them.
+  MaskTable(const CubeMask &mask, const std::vector<Cube> &moves);
+
+  const CubeMask &mask() const { return mask_; }
+  size_t size() const { return size_t(1) << (5 * pieces_.size()); }
+
+  size_t index(const Cube &inv) const;
+  int operator[](size_t index) const {
+    return (packed_[index >> 1] >> ((index & 1) << 2)) & 0xf;
+  }
+  // The distance to solve the mask's pieces in `pos`.
+  int distance(const Cube &pos) const { return (*this)[index(pos.invert())]; }
+
+private:
+  struct piece {
+    // The byte of the edge or corner vector (corners come after the
+    // twelve edges), and the bits of it that matter.
+    uint8_t byte;
+    uint8_t bits;
+  };
+
+  CubeMask mask_;
+  std::vector<piece> pieces_;
+  std::vector<uint8_t> packed_;
+};
+
+// MaskedHeuristic bounds the distance to a mask's goal by the largest
+// of the MaskTables for groups of its pieces.
+class MaskedHeuristic {
+public:
+  explicit MaskedHeuristic(const CubeMask &mask);
+  // The heuristic for a search with `moves`, as MaskTable takes them.
+  MaskedHeuristic(const CubeMask &mask, const std::vector<Cube> &moves);
+
+  // get returns the heuristic for `mask`, building and caching its
+  // tables on first use. It is safe to call from any thread; callers
+  // asking for a mask that is being built wait for it.
+  static std::shared_ptr<const MaskedHeuristic> get(const CubeMask &mask);
+
+  const CubeMask &mask() const { return mask_; }
+  const std::vector<MaskTable> &tables() const { return tables_; }
+
+  int operator()(const Cube &pos) const;
+  // prune is true if the goal is more than `depth` moves from `pos`.
+  bool prune(const Cube &pos, int depth) const;
+
+private:
+  CubeMask mask_;
+  std::vector<MaskTable> tables_;
+};
+
+// solve_masked finds the shortest sequence of quarter turns that puts
+// every piece of `mask` home, ignoring the rest of the cube, and
+// otherwise behaves like solve(). opts.order_moves, opts.weight and
+// opts.cancel apply; the other options are for the full-cube tables
+// and are ignored.
+SearchResult solve_masked(Cube start, const CubeMask &mask, int max_depth,
+                          const SearchOptions &opts = SearchOptions());
+
+// A CubePattern is a partially specified cube: the pieces in the slots
+// of `mask` are as in `cube` (with their orientation only where the
+// mask asks for it), and the rest are unknown.
+struct CubePattern {
+  Cube cube;
+  CubeMask mask;
+};
+
+// enumerate_masked calls `found` with every sequence of quarter turns
+// of up to max_depth moves that takes every cube matching `from` to a
+// cube matching `to`, as enumerate_solutions() does for full cubes:
+// opts.optimal_only, threads, ordered and cancel apply. Since `from` is
+// only partly known, each piece `to` names must be in a slot of
+// from.mask, oriented there if `to` asks for its orientation; if not,
+// no sequence can match and enumerate_masked returns an Error.
+Result<size_t, Error>
+enumerate_masked(const CubePattern &from, const CubePattern &to,
+                 int max_depth,
+                 const std::function<bool(const std::vector<Cube> &)> &found,
+                 const EnumerateOptions &opts = EnumerateOptions());
+}; // namespace rubik
+
+#endif
@@ -0,0 +1,279 @@
+#include "moveset.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <unordered_set>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/str_cat.h"
+
+#include "rubik_impl.h"
+
+using namespace std;
+
+namespace rubik {
+
+constexpr int MoveSet::kDefaultHistory;
+
+struct MoveSet::tree {
+  vector<Move> moves;
+  // nodes[i] are the moves out of states[i]; states[0] is the root.
+  vector<vector<search_node>> nodes;
+  vector<search_moves> states;
+  CubeMask moved;
+  unique_ptr<MaskedHeuristic> heuristic;
+};
+
+namespace {
+// Deriving the tree enumerates every sequence of history + 1 moves.
+constexpr size_t kMaxSequences = size_t(1) << 22;
+
+// minimal_sequences returns, for each length k up to `length`, which
+// sequences of k moves are minimal: the first with their product, in
+// order of length and then of move indices. Sequence number c of length
+// k has moves c's base-n digits, the first move most significant.
+vector<vector<bool>> minimal_sequences(const vector<Cube> &moves,
+                                       int length) {
+  size_t n = moves.size();
+  unordered_set<Cube, absl::Hash<Cube>> seen{Cube()};
+  vector<vector<bool>> minimal(length + 1);
+  minimal[0] = {true};
+  size_t count = 1;
+  for (int k = 1; k <= length; ++k) {
+    count *= n;
+    minimal[k].assign(count, false);
+    for (size_t c = 0; c < count; ++c) {
+      // Every factor of a minimal sequence is minimal: a smaller factor
+      // would make a smaller sequence with the same product. So if the
+      // prefix isn't, some smaller sequence with this one's product has
+      // been seen already.
+      if (!minimal[k - 1][c / n]) {
+        continue;
+      }
+      Cube product;
+      for (size_t rest = c, place = count / n; place > 0; place /= n) {
+        product = product.apply(moves[rest / place]);
+        rest %= place;
+      }
+      minimal[k][c] = seen.insert(product).second;
+    }
+  }
+  return minimal;
+}
+
+// turn_of parses one generator of MoveSet::parse, without its suffix,
+// into the turn it names.
+bool turn_of(absl::string_view word, Cube &turn) {
+  static const Rotations r;
+  static const absl::string_view kFaces = "RLFBUD", kWide = "rlfbud";
+  // Each face's quarter turn; a wide turn is its opposite face's.
+  const Cube faces[6] = {r.R, r.L, r.F, r.B, r.U, r.D};
+  const Cube wide[6] = {r.L, r.R, r.B, r.F, r.D, r.U};
+  if (word.size() == 2 && word[1] == 'w' &&
+      kFaces.find(word[0]) != absl::string_view::npos) {
+    turn = wide[kFaces.find(word[0])];
+    return true;
+  }
+  if (word.size() != 1) {
+    return false;
+  }
+  // Slices turn like the face each follows: M like L, E like D and S
+  // like F.
+  switch (word[0]) {
+  case 'M':
+    turn = r.Linv.apply(r.R);
+    return true;
+  case 'E':
+    turn = r.U.apply(r.Dinv);
+    return true;
+  case 'S':
+    turn = r.Finv.apply(r.B);
+    return true;
+  }
+  if (kFaces.find(word[0]) != absl::string_view::npos) {
+    turn = faces[kFaces.find(word[0])];
+    return true;
+  }
+  if (kWide.find(word[0]) != absl::string_view::npos) {
+    turn = wide[kWide.find(word[0])];
+    return true;
+  }
+  return false;
+}
+}; // namespace
+
+Result<MoveSet, Error> MoveSet::create(vector<Move> moves, int history) {
+  if (moves.empty()) {
+    return Error{"no moves"};
+  }
+  if (history < 0) {
+    return Error{"history must not be negative"};
+  }
+  vector<Cube> rotations;
+  for (auto &move : moves) {
+    rotations.push_back(move.rotation);
+  }
+  for (auto &move : moves) {
+    if (find(rotations.begin(), rotations.end(), move.rotation.invert()) ==
+        rotations.end()) {
+      return Error{absl::StrCat(move.name, ": no inverse in the move set")};
+    }
+  }
+  size_t n = moves.size(), sequences = 1;
+  for (int k = 0; k <= history; ++k) {
+    if (sequences > kMaxSequences / n) {
+      return Error{absl::StrCat("history ", history, " is too long for ", n,
+                                " moves")};
+    }
+    sequences *= n;
+  }
+  auto minimal = minimal_sequences(rotations, history + 1);
+
+  // A state is the last `history` moves (all of them, near the root),
+  // as a sequence number of its length. Number the states reachable from
+  // the root, and the moves out of each, breadth first.
+  size_t window = sequences / n;
+  map<pair<int, size_t>, size_t> index;
+  vector<pair<int, size_t>> keys{{0, 0}};
+  index[keys[0]] = 0;
+  vector<vector<pair<int, size_t>>> out;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    int k = keys[i].first;
+    size_t c = keys[i].second;
+    out.emplace_back();
+    for (size_t m = 0; m < n; ++m) {
+      size_t next = c * n + m;
+      if (!minimal[k + 1][next]) {
+        continue;
+      }
+      pair<int, size_t> key =
+          k < history ? make_pair(k + 1, next) : make_pair(k, next % window);
+      auto it = index.find(key);
+      if (it == index.end()) {
+        it = index.emplace(key, keys.size()).first;
+        keys.push_back(key);
+      }
+      out.back().emplace_back(int(m), it->second);
+    }
+  }
+
+  auto t = make_shared<tree>();
+  t->moves = move(moves);
+  t->nodes.resize(keys.size());
+  t->states.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (auto &edge : out[i]) {
+      t->nodes[i].emplace_back(rotations[edge.first], nullptr);
+    }
+    t->states.emplace_back(t->nodes[i]);
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (size_t j = 0; j < out[i].size(); ++j) {
+      t->nodes[i][j].next = &t->states[out[i][j].second];
+    }
+  }
+
+  edge_union eu;
+  corner_union cu;
+  for (auto &rotation : rotations) {
+    eu.mm = rotation.getEdges();
+    cu.mm = rotation.getCorners();
+    for (int i = 0; i < CubeMask::kEdges; ++i) {
+      if (eu.arr[i] != i) {
+        t->moved.edge(i);
+      }
+    }
+    for (int i = 0; i < CubeMask::kCorners; ++i) {
+      if (cu.arr[i] != i) {
+        t->moved.corner(i);
+      }
+    }
+  }
+  t->heuristic.reset(new MaskedHeuristic(t->moved, rotations));
+  return MoveSet(move(t));
+}
+
+Result<MoveSet, Error> MoveSet::parse(absl::string_view generators,
+                                      bool half_turns, int history) {
+  vector<Move> moves;
+  auto add = [&](string name, const Cube &rotation) {
+    for (auto &move : moves) {
+      if (move.rotation == rotation && move.name == name) {
+        return;
+      }
+    }
+    moves.push_back(Move{move(name), rotation});
+  };
+  size_t i = 0;
+  auto separator = [](char c) {
+    return c == ' ' || c == ',' || c == '\t' || c == '<' || c == '>';
+  };
+  while (true) {
+    while (i < generators.size() && separator(generators[i])) {
+      ++i;
+    }
+    if (i == generators.size()) {
+      break;
+    }
+    size_t end = i;
+    while (end < generators.size() && !separator(generators[end])) {
+      ++end;
+    }
+    auto word = generators.substr(i, end - i);
+    i = end;
+
+    char suffix = '\0';
+    if (word.size() > 1 && (word.back() == '\'' || word.back() == '2')) {
+      suffix = word.back();
+      word.remove_suffix(1);
+    }
+    if (word == "x" || word == "y" || word == "z") {
+      return Error{absl::StrCat(
+          word, ": a whole-cube rotation doesn't move the pieces relative "
+                "to the centers")};
+    }
+    Cube turn;
+    if (!turn_of(word, turn)) {
+      return Error{absl::StrCat("unknown move: ", word)};
+    }
+    string name(word);
+    Cube half = turn.apply(turn);
+    if (suffix == '2') {
+      add(name + "2", half);
+    } else if (suffix == '\'') {
+      add(name, turn);
+      add(name + "'", turn.invert());
+    } else {
+      add(name, turn);
+      add(name + "'", turn.invert());
+      if (half_turns) {
+        add(name + "2", half);
+      }
+    }
+  }
+  return create(move(moves), history);
+}
+
+const vector<MoveSet::Move> &MoveSet::moves() const { return tree_->moves; }
+const search_moves &MoveSet::root() const { return tree_->states.front(); }
+size_t MoveSet::states() const { return tree_->states.size(); }
+const CubeMask &MoveSet::moved() const { return tree_->moved; }
+const MaskedHeuristic &MoveSet::heuristic() const { return *tree_->heuristic; }
+
+Result<string, Error> MoveSet::to_algorithm(const vector<Cube> &path) const {
+  string out;
+  for (auto &cube : path) {
+    auto move = find_if(tree_->moves.begin(), tree_->moves.end(),
+                        [&](const Move &m) { return m.rotation == cube; });
+    if (move == tree_->moves.end()) {
+      return Error{"Unrecognized rotation"};
+    }
+    if (!out.empty()) {
+      out.push_back(' ');
+    }
+    out += move->name;
+  }
+  return out;
+}
+}; // namespace rubik
@@ -0,0 +1,87 @@
+#ifndef RUBIK_MOVESET_H
+#define RUBIK_MOVESET_H
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "mask.h"
+#include "rubik.h"
+
+namespace rubik {
+// A MoveSet is a set of moves to search with in place of the qtm tree's
+// twelve quarter turns: say <R, U> for a robot with two grippers, or
+// face turns plus half turns and slices. Every move costs one.
+//
+// The search tree for a move set is derived from its moves: a sequence
+// is searched only if it is the first of the sequences with its product,
+// in order of length and then of the moves' indices, for every window
+// of history + 1 moves along it. With history 1 this leaves out a move
+// followed by its inverse and one order of each pair of moves that
+// commute, as the qtm tree does; deeper histories also leave out runs
+// like R R R for R'.
+//
+// Positions here are relative to the centers, which Cube doesn't track.
+// A slice turn is thus the same as turning the two faces beside it the
+// other way (M as L' R), a wide turn the same as turning the opposite
+// face (r as L), and a whole-cube rotation isn't a move at all. A
+// solution names faces by their centers, as if the cube were turned
+// back after each slice or wide turn.
+class MoveSet {
+public:
+  struct Move {
+    std::string name;
+    Cube rotation;
+  };
+
+  static constexpr int kDefaultHistory = 2;
+
+  // create makes a move set from `moves`, which must include the
+  // inverse of each of its moves. It derives the search tree, and builds
+  // pattern tables for the pieces the moves move, with distances counted
+  // in the moves of the set.
+  static Result<MoveSet, Error> create(std::vector<Move> moves,
+                                       int history = kDefaultHistory);
+  // parse makes a move set from a list of generators like "R U" or
+  // "<R, U, M>": faces (R L F B U D), slices (M E S) and wide turns
+  // (r l f b u d, or Rw and so on). Each generator adds its turn and
+  // the inverse, and with half_turns its half turn too; a generator with
+  // a suffix, like R2, adds just that turn and its inverse.
+  static Result<MoveSet, Error> parse(absl::string_view generators,
+                                      bool half_turns = false,
+                                      int history = kDefaultHistory);
+
+  const std::vector<Move> &moves() const;
+  // The root of the derived search tree, and how many distinct nodes
+  // (sets of moves out of a node) it has.
+  const search_moves &root() const;
+  size_t states() const;
+  // The pieces that some move moves. A position whose other pieces
+  // aren't home can't be solved.
+  const CubeMask &moved() const;
+  const MaskedHeuristic &heuristic() const;
+
+  // to_algorithm names the moves of a path by their names in the set.
+  Result<std::string, Error> to_algorithm(const std::vector<Cube> &path) const;
+
+private:
+  struct tree;
+  explicit MoveSet(std::shared_ptr<const tree> tree) : tree_(std::move(tree)) {}
+
+  std::shared_ptr<const tree> tree_;
+};
+
+// solve_moveset finds the shortest sequence of `moves` that solves
+// `start`, and otherwise behaves like solve(). opts.order_moves and
+// opts.cancel apply; the other options are for the qtm tree and its
+// tables, and are ignored. If `start` moves a piece that no move
+// does, the search fails without searching, with a lower bound past
+// max_depth.
+SearchResult solve_moveset(Cube start, const MoveSet &moves, int max_depth,
+                           const SearchOptions &opts = SearchOptions());
+}; // namespace rubik
+
+#endif
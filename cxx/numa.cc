@@ -0,0 +1,229 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr size_t kHugePage = 2 << 20;
+// Enough bits for any node id we'll see.
+constexpr int kMaxNodes = 1024;
+constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+
+vector<int> allowed_cpus() {
+  cpu_set_t set;
+  vector<int> cpus;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    cpus.push_back(0);
+    return cpus;
+  }
+  for (int i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &set)) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+// parse_cpulist parses the kernel's list format, e.g. "0-3,8,10-11".
+vector<int> parse_cpulist(const string &str) {
+  vector<int> out;
+  stringstream ss(str);
+  string range;
+  while (getline(ss, range, ',')) {
+    int lo, hi;
+    int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+    if (n < 1) {
+      continue;
+    }
+    if (n == 1) {
+      hi = lo;
+    }
+    for (int cpu = lo; cpu <= hi; ++cpu) {
+      out.push_back(cpu);
+    }
+  }
+  return out;
+}
+
+size_t available_bytes() {
+  return size_t(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+}
+
+// node_free_bytes reads MemFree from a node's meminfo.
+size_t node_free_bytes(const string &dir) {
+  ifstream meminfo(dir + "/meminfo");
+  string line;
+  while (getline(meminfo, line)) {
+    auto pos = line.find("MemFree:");
+    if (pos != string::npos) {
+      return stoull(line.substr(pos + strlen("MemFree:"))) * 1024;
+    }
+  }
+  return 0;
+}
+
+size_t mapping_size() {
+  return (sizeof(QuadTable) + kHugePage - 1) & ~(kHugePage - 1);
+}
+
+// map_table maps memory for a table, applies `mode` over the nodes in
+// `nodes` (if any), and only then copies the table in, so that its
+// pages are first touched under that policy. Returns null if we can't
+// get the memory, and clears `bound` if the kernel rejects the policy.
+void *map_table(const QuadTable &table, int mode, const vector<int> &nodes,
+                bool &bound) {
+  size_t size = mapping_size();
+  void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  madvise(mem, size, MADV_HUGEPAGE);
+
+  unsigned long mask[kMaxNodes / kBitsPerWord] = {};
+  bool any = false;
+  for (int id : nodes) {
+    if (id < 0 || id >= kMaxNodes) {
+      continue;
+    }
+    mask[id / kBitsPerWord] |= 1ul << (id % kBitsPerWord);
+    any = true;
+  }
+  if (!any ||
+      syscall(SYS_mbind, mem, size, mode, mask, kMaxNodes, MPOL_MF_STRICT) !=
+          0) {
+    bound = false;
+  }
+  memcpy(mem, &table, sizeof(table));
+  mprotect(mem, size, PROT_READ);
+  return mem;
+}
+}; // namespace
+
+NumaTopology NumaTopology::detect() {
+  NumaTopology topo;
+  auto allowed = allowed_cpus();
+  ifstream online("/sys/devices/system/node/online");
+  string list;
+  if (getline(online, list)) {
+    for (int id : parse_cpulist(list)) {
+      string dir = "/sys/devices/system/node/node" + to_string(id);
+      ifstream cpulist(dir + "/cpulist");
+      string cpus;
+      getline(cpulist, cpus);
+      NumaNode node{id, {}, node_free_bytes(dir)};
+      for (int cpu : parse_cpulist(cpus)) {
+        if (find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+          node.cpus.push_back(cpu);
+        }
+      }
+      if (!node.cpus.empty()) {
+        topo.nodes.push_back(node);
+      }
+    }
+  }
+  if (topo.nodes.empty()) {
+    topo.nodes.push_back(NumaNode{-1, allowed, available_bytes()});
+  }
+  return topo;
+}
+
+NumaTopology NumaTopology::simulate(int nodes) {
+  NumaTopology topo;
+  auto allowed = allowed_cpus();
+  nodes = max(nodes, 1);
+  for (int i = 0; i < nodes; ++i) {
+    topo.nodes.push_back(NumaNode{-1, {}, available_bytes() / nodes});
+  }
+  // Give each node a contiguous run of CPUs. With fewer CPUs than nodes,
+  // nodes share them.
+  for (size_t i = 0; i < max<size_t>(allowed.size(), nodes); ++i) {
+    topo.nodes[i * nodes / max<size_t>(allowed.size(), nodes)].cpus.push_back(
+        allowed[i % allowed.size()]);
+  }
+  return topo;
+}
+
+int NumaTopology::node_of_cpu(int cpu) const {
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    auto &cpus = nodes[i].cpus;
+    if (find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+bool pin_to_node(const NumaNode &node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : node.cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+TableReplicas::TableReplicas(const NumaTopology &topology, Placement want)
+    : topology_(topology), placement_(want) {
+  if (placement_ == Replicated) {
+    for (auto &node : topology_.nodes) {
+      if (node.free_bytes < mapping_size()) {
+        placement_ = Interleaved;
+      }
+    }
+  }
+  if (placement_ == Replicated) {
+    for (auto &node : topology_.nodes) {
+      void *mem = map_table(quad01_dist, MPOL_BIND, {node.id}, bound_);
+      if (mem == nullptr) {
+        placement_ = Interleaved;
+        break;
+      }
+      mappings_.push_back(mem);
+      quad_.push_back(static_cast<const QuadTable *>(mem));
+    }
+  }
+  if (placement_ == Interleaved) {
+    for (void *mem : mappings_) {
+      munmap(mem, mapping_size());
+    }
+    mappings_.clear();
+    quad_.clear();
+    bound_ = true;
+
+    vector<int> ids;
+    for (auto &node : topology_.nodes) {
+      ids.push_back(node.id);
+    }
+    void *mem = map_table(quad01_dist, MPOL_INTERLEAVE, ids, bound_);
+    if (mem != nullptr) {
+      mappings_.push_back(mem);
+      quad_.push_back(static_cast<const QuadTable *>(mem));
+    } else {
+      bound_ = false;
+      quad_.push_back(&quad01_dist);
+    }
+  }
+}
+
+TableReplicas::~TableReplicas() {
+  for (void *mem : mappings_) {
+    munmap(mem, mapping_size());
+  }
+}
+
+}; // namespace rubik
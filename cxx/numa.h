@@ -0,0 +1,82 @@
+#ifndef RUBIK_NUMA_H
+#define RUBIK_NUMA_H
+#include <assert.h>
+#include <stddef.h>
+#include <vector>
+
+#include "tables.h"
+
+namespace rubik {
+struct NumaNode {
+  // The kernel's id for this node, or -1 if the node is simulated and
+  // memory can't be bound to it.
+  int id;
+  // The CPUs on this node that we are allowed to run on.
+  std::vector<int> cpus;
+  // Free memory on the node, in bytes.
+  size_t free_bytes;
+};
+
+struct NumaTopology {
+  std::vector<NumaNode> nodes;
+
+  // detect reads the topology from /sys/devices/system/node. Nodes with
+  // none of our CPUs are left out. Without sysfs, it returns a single
+  // simulated node.
+  static NumaTopology detect();
+  // simulate splits our CPUs and free memory into `nodes` simulated
+  // nodes, so that the NUMA code paths can run on a single-node host.
+  static NumaTopology simulate(int nodes);
+
+  // The node whose CPUs include `cpu`, or 0 if there is none.
+  int node_of_cpu(int cpu) const;
+};
+
+// pin_to_node restricts the calling thread to the CPUs of `node`.
+bool pin_to_node(const NumaNode &node);
+
+using QuadTable = PackedDistTable<32 * 32 * 32 * 32>;
+
+// TableReplicas holds copies of the pattern tables placed for a NUMA
+// topology. It is read-only once constructed, and must outlive any
+// search that uses it.
+class TableReplicas {
+public:
+  enum Placement {
+    // One copy bound to each node.
+    Replicated,
+    // A single copy with its pages interleaved across the nodes.
+    Interleaved,
+  };
+
+  // Replicates the tables if `want` is Replicated and every node has
+  // the free memory for a copy; otherwise falls back to interleaving.
+  explicit TableReplicas(const NumaTopology &topology,
+                         Placement want = Replicated);
+  ~TableReplicas();
+  TableReplicas(const TableReplicas &) = delete;
+  TableReplicas &operator=(const TableReplicas &) = delete;
+
+  const NumaTopology &topology() const { return topology_; }
+  Placement placement() const { return placement_; }
+  // Whether the kernel accepted our memory policy for every copy. This
+  // is false for simulated topologies.
+  bool bound() const { return bound_; }
+
+  // The copy of quad01_dist to probe from threads running on `node`,
+  // which must be one of the topology's.
+  const QuadTable &quad(int node) const {
+    assert(node >= 0 && size_t(node) < topology_.nodes.size());
+    return *quad_[placement_ == Replicated ? node : 0];
+  }
+
+private:
+  NumaTopology topology_;
+  Placement placement_;
+  bool bound_ = true;
+  std::vector<const QuadTable *> quad_;
+  std::vector<void *> mappings_;
+};
+}; // namespace rubik
+
+#endif
@@ -0,0 +1,681 @@
+// rubik._native exposes the C++ cube and search to Python. The Cube
+// type is a thin wrapper around rubik::Cube; the *_batch functions work
+// on buffers of packed cubes (see Cube::pack) so that large batches
+// never become Python objects. rubik/native.py wraps those buffers as
+// numpy arrays.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "rubik.h"
+#include "rubik_impl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "absl/hash/hash.h"
+
+using namespace std;
+using rubik::Cube;
+
+namespace {
+
+struct PyCube {
+  PyObject_HEAD
+  Cube cube;
+};
+
+PyTypeObject *CubeType;
+
+// The quarter turns, in the order search_batch numbers them.
+const char *const kMoveNames[] = {
+    "L", "L'", "R", "R'", "U", "U'", "D", "D'", "F", "F'", "B", "B'",
+};
+constexpr int kMoveCount = sizeof(kMoveNames) / sizeof(kMoveNames[0]);
+constexpr uint8_t kNoMove = 0xff;
+vector<Cube> moves;
+
+// The longest search we accept; the qtm diameter is 26.
+constexpr int kMaxDepth = 30;
+
+PyObject *wrap(PyTypeObject *type, const Cube &cube) {
+  auto obj = reinterpret_cast<PyCube *>(type->tp_alloc(type, 0));
+  if (obj == nullptr) {
+    return nullptr;
+  }
+  new (&obj->cube) Cube(cube);
+  return reinterpret_cast<PyObject *>(obj);
+}
+
+const Cube &unwrap(PyObject *obj) {
+  return reinterpret_cast<PyCube *>(obj)->cube;
+}
+
+bool check_cube(PyObject *obj) {
+  if (!PyObject_TypeCheck(obj, CubeType)) {
+    PyErr_Format(PyExc_TypeError, "expected a Cube, got %s",
+                 Py_TYPE(obj)->tp_name);
+    return false;
+  }
+  return true;
+}
+
+// valid_packed checks that `p` is a Cube::pack() encoding of some
+// (not necessarily solvable) cube, so that nothing downstream indexes a
+// table with an out-of-range cubie.
+bool valid_packed(const Cube::Packed &p) {
+  int seen = 0;
+  for (int i = 0; i < 12; ++i) {
+    int e = (p[i / 2] >> (4 * (i % 2))) & 0xf;
+    if (e >= 12 || (seen & (1 << e))) {
+      return false;
+    }
+    seen |= 1 << e;
+  }
+  if (p[7] & 0xf0) {
+    return false;
+  }
+  seen = 0;
+  for (int i = 0; i < 8; ++i) {
+    int c = p[8 + i] & Cube::kCornerPermMask;
+    int twist = p[8 + i] >> Cube::kCornerAlignShift;
+    if (twist > 2 || (seen & (1 << c))) {
+      return false;
+    }
+    seen |= 1 << c;
+  }
+  return true;
+}
+
+PyObject *parse_error(const rubik::Error &err) {
+  PyErr_SetString(PyExc_ValueError, err.error.c_str());
+  return nullptr;
+}
+
+// A read-only view of a buffer holding whole packed cubes.
+class packed_view {
+  Py_buffer view_;
+  bool ok_ = false;
+
+public:
+  explicit packed_view(PyObject *obj) {
+    if (PyObject_GetBuffer(obj, &view_, PyBUF_C_CONTIGUOUS) < 0) {
+      return;
+    }
+    ok_ = true;
+    if (view_.len % sizeof(Cube::Packed) != 0) {
+      PyErr_Format(PyExc_ValueError,
+                   "packed cubes are %zd bytes, got a buffer of %zd bytes",
+                   sizeof(Cube::Packed), view_.len);
+      return;
+    }
+    for (Py_ssize_t i = 0; i < size(); ++i) {
+      if (!valid_packed(at(i))) {
+        PyErr_Format(PyExc_ValueError, "cube %zd is not a valid packed cube",
+                     i);
+        return;
+      }
+    }
+  }
+  ~packed_view() {
+    if (ok_) {
+      PyBuffer_Release(&view_);
+    }
+  }
+  packed_view(const packed_view &) = delete;
+  packed_view &operator=(const packed_view &) = delete;
+
+  bool ok() const { return ok_ && !PyErr_Occurred(); }
+  Py_ssize_t size() const { return view_.len / sizeof(Cube::Packed); }
+  Cube::Packed at(Py_ssize_t i) const {
+    Cube::Packed p;
+    memcpy(p.data(), static_cast<const char *>(view_.buf) + i * p.size(),
+           p.size());
+    return p;
+  }
+};
+
+PyObject *new_packed(Py_ssize_t n, uint8_t **out) {
+  PyObject *result =
+      PyByteArray_FromStringAndSize(nullptr, n * sizeof(Cube::Packed));
+  if (result != nullptr) {
+    *out = reinterpret_cast<uint8_t *>(PyByteArray_AS_STRING(result));
+  }
+  return result;
+}
+
+void store(uint8_t *out, Py_ssize_t i, const Cube &cube) {
+  auto p = cube.pack();
+  memcpy(out + i * p.size(), p.data(), p.size());
+}
+
+// Cube
+
+bool fill(PyObject *seq, const char *name, uint8_t *out, int n, int limit) {
+  if (seq == nullptr || seq == Py_None) {
+    return true;
+  }
+  PyObject *fast = PySequence_Fast(seq, name);
+  if (fast == nullptr) {
+    return false;
+  }
+  bool ok = PySequence_Fast_GET_SIZE(fast) == n;
+  for (int i = 0; ok && i < n; ++i) {
+    long v = PyLong_AsLong(PySequence_Fast_GET_ITEM(fast, i));
+    ok = v >= 0 && v < limit;
+    out[i] = v;
+  }
+  Py_DECREF(fast);
+  if (!ok && !PyErr_Occurred()) {
+    PyErr_Format(PyExc_ValueError, "%s must be %d integers in [0, %d)", name,
+                 n, limit);
+  }
+  return ok;
+}
+
+PyObject *cube_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"edge_perm", "edge_align", "corner_perm",
+                                 "corner_align", nullptr};
+  PyObject *eperm = nullptr, *ealign = nullptr, *cperm = nullptr,
+           *calign = nullptr;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOO",
+                                   const_cast<char **>(kwlist), &eperm,
+                                   &ealign, &cperm, &calign)) {
+    return nullptr;
+  }
+  uint8_t ep[12], ea[12] = {}, cp[8], ca[8] = {};
+  for (int i = 0; i < 12; ++i) {
+    ep[i] = i;
+  }
+  for (int i = 0; i < 8; ++i) {
+    cp[i] = i;
+  }
+  if (!fill(eperm, "edge_perm", ep, 12, 12) ||
+      !fill(ealign, "edge_align", ea, 12, 2) ||
+      !fill(cperm, "corner_perm", cp, 8, 8) ||
+      !fill(calign, "corner_align", ca, 8, 3)) {
+    return nullptr;
+  }
+  array<uint8_t, 12> edges;
+  array<uint8_t, 8> corners;
+  for (int i = 0; i < 12; ++i) {
+    edges[i] = ep[i] | (ea[i] << Cube::kEdgeAlignShift);
+  }
+  for (int i = 0; i < 8; ++i) {
+    corners[i] = cp[i] | (ca[i] << Cube::kCornerAlignShift);
+  }
+  Cube cube(edges, corners);
+  if (!valid_packed(cube.pack())) {
+    PyErr_SetString(PyExc_ValueError,
+                    "edge_perm and corner_perm must be permutations");
+    return nullptr;
+  }
+  return wrap(type, cube);
+}
+
+void cube_dealloc(PyObject *self) {
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free(self);
+  Py_DECREF(type);
+}
+
+PyObject *cube_richcompare(PyObject *self, PyObject *other, int op) {
+  if ((op != Py_EQ && op != Py_NE) || !PyObject_TypeCheck(other, CubeType)) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  bool eq = unwrap(self) == unwrap(other);
+  return PyBool_FromLong(eq == (op == Py_EQ));
+}
+
+Py_hash_t cube_hash(PyObject *self) {
+  Py_hash_t h = absl::Hash<Cube>()(unwrap(self));
+  return h == -1 ? -2 : h;
+}
+
+PyObject *tuple_of(const uint8_t *arr, int n, uint8_t mask, int shift) {
+  PyObject *t = PyTuple_New(n);
+  if (t == nullptr) {
+    return nullptr;
+  }
+  for (int i = 0; i < n; ++i) {
+    PyTuple_SET_ITEM(t, i, PyLong_FromLong((arr[i] & mask) >> shift));
+  }
+  return t;
+}
+
+PyObject *cube_edge_perm(PyObject *self, void *) {
+  rubik::edge_union eu;
+  eu.mm = unwrap(self).getEdges();
+  return tuple_of(eu.arr.data(), 12, Cube::kEdgePermMask, 0);
+}
+
+PyObject *cube_edge_align(PyObject *self, void *) {
+  rubik::edge_union eu;
+  eu.mm = unwrap(self).getEdges();
+  return tuple_of(eu.arr.data(), 12, Cube::kEdgeAlignMask,
+                  Cube::kEdgeAlignShift);
+}
+
+PyObject *cube_corner_perm(PyObject *self, void *) {
+  rubik::corner_union cu;
+  cu.mm = unwrap(self).getCorners();
+  return tuple_of(cu.arr.data(), 8, Cube::kCornerPermMask, 0);
+}
+
+PyObject *cube_corner_align(PyObject *self, void *) {
+  rubik::corner_union cu;
+  cu.mm = unwrap(self).getCorners();
+  return tuple_of(cu.arr.data(), 8, Cube::kCornerAlignMask,
+                  Cube::kCornerAlignShift);
+}
+
+PyObject *cube_repr(PyObject *self) {
+  PyObject *fields[] = {cube_edge_perm(self, nullptr),
+                        cube_edge_align(self, nullptr),
+                        cube_corner_perm(self, nullptr),
+                        cube_corner_align(self, nullptr)};
+  PyObject *repr = nullptr;
+  if (fields[0] && fields[1] && fields[2] && fields[3]) {
+    repr = PyUnicode_FromFormat(
+        "%s(edge_perm=%R, edge_align=%R, corner_perm=%R, corner_align=%R)",
+        Py_TYPE(self)->tp_name, fields[0], fields[1], fields[2], fields[3]);
+  }
+  for (auto f : fields) {
+    Py_XDECREF(f);
+  }
+  return repr;
+}
+
+PyObject *cube_apply(PyObject *self, PyObject *other) {
+  if (!check_cube(other)) {
+    return nullptr;
+  }
+  return wrap(Py_TYPE(self), unwrap(self).apply(unwrap(other)));
+}
+
+PyObject *cube_invert(PyObject *self, PyObject *) {
+  return wrap(Py_TYPE(self), unwrap(self).invert());
+}
+
+PyObject *cube_pack(PyObject *self, PyObject *) {
+  auto p = unwrap(self).pack();
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char *>(p.data()),
+                                   p.size());
+}
+
+PyObject *cube_unpack(PyObject *cls, PyObject *arg) {
+  packed_view view(arg);
+  if (!view.ok()) {
+    return nullptr;
+  }
+  if (view.size() != 1) {
+    PyErr_SetString(PyExc_ValueError, "expected exactly one packed cube");
+    return nullptr;
+  }
+  return wrap(reinterpret_cast<PyTypeObject *>(cls),
+              Cube::unpack(view.at(0)));
+}
+
+PyObject *cube_from_algorithm(PyObject *cls, PyObject *arg) {
+  Py_ssize_t len;
+  const char *str = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (str == nullptr) {
+    return nullptr;
+  }
+  auto r = rubik::from_algorithm(absl::string_view(str, len));
+  if (auto err = absl::get_if<rubik::Error>(&r)) {
+    return parse_error(*err);
+  }
+  return wrap(reinterpret_cast<PyTypeObject *>(cls), absl::get<Cube>(r));
+}
+
+PyObject *cube_from_facelets(PyObject *cls, PyObject *arg) {
+  Py_ssize_t len;
+  const char *str = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (str == nullptr) {
+    return nullptr;
+  }
+  auto r = rubik::from_facelets(absl::string_view(str, len));
+  if (auto err = absl::get_if<rubik::Error>(&r)) {
+    return parse_error(*err);
+  }
+  return wrap(reinterpret_cast<PyTypeObject *>(cls), absl::get<Cube>(r));
+}
+
+PyMethodDef cube_methods[] = {
+    {"apply", cube_apply, METH_O,
+     "apply(other) -> the result of applying `other` to this cube."},
+    {"invert", cube_invert, METH_NOARGS, "invert() -> the inverse cube."},
+    {"pack", cube_pack, METH_NOARGS,
+     "pack() -> the 16-byte packed encoding of this cube."},
+    {"unpack", cube_unpack, METH_O | METH_CLASS,
+     "unpack(buf) -> the cube encoded by a 16-byte buffer from pack()."},
+    {"from_algorithm", cube_from_algorithm, METH_O | METH_CLASS,
+     "from_algorithm(str) -> the cube produced by a move sequence."},
+    {"from_facelets", cube_from_facelets, METH_O | METH_CLASS,
+     "from_facelets(str) -> the cube described by a facelet string."},
+    {nullptr},
+};
+
+PyGetSetDef cube_getset[] = {
+    {"edge_perm", cube_edge_perm, nullptr, nullptr, nullptr},
+    {"edge_align", cube_edge_align, nullptr, nullptr, nullptr},
+    {"corner_perm", cube_corner_perm, nullptr, nullptr, nullptr},
+    {"corner_align", cube_corner_align, nullptr, nullptr, nullptr},
+    {nullptr},
+};
+
+PyType_Slot cube_slots[] = {
+    {Py_tp_new, reinterpret_cast<void *>(cube_new)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(cube_dealloc)},
+    {Py_tp_richcompare, reinterpret_cast<void *>(cube_richcompare)},
+    {Py_tp_hash, reinterpret_cast<void *>(cube_hash)},
+    {Py_tp_repr, reinterpret_cast<void *>(cube_repr)},
+    {Py_tp_methods, cube_methods},
+    {Py_tp_getset, cube_getset},
+    {Py_tp_doc, const_cast<char *>(
+                    "Cube(edge_perm=None, edge_align=None, corner_perm=None, "
+                    "corner_align=None)\n\nAn immutable cube position.")},
+    {0, nullptr},
+};
+
+PyType_Spec cube_spec = {
+    "rubik._native.Cube",
+    sizeof(PyCube),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    cube_slots,
+};
+
+// Search
+
+// solve returns the length of an optimal solution of at most
+// max_depth quarter turns, leaving its moves in `path`, or -1.
+int solve(const Cube &start, int max_depth, vector<Cube> &path) {
+  auto result = rubik::solve(start, max_depth);
+  if (!result.solved) {
+    return -1;
+  }
+  path = move(result.path);
+  return path.size();
+}
+
+uint8_t move_index(const Cube &move) {
+  return find(moves.begin(), moves.end(), move) - moves.begin();
+}
+
+bool check_depth(int max_depth) {
+  if (max_depth < 0 || max_depth > kMaxDepth) {
+    PyErr_Format(PyExc_ValueError, "max_depth must be in [0, %d]", kMaxDepth);
+    return false;
+  }
+  return true;
+}
+
+PyObject *py_search(PyObject *, PyObject *args) {
+  PyObject *cube;
+  int max_depth;
+  if (!PyArg_ParseTuple(args, "Oi", &cube, &max_depth) || !check_cube(cube) ||
+      !check_depth(max_depth)) {
+    return nullptr;
+  }
+  Cube start = unwrap(cube);
+  vector<Cube> path;
+  int len;
+  Py_BEGIN_ALLOW_THREADS;
+  len = solve(start, max_depth, path);
+  Py_END_ALLOW_THREADS;
+  if (len < 0) {
+    Py_RETURN_NONE;
+  }
+  PyObject *out = PyList_New(len);
+  for (int i = 0; out != nullptr && i < len; ++i) {
+    PyObject *move = wrap(Py_TYPE(cube), path[i]);
+    if (move == nullptr) {
+      Py_CLEAR(out);
+      break;
+    }
+    PyList_SET_ITEM(out, i, move);
+  }
+  return out;
+}
+
+PyObject *py_search_batch(PyObject *, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"cubes", "max_depth", "threads", nullptr};
+  PyObject *cubes;
+  int max_depth, threads = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|i",
+                                   const_cast<char **>(kwlist), &cubes,
+                                   &max_depth, &threads) ||
+      !check_depth(max_depth)) {
+    return nullptr;
+  }
+  packed_view view(cubes);
+  if (!view.ok()) {
+    return nullptr;
+  }
+  Py_ssize_t n = view.size();
+  PyObject *lengths = PyByteArray_FromStringAndSize(nullptr, n);
+  PyObject *solutions = PyByteArray_FromStringAndSize(nullptr, n * max_depth);
+  if (lengths == nullptr || solutions == nullptr) {
+    Py_XDECREF(lengths);
+    Py_XDECREF(solutions);
+    return nullptr;
+  }
+  auto len_out = reinterpret_cast<int8_t *>(PyByteArray_AS_STRING(lengths));
+  auto sol_out = reinterpret_cast<uint8_t *>(PyByteArray_AS_STRING(solutions));
+  memset(sol_out, kNoMove, n * max_depth);
+
+  if (threads <= 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  threads = min<Py_ssize_t>(threads, max<Py_ssize_t>(n, 1));
+
+  Py_BEGIN_ALLOW_THREADS;
+  atomic<Py_ssize_t> next(0);
+  auto worker = [&]() {
+    vector<Cube> path;
+    for (Py_ssize_t i; (i = next.fetch_add(1)) < n;) {
+      int len = solve(Cube::unpack(view.at(i)), max_depth, path);
+      len_out[i] = len;
+      for (int j = 0; j < len; ++j) {
+        sol_out[i * max_depth + j] = move_index(path[j]);
+      }
+    }
+  };
+  vector<thread> pool;
+  for (int i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : pool) {
+    t.join();
+  }
+  Py_END_ALLOW_THREADS;
+
+  return Py_BuildValue("(NN)", lengths, solutions);
+}
+
+// Batches
+
+PyObject *py_apply_batch(PyObject *, PyObject *args) {
+  PyObject *lhs_obj, *rhs_obj;
+  if (!PyArg_ParseTuple(args, "OO", &lhs_obj, &rhs_obj)) {
+    return nullptr;
+  }
+  packed_view lhs(lhs_obj);
+  if (!lhs.ok()) {
+    return nullptr;
+  }
+  packed_view rhs(rhs_obj);
+  if (!rhs.ok()) {
+    return nullptr;
+  }
+  Py_ssize_t n = max(lhs.size(), rhs.size());
+  if ((lhs.size() != n && lhs.size() != 1) ||
+      (rhs.size() != n && rhs.size() != 1)) {
+    PyErr_Format(PyExc_ValueError,
+                 "can't apply %zd cubes to %zd cubes; the counts must match "
+                 "or one must be 1",
+                 rhs.size(), lhs.size());
+    return nullptr;
+  }
+  uint8_t *out;
+  PyObject *result = new_packed(n, &out);
+  if (result == nullptr) {
+    return nullptr;
+  }
+  Py_BEGIN_ALLOW_THREADS;
+  Py_ssize_t li = lhs.size() == 1 ? 0 : 1, ri = rhs.size() == 1 ? 0 : 1;
+  for (Py_ssize_t i = 0; i < n; ++i) {
+    auto c = Cube::unpack(lhs.at(i * li)).apply(Cube::unpack(rhs.at(i * ri)));
+    store(out, i, c);
+  }
+  Py_END_ALLOW_THREADS;
+  return result;
+}
+
+PyObject *py_invert_batch(PyObject *, PyObject *arg) {
+  packed_view in(arg);
+  if (!in.ok()) {
+    return nullptr;
+  }
+  uint8_t *out;
+  PyObject *result = new_packed(in.size(), &out);
+  if (result == nullptr) {
+    return nullptr;
+  }
+  Py_BEGIN_ALLOW_THREADS;
+  for (Py_ssize_t i = 0; i < in.size(); ++i) {
+    store(out, i, Cube::unpack(in.at(i)).invert());
+  }
+  Py_END_ALLOW_THREADS;
+  return result;
+}
+
+template <rubik::Result<vector<Cube>, rubik::Error> (*parse)(
+    absl::string_view)>
+PyObject *parse_lines(PyObject *, PyObject *arg) {
+  Py_ssize_t len;
+  const char *str = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (str == nullptr) {
+    return nullptr;
+  }
+  rubik::Result<vector<Cube>, rubik::Error> r;
+  Py_BEGIN_ALLOW_THREADS;
+  r = parse(absl::string_view(str, len));
+  Py_END_ALLOW_THREADS;
+  if (auto err = absl::get_if<rubik::Error>(&r)) {
+    return parse_error(*err);
+  }
+  auto &cubes = absl::get<vector<Cube>>(r);
+  uint8_t *out;
+  PyObject *result = new_packed(cubes.size(), &out);
+  for (size_t i = 0; result != nullptr && i < cubes.size(); ++i) {
+    store(out, i, cubes[i]);
+  }
+  return result;
+}
+
+PyObject *py_to_algorithm(PyObject *, PyObject *arg) {
+  PyObject *fast = PySequence_Fast(arg, "to_algorithm takes a sequence");
+  if (fast == nullptr) {
+    return nullptr;
+  }
+  vector<Cube> path;
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(fast); ++i) {
+    PyObject *item = PySequence_Fast_GET_ITEM(fast, i);
+    if (!check_cube(item)) {
+      Py_DECREF(fast);
+      return nullptr;
+    }
+    path.push_back(unwrap(item));
+  }
+  Py_DECREF(fast);
+  auto r = rubik::to_algorithm(path);
+  if (auto err = absl::get_if<rubik::Error>(&r)) {
+    return parse_error(*err);
+  }
+  auto &str = absl::get<string>(r);
+  return PyUnicode_FromStringAndSize(str.data(), str.size());
+}
+
+PyMethodDef module_methods[] = {
+    {"search", py_search, METH_VARARGS,
+     "search(cube, max_depth) -> the moves of an optimal solution of at most "
+     "max_depth quarter turns, or None."},
+    {"search_batch", reinterpret_cast<PyCFunction>(py_search_batch),
+     METH_VARARGS | METH_KEYWORDS,
+     "search_batch(cubes, max_depth, threads=1) -> (lengths, moves)\n\n"
+     "Solves each packed cube in `cubes` optimally. lengths[i] is the "
+     "solution length, or -1; moves[i*max_depth:][:lengths[i]] are its "
+     "moves as indices into MOVES."},
+    {"apply_batch", py_apply_batch, METH_VARARGS,
+     "apply_batch(a, b) -> packed a[i].apply(b[i]). Either may hold a "
+     "single cube."},
+    {"invert_batch", py_invert_batch, METH_O,
+     "invert_batch(a) -> packed a[i].invert()."},
+    {"from_algorithm_lines", parse_lines<rubik::from_algorithm_lines>, METH_O,
+     "from_algorithm_lines(str) -> packed cubes, one per line."},
+    {"from_facelets_lines", parse_lines<rubik::from_facelets_lines>, METH_O,
+     "from_facelets_lines(str) -> packed cubes, one per line."},
+    {"to_algorithm", py_to_algorithm, METH_O,
+     "to_algorithm(moves) -> the algorithm for a sequence of move cubes."},
+    {nullptr},
+};
+
+PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT, "rubik._native",
+    "Bindings for the C++ cube and search.", -1, module_methods,
+};
+
+}; // namespace
+
+PyMODINIT_FUNC PyInit__native() {
+  for (auto name : kMoveNames) {
+    moves.push_back(absl::get<Cube>(rubik::from_algorithm(name)));
+  }
+
+  PyObject *m = PyModule_Create(&module_def);
+  if (m == nullptr) {
+    return nullptr;
+  }
+  // PyModule_AddObject takes our reference only if it succeeds. The
+  // module gets one reference to the type, and CubeType keeps another.
+  CubeType = reinterpret_cast<PyTypeObject *>(PyType_FromSpec(&cube_spec));
+  if (CubeType == nullptr) {
+    Py_DECREF(m);
+    return nullptr;
+  }
+  Py_INCREF(CubeType);
+  if (PyModule_AddObject(m, "Cube", reinterpret_cast<PyObject *>(CubeType)) <
+      0) {
+    Py_DECREF(CubeType);
+    Py_CLEAR(CubeType);
+    Py_DECREF(m);
+    return nullptr;
+  }
+
+  PyObject *names = PyTuple_New(kMoveCount);
+  for (int i = 0; names != nullptr && i < kMoveCount; ++i) {
+    PyObject *name = PyUnicode_FromString(kMoveNames[i]);
+    if (name == nullptr) {
+      Py_CLEAR(names);
+      break;
+    }
+    PyTuple_SET_ITEM(names, i, name);
+  }
+  if (names == nullptr || PyModule_AddObject(m, "MOVES", names) < 0) {
+    Py_XDECREF(names);
+    Py_DECREF(m);
+    return nullptr;
+  }
+  if (PyModule_AddIntConstant(m, "PACKED_SIZE", sizeof(Cube::Packed)) < 0) {
+    Py_DECREF(m);
+    return nullptr;
+  }
+  return m;
+}
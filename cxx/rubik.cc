@@ -8,13 +8,12 @@
 #include <tmmintrin.h>
 
 #include <algorithm>
-#include <map>
+#include <tuple>
 #include <numeric>
 #include <vector>
 
 #include <iomanip>
 #include <iostream>
-#include <sstream>
 
 #include <cassert>
 
@@ -22,28 +21,10 @@ using namespace std;
 
 namespace rubik {
 
-Cube::Cube()
-    : edges(_mm_set_epi8(0, 0, 0, 0, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)),
-      corners(_mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0, 7, 6, 5, 4, 3, 2, 1, 0)) {
-  sanityCheck();
-}
-
 Cube::Cube(__m128i edges, __m128i corners) : edges(edges), corners(corners) {
   sanityCheck();
 }
 
-Cube::Cube(std::array<uint8_t, 12> edges, std::array<uint8_t, 8> corners) {
-  edge_union e;
-  e.pad = 0;
-  e.arr = edges;
-  this->edges = e.mm;
-
-  corner_union c;
-  c.pad = 0;
-  c.arr = corners;
-  this->corners = c.mm;
-}
-
 Cube Cube::apply(const Cube &other) const {
   auto edge_perm = _mm_and_si128(other.edges, _mm_set1_epi8(kEdgePermMask));
   auto out_edges = _mm_shuffle_epi8(edges, edge_perm);
@@ -136,153 +117,346 @@ void Cube::sanityCheck() const {
 
 namespace {
 static constexpr uint8_t E = Cube::kEdgeAlignMask;
-static constexpr uint8_t C0 = 0 << Cube::kCornerAlignShift;
 static constexpr uint8_t C1 = 1 << Cube::kCornerAlignShift;
 static constexpr uint8_t C2 = 2 << Cube::kCornerAlignShift;
+
+constexpr Rotations kRotations;
+
+const std::array<Cube, 18> kFaceTurns = {{
+    kRotations.R, kRotations.Rinv, kRotations.R2, kRotations.L,
+    kRotations.Linv, kRotations.L2, kRotations.F, kRotations.Finv,
+    kRotations.F2, kRotations.B, kRotations.Binv, kRotations.B2,
+    kRotations.U, kRotations.Uinv, kRotations.U2, kRotations.D,
+    kRotations.Dinv, kRotations.D2,
+}};
 }; // namespace
 
-Rotations::Rotations()
-    : L({4, 1, 2, 3, 8, 5, 6, 0, 7, 9, 10, 11},
-        {C1 | 4, C0 | 1, C0 | 2, C2 | 0, C2 | 7, C0 | 5, C0 | 6, C1 | 3}),
-      L2(L.apply(L)), Linv(L.invert()),
+const std::array<Cube, 18> &face_turns() { return kFaceTurns; }
 
-      R({0, 1, E | 6, 3, 4, E | 2, E | 10, 7, 8, 9, E | 5, 11},
-        {C0 | 0, C2 | 2, C1 | 6, C0 | 3, C0 | 4, C1 | 1, C2 | 5, C0 | 7}),
-      R2(R.apply(R)), Rinv(R.invert()),
+Cube replay_face_turns(uint64_t code) {
+  Cube pos;
+  for (; code != 0; code /= 19) {
+    pos = pos.apply(face_turns()[code % 19 - 1]);
+  }
+  return pos;
+}
 
-      U({3, 0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 11},
-        {C0 | 3, C0 | 0, C0 | 1, C0 | 2, C0 | 4, C0 | 5, C0 | 6, C0 | 7}),
-      U2(U.apply(U)), Uinv(U.invert()),
+uint64_t stable_hash(const Cube &pos) {
+  uint64_t e0 = _mm_cvtsi128_si64(pos.getEdges());
+  uint64_t e1 = uint32_t(_mm_extract_epi32(pos.getEdges(), 2));
+  uint64_t c0 = _mm_cvtsi128_si64(pos.getCorners());
+  uint64_t h = e0 * 0x9e3779b97f4a7c15ull ^ c0 * 0xc2b2ae3d27d4eb4full ^ e1;
+  h ^= h >> 31;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 29;
+  h *= 0x94d049bb133111ebull;
+  return h ^ (h >> 32);
+}
 
-      D({0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 8},
-        {C0 | 0, C0 | 1, C0 | 2, C0 | 3, C0 | 5, C0 | 6, C0 | 7, C0 | 4}),
-      D2(D.apply(D)), Dinv(D.invert()),
+namespace {
+// The qtm tree is constant data. Its moves are numbered in the order of
+// the root: each face's clockwise turn and then its inverse, for the
+// faces L, R, U, D, F, B. After each move, the tree leaves out
+//  - the move's inverse, which would undo it;
+//  - for an inverse, the move itself: M' M' is the same as M M;
+//  - after the first face of each pair of opposite faces (L, U and F),
+//    the turns of the second (R, D and B): opposite faces commute, so
+//    we search R L and never L R.
+enum qtm_move { kL, kLi, kR, kRi, kU, kUi, kD, kDi, kF, kFi, kB, kBi };
+
+constexpr CubeBytes qtm_turn(int move) {
+  constexpr Face faces[] = {Face::Left, Face::Right, Face::Up,
+                            Face::Down, Face::Front, Face::Back};
+  return move % 2 == 0 ? Rotations::turn(faces[move / 2])
+                       : Rotations::turn(faces[move / 2]).invert();
+}
 
-      F({0, 1, 2, E | 7, 4, 5, 3, E | 11, 8, 9, 10, 6},
-        {C0 | 0, C0 | 1, C2 | 3, C1 | 7, C0 | 4, C0 | 5, C1 | 2, C2 | 6}),
-      F2(F.apply(F)), Finv(F.invert()),
+extern const search_moves kQtmAfter[12];
 
-      B({0, 5, 2, 3, E | 1, 9, 6, 7, 8, E | 4, 10, 11},
-        {C2 | 1, C1 | 5, C0 | 2, C0 | 3, C1 | 0, C2 | 4, C0 | 6, C0 | 7}),
-      B2(B.apply(B)), Binv(B.invert()) {}
+constexpr search_node qtm_node(int move) {
+  return search_node(qtm_turn(move), &kQtmAfter[move]);
+}
 
-namespace {
-const std::vector<search_node> *make_qtm_tree() {
-  Rotations rotations;
-  static std::vector<search_node> l, linv, r, rinv, u, uinv, d, dinv, f, finv,
-      b, binv;
-  static std::vector<search_node> root({{rotations.L, &l},
-                                        {rotations.Linv, &linv},
-                                        {rotations.R, &r},
-                                        {rotations.Rinv, &rinv},
-                                        {rotations.U, &u},
-                                        {rotations.Uinv, &uinv},
-                                        {rotations.D, &d},
-                                        {rotations.Dinv, &dinv},
-                                        {rotations.F, &f},
-                                        {rotations.Finv, &finv},
-                                        {rotations.B, &b},
-                                        {rotations.Binv, &binv}});
-
-  const vector<Cube> forward_moves = {
-      rotations.L, rotations.R, rotations.U,
-      rotations.D, rotations.F, rotations.B,
-  };
+template <size_t N>
+constexpr search_moves moves_of(const search_node (&nodes)[N]) {
+  return search_moves(nodes, N);
+}
 
-  const vector<pair<const Cube, const Cube>> obverse = {
-      {rotations.L, rotations.R},
-      {rotations.U, rotations.D},
-      {rotations.F, rotations.B},
-  };
-  for (auto &ent : root) {
-    bool isfwd = find(forward_moves.begin(), forward_moves.end(),
-                      ent.rotation) != forward_moves.end();
-    auto ob = find_if(obverse.begin(), obverse.end(), [&](auto &pair) {
-      return (pair.first == ent.rotation ||
-              pair.first == ent.rotation.invert());
-    });
-    for (auto &next : root) {
-      // No need to ever search M -> M^{-1}
-      if (ent.rotation == next.rotation.invert()) {
-        continue;
-      }
-      // No need to search M' -> M'; it's the same as M -> M
-      if (!isfwd && next.rotation == ent.rotation) {
-        continue;
-      }
-      // L and L' commute with R and R';
-      // canonicalize so we always search R -> L or R' -> L
-      // and never L -> R
-      // similarly for U/D and F/B
-      if (ob != obverse.end()) {
-        if (next.rotation == ob->second ||
-            next.rotation.invert() == ob->second) {
-          continue;
-        }
-      }
-      ent.next->push_back(next);
-    }
+const search_node kQtmRoot[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi),
+    qtm_node(kU), qtm_node(kUi), qtm_node(kD), qtm_node(kDi),
+    qtm_node(kF), qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterL[] = {
+    qtm_node(kL),  qtm_node(kU),  qtm_node(kUi), qtm_node(kD), qtm_node(kDi),
+    qtm_node(kF),  qtm_node(kFi), qtm_node(kB),  qtm_node(kBi),
+};
+const search_node kAfterLi[] = {
+    qtm_node(kU), qtm_node(kUi), qtm_node(kD), qtm_node(kDi),
+    qtm_node(kF), qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterR[] = {
+    qtm_node(kL),  qtm_node(kLi), qtm_node(kR), qtm_node(kU),
+    qtm_node(kUi), qtm_node(kD),  qtm_node(kDi), qtm_node(kF),
+    qtm_node(kFi), qtm_node(kB),  qtm_node(kBi),
+};
+const search_node kAfterRi[] = {
+    qtm_node(kL),  qtm_node(kLi), qtm_node(kU), qtm_node(kUi), qtm_node(kD),
+    qtm_node(kDi), qtm_node(kF),  qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterU[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi), qtm_node(kU),
+    qtm_node(kF), qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterUi[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi),
+    qtm_node(kF), qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterD[] = {
+    qtm_node(kL),  qtm_node(kLi), qtm_node(kR), qtm_node(kRi),
+    qtm_node(kU),  qtm_node(kUi), qtm_node(kD), qtm_node(kF),
+    qtm_node(kFi), qtm_node(kB),  qtm_node(kBi),
+};
+const search_node kAfterDi[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi), qtm_node(kU),
+    qtm_node(kUi), qtm_node(kF), qtm_node(kFi), qtm_node(kB), qtm_node(kBi),
+};
+const search_node kAfterF[] = {
+    qtm_node(kL),  qtm_node(kLi), qtm_node(kR), qtm_node(kRi), qtm_node(kU),
+    qtm_node(kUi), qtm_node(kD),  qtm_node(kDi), qtm_node(kF),
+};
+const search_node kAfterFi[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi),
+    qtm_node(kU), qtm_node(kUi), qtm_node(kD), qtm_node(kDi),
+};
+const search_node kAfterB[] = {
+    qtm_node(kL),  qtm_node(kLi), qtm_node(kR), qtm_node(kRi),
+    qtm_node(kU),  qtm_node(kUi), qtm_node(kD), qtm_node(kDi),
+    qtm_node(kF),  qtm_node(kFi), qtm_node(kB),
+};
+const search_node kAfterBi[] = {
+    qtm_node(kL), qtm_node(kLi), qtm_node(kR), qtm_node(kRi), qtm_node(kU),
+    qtm_node(kUi), qtm_node(kD), qtm_node(kDi), qtm_node(kF), qtm_node(kFi),
+};
+
+const search_moves kQtmAfter[12] = {
+    moves_of(kAfterL), moves_of(kAfterLi), moves_of(kAfterR),
+    moves_of(kAfterRi), moves_of(kAfterU), moves_of(kAfterUi),
+    moves_of(kAfterD), moves_of(kAfterDi), moves_of(kAfterF),
+    moves_of(kAfterFi), moves_of(kAfterB), moves_of(kAfterBi),
+};
+const search_moves kQtmTree = moves_of(kQtmRoot);
+
+// move_table maps between face-turn names and cubes without any
+// string compares. A move is named by its face (an index into kFaces)
+// and a turn: 0 for clockwise, 1 for counterclockwise, 2 for a half
+// turn.
+constexpr char kFaces[] = "RLFBUD";
+constexpr char kTurnSuffix[] = {'\0', '\'', '2'};
+
+int face_index(char c) {
+  switch (c) {
+  case 'R':
+    return 0;
+  case 'L':
+    return 1;
+  case 'F':
+    return 2;
+  case 'B':
+    return 3;
+  case 'U':
+    return 4;
+  case 'D':
+    return 5;
+  default:
+    return -1;
   }
-  return &root;
 }
 
-const vector<pair<string, const Cube>> init_move_names() {
-  Rotations rotations;
-  return {
-      {"R", rotations.R}, {"R'", rotations.Rinv}, {"R2", rotations.R2},
-      {"L", rotations.L}, {"L'", rotations.Linv}, {"L2", rotations.L2},
-      {"F", rotations.F}, {"F'", rotations.Finv}, {"F2", rotations.F2},
-      {"B", rotations.B}, {"B'", rotations.Binv}, {"B2", rotations.B2},
-      {"U", rotations.U}, {"U'", rotations.Uinv}, {"U2", rotations.U2},
-      {"D", rotations.D}, {"D'", rotations.Dinv}, {"D2", rotations.D2},
-  };
+int turn_index(char c) {
+  switch (c) {
+  case '\'':
+    return 1;
+  case '2':
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+struct move_table {
+  Cube moves[6][3];
+  // Bitmask of the edges each face's turns leave in place, which tells
+  // to_algorithm which face to compare a cube against.
+  int fixed_edges[6];
+};
+
+int fixed_edges(const Cube &c) {
+  auto solved = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 0, 0, 0);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(c.getEdges(), solved)) & 0x0fff;
 }
 
-const vector<pair<string, const Cube>> move_names = init_move_names();
+// fixed_edge_mask is fixed_edges() for a turn, at compile time.
+constexpr int fixed_edge_mask(const CubeBytes &turn) {
+  int mask = 0;
+  for (int i = 0; i < 12; ++i) {
+    if (turn.edges[i] == i) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+const move_table move_names = {
+    {
+        {kRotations.R, kRotations.Rinv, kRotations.R2},
+        {kRotations.L, kRotations.Linv, kRotations.L2},
+        {kRotations.F, kRotations.Finv, kRotations.F2},
+        {kRotations.B, kRotations.Binv, kRotations.B2},
+        {kRotations.U, kRotations.Uinv, kRotations.U2},
+        {kRotations.D, kRotations.Dinv, kRotations.D2},
+    },
+    {
+        fixed_edge_mask(Rotations::turn(Face::Right)),
+        fixed_edge_mask(Rotations::turn(Face::Left)),
+        fixed_edge_mask(Rotations::turn(Face::Front)),
+        fixed_edge_mask(Rotations::turn(Face::Back)),
+        fixed_edge_mask(Rotations::turn(Face::Up)),
+        fixed_edge_mask(Rotations::turn(Face::Down)),
+    },
+};
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// for_each_move calls `fn` with each move of the algorithm in `str`, in
+// order. On a parse error it sets `err` and returns false.
+template <typename Fn>
+bool for_each_move(absl::string_view str, Error &err, const Fn &fn) {
+  size_t i = 0;
+  while (true) {
+    while (i < str.size() && is_space(str[i])) {
+      ++i;
+    }
+    if (i == str.size()) {
+      break;
+    }
+    size_t end = i;
+    while (end < str.size() && !is_space(str[end])) {
+      ++end;
+    }
+    auto word = str.substr(i, end - i);
+    int face = face_index(word[0]);
+    int turn = 0;
+    if (word.size() == 2) {
+      turn = turn_index(word[1]);
+    }
+    if (face < 0 || turn < 0 || word.size() > 2) {
+      err = Error{absl::StrCat("unknown move: ", word)};
+      return false;
+    }
+    fn(move_names.moves[face][turn]);
+    i = end;
+  }
+  return true;
+}
 
 }; // namespace
 
-const vector<search_node> *qtm_root = make_qtm_tree();
+const search_moves *const qtm_root = &kQtmTree;
 
-Result<Cube, Error> from_algorithm(const string &str) {
+Result<Cube, Error> from_algorithm(absl::string_view str) {
   Cube out;
-  auto it = str.begin();
-  while (it != str.end()) {
-    auto next = find(it, str.end(), ' ');
-    string word(it, next);
-    auto fnd = find_if(move_names.begin(), move_names.end(),
-                       [&](auto &ent) { return ent.first == word; });
-    if (fnd == move_names.end()) {
-      return Error{"unknown move: " + word};
-    }
-    out = out.apply(fnd->second);
-    it = next;
-    while (it != str.end() && *it == ' ') {
-      ++it;
+  Error err;
+  if (!for_each_move(str, err,
+                     [&](const Cube &move) { out = out.apply(move); })) {
+    return err;
+  }
+  return out;
+}
+
+Result<vector<Cube>, Error> algorithm_moves(absl::string_view str) {
+  vector<Cube> out;
+  Error err;
+  if (!for_each_move(str, err,
+                     [&](const Cube &move) { out.push_back(move); })) {
+    return err;
+  }
+  return out;
+}
+
+Result<vector<Cube>, Error> from_algorithm_lines(absl::string_view text) {
+  vector<Cube> out;
+  int lineno = 0;
+  while (!text.empty()) {
+    ++lineno;
+    auto nl = text.find('\n');
+    auto line = text.substr(0, nl);
+    text.remove_prefix(nl == absl::string_view::npos ? text.size() : nl + 1);
+
+    auto r = from_algorithm(line);
+    if (absl::holds_alternative<Error>(r)) {
+      return Error{absl::StrCat("line ", lineno, ": ", get<Error>(r).error)};
     }
+    out.push_back(get<Cube>(r));
   }
   return out;
 }
 
 Result<string, Error> to_algorithm(const vector<Cube> &path) {
-  stringstream out;
+  string out;
+  out.reserve(3 * path.size());
   for (auto &cube : path) {
-    auto fnd = find_if(move_names.begin(), move_names.end(),
-                       [&](auto &ent) { return ent.second == cube; });
-    if (fnd == move_names.end()) {
+    int fixed = fixed_edges(cube);
+    int face = 0, turn = 0;
+    for (face = 0; face < 6; ++face) {
+      if (move_names.fixed_edges[face] != fixed) {
+        continue;
+      }
+      for (turn = 0; turn < 3; ++turn) {
+        if (move_names.moves[face][turn] == cube) {
+          break;
+        }
+      }
+      break;
+    }
+    if (face == 6 || turn == 3) {
       return Error{"Unrecognized rotation"};
     }
     if (&cube != &path.front()) {
-      out << ' ';
+      out.push_back(' ');
+    }
+    out.push_back(kFaces[face]);
+    if (kTurnSuffix[turn]) {
+      out.push_back(kTurnSuffix[turn]);
     }
-    out << fnd->first;
   }
-  return out.str();
+  return out;
 }
 
 namespace {
+int color_index(Color c) {
+  switch (c) {
+  case Color::Red:
+    return 0;
+  case Color::White:
+    return 1;
+  case Color::Green:
+    return 2;
+  case Color::Blue:
+    return 3;
+  case Color::Orange:
+    return 4;
+  case Color::Yellow:
+    return 5;
+  default:
+    return -1;
+  }
+}
+
 class facelet_parser {
-  const map<pair<Color, Color>, uint8_t> edge_map{
+  static constexpr uint8_t kNone = 0xff;
+
+  const vector<pair<pair<Color, Color>, uint8_t>> edge_map{
       {{Color::Red, Color::Green}, 0},
       {{Color::Green, Color::Red}, E | 0},
       {{Color::Red, Color::White}, 1},
@@ -309,7 +483,7 @@ class facelet_parser {
       {{Color::Yellow, Color::Orange}, E | 11},
   };
 
-  const map<tuple<Color, Color, Color>, uint8_t> corner_map{
+  const vector<pair<tuple<Color, Color, Color>, uint8_t>> corner_map{
       {{Color::Red, Color::Green, Color::White}, 0},
       {{Color::Green, Color::White, Color::Red}, C1 | 0},
       {{Color::White, Color::Red, Color::Green}, C2 | 0},
@@ -362,8 +536,42 @@ class facelet_parser {
       {28, Color::Blue}, {31, Color::Orange}, {49, Color::Yellow},
   };
 
+  // edge_map and corner_map, indexed by the color_index of each facelet
+  // in base 6.
+  array<uint8_t, 6 * 6> edge_lookup;
+  array<uint8_t, 6 * 6 * 6> corner_lookup;
+
+  uint8_t find_edge(Color a, Color b) const {
+    int ia = color_index(a), ib = color_index(b);
+    if (ia < 0 || ib < 0) {
+      return kNone;
+    }
+    return edge_lookup[ia * 6 + ib];
+  }
+
+  uint8_t find_corner(Color a, Color b, Color c) const {
+    int ia = color_index(a), ib = color_index(b), ic = color_index(c);
+    if (ia < 0 || ib < 0 || ic < 0) {
+      return kNone;
+    }
+    return corner_lookup[(ia * 6 + ib) * 6 + ic];
+  }
+
 public:
   facelet_parser() {
+    edge_lookup.fill(kNone);
+    for (auto &ent : edge_map) {
+      edge_lookup[color_index(ent.first.first) * 6 +
+                  color_index(ent.first.second)] = ent.second;
+    }
+    corner_lookup.fill(kNone);
+    for (auto &ent : corner_map) {
+      auto &cs = ent.first;
+      corner_lookup[(color_index(get<0>(cs)) * 6 + color_index(get<1>(cs))) *
+                        6 +
+                    color_index(get<2>(cs))] = ent.second;
+    }
+
     if (debug_mode) {
       return;
     }
@@ -403,7 +611,7 @@ public:
     }
   }
 
-  Result<Cube, Error> parse(const std::string &str) {
+  Result<Cube, Error> parse(absl::string_view str) const {
     if (str.size() != 6 * 9) {
       return Error{absl::StrCat("Wrong string size: ", str.size())};
     }
@@ -420,28 +628,26 @@ public:
     corner_union cu;
     i = 0;
     for (auto e : edge_indexes) {
-      auto cs = make_pair((Color)str[e.first], (Color)str[e.second]);
-      auto fnd = edge_map.find(cs);
-      if (fnd == edge_map.end()) {
-        return Error{absl::StrCat("Can't find edge: ", string(&str[e.first], 1),
-                                  "/", string(&str[e.second], 1), " (index ",
+      auto fnd = find_edge((Color)str[e.first], (Color)str[e.second]);
+      if (fnd == kNone) {
+        return Error{absl::StrCat("Can't find edge: ", string(1, str[e.first]),
+                                  "/", string(1, str[e.second]), " (index ",
                                   e.first, "/", e.second, ")")};
       }
-      eu.arr[i++] = fnd->second;
+      eu.arr[i++] = fnd;
     }
 
     i = 0;
     for (auto c : corner_indexes) {
-      auto cs = make_tuple((Color)str[get<0>(c)], (Color)str[get<1>(c)],
-                           (Color)str[get<2>(c)]);
-      auto fnd = corner_map.find(cs);
-      if (fnd == corner_map.end()) {
+      auto fnd = find_corner((Color)str[get<0>(c)], (Color)str[get<1>(c)],
+                             (Color)str[get<2>(c)]);
+      if (fnd == kNone) {
         return Error{absl::StrCat(
-            "Can't find corner: ", string(&str[get<0>(c)], 1), "/",
-            string(&str[get<1>(c)], 1), "/", string(&str[get<2>(c)], 1),
+            "Can't find corner: ", string(1, str[get<0>(c)]), "/",
+            string(1, str[get<1>(c)]), "/", string(1, str[get<2>(c)]),
             " (index ", get<0>(c), "/", get<1>(c), "/", get<2>(c), ")")};
       }
-      cu.arr[i++] = fnd->second;
+      cu.arr[i++] = fnd;
     }
 
     return Cube(eu.mm, cu.mm);
@@ -450,9 +656,30 @@ public:
 
 }; // namespace
 
-Result<Cube, Error> from_facelets(const std::string &str) {
-  static facelet_parser parser;
+Result<Cube, Error> from_facelets(absl::string_view str) {
+  static const facelet_parser parser;
   return parser.parse(str);
 }
 
+Result<vector<Cube>, Error> from_facelets_lines(absl::string_view text) {
+  vector<Cube> out;
+  int lineno = 0;
+  while (!text.empty()) {
+    ++lineno;
+    auto nl = text.find('\n');
+    auto line = text.substr(0, nl);
+    text.remove_prefix(nl == absl::string_view::npos ? text.size() : nl + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    auto r = from_facelets(line);
+    if (absl::holds_alternative<Error>(r)) {
+      return Error{absl::StrCat("line ", lineno, ": ", get<Error>(r).error)};
+    }
+    out.push_back(get<Cube>(r));
+  }
+  return out;
+}
+
 }; // namespace rubik
@@ -2,15 +2,22 @@
 #define RUBIK_H
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <emmintrin.h>
+#include <functional>
 #include <stdint.h>
 #include <string>
 #include <vector>
 
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/variant.h"
 
 namespace rubik {
 class Rotations;
+class TableReplicas;
+class HeuristicCascade;
 
 enum class Color : char {
   Red = 'R',
@@ -30,6 +37,28 @@ enum class Face : char {
   Back = 'B',
 };
 
+// The number of reachable cube positions, 8! * 3^7 * 12! * 2^11 / 2.
+extern const absl::uint128 kCubeStates;
+
+// The position of each orbit of cubies, as a dense coordinate.
+struct CubeCoordinates {
+  uint16_t corner_orient; // [0, 3^7)
+  uint16_t edge_orient;   // [0, 2^11)
+  uint16_t corner_perm;   // [0, 8!)
+  uint32_t edge_perm;     // [0, 12!/2)
+};
+
+// CubeBytes holds the cubie bytes of a position in the layout of Cube,
+// for computing positions at compile time: apply() and invert() match
+// Cube's, and a Cube made from constant CubeBytes is constant data.
+struct CubeBytes {
+  uint8_t edges[12];
+  uint8_t corners[8];
+
+  constexpr CubeBytes apply(const CubeBytes &rhs) const;
+  constexpr CubeBytes invert() const;
+};
+
 class Cube {
   friend class Rotations;
 
@@ -44,24 +73,50 @@ public:
   static constexpr uint8_t kCornerAlignShift = 3;
   static constexpr uint8_t kCornerAlignMask = 3 << kCornerAlignShift;
 
-  Cube();
+  // The solved cube.
+  constexpr Cube()
+      : Cube(std::array<uint8_t, 12>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+             std::array<uint8_t, 8>{0, 1, 2, 3, 4, 5, 6, 7}) {}
   Cube(__m128i edges, __m128i corners);
-  Cube(std::array<uint8_t, 12> edges, std::array<uint8_t, 8> corners);
+  // These constructors don't check the position, so that constant
+  // positions need no code at startup.
+  constexpr Cube(const std::array<uint8_t, 12> &edges,
+                 const std::array<uint8_t, 8> &corners)
+      : edges{pack_bytes(edges, 0, 8), pack_bytes(edges, 8, 4)},
+        corners{pack_bytes(corners, 0, 8), 0} {}
+  constexpr Cube(const CubeBytes &bytes)
+      : edges{pack_bytes(bytes.edges, 0, 8), pack_bytes(bytes.edges, 8, 4)},
+        corners{pack_bytes(bytes.corners, 0, 8), 0} {}
 
   Cube apply(const Cube &rhs) const;
   Cube invert() const;
 
   void sanityCheck() const;
 
+  // A 16-byte encoding: six bytes of edge permutation nibbles, two bytes
+  // of edge flip bits, and the eight corner bytes.
+  using Packed = std::array<uint8_t, 16>;
+  Packed pack() const;
+  static Cube unpack(const Packed &packed);
+
+  // rank maps each reachable position to a distinct integer in
+  // [0, kCubeStates); unrank is its inverse. The rank is built from
+  // coordinates(), with the edge permutation as the most significant
+  // part and the edge orientation as the least.
+  absl::uint128 rank() const;
+  static Cube unrank(absl::uint128 rank);
+  CubeCoordinates coordinates() const;
+  static Cube from_coordinates(const CubeCoordinates &coords);
+
   Cube(const Cube &) = default;
   Cube &operator=(const Cube &) = default;
 
   bool operator==(const Cube &other) const;
   bool operator!=(const Cube &other) const { return !(*this == other); };
 
-  const __m128i &getEdges() const { return edges; }
+  constexpr const __m128i &getEdges() const { return edges; }
 
-  const __m128i &getCorners() const { return corners; }
+  constexpr const __m128i &getCorners() const { return corners; }
 
   template <typename H> friend H AbslHashValue(H h, const Cube &c) {
     union {
@@ -84,16 +139,204 @@ public:
 
     return H::combine(std::move(h), eu.u1, eu.u2, cu.u1);
   }
+
+private:
+  // pack_bytes packs n <= 8 bytes from bytes[i] on into one lane of an
+  // __m128i, first byte lowest.
+  template <typename Bytes>
+  static constexpr long long pack_bytes(const Bytes &bytes, int i, int n) {
+    uint64_t lane = 0;
+    for (int k = n - 1; k >= 0; --k) {
+      lane = lane << 8 | bytes[i + k];
+    }
+    return (long long)lane;
+  }
 };
 
+constexpr CubeBytes CubeBytes::apply(const CubeBytes &rhs) const {
+  CubeBytes out{};
+  for (int i = 0; i < 12; ++i) {
+    uint8_t e = rhs.edges[i];
+    out.edges[i] = edges[e & Cube::kEdgePermMask] ^ (e & Cube::kEdgeAlignMask);
+  }
+  for (int i = 0; i < 8; ++i) {
+    uint8_t c = rhs.corners[i];
+    int sum = corners[c & Cube::kCornerPermMask] + (c & Cube::kCornerAlignMask);
+    if (sum >= 3 << Cube::kCornerAlignShift) {
+      sum -= 3 << Cube::kCornerAlignShift;
+    }
+    out.corners[i] = sum;
+  }
+  return out;
+}
+
+constexpr CubeBytes CubeBytes::invert() const {
+  CubeBytes out{};
+  for (int i = 0; i < 12; ++i) {
+    out.edges[edges[i] & Cube::kEdgePermMask] =
+        i | (edges[i] & Cube::kEdgeAlignMask);
+  }
+  for (int i = 0; i < 8; ++i) {
+    int twist = corners[i] & Cube::kCornerAlignMask;
+    out.corners[corners[i] & Cube::kCornerPermMask] =
+        i | (twist == 0 ? 0 : (3 << Cube::kCornerAlignShift) - twist);
+  }
+  return out;
+}
+
 struct search_node;
+class search_moves;
 template <typename Check, typename Prune, typename Unwind>
-bool search(const Cube &pos, const std::vector<search_node> &moves, int depth,
+bool search(const Cube &pos, const search_moves &moves, int depth,
             const Check &check, const Prune &prune, const Unwind &unwind);
 template <typename Visit>
-void search(const Cube &pos, const std::vector<search_node> &moves, int depth,
+void search(const Cube &pos, const search_moves &moves, int depth,
             const Visit &visit);
-bool search(Cube start, std::vector<Cube> &path, int max_depth);
+
+// A CancelToken stops the searches it is passed, either when another
+// thread calls cancel() or once its deadline passes. Searches poll it
+// every few thousand nodes, so they stop within a fraction of a
+// millisecond rather than immediately.
+class CancelToken {
+public:
+  using clock = std::chrono::steady_clock;
+
+  CancelToken() : deadline_(clock::time_point::max()) {}
+  explicit CancelToken(clock::time_point deadline) : deadline_(deadline) {}
+  static CancelToken after(clock::duration timeout) {
+    return CancelToken(clock::now() + timeout);
+  }
+  CancelToken(const CancelToken &other)
+      : cancelled_(other.cancelled_.load()), deadline_(other.deadline_) {}
+
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool cancelled() const {
+    return cancelled_.load(std::memory_order_relaxed) ||
+           (deadline_ != clock::time_point::max() && clock::now() >= deadline_);
+  }
+
+private:
+  std::atomic<bool> cancelled_{false};
+  clock::time_point deadline_;
+};
+
+struct SearchOptions {
+  // Evaluate the heuristic for every child of a node and descend into
+  // the most promising ones first. This costs extra table probes per
+  // node, but the final iteration of an IDDFS typically reaches a
+  // solution after visiting far less of the tree.
+  bool order_moves = false;
+  // Compute the pattern-table indices for all of a node's children and
+  // prefetch them before pruning any child.
+  bool prefetch = false;
+  // Probe these tables instead of the built-in copy, reading the
+  // replica for `numa_node`, or for the node we are running on if it's
+  // -1 (or not a node of theirs).
+  const TableReplicas *tables = nullptr;
+  int numa_node = -1;
+  // Give up, returning no solution, once this token is cancelled.
+  const CancelToken *cancel = nullptr;
+  // Weighted IDA*: prune nodes where moves so far + weight * heuristic
+  // exceeds the depth bound. A weight w >= 1 finds solutions at most
+  // ceil(w * optimal) moves long, usually visiting far fewer nodes.
+  double weight = 1.0;
+  // Probe the pattern tables on each position as well as its inverse,
+  // and take the larger bound. This doubles the probes per node, in
+  // exchange for pruning more of the tree.
+  bool dual_lookup = false;
+  // In solve(), search for the inverse of the start instead (and invert
+  // the solution) if the tables bound it higher. With dual_lookup the
+  // bounds are always equal, so this has no effect.
+  bool dual_search = false;
+  // Prune with this cascade of bounds (see cascade.h) instead of the
+  // quad table alone. order_moves and prefetch take precedence, since
+  // they evaluate the quad table for every child anyway.
+  HeuristicCascade *cascade = nullptr;
+};
+
+bool search(Cube start, std::vector<Cube> &path, int max_depth,
+            const SearchOptions &opts = SearchOptions());
+
+struct SearchResult {
+  // Whether `path` solves the cube. solve() deepens one move at a time,
+  // so with weight 1 any solution it finds is optimal.
+  bool solved = false;
+  std::vector<Cube> path;
+  // Every solution has at least this many moves: the heuristic bound of
+  // the start, or what the exhaustively searched depths prove.
+  int lower_bound = 0;
+  // path.size() / lower_bound: the solution is at most this many times
+  // longer than optimal. It is 1 for unweighted searches, and at most
+  // about the weight otherwise.
+  double suboptimality = 1.0;
+  // Nodes visited, over all depths.
+  uint64_t nodes = 0;
+  // Whether the search stopped early because opts.cancel fired.
+  bool cancelled = false;
+  // Whether solve() searched the inverse of the start (see
+  // SearchOptions::dual_search).
+  bool inverse = false;
+};
+
+// search_subtree is search() below one node of the qtm tree, whose
+// moves are `moves`: it looks for a path of at most `depth` of them from
+// `start`, and reports the nodes it visited and whether opts.cancel
+// stopped it. It's how a search is split into independent jobs.
+SearchResult search_subtree(const Cube &start, const search_moves &moves,
+                            int depth,
+                            const SearchOptions &opts = SearchOptions());
+
+// solve searches for an optimal (or with opts.weight, bounded
+// suboptimal) solution of at most max_depth moves, iteratively
+// deepening search(). A weighted search starts at w times the start's
+// heuristic bound, which max_depth must leave room for. If opts.cancel
+// fires, solve returns what it has proven so far.
+SearchResult solve(Cube start, int max_depth,
+                   const SearchOptions &opts = SearchOptions());
+
+// solve_interleaved solves each of `starts` as solve() would, on the
+// calling thread, but keeps `interleave` of the searches going at once
+// and advances them a node at a time in turn. Each search prefetches
+// the table entry for its next node before yielding, so a cache miss
+// in one search overlaps the work of the others instead of stalling
+// the core. opts.tables, numa_node, cancel, weight and dual_lookup
+// apply; every search always prefetches, so order_moves, prefetch and
+// dual_search are ignored. Results are in the order of `starts`, and
+// the paths are the same as with opts.prefetch.
+std::vector<SearchResult>
+solve_interleaved(const std::vector<Cube> &starts, int max_depth,
+                  int interleave = 8,
+                  const SearchOptions &opts = SearchOptions());
+
+struct EnumerateOptions {
+  // Report only the shortest solutions, instead of every solution of up
+  // to max_depth moves.
+  bool optimal_only = true;
+  // Number of threads to search on. 1 searches on the calling thread; 0
+  // uses one thread per core.
+  int threads = 1;
+  // When searching on several threads, still report solutions in the
+  // order a single-threaded search would. This holds back solutions
+  // from subtrees that finish early, so it costs memory.
+  bool ordered = false;
+  // Pin each worker thread to a node of these tables' topology, spread
+  // round-robin, and have it probe that node's replica.
+  const TableReplicas *tables = nullptr;
+  // Stop enumerating once this token is cancelled.
+  const CancelToken *cancel = nullptr;
+  // As SearchOptions::dual_lookup.
+  bool dual_lookup = false;
+};
+
+// enumerate_solutions calls `found` with every solution of `start`,
+// as a path of quarter turns, as they are found. Solutions are distinct
+// up to the canonicalization of the qtm tree, and never have a shorter
+// solution as a prefix. Calls to `found` are serialized; if it returns
+// false, enumeration stops. Returns the number of solutions reported.
+size_t
+enumerate_solutions(Cube start, int max_depth,
+                    const std::function<bool(const std::vector<Cube> &)> &found,
+                    const EnumerateOptions &opts = EnumerateOptions());
 
 template <typename Ok, typename Err> using Result = absl::variant<Ok, Err>;
 
@@ -101,9 +344,17 @@ struct Error {
   std::string error;
 };
 
-Result<Cube, Error> from_algorithm(const std::string &str);
-Result<Cube, Error> from_facelets(const std::string &notation);
+Result<Cube, Error> from_algorithm(absl::string_view str);
+Result<Cube, Error> from_facelets(absl::string_view notation);
 Result<std::string, Error> to_algorithm(const std::vector<Cube> &path);
+// algorithm_moves parses an algorithm like from_algorithm, but returns
+// its moves (each a quarter or half turn) instead of their product.
+Result<std::vector<Cube>, Error> algorithm_moves(absl::string_view str);
+
+// Parse a buffer holding one algorithm (or facelet string) per line.
+// Errors name the offending line.
+Result<std::vector<Cube>, Error> from_algorithm_lines(absl::string_view text);
+Result<std::vector<Cube>, Error> from_facelets_lines(absl::string_view text);
 
 class Rotations {
 public:
@@ -114,8 +365,66 @@ public:
   const Cube F, F2, Finv;
   const Cube B, B2, Binv;
 
-  Rotations();
+  // Every turn is computed at compile time, so a Rotations costs
+  // nothing to construct and a global one is constant data.
+  constexpr Rotations()
+      : Rotations(turn(Face::Left), turn(Face::Right), turn(Face::Up),
+                  turn(Face::Down), turn(Face::Front), turn(Face::Back)) {}
+
+  // The clockwise quarter turn of `face`.
+  static constexpr CubeBytes turn(Face face);
+
+private:
+  constexpr Rotations(const CubeBytes &l, const CubeBytes &r,
+                      const CubeBytes &u, const CubeBytes &d,
+                      const CubeBytes &f, const CubeBytes &b)
+      : L(l), L2(l.apply(l)), Linv(l.invert()), R(r), R2(r.apply(r)),
+        Rinv(r.invert()), U(u), U2(u.apply(u)), Uinv(u.invert()), D(d),
+        D2(d.apply(d)), Dinv(d.invert()), F(f), F2(f.apply(f)),
+        Finv(f.invert()), B(b), B2(b.apply(b)), Binv(b.invert()) {}
 };
 
+constexpr CubeBytes Rotations::turn(Face face) {
+  // Flip and twist bits, to or into the cubies' slots.
+  constexpr uint8_t E = Cube::kEdgeAlignMask;
+  constexpr uint8_t C1 = 1 << Cube::kCornerAlignShift;
+  constexpr uint8_t C2 = 2 << Cube::kCornerAlignShift;
+  switch (face) {
+  case Face::Left:
+    return {{4, 1, 2, 3, 8, 5, 6, 0, 7, 9, 10, 11},
+            {C1 | 4, 1, 2, C2 | 0, C2 | 7, 5, 6, C1 | 3}};
+  case Face::Right:
+    return {{0, 1, E | 6, 3, 4, E | 2, E | 10, 7, 8, 9, E | 5, 11},
+            {0, C2 | 2, C1 | 6, 3, 4, C1 | 1, C2 | 5, 7}};
+  case Face::Up:
+    return {{3, 0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 11},
+            {3, 0, 1, 2, 4, 5, 6, 7}};
+  case Face::Down:
+    return {{0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 8},
+            {0, 1, 2, 3, 5, 6, 7, 4}};
+  case Face::Front:
+    return {{0, 1, 2, E | 7, 4, 5, 3, E | 11, 8, 9, 10, 6},
+            {0, 1, C2 | 3, C1 | 7, 4, 5, C1 | 2, C2 | 6}};
+  case Face::Back:
+    return {{0, 5, 2, 3, E | 1, 9, 6, 7, 8, E | 4, 10, 11},
+            {C2 | 1, C1 | 5, 2, 3, C1 | 0, C2 | 4, 6, 7}};
+  }
+  return {};
+}
+
+// The 18 face turns, three per face in the order R, L, F, B, U, D (a
+// quarter turn, its inverse and the half turn), so that turn / 3 is
+// the face and turn / 6 the axis.
+const std::array<Cube, 18> &face_turns();
+// replay_face_turns returns the position that a code of face turns
+// reaches: base-19 digits, least significant first, each one more than
+// the turn's index in face_turns(). A 0 digit ends the code.
+Cube replay_face_turns(uint64_t code);
+
+// stable_hash hashes a position the same way in every process, unlike
+// absl::Hash, which is seeded per process; tables saved to disk and
+// mapped back in key on it.
+uint64_t stable_hash(const Cube &pos);
+
 }; // namespace rubik
 #endif
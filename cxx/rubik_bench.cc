@@ -1,72 +1,47 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
 
-#include <regex>
-
-#include "absl/types/optional.h"
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "bench.h"
+#include "cascade.h"
+#include "checkpoint.h"
+#include "database.h"
+#include "dictionary.h"
+#include "distributed.h"
+#include "mask.h"
+#include "moveset.h"
+#include "numa.h"
 #include "rubik.h"
 #include "rubik_impl.h"
+#include "store.h"
+#include "symmetry.h"
+#include "tools/flags.h"
 
 using namespace rubik;
 using namespace std;
 
-absl::optional<regex> benchmark_pattern;
-
 namespace {
 Rotations rotations;
+Bench bench;
 };
 
-template <typename To, typename From>
-bool try_fmt(std::ostream &out, const std::string &unit, From dur) {
-  auto to = chrono::duration_cast<To>(dur);
-  if (to.count() < 10000) {
-    out << to.count() << unit;
-    return true;
-  }
-  return false;
-}
-
-template <typename T> void format_duration(std::ostream &out, T dur) {
-  if (try_fmt<chrono::nanoseconds>(out, "ns", dur)) {
-    return;
-  }
-  if (try_fmt<chrono::microseconds>(out, "us", dur)) {
-    return;
-  }
-  if (try_fmt<chrono::milliseconds>(out, "ms", dur)) {
-    return;
-  }
-  if (try_fmt<chrono::seconds>(out, "s", dur)) {
-    return;
-  }
-  out << dur.count() << "<" << T::period::num << "/" << T::period::den << ">\n";
-}
+bool benchmark_enabled(const std::string &name) { return bench.enabled(name); }
 
 template <typename T> void benchmark(const std::string &name, T body) {
-  if (benchmark_pattern.has_value()) {
-    if (!regex_search(name, *benchmark_pattern)) {
-      return;
-    }
-  }
-  for (uint8_t order = 0;; ++order) {
-    auto before = chrono::steady_clock::now();
-    uint64_t N = (1ul << order);
-    for (uint64_t i = 0; i < N; ++i) {
-      body();
-    }
-    auto after = chrono::steady_clock::now();
-    if ((after - before) < chrono::seconds(1)) {
-      continue;
-    }
-
-    cout << name << ": ";
-    format_duration(cout, (after - before) / N);
-    cout << "/op [order=" << (int)order << "]"
-         << "\n";
-    break;
-  }
+  bench.run(name, body);
 }
 
 void bench_rotate() {
@@ -79,6 +54,54 @@ void bench_invert() {
   benchmark("invert", [cube]() { cube.invert(); });
 }
 
+// bench_conjugate conjugates a position by all nine search symmetries,
+// with two apply()s each and with a SymmetryTable's fused kernel, full
+// and partial.
+void bench_conjugate() {
+  SymmetryTable table(symmetries);
+  Cube cube = rotations.R.apply(rotations.U).apply(rotations.Finv);
+  benchmark("conjugate-apply", [&]() {
+    for (auto &p : symmetries) {
+      Cube c = p.second.apply(cube.apply(p.first));
+      asm("" ::"x"(c.getEdges()), "x"(c.getCorners()));
+    }
+  });
+  benchmark("conjugate-table", [&]() {
+    for (size_t i = 0; i < table.size(); ++i) {
+      Cube c = table.conjugate(i, cube);
+      asm("" ::"x"(c.getEdges()), "x"(c.getCorners()));
+    }
+  });
+  benchmark("conjugate-partial", [&]() {
+    for (size_t i = 0; i < table.size(); ++i) {
+      auto c = table.partial_conjugate(i, cube);
+      asm("" ::"x"(c.edges), "x"(c.corners));
+    }
+  });
+}
+
+// bench_startup times a fork and exec of this binary with
+// --startup-probe, which exits as soon as main() starts: the cost of
+// loading the binary and running its static initializers.
+void bench_startup() {
+  if (!benchmark_enabled("startup")) {
+    return;
+  }
+  benchmark("startup", []() {
+    pid_t pid = fork();
+    if (pid == 0) {
+      execl("/proc/self/exe", "rubik_bench", "--startup-probe", nullptr);
+      _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      cerr << "startup probe failed\n";
+      abort();
+    }
+  });
+}
+
 void bench_search() {
   Cube superflip = get<Cube>(rubik::from_algorithm(
       "U R2 F B R B2 R U2 L B2 R U' D' R2 F R' L B2 U2 F2"));
@@ -104,20 +127,899 @@ void bench_search() {
       abort();
     }
   });
+
+  SearchOptions prefetch;
+  prefetch.prefetch = true;
+  benchmark("search-14-prefetch", [&]() {
+    if (search(superflip, out, 14, prefetch)) {
+      abort();
+    }
+  });
+
+  // The cost of polling a token that never fires.
+  CancelToken never;
+  SearchOptions cancellable;
+  cancellable.cancel = &never;
+  benchmark("search-14-cancellable", [&]() {
+    if (search(superflip, out, 14, cancellable)) {
+      abort();
+    }
+  });
+}
+
+void bench_parse() {
+  const string superflip =
+      "U R2 F B R B2 R U2 L B2 R U' D' R2 F R' L B2 U2 F2";
+  const string facelets =
+      "WWWWWWWWWGGGRRRBBBOOOGGGRRRBBBOOOGGGRRRBBBOOOYYYYYYYYY";
+  vector<Cube> path{rotations.R,  rotations.U2,   rotations.Finv,
+                    rotations.B,  rotations.L2,   rotations.Dinv,
+                    rotations.R2, rotations.Uinv, rotations.F};
+  string lines;
+  for (int i = 0; i < 1000; ++i) {
+    lines += superflip + "\n";
+  }
+
+  benchmark("parse-algorithm", [&]() {
+    auto c = from_algorithm(superflip);
+    asm("" ::"x"(get<Cube>(c).getEdges()));
+  });
+  benchmark("parse-facelets", [&]() {
+    auto c = from_facelets(facelets);
+    asm("" ::"x"(get<Cube>(c).getEdges()));
+  });
+  benchmark("to-algorithm", [&]() {
+    auto s = to_algorithm(path);
+    asm("" ::"r"(get<string>(s).data()));
+  });
+  benchmark("parse-algorithm-lines-1k", [&]() {
+    auto cubes = from_algorithm_lines(lines);
+    asm("" ::"r"(get<vector<Cube>>(cubes).data()));
+  });
+}
+
+// random_corpus returns `n` positions, each scrambled by a random walk
+// of `moves` steps down the qtm tree. The walk is seeded so that every
+// run benchmarks the same positions.
+vector<Cube> random_corpus(size_t n, int moves) {
+  mt19937 rng(n * 100 + moves);
+  vector<Cube> out;
+  for (size_t i = 0; i < n; ++i) {
+    Cube pos;
+    auto *node = qtm_root;
+    for (int j = 0; j < moves; ++j) {
+      auto &next = (*node)[rng() % node->size()];
+      pos = pos.apply(next.rotation);
+      node = next.next;
+    }
+    out.push_back(pos);
+  }
+  return out;
+}
+
+// optimal_depths returns the length of the shortest solution for each
+// cube in `corpus`.
+vector<int> optimal_depths(const vector<Cube> &corpus) {
+  vector<int> depths;
+  vector<Cube> path;
+  for (auto &pos : corpus) {
+    int depth = 0;
+    while (!search(pos, path, depth)) {
+      ++depth;
+    }
+    depths.push_back(depth);
+  }
+  return depths;
+}
+
+// bench_distributed solves a corpus with a SearchCoordinator and a few
+// numbers of worker processes, against solve() in this process, to
+// weigh the protocol's round trips against the parallelism.
+void bench_distributed() {
+  const int processes[] = {1, 2, 4, 8};
+  auto name = [](int n) { return "distributed-" + to_string(n); };
+  if (!benchmark_enabled("distributed-sequential") &&
+      none_of(begin(processes), end(processes),
+              [&](int n) { return benchmark_enabled(name(n)); })) {
+    return;
+  }
+  auto corpus = random_corpus(8, 14);
+  DistributedOptions opts;
+  opts.search.prefetch = true;
+  benchmark("distributed-sequential", [&]() {
+    for (auto &pos : corpus) {
+      if (!solve(pos, 26, opts.search).solved) {
+        abort();
+      }
+    }
+  });
+  for (int n : processes) {
+    if (!benchmark_enabled(name(n))) {
+      continue;
+    }
+    SearchCoordinator coordinator;
+    for (int i = 0; i < n; ++i) {
+      if (absl::holds_alternative<Error>(
+              coordinator.spawn_worker(opts.search))) {
+        abort();
+      }
+    }
+    benchmark(name(n), [&]() {
+      for (auto &pos : corpus) {
+        auto result = coordinator.solve(pos, 26, opts);
+        if (!absl::holds_alternative<SearchResult>(result) ||
+            !absl::get<SearchResult>(result).solved) {
+          abort();
+        }
+      }
+    });
+  }
+}
+
+// bench_checkpoint solves a corpus with solve() and with
+// solve_resumable(), once with checkpoints too far apart to ever be
+// taken, to price tracking the search's position, and once saving a
+// checkpoint every 10ms.
+void bench_checkpoint() {
+  if (!benchmark_enabled("checkpoint-off") &&
+      !benchmark_enabled("checkpoint-tracking") &&
+      !benchmark_enabled("checkpoint-10ms")) {
+    return;
+  }
+  auto corpus = random_corpus(4, 14);
+  char path[] = "/tmp/rubik_bench_checkpoint_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    abort();
+  }
+  close(fd);
+  unlink(path);
+  auto solve_all = [&](chrono::steady_clock::duration interval) {
+    CheckpointOptions checkpoint;
+    checkpoint.path = path;
+    checkpoint.interval = interval;
+    for (auto &pos : corpus) {
+      auto result = solve_resumable(pos, 26, checkpoint);
+      if (!absl::holds_alternative<SearchResult>(result) ||
+          !absl::get<SearchResult>(result).solved) {
+        abort();
+      }
+    }
+  };
+
+  benchmark("checkpoint-off", [&]() {
+    for (auto &pos : corpus) {
+      if (!solve(pos, 26).solved) {
+        abort();
+      }
+    }
+  });
+  benchmark("checkpoint-tracking", [&]() { solve_all(chrono::hours(24)); });
+  benchmark("checkpoint-10ms",
+            [&]() { solve_all(chrono::milliseconds(10)); });
+  unlink(path);
+}
+
+// bench_moveset solves <R, U> scrambles with the trees derived for a
+// few lengths of history: 0 cuts nothing but repeated moves, 1 makes the
+// qtm tree's cuts and 2 also cuts runs like R R R.
+void bench_moveset() {
+  const int histories[] = {0, 1, 2};
+  auto name = [](int h) { return "moveset-ru-history" + to_string(h); };
+  if (!benchmark_enabled("moveset-parse") &&
+      none_of(begin(histories), end(histories),
+              [&](int h) { return benchmark_enabled(name(h)); })) {
+    return;
+  }
+  benchmark("moveset-parse", [&]() {
+    if (absl::holds_alternative<Error>(MoveSet::parse("R U"))) {
+      abort();
+    }
+  });
+  cout << "# tree states nodes/corpus\n";
+  mt19937 rng(48);
+  const Cube ru[] = {rotations.R, rotations.Rinv, rotations.U,
+                     rotations.Uinv};
+  vector<Cube> corpus(8);
+  for (auto &pos : corpus) {
+    for (int i = 0; i < 30; ++i) {
+      pos = pos.apply(ru[rng() % 4]);
+    }
+  }
+  for (int h : histories) {
+    if (!benchmark_enabled(name(h))) {
+      continue;
+    }
+    auto set = absl::get<MoveSet>(MoveSet::parse("R U", false, h));
+    uint64_t nodes = 0;
+    benchmark(name(h), [&]() {
+      nodes = 0;
+      for (auto &pos : corpus) {
+        auto result = solve_moveset(pos, set, 30);
+        if (!result.solved) {
+          abort();
+        }
+        nodes += result.nodes;
+      }
+    });
+    cout << "# " << name(h) << " " << set.states() << " " << nodes << "\n";
+  }
+}
+
+void bench_encoding() {
+  auto corpus = random_corpus(1024, 30);
+  vector<Cube::Packed> packed(corpus.size());
+  vector<absl::uint128> ranks(corpus.size());
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    packed[i] = corpus[i].pack();
+    ranks[i] = corpus[i].rank();
+  }
+
+  benchmark("pack-1k", [&]() {
+    for (size_t i = 0; i < corpus.size(); ++i) {
+      packed[i] = corpus[i].pack();
+    }
+    asm("" ::"r"(packed.data()) : "memory");
+  });
+  benchmark("unpack-1k", [&]() {
+    for (size_t i = 0; i < corpus.size(); ++i) {
+      corpus[i] = Cube::unpack(packed[i]);
+    }
+    asm("" ::"r"(corpus.data()) : "memory");
+  });
+  benchmark("rank-1k", [&]() {
+    for (size_t i = 0; i < corpus.size(); ++i) {
+      ranks[i] = corpus[i].rank();
+    }
+    asm("" ::"r"(ranks.data()) : "memory");
+  });
+  benchmark("unrank-1k", [&]() {
+    for (size_t i = 0; i < corpus.size(); ++i) {
+      corpus[i] = Cube::unrank(ranks[i]);
+    }
+    asm("" ::"r"(corpus.data()) : "memory");
+  });
+}
+
+void bench_corpus() {
+  if (!benchmark_enabled("corpus-final") &&
+      !benchmark_enabled("corpus-final-ordered") &&
+      !benchmark_enabled("corpus-final-prefetch")) {
+    return;
+  }
+  auto corpus = random_corpus(16, 13);
+  auto depths = optimal_depths(corpus);
+  vector<Cube> out;
+
+  // Time only the final IDDFS iteration, the one that finds a solution.
+  auto final_iteration = [&](const SearchOptions &opts) {
+    for (size_t i = 0; i < corpus.size(); ++i) {
+      if (!search(corpus[i], out, depths[i], opts)) {
+        abort();
+      }
+    }
+  };
+
+  SearchOptions ordered;
+  ordered.order_moves = true;
+  SearchOptions prefetch;
+  prefetch.prefetch = true;
+  benchmark("corpus-final", [&]() { final_iteration(SearchOptions()); });
+  benchmark("corpus-final-ordered", [&]() { final_iteration(ordered); });
+  benchmark("corpus-final-prefetch", [&]() { final_iteration(prefetch); });
+}
+
+// bench_dual solves a corpus with and without dual table lookups and
+// dual search, printing the nodes each visits, to weigh the extra
+// probes per node against the nodes they prune.
+void bench_dual() {
+  const char *names[] = {"dual-none", "dual-lookup", "dual-search"};
+  if (none_of(begin(names), end(names),
+              [](const char *name) { return benchmark_enabled(name); })) {
+    return;
+  }
+  auto corpus = random_corpus(16, 13);
+  cout << "# mode nodes/corpus\n";
+  for (int mode = 0; mode < 3; ++mode) {
+    if (!benchmark_enabled(names[mode])) {
+      continue;
+    }
+    SearchOptions opts;
+    opts.dual_lookup = mode == 1;
+    opts.dual_search = mode == 2;
+    uint64_t nodes = 0;
+    benchmark(names[mode], [&]() {
+      nodes = 0;
+      for (auto &pos : corpus) {
+        auto result = solve(pos, 26, opts);
+        if (!result.solved) {
+          abort();
+        }
+        nodes += result.nodes;
+      }
+    });
+    cout << "# " << names[mode] << " " << nodes << "\n";
+  }
 }
 
+// bench_cascade solves a corpus pruning with the quad table alone, and
+// with a heuristic cascade in its default order and in the order
+// calibrate() picks on another corpus. It prints each cascade's order,
+// and the nodes each of its stages saw and pruned.
+void bench_cascade() {
+  const char *names[] = {"cascade-off", "cascade-default",
+                         "cascade-calibrated"};
+  if (none_of(begin(names), end(names),
+              [](const char *name) { return benchmark_enabled(name); })) {
+    return;
+  }
+  auto corpus = random_corpus(16, 13);
+  HeuristicCascade cascades[2];
+  cascades[1].calibrate(random_corpus(16, 13));
+  cout << "# cascade stage ns/node prune-rate\n";
+  for (int i = 0; i < HeuristicCascade::kStages; ++i) {
+    auto stage = HeuristicCascade::Stage(i);
+    cout << "# calibrate " << HeuristicCascade::name(stage) << " "
+         << cascades[1].costs()[i].ns << " "
+         << cascades[1].costs()[i].prune_rate << "\n";
+  }
+  for (int mode = 0; mode < 3; ++mode) {
+    if (!benchmark_enabled(names[mode])) {
+      continue;
+    }
+    SearchOptions opts;
+    if (mode > 0) {
+      opts.cascade = &cascades[mode - 1];
+    }
+    benchmark(names[mode], [&]() {
+      for (auto &pos : corpus) {
+        if (!solve(pos, 26, opts).solved) {
+          abort();
+        }
+      }
+    });
+    if (mode == 0) {
+      continue;
+    }
+    auto &cascade = cascades[mode - 1];
+    auto stats = cascade.stats();
+    cout << "# cascade stage calls prunes\n";
+    for (auto stage : cascade.order()) {
+      cout << "# " << names[mode] << " " << HeuristicCascade::name(stage)
+           << " " << stats[stage].calls << " " << stats[stage].prunes
+           << "\n";
+    }
+  }
+}
+
+// bench_interleaved solves a corpus with solve_interleaved() at a few
+// interleave widths, against solving it one position at a time with
+// prefetching on, to measure how much of the probes' memory latency
+// the interleaved searches hide.
+void bench_interleaved() {
+  const int widths[] = {1, 4, 8, 16};
+  auto name = [](int width) { return "interleaved-" + to_string(width); };
+  if (!benchmark_enabled("interleaved-sequential") &&
+      none_of(begin(widths), end(widths),
+              [&](int width) { return benchmark_enabled(name(width)); })) {
+    return;
+  }
+  auto corpus = random_corpus(16, 13);
+  SearchOptions opts;
+  opts.prefetch = true;
+  benchmark("interleaved-sequential", [&]() {
+    for (auto &pos : corpus) {
+      if (!solve(pos, 26, opts).solved) {
+        abort();
+      }
+    }
+  });
+  for (int width : widths) {
+    benchmark(name(width), [&]() {
+      for (auto &result : solve_interleaved(corpus, 26, width, opts)) {
+        if (!result.solved) {
+          abort();
+        }
+      }
+    });
+  }
+}
+
+// bench_shorten shortens 1000 random 30-move sequences of face turns
+// with a depth-6 dictionary. Random turns repeat faces and axes often
+// enough to leave something to shorten, much like hand-written
+// algorithms.
+void bench_shorten() {
+  if (!benchmark_enabled("shorten-")) {
+    return;
+  }
+  auto dict = MoveDictionary::build(6);
+  const Cube faces[] = {
+      rotations.R,    rotations.Rinv, rotations.R2, rotations.L,
+      rotations.Linv, rotations.L2,   rotations.F,  rotations.Finv,
+      rotations.F2,   rotations.B,    rotations.Binv, rotations.B2,
+      rotations.U,    rotations.Uinv, rotations.U2, rotations.D,
+      rotations.Dinv, rotations.D2,
+  };
+  mt19937 rng(30);
+  vector<vector<Cube>> corpus(1000);
+  for (auto &seq : corpus) {
+    for (int i = 0; i < 30; ++i) {
+      seq.push_back(faces[rng() % 18]);
+    }
+  }
+  size_t out_moves = 0;
+  auto shorten_all = [&](const MoveDictionary &dict, int window) {
+    out_moves = 0;
+    for (auto &seq : corpus) {
+      out_moves += dict.shorten(seq, window).size();
+    }
+  };
+  benchmark("shorten-1k", [&]() { shorten_all(dict, 0); });
+  cout << "# shorten: " << 30 * corpus.size() << " -> " << out_moves
+       << " moves\n";
+  benchmark("shorten-1k-window8", [&]() { shorten_all(dict, 8); });
+  cout << "# shorten: " << 30 * corpus.size() << " -> " << out_moves
+       << " moves\n";
+
+  // The same dictionary mapped from a file, which gets no huge pages.
+  char path[] = "/tmp/rubik_bench_dict_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return;
+  }
+  close(fd);
+  dict.save(path);
+  auto mapped = MoveDictionary::open(path);
+  unlink(path);
+  if (auto *m = absl::get_if<MoveDictionary>(&mapped)) {
+    benchmark("shorten-1k-mapped", [&]() { shorten_all(*m, 0); });
+  }
+}
+
+string weighted_name(double weight) {
+  char name[32];
+  snprintf(name, sizeof(name), "weighted-%.2f", weight);
+  return name;
+}
+
+// bench_database times AlgorithmDatabase lookups of short cases, exact
+// and up to rotation and AUF, against a depth-6 database it builds in
+// a temporary file.
+void bench_database() {
+  if (!benchmark_enabled("algdb-lookup") &&
+      !benchmark_enabled("algdb-lookup-symmetric")) {
+    return;
+  }
+  char path[] = "/tmp/rubik_bench_algdb_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    abort();
+  }
+  close(fd);
+  if (!absl::holds_alternative<size_t>(AlgorithmDatabase::build(path, 6))) {
+    abort();
+  }
+  auto opened = AlgorithmDatabase::open(path);
+  unlink(path);
+  auto &db = absl::get<AlgorithmDatabase>(opened);
+
+  auto cases = random_corpus(1000, 6);
+  benchmark("algdb-lookup", [&]() {
+    for (auto &pos : cases) {
+      if (db.lookup(pos).empty()) {
+        abort();
+      }
+    }
+  });
+  DatabaseLookupOptions opts;
+  opts.rotations = true;
+  opts.auf = true;
+  benchmark("algdb-lookup-symmetric", [&]() {
+    for (size_t i = 0; i < 10; ++i) {
+      if (db.lookup(cases[i], opts).empty()) {
+        abort();
+      }
+    }
+  });
+}
+
+// bench_store times SolutionStore lookups in a store of 64K solutions
+// that it fills in a temporary file: of stored positions, with 0, 1 and
+// 3 other processes looking positions up in the store meanwhile, and of
+// positions it doesn't hold.
+void bench_store() {
+  const int readers[] = {0, 1, 3};
+  auto name = [](int n) { return "store-lookup-readers" + to_string(n); };
+  if (!benchmark_enabled("store-lookup-miss") &&
+      none_of(begin(readers), end(readers),
+              [&](int n) { return benchmark_enabled(name(n)); })) {
+    return;
+  }
+  char path[] = "/tmp/rubik_bench_store_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    abort();
+  }
+  close(fd);
+  unlink(path);
+  SolutionStoreOptions opts;
+  opts.capacity = 1 << 16;
+  opts.sync = false;
+  auto opened = SolutionStore::open(path, opts);
+  if (!absl::holds_alternative<SolutionStore>(opened)) {
+    abort();
+  }
+  auto &store = absl::get<SolutionStore>(opened);
+
+  // Store scrambles with the inverse of each scramble as its solution.
+  mt19937 rng(50);
+  vector<Cube> stored;
+  while (stored.size() < opts.capacity) {
+    Cube pos;
+    vector<Cube> solution;
+    for (int i = 0; i < 14; ++i) {
+      auto &move = qtm_root->at(rng() % qtm_root->size()).rotation;
+      pos = pos.apply(move);
+      solution.insert(solution.begin(), move.invert());
+    }
+    auto inserted = store.insert(pos, solution);
+    if (!absl::holds_alternative<bool>(inserted)) {
+      abort();
+    }
+    if (absl::get<bool>(inserted)) {
+      stored.push_back(pos);
+    }
+  }
+  auto missing = random_corpus(1024, 20);
+
+  vector<Cube> found;
+  size_t next = 0;
+  for (int n : readers) {
+    if (!benchmark_enabled(name(n))) {
+      continue;
+    }
+    vector<pid_t> children;
+    for (int i = 0; i < n; ++i) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        SolutionStoreOptions read_only;
+        read_only.read_only = true;
+        auto mine = SolutionStore::open(path, read_only);
+        if (!absl::holds_alternative<SolutionStore>(mine)) {
+          _exit(1);
+        }
+        for (size_t j = i;; j = (j + 7919) % stored.size()) {
+          absl::get<SolutionStore>(mine).lookup(stored[j], found);
+        }
+      }
+      if (pid < 0) {
+        abort();
+      }
+      children.push_back(pid);
+    }
+    benchmark(name(n), [&]() {
+      next = (next + 7919) % stored.size();
+      if (!store.lookup(stored[next], found)) {
+        abort();
+      }
+    });
+    for (auto pid : children) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+  }
+  benchmark("store-lookup-miss", [&]() {
+    next = (next + 1) % missing.size();
+    store.lookup(missing[next], found);
+  });
+  unlink(path);
+}
+
+// bench_weighted sweeps the weighted-search weight over a random corpus,
+// timing the corpus at each weight and printing the mean solution
+// length alongside, for picking an operating point.
+void bench_weighted() {
+  vector<double> weights;
+  for (double weight : {1.0, 1.1, 1.25, 1.5, 2.0, 3.0}) {
+    if (benchmark_enabled(weighted_name(weight))) {
+      weights.push_back(weight);
+    }
+  }
+  if (weights.empty()) {
+    return;
+  }
+  auto corpus = random_corpus(16, 12);
+  cout << "# weight moves/solve max-suboptimality nodes/corpus\n";
+  for (double weight : weights) {
+    SearchOptions opts;
+    opts.weight = weight;
+    size_t moves = 0;
+    uint64_t nodes = 0;
+    double worst = 1;
+    benchmark(weighted_name(weight), [&]() {
+      moves = 0;
+      nodes = 0;
+      for (auto &pos : corpus) {
+        auto result = solve(pos, ceil(26 * weight), opts);
+        if (!result.solved) {
+          abort();
+        }
+        moves += result.path.size();
+        nodes += result.nodes;
+        worst = max(worst, result.suboptimality);
+      }
+    });
+    cout << "# " << weight << " " << double(moves) / corpus.size() << " "
+         << worst << " " << nodes << "\n";
+  }
+}
+
+// bench_masked times partial-goal solves of the stages of a
+// layer-by-layer solve, and building the tables for a mask.
+void bench_masked() {
+  if (!benchmark_enabled("masked-tables-f2l") &&
+      !benchmark_enabled("masked-cross") &&
+      !benchmark_enabled("masked-xcross")) {
+    return;
+  }
+  const auto cross = CubeMask::layer(Face::Down).edges();
+  // The cross and one of its corners, with the middle edge beside it.
+  const auto xcross = cross | CubeMask().corner(4).edge(4);
+  const auto f2l = CubeMask::all().without(CubeMask::layer(Face::Up));
+
+  benchmark("masked-tables-f2l", [&]() { MaskedHeuristic h(f2l); });
+
+  auto corpus = random_corpus(16, 20);
+  for (auto &stage : {make_pair("masked-cross", cross),
+                      make_pair("masked-xcross", xcross)}) {
+    MaskedHeuristic::get(stage.second);
+    benchmark(stage.first, [&]() {
+      for (auto &pos : corpus) {
+        if (!solve_masked(pos, stage.second, 20).solved) {
+          abort();
+        }
+      }
+    });
+  }
+}
+
+// bench_pattern enumerates the shortest corner 3-cycles that leave
+// every other piece in its slot (edges may flip), on one thread and on
+// every core.
+void bench_pattern() {
+  if (!benchmark_enabled("pattern-3cycle") &&
+      !benchmark_enabled("pattern-3cycle-parallel")) {
+    return;
+  }
+  // An A permutation cycles three corners.
+  CubePattern from{Cube(), CubeMask::all()};
+  CubePattern to{get<Cube>(from_algorithm("R' F R' B2 R F' R' B2 R2")),
+                 CubeMask::all().corners()};
+  for (int i = 0; i < CubeMask::kEdges; ++i) {
+    to.mask.edge(i, false);
+  }
+  for (int threads : {1, 0}) {
+    string name = threads == 1 ? "pattern-3cycle" : "pattern-3cycle-parallel";
+    if (!benchmark_enabled(name)) {
+      continue;
+    }
+    EnumerateOptions opts;
+    opts.threads = threads;
+    size_t found = 0;
+    benchmark(name, [&]() {
+      found = absl::get<size_t>(enumerate_masked(
+          from, to, 14, [](const vector<Cube> &) { return true; }, opts));
+    });
+    cout << "# " << found << " optimal 3-cycles\n";
+  }
+}
+
+// bench_numa measures pattern-table probes and solves with per-node
+// table replicas. On a single-node host it simulates two nodes, which
+// exercises the same code but should show no difference between them.
+void bench_numa() {
+  if (!benchmark_enabled("numa-")) {
+    return;
+  }
+  auto topo = NumaTopology::detect();
+  bool simulated = topo.nodes.size() == 1;
+  if (simulated) {
+    topo = NumaTopology::simulate(2);
+  }
+  TableReplicas tables(topo);
+  cout << "# numa: " << topo.nodes.size() << " nodes"
+       << (simulated ? " (simulated)" : "") << ", "
+       << (tables.placement() == TableReplicas::Replicated ? "replicated"
+                                                           : "interleaved")
+       << (tables.bound() ? "" : ", unbound") << "\n";
+
+  cpu_set_t saved;
+  sched_getaffinity(0, sizeof(saved), &saved);
+
+  // Probe latency from each node to each replica. Every index depends
+  // on the previous probe, so the probes can't overlap.
+  for (size_t cpu = 0; cpu < topo.nodes.size(); ++cpu) {
+    pin_to_node(topo.nodes[cpu]);
+    for (size_t mem = 0; mem < topo.nodes.size(); ++mem) {
+      auto &table = tables.quad(mem);
+      uint32_t idx = 0;
+      benchmark("numa-probe-cpu" + to_string(cpu) + "-mem" + to_string(mem),
+                [&]() {
+                  idx = (idx * 2654435761u + table[idx] + 1) &
+                        (table.size() - 1);
+                  asm("" ::"r"(idx));
+                });
+    }
+  }
+  sched_setaffinity(0, sizeof(saved), &saved);
+
+  auto corpus = random_corpus(16, 13);
+  auto depths = optimal_depths(corpus);
+  int threads = 0;
+  for (auto &node : topo.nodes) {
+    threads += node.cpus.size();
+  }
+
+  // Solve the corpus's final iterations on one thread per CPU, either
+  // all reading the shared table, or pinned and reading their node's
+  // replica.
+  auto solve_all = [&](bool replicas) {
+    atomic<size_t> next(0);
+    auto worker = [&](int w) {
+      SearchOptions opts;
+      if (replicas) {
+        opts.numa_node = w % topo.nodes.size();
+        opts.tables = &tables;
+        pin_to_node(topo.nodes[opts.numa_node]);
+      }
+      vector<Cube> out;
+      for (size_t i; (i = next.fetch_add(1)) < corpus.size();) {
+        if (!search(corpus[i], out, depths[i], opts)) {
+          abort();
+        }
+      }
+    };
+    vector<thread> pool;
+    for (int i = 0; i < threads; ++i) {
+      pool.emplace_back(worker, i);
+    }
+    for (auto &t : pool) {
+      t.join();
+    }
+  };
+  benchmark("numa-solve-shared", [&]() { solve_all(false); });
+  benchmark("numa-solve-replicated", [&]() { solve_all(true); });
+}
+
+namespace {
+int usage() {
+  cerr << "usage: rubik_bench [--trials=N] [--warmup=N] [--min-time-ms=T]\n"
+          "                   [--no-counters] [--json=FILE]\n"
+          "                   [--baseline=FILE [--threshold=PCT]] [PATTERN]\n";
+  return 2;
+}
+
+// compare_baseline prints each result against the same-named result in
+// `baseline`, and returns the number of regressions.
+int compare_baseline(const vector<BenchResult> &baseline, double threshold) {
+  map<string, const BenchResult *> by_name;
+  for (auto &r : baseline) {
+    by_name[r.name] = &r;
+  }
+  int regressions = 0;
+  cout << "\n# compared to baseline (threshold " << 100 * threshold
+       << "%)\n";
+  for (auto &r : bench.results()) {
+    auto it = by_name.find(r.name);
+    if (it == by_name.end()) {
+      cout << r.name << ": new\n";
+      continue;
+    }
+    auto cmp = compare(*it->second, r, threshold);
+    char ratio[32];
+    snprintf(ratio, sizeof(ratio), "%+.1f%%", 100 * (cmp.ratio - 1));
+    cout << r.name << ": " << format_duration(it->second->ns_per_op.median)
+         << " -> " << format_duration(r.ns_per_op.median) << " " << ratio;
+    if (cmp.verdict == Comparison::Slower) {
+      cout << " REGRESSION";
+      ++regressions;
+    } else if (cmp.verdict == Comparison::Faster) {
+      cout << " faster";
+    }
+    cout << "\n";
+  }
+  return regressions;
+}
+}; // namespace
+
 int main(int argc, char **argv) {
-  if (argc > 1) {
-    try {
-      benchmark_pattern = regex(argv[1]);
-    } catch (regex_error &err) {
-      cerr << "bad pattern: " << err.what() << "\n";
+  if (argc == 2 && string(argv[1]) == "--startup-probe") {
+    return 0;
+  }
+  BenchOptions opts;
+  string json_path, baseline_path;
+  double threshold = 0.05;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i], value;
+    if (flag_value(arg, "--trials=", value)) {
+      opts.trials = atoi(value.c_str());
+    } else if (flag_value(arg, "--warmup=", value)) {
+      opts.warmup = atoi(value.c_str());
+    } else if (flag_value(arg, "--min-time-ms=", value)) {
+      opts.min_time = chrono::milliseconds(atol(value.c_str()));
+    } else if (arg == "--no-counters") {
+      opts.counters = false;
+    } else if (flag_value(arg, "--json=", value)) {
+      json_path = value;
+    } else if (flag_value(arg, "--baseline=", value)) {
+      baseline_path = value;
+    } else if (flag_value(arg, "--threshold=", value)) {
+      threshold = atof(value.c_str()) / 100;
+    } else if (arg.compare(0, 2, "--") == 0 || opts.pattern.has_value()) {
+      return usage();
+    } else {
+      try {
+        opts.pattern = regex(arg);
+      } catch (regex_error &err) {
+        cerr << "bad pattern: " << err.what() << "\n";
+        return 1;
+      }
+    }
+  }
+
+  // Read the baseline first, so that a bad path fails before we spend
+  // minutes benchmarking.
+  vector<BenchResult> baseline;
+  if (!baseline_path.empty()) {
+    ifstream in(baseline_path);
+    if (!in) {
+      cerr << baseline_path << ": can't read\n";
       return 1;
     }
+    stringstream buf;
+    buf << in.rdbuf();
+    auto parsed = results_from_json(buf.str());
+    if (auto err = absl::get_if<Error>(&parsed)) {
+      cerr << baseline_path << ": " << err->error << "\n";
+      return 1;
+    }
+    baseline = absl::get<vector<BenchResult>>(parsed);
   }
+
+  bench = Bench(opts);
+  bench_startup();
   bench_rotate();
   bench_invert();
+  bench_conjugate();
+  bench_parse();
   bench_search();
+  bench_corpus();
+  bench_dual();
+  bench_cascade();
+  bench_interleaved();
+  bench_distributed();
+  bench_checkpoint();
+  bench_moveset();
+  bench_encoding();
+  bench_shorten();
+  bench_database();
+  bench_store();
+  bench_weighted();
+  bench_masked();
+  bench_pattern();
+  bench_numa();
 
+  if (!json_path.empty()) {
+    ofstream out(json_path);
+    out << to_json(bench.results());
+    if (!out) {
+      cerr << json_path << ": write failed\n";
+      return 1;
+    }
+  }
+  if (!baseline_path.empty() && compare_baseline(baseline, threshold) > 0) {
+    return 1;
+  }
   return 0;
 }
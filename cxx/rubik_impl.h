@@ -1,13 +1,55 @@
 #ifndef RUBIK_IMPL_H
 #define RUBIK_IMPL_H
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace rubik {
+class search_moves;
+
 struct search_node {
+  search_node(const Cube &rotation, const search_moves *next)
+      : rotation(rotation), inverse(rotation.invert()), next(next) {}
+  // For constant trees: the node is computed at compile time.
+  constexpr search_node(const CubeBytes &rotation, const search_moves *next)
+      : rotation(rotation), inverse(rotation.invert()), next(next) {}
+
   const Cube rotation;
-  std::vector<search_node> *next;
+  // rotation.invert(), so that searches can update a position's inverse
+  // along with it: the inverse of pos.apply(rotation) is
+  // inverse.apply(pos.invert()).
+  const Cube inverse;
+  const search_moves *next;
+};
+
+// search_moves is the list of moves out of a node of a search tree: a
+// view of an array of search_nodes, which may be constant data (as
+// qtm_root's are) or a vector built at runtime.
+class search_moves {
+public:
+  constexpr search_moves(const search_node *nodes, size_t size)
+      : nodes_(nodes), size_(size) {}
+  search_moves(const std::vector<search_node> &nodes)
+      : nodes_(nodes.data()), size_(nodes.size()) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const search_node *begin() const { return nodes_; }
+  const search_node *end() const { return nodes_ + size_; }
+  const search_node &operator[](size_t i) const { return nodes_[i]; }
+  const search_node &at(size_t i) const {
+    assert(i < size_);
+    return nodes_[i];
+  }
+
+private:
+  const search_node *nodes_;
+  size_t size_;
 };
-extern const std::vector<search_node> *qtm_root;
+
+extern const search_moves *const qtm_root;
 
 union edge_union {
   __m128i mm;
@@ -26,7 +68,7 @@ union corner_union {
 };
 
 template <typename Check, typename Prune, typename Unwind, typename Fail>
-bool search(const Cube &pos, const std::vector<search_node> &moves, int depth,
+bool search(const Cube &pos, const search_moves &moves, int depth,
             const Check &check, const Prune &prune, const Fail &fail,
             const Unwind &unwind) {
   if (check(pos, depth)) {
@@ -50,14 +92,369 @@ bool search(const Cube &pos, const std::vector<search_node> &moves, int depth,
 }
 
 template <typename Check, typename Prune, typename Unwind>
-bool search(const Cube &pos, const std::vector<search_node> &moves, int depth,
+bool search(const Cube &pos, const search_moves &moves, int depth,
             const Check &check, const Prune &prune, const Unwind &unwind) {
   return search(
       pos, moves, depth, check, prune, [&](const Cube &, int) {}, unwind);
 }
 
+// search_all is like search(), but keeps going after the first solution.
+// `path` holds the moves from the root to `pos`. Each time `check`
+// accepts a position we call `found(path)` and don't search below that
+// position; if `found` returns false we stop and return false.
+template <typename Check, typename Prune, typename Found>
+bool search_all(const Cube &pos, const search_moves &moves,
+                int depth, std::vector<Cube> &path, const Check &check,
+                const Prune &prune, const Found &found) {
+  if (check(pos, depth)) {
+    return found(path);
+  }
+  if (depth <= 0) {
+    return true;
+  }
+  if (prune(pos, depth)) {
+    return true;
+  }
+  for (auto &rot : moves) {
+    path.push_back(rot.rotation);
+    bool more = search_all(pos.apply(rot.rotation), *rot.next, depth - 1, path,
+                           check, prune, found);
+    path.pop_back();
+    if (!more) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// resumable_search_all is search_all() that keeps track of where it is,
+// so that it can be stopped and resumed. `at` holds the index of each
+// move on `path` in its node's list of moves, and `visit(at)` is called
+// on entering each node, before `check`.
+//
+// The search starts at the node that [resume, resume_end) names in the
+// same way, as if every node before it in depth-first order had already
+// been searched: on the way down to it, each node skips the children
+// before the one on the path, and isn't visited again.
+template <typename Check, typename Prune, typename Found, typename Visit>
+bool resumable_search_all(const Cube &pos, const search_moves &moves,
+                          int depth, std::vector<Cube> &path,
+                          std::vector<uint8_t> &at, const uint8_t *resume,
+                          const uint8_t *resume_end, const Check &check,
+                          const Prune &prune, const Found &found,
+                          const Visit &visit) {
+  if (resume == resume_end) {
+    visit(at);
+  }
+  if (check(pos, depth)) {
+    return found(path);
+  }
+  if (depth <= 0) {
+    return true;
+  }
+  if (prune(pos, depth)) {
+    return true;
+  }
+  size_t first = resume == resume_end ? 0 : *resume;
+  for (size_t i = first; i < moves.size(); ++i) {
+    bool resuming = resume != resume_end && i == first;
+    path.push_back(moves[i].rotation);
+    at.push_back(i);
+    bool more = resumable_search_all(
+        pos.apply(moves[i].rotation), *moves[i].next, depth - 1, path, at,
+        resuming ? resume + 1 : nullptr, resuming ? resume_end : nullptr,
+        check, prune, found, visit);
+    at.pop_back();
+    path.pop_back();
+    if (!more) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The most children ordered_search, prefetch_search and expand_search
+// will handle at a single node.
+constexpr size_t kMaxBranching = 64;
+
+// ordered_search is a variant of search() that takes a heuristic
+// instead of a prune callback. `h` is the heuristic value of `pos`,
+// computed by our caller. At each node we evaluate `heuristic` once for
+// every child, drop the children that can't reach the goal in the
+// remaining depth, and descend into the rest in ascending order of h,
+// handing each child its already-computed value.
+template <typename Check, typename Heuristic, typename Unwind>
+bool ordered_search(const Cube &pos, const search_moves &moves,
+                    int depth, int h, const Check &check,
+                    const Heuristic &heuristic, const Unwind &unwind) {
+  if (check(pos, depth)) {
+    return true;
+  }
+  if (depth <= 0 || h > depth) {
+    return false;
+  }
+  assert(moves.size() <= kMaxBranching);
+  int hs[kMaxBranching];
+  uint8_t order[kMaxBranching];
+  size_t n = 0;
+  for (size_t i = 0; i < moves.size(); ++i) {
+    int ch = heuristic(pos.apply(moves[i].rotation));
+    if (ch > depth - 1) {
+      continue;
+    }
+    // Insertion sort; ties keep their order in `moves`.
+    size_t j = n++;
+    for (; j > 0 && hs[j - 1] > ch; --j) {
+      hs[j] = hs[j - 1];
+      order[j] = order[j - 1];
+    }
+    hs[j] = ch;
+    order[j] = i;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    auto &rot = moves[order[i]];
+    if (ordered_search(pos.apply(rot.rotation), *rot.next, depth - 1, hs[i],
+                       check, heuristic, unwind)) {
+      unwind(depth, rot.rotation);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Check, typename Heuristic, typename Unwind>
+bool ordered_search(const Cube &pos, const search_moves &moves,
+                    int depth, const Check &check, const Heuristic &heuristic,
+                    const Unwind &unwind) {
+  return ordered_search(pos, moves, depth, heuristic(pos), check, heuristic,
+                        unwind);
+}
+
+// prefetch_search splits pruning into two phases so that the table
+// probes for all of a node's children can be in flight at once.
+// `prepare` maps a position to a key (typically its table indices) and
+// should issue prefetches for whatever memory `prune` will read for that
+// key. We prepare every child before pruning or descending into any of
+// them, so a node pays roughly one memory latency instead of one per
+// child.
+template <typename Check, typename Prepare, typename Prune, typename Unwind>
+bool prefetch_search(const Cube &pos, const search_moves &moves,
+                     int depth, const Check &check, const Prepare &prepare,
+                     const Prune &prune, const Unwind &unwind,
+                     bool root = true) {
+  if (root && prune(prepare(pos), depth)) {
+    return false;
+  }
+  if (check(pos, depth)) {
+    return true;
+  }
+  if (depth <= 0) {
+    return false;
+  }
+  assert(moves.size() <= kMaxBranching);
+  // Keys may hold a Cube, which isn't cheap to default-construct, so we
+  // build them in place for just the children we have.
+  using Key = decltype(prepare(pos));
+  static_assert(std::is_trivially_destructible<Key>::value,
+                "prefetch_search keys are never destroyed");
+  typename std::aligned_storage<sizeof(Key), alignof(Key)>::type
+      storage[kMaxBranching];
+  auto keys = reinterpret_cast<Key *>(storage);
+  for (size_t i = 0; i < moves.size(); ++i) {
+    new (&keys[i]) Key(prepare(pos.apply(moves[i].rotation)));
+  }
+  for (size_t i = 0; i < moves.size(); ++i) {
+    if (prune(keys[i], depth - 1)) {
+      continue;
+    }
+    auto &rot = moves[i];
+    if (prefetch_search(pos.apply(rot.rotation), *rot.next, depth - 1, check,
+                        prepare, prune, unwind, false)) {
+      unwind(depth, rot.rotation);
+      return true;
+    }
+  }
+  return false;
+}
+
+// expand_search is prefetch_search() for keys that a node's children's
+// keys can be derived from more cheaply than from the children's
+// positions. `expand(key, moves, keys, hs)` constructs, in place, the
+// key of the child down each of `moves` from the node with key `key`,
+// issuing prefetches for what `prune` will read; then it stores a cheap
+// lower bound on each child's distance (say, its first table probe) in
+// hs. Each child is then pruned by `prune(key, h, depth)`. Keys hold
+// their position as `pos`; the caller prunes the root.
+template <typename Key, typename Check, typename Expand, typename Prune,
+          typename Unwind>
+bool expand_search(const Key &key, const search_moves &moves,
+                   int depth, const Check &check, const Expand &expand,
+                   const Prune &prune, const Unwind &unwind) {
+  if (check(key.pos, depth)) {
+    return true;
+  }
+  if (depth <= 0) {
+    return false;
+  }
+  assert(moves.size() <= kMaxBranching);
+  static_assert(std::is_trivially_destructible<Key>::value,
+                "expand_search keys are never destroyed");
+  typename std::aligned_storage<sizeof(Key), alignof(Key)>::type
+      storage[kMaxBranching];
+  auto keys = reinterpret_cast<Key *>(storage);
+  int hs[kMaxBranching];
+  expand(key, moves, keys, hs);
+  for (size_t i = 0; i < moves.size(); ++i) {
+    if (prune(keys[i], hs[i], depth - 1)) {
+      continue;
+    }
+    auto &rot = moves[i];
+    if (expand_search(keys[i], *rot.next, depth - 1, check, expand, prune,
+                      unwind)) {
+      unwind(depth, rot.rotation);
+      return true;
+    }
+  }
+  return false;
+}
+
+// stepped_search is prefetch_search() with an explicit stack, so that
+// a caller can advance it one node at a time and interleave several
+// searches on one thread. Each step() prunes the child that the
+// previous step prepared (descending into it if it survives), then
+// prepares the next child and returns. A caller that steps K searches
+// in turn gives each prefetch the time of K - 1 other nodes to land,
+// where prefetch_search can only overlap the probes of one node's
+// children with each other.
+//
+// The callbacks are those of prefetch_search, passed to every call so
+// that they can refer to per-search state the caller keeps alongside.
+// Keys must be default-constructible.
+template <typename Key> class stepped_search {
+public:
+  enum class status { running, found, exhausted };
+
+  // reset starts a search of `pos` to `depth`, discarding any search in
+  // progress. The root is pruned and checked right away, so the search
+  // may already be over.
+  template <typename Check, typename Prepare, typename Prune>
+  status reset(const Cube &pos, const search_moves &moves,
+               int depth, const Check &check, const Prepare &prepare,
+               const Prune &prune) {
+    stack_.clear();
+    path_.clear();
+    depth_ = depth;
+    if (prune(prepare(pos), depth)) {
+      return status_ = status::exhausted;
+    }
+    if (check(pos, depth)) {
+      return status_ = status::found;
+    }
+    if (depth <= 0) {
+      return status_ = status::exhausted;
+    }
+    stack_.push_back(frame{pos, &moves, 0});
+    status_ = status::running;
+    advance(prepare);
+    return status_;
+  }
+
+  // step visits one node and returns the search's status after it.
+  template <typename Check, typename Prepare, typename Prune>
+  status step(const Check &check, const Prepare &prepare,
+              const Prune &prune) {
+    if (status_ != status::running) {
+      return status_;
+    }
+    int depth = depth_ - int(stack_.size());
+    if (!prune(key_, depth)) {
+      if (check(child_, depth)) {
+        path_.push_back(child_node_->rotation);
+        return status_ = status::found;
+      }
+      if (depth > 0) {
+        stack_.push_back(frame{child_, child_node_->next, 0});
+        path_.push_back(child_node_->rotation);
+      }
+    }
+    advance(prepare);
+    return status_;
+  }
+
+  status state() const { return status_; }
+  // The moves from the root to the solution, once the search has
+  // found one.
+  const std::vector<Cube> &path() const { return path_; }
+
+private:
+  struct frame {
+    Cube pos;
+    const search_moves *moves;
+    size_t next;
+  };
+
+  // advance prepares the next child to visit, popping the nodes whose
+  // children are all done.
+  template <typename Prepare> void advance(const Prepare &prepare) {
+    while (!stack_.empty()) {
+      auto &top = stack_.back();
+      if (top.next < top.moves->size()) {
+        child_node_ = &(*top.moves)[top.next++];
+        child_ = top.pos.apply(child_node_->rotation);
+        key_ = prepare(child_);
+        return;
+      }
+      stack_.pop_back();
+      if (!path_.empty()) {
+        path_.pop_back();
+      }
+    }
+    status_ = status::exhausted;
+  }
+
+  // stack_[i] is the node i moves below the root, reached by path_[i -
+  // 1]; the child being visited is one below the top.
+  std::vector<frame> stack_;
+  std::vector<Cube> path_;
+  int depth_ = 0;
+  status status_ = status::exhausted;
+  const search_node *child_node_ = nullptr;
+  Cube child_;
+  Key key_;
+};
+
+// cancel_poll lets a search check a CancelToken without paying for a
+// clock read at every node. Call visit() once per node, and stop()
+// from the prune callback: it polls the token once every
+// kCancelInterval visits, and after the token fires it keeps returning
+// true so that the search unwinds.
+class cancel_poll {
+  static constexpr uint64_t kCancelInterval = 4096;
+
+  const CancelToken *token_;
+  uint64_t nodes_ = 0;
+  uint64_t next_poll_ = kCancelInterval;
+  bool stopped_ = false;
+
+public:
+  explicit cancel_poll(const CancelToken *token) : token_(token) {
+    stopped_ = token_ != nullptr && token_->cancelled();
+  }
+
+  void visit() { ++nodes_; }
+  bool stop() {
+    if (nodes_ >= next_poll_) {
+      next_poll_ = nodes_ + kCancelInterval;
+      stopped_ = stopped_ || (token_ != nullptr && token_->cancelled());
+    }
+    return stopped_;
+  }
+  bool stopped() const { return stopped_; }
+  uint64_t nodes() const { return nodes_; }
+};
+
 template <typename Visit>
-void search(const Cube &pos, const std::vector<search_node> &moves, int depth,
+void search(const Cube &pos, const search_moves &moves, int depth,
             const Visit &visit) {
   search(
       pos, moves, depth,
@@ -68,7 +465,7 @@ void search(const Cube &pos, const std::vector<search_node> &moves, int depth,
       [&](const Cube &, int) { return false; }, [&](int, const Cube &) {});
 }
 
-extern const std::vector<std::pair<Cube, Cube>> symmetries;
+extern const std::array<std::pair<Cube, Cube>, 9> symmetries;
 
 constexpr bool debug_mode =
 #ifdef NDEBUG
@@ -8,6 +8,7 @@
 #include <smmintrin.h>
 #include <tmmintrin.h>
 
+#include "mask.h"
 #include "rubik.h"
 #include "rubik_impl.h"
 #include "tables.h"
@@ -85,7 +86,7 @@ int quad_heuristic(const Cube &pos) {
   cu.mm = inv.getCorners();
   int d = rubik::quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
                              (cu.arr[0] << 5) | (cu.arr[1])];
-  assert(d >= 0);
+  assert(d != kUnknownDist);
   for (auto &p : symmetries) {
     auto c = p.second.apply(inv.apply(p.first));
     eu.mm = c.getEdges();
@@ -165,59 +166,13 @@ void search_two() {
   auto superflip = get<Cube>(rubik::from_algorithm(
       "U R2 F B R B2 R U2 L B2 R U' D' R2 F R' L B2 U2 F2"));
 
-  const auto edge_mask =
-      _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff);
-  const auto corner_mask =
-      _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff);
-
-  for (int depth = 0; depth < 15; ++depth) {
-    vector<Cube> path;
-    bool ok = search(
-        superflip, *qtm_root, depth,
-        [&](const Cube &pos, int) {
-          return _mm_test_all_zeros(
-              _mm_or_si128(
-                  _mm_and_si128(edge_mask, _mm_xor_si128(pos.getEdges(),
-                                                         solved.getEdges())),
-                  _mm_and_si128(
-                      corner_mask,
-                      _mm_xor_si128(pos.getCorners(), solved.getCorners()))),
-              _mm_set_epi32(0, 0xffffffff, 0xffffffff, 0xffffffff));
-        },
-        [&](const Cube &pos, int depth) {
-          auto inv = pos.invert();
-          edge_union eu;
-          corner_union cu;
-          eu.mm = inv.getEdges();
-          cu.mm = inv.getCorners();
-          int d = rubik::quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
-                                     (cu.arr[0] << 5) | (cu.arr[1])];
-          assert(d >= 0);
-          if (d > depth) {
-            return true;
-          }
-          for (auto &p : topSymmetries) {
-            auto c = p.second.apply(inv.apply(p.first));
-            eu.mm = c.getEdges();
-            cu.mm = c.getCorners();
-            auto d = rubik::quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
-                                        (cu.arr[0] << 5) | (cu.arr[1])];
-            if (d > depth) {
-              return true;
-            }
-          }
-          return false;
-        },
-        [&](int, const Cube &rot) { path.push_back(rot); });
-    if (!ok) {
-      cout << "depth=" << depth << ": no\n";
-    } else {
-      reverse(path.begin(), path.end());
-      cout << "depth=" << depth << ": yes: " << get<string>(to_algorithm(path))
-           << "\n";
-      return;
-    }
+  auto result = solve_masked(superflip, CubeMask::layer(Face::Up), 14);
+  if (!result.solved) {
+    cout << "no solution within 14 moves\n";
+    return;
   }
+  cout << "depth=" << result.path.size()
+       << ": yes: " << get<string>(to_algorithm(result.path)) << "\n";
 }
 
 int main() {
@@ -1,14 +1,44 @@
 #include "catch/catch.hpp"
 
+#include "bench.h"
+#include "cascade.h"
+#include "checkpoint.h"
+#include "database.h"
+#include "dictionary.h"
+#include "distributed.h"
+#include "mask.h"
+#include "moveset.h"
+#include "numa.h"
 #include "rubik.h"
 #include "rubik_impl.h"
+#include "store.h"
+#include "symmetry.h"
+#include "tables.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "absl/hash/hash.h"
+
 using namespace rubik;
 using namespace std;
 
@@ -21,6 +51,20 @@ struct {
     {"L", rotations.L}, {"R", rotations.R}, {"U", rotations.U},
     {"D", rotations.D}, {"F", rotations.F}, {"B", rotations.B},
 };
+
+// scramble returns the position that `n` random moves of `moves`,
+// drawn with `rng`, take the solved cube to; by default the moves are
+// quarter turns.
+template <typename Moves>
+Cube scramble(mt19937 &rng, int n, const Moves &moves) {
+  Cube pos;
+  for (int i = 0; i < n; ++i) {
+    pos = pos.apply(moves[rng() % moves.size()].rotation);
+  }
+  return pos;
+}
+
+Cube scramble(mt19937 &rng, int n) { return scramble(rng, n, *qtm_root); }
 }; // namespace
 
 TEST_CASE("Default cube is constructible", "[rubik]") { Cube cube; }
@@ -69,7 +113,87 @@ TEST_CASE("from_facelets", "[rubik]") {
   CHECK(get<Cube>(c) == Cube());
 }
 
-const rubik::search_node *find_node(const std::vector<search_node> *nodes,
+TEST_CASE("from_algorithm", "[rubik]") {
+  vector<pair<string, Cube>> names = {
+      {"R", rotations.R}, {"R'", rotations.Rinv}, {"R2", rotations.R2},
+      {"L", rotations.L}, {"L'", rotations.Linv}, {"L2", rotations.L2},
+      {"F", rotations.F}, {"F'", rotations.Finv}, {"F2", rotations.F2},
+      {"B", rotations.B}, {"B'", rotations.Binv}, {"B2", rotations.B2},
+      {"U", rotations.U}, {"U'", rotations.Uinv}, {"U2", rotations.U2},
+      {"D", rotations.D}, {"D'", rotations.Dinv}, {"D2", rotations.D2},
+  };
+  for (auto &ent : names) {
+    INFO("move: " << ent.first);
+    auto c = from_algorithm(ent.first);
+    REQUIRE(absl::holds_alternative<Cube>(c));
+    CHECK(get<Cube>(c) == ent.second);
+    CHECK(get<string>(to_algorithm({ent.second})) == ent.first);
+  }
+
+  CHECK(get<Cube>(from_algorithm("")) == Cube());
+  CHECK(get<Cube>(from_algorithm("  R  U ")) ==
+        rotations.R.apply(rotations.U));
+  for (auto bad : {"X", "R3", "R''", "RU", "r"}) {
+    INFO("bad: " << bad);
+    auto c = from_algorithm(bad);
+    REQUIRE(absl::holds_alternative<Error>(c));
+    CHECK(get<Error>(c).error == string("unknown move: ") + bad);
+  }
+  CHECK(absl::holds_alternative<Error>(to_algorithm({superflip()})));
+
+  auto lines = from_algorithm_lines("R U\n\nF' D2\r\n");
+  REQUIRE(absl::holds_alternative<vector<Cube>>(lines));
+  CHECK(get<vector<Cube>>(lines) ==
+        (vector<Cube>{rotations.R.apply(rotations.U), Cube(),
+                      rotations.Finv.apply(rotations.D2)}));
+  auto bad = from_algorithm_lines("R U\nR X\n");
+  REQUIRE(absl::holds_alternative<Error>(bad));
+  CHECK(get<Error>(bad).error == "line 2: unknown move: X");
+
+  auto facelets = from_facelets_lines(
+      "WWWWWWWWWGGGRRRBBBOOOGGGRRRBBBOOOGGGRRRBBBOOOYYYYYYYYY\r\n"
+      "WWWWWWWWWGGGRRRBBBOOOGGGRRRBBBOOOGGGRRRBBBOOOYYYYYYYYY\n");
+  REQUIRE(absl::holds_alternative<vector<Cube>>(facelets));
+  CHECK(get<vector<Cube>>(facelets) == (vector<Cube>{Cube(), Cube()}));
+}
+
+TEST_CASE("Cube encodings", "[rubik]") {
+  CHECK(Cube().rank() == 0);
+  CHECK(Cube::unrank(0) == Cube());
+  auto last = Cube::unrank(kCubeStates - 1);
+  CHECK(last.rank() == kCubeStates - 1);
+  CHECK(Cube::unpack(superflip().pack()) == superflip());
+  CHECK(Cube::unrank(superflip().rank()) == superflip());
+
+  for (int i = 0; i < 1000; ++i) {
+    absl::uint128 rank = kCubeStates / 1000 * i + i;
+    INFO("rank " << i);
+    CHECK(Cube::unrank(rank).rank() == rank);
+  }
+
+  map<absl::uint128, Cube> ranks;
+  search(Cube(), *qtm_root, 4, [&](const Cube &pos, int) {
+    CHECK(Cube::unpack(pos.pack()) == pos);
+    auto rank = pos.rank();
+    CHECK(rank < kCubeStates);
+    CHECK(Cube::unrank(rank) == pos);
+    auto coords = pos.coordinates();
+    CHECK(Cube::from_coordinates(coords) == pos);
+
+    auto ins = ranks.emplace(rank, pos);
+    if (!ins.second) {
+      CHECK(ins.first->second == pos);
+    }
+  });
+  for (auto it = ranks.begin(); it != ranks.end(); ++it) {
+    auto next = std::next(it);
+    if (next != ranks.end()) {
+      CHECK(it->second != next->second);
+    }
+  }
+}
+
+const rubik::search_node *find_node(const search_moves *nodes,
                                     const Cube &rot) {
   auto fnd = find_if(nodes->begin(), nodes->end(),
                      [&](auto &node) { return node.rotation == rot; });
@@ -114,6 +238,77 @@ TEST_CASE("qtm_tree", "[rubik]") {
   }
 }
 
+TEST_CASE("Constant move tables", "[rubik]") {
+  struct {
+    Cube rot, rot2, inv;
+  } faces[] = {
+      {rotations.L, rotations.L2, rotations.Linv},
+      {rotations.R, rotations.R2, rotations.Rinv},
+      {rotations.U, rotations.U2, rotations.Uinv},
+      {rotations.D, rotations.D2, rotations.Dinv},
+      {rotations.F, rotations.F2, rotations.Finv},
+      {rotations.B, rotations.B2, rotations.Binv},
+  };
+  for (auto &f : faces) {
+    CHECK(f.rot2 == f.rot.apply(f.rot));
+    CHECK(f.inv == f.rot.invert());
+  }
+
+  SECTION("qtm tree") {
+    // The tree leaves out M M', M' M' and, for each pair of opposite
+    // faces, turns of the second face after turns of the first.
+    const pair<Cube, Cube> opposite[] = {
+        {rotations.L, rotations.R},
+        {rotations.U, rotations.D},
+        {rotations.F, rotations.B},
+    };
+    auto same_face = [](const Cube &a, const Cube &b) {
+      return a == b || a == b.invert();
+    };
+    REQUIRE(qtm_root->size() == 12);
+    for (auto &node : *qtm_root) {
+      CHECK(node.inverse == node.rotation.invert());
+      bool fwd = any_of(begin(faces), end(faces),
+                        [&](auto &f) { return f.rot == node.rotation; });
+      for (auto &next : *qtm_root) {
+        bool want = next.rotation != node.inverse &&
+                    (fwd || next.rotation != node.rotation);
+        for (auto &o : opposite) {
+          if (same_face(node.rotation, o.first) &&
+              same_face(next.rotation, o.second)) {
+            want = false;
+          }
+        }
+        auto got = find_node(node.next, next.rotation);
+        CHECK((got != nullptr) == want);
+        if (got != nullptr) {
+          CHECK(got->next == next.next);
+        }
+      }
+    }
+  }
+
+  SECTION("symmetries") {
+    auto parse = [](const char *facelets) {
+      return get<Cube>(from_facelets(facelets));
+    };
+    Cube axes[] = {
+        parse("GGGGWGGGGYYYRRRWWWOOOYGYRRRWBWOOOYYYRRRWWWOOOBBBBYBBBB"),
+        parse("RRRRWRRRRGGGYYYBBBWWWGGGYRYBBBWOWGGGYYYBBBWWWOOOOYOOOO"),
+        parse("WWWWWWWWWOOOGGGRRRBBBOGOGRGRBRBOBOOOGGGRRRBBBYYYYYYYYY"),
+    };
+    REQUIRE(symmetries.size() == 9);
+    for (int a = 0; a < 3; ++a) {
+      Cube want[] = {axes[a], axes[a].apply(axes[a]), axes[a].invert()};
+      for (int i = 0; i < 3; ++i) {
+        auto &sym = symmetries[3 * a + i];
+        CHECK(sym.first == want[i]);
+        CHECK(sym.second == want[i].invert());
+      }
+    }
+  }
+}
+
 TEST_CASE("Search", "[rubik]") {
   struct {
     string in;
@@ -179,6 +374,461 @@ TEST_CASE("Search", "[rubik]") {
   }
 }
 
+TEST_CASE("Search options", "[rubik]") {
+  struct {
+    string name;
+    SearchOptions opts;
+  } variants[3];
+  variants[0].name = "order_moves";
+  variants[0].opts.order_moves = true;
+  variants[1].name = "prefetch";
+  variants[1].opts.prefetch = true;
+  variants[2].name = "order_moves+prefetch";
+  variants[2].opts.order_moves = true;
+  variants[2].opts.prefetch = true;
+
+  for (auto &v : variants) {
+    for (auto alg : {"R", "R U", "R U' B", "R L", "R2", "F R U' B2 D"}) {
+      INFO(v.name << ": search(\"" << alg << "\")");
+      Cube in = get<Cube>(from_algorithm(alg));
+      for (int depth = 0; depth <= 8; ++depth) {
+        vector<Cube> plain, path;
+        bool ok = search(in, plain, depth);
+        REQUIRE(search(in, path, depth, v.opts) == ok);
+        if (!ok) {
+          continue;
+        }
+        Cube out = in;
+        for (auto &rot : path) {
+          out = out.apply(rot);
+        }
+        CHECK(out == Cube());
+        CHECK(path.size() == plain.size());
+        break;
+      }
+    }
+  }
+}
+
+TEST_CASE("solve", "[rubik]") {
+  for (auto alg : {"", "R", "R U' B", "F R U' B2 D"}) {
+    INFO("solve(\"" << alg << "\")");
+    Cube in = get<Cube>(from_algorithm(alg));
+    vector<Cube> path;
+    int optimal = 0;
+    while (!search(in, path, optimal)) {
+      ++optimal;
+    }
+    auto result = solve(in, 12);
+    REQUIRE(result.solved);
+    CHECK(!result.cancelled);
+    CHECK(result.path.size() == (size_t)optimal);
+    CHECK(result.lower_bound == optimal);
+    CHECK(result.nodes > 0);
+    Cube out = in;
+    for (auto &rot : result.path) {
+      out = out.apply(rot);
+    }
+    CHECK(out == Cube());
+  }
+
+  SECTION("weighted") {
+    for (auto alg : {"F R U' B2 D", "R2 L2 U2 D2 F2 B2", "L U' F2 R D' B L2"}) {
+      Cube in = get<Cube>(from_algorithm(alg));
+      auto optimal = solve(in, 16);
+      REQUIRE(optimal.solved);
+      for (double weight : {1.0, 1.2, 1.5, 2.0, 4.0}) {
+        INFO("solve(\"" << alg << "\"), weight=" << weight);
+        SearchOptions opts;
+        opts.weight = weight;
+        // Weighted searches start deepening at w times the heuristic
+        // bound, so max_depth needs room for that.
+        auto result = solve(in, 64, opts);
+        REQUIRE(result.solved);
+        Cube out = in;
+        for (auto &rot : result.path) {
+          out = out.apply(rot);
+        }
+        CHECK(out == Cube());
+        CHECK(result.path.size() <= ceil(weight * optimal.path.size()));
+        CHECK(result.lower_bound <= (int)optimal.path.size());
+        CHECK(result.suboptimality ==
+              double(result.path.size()) / result.lower_bound);
+        if (weight == 1.0) {
+          CHECK(result.path == optimal.path);
+        }
+      }
+    }
+  }
+
+  SECTION("dual") {
+    mt19937 rng(41);
+    int inverted = 0;
+    for (int trial = 0; trial < 20; ++trial) {
+      Cube in = scramble(rng, 9);
+      auto plain = solve(in, 12);
+      REQUIRE(plain.solved);
+      CHECK(!plain.inverse);
+      SearchOptions dual_lookup;
+      dual_lookup.dual_lookup = true;
+      SearchOptions dual_search;
+      dual_search.dual_search = true;
+      for (auto &opts : {dual_lookup, dual_search}) {
+        INFO("trial " << trial << ", dual_lookup=" << opts.dual_lookup);
+        auto result = solve(in, 12, opts);
+        REQUIRE(result.solved);
+        CHECK(result.path.size() == plain.path.size());
+        Cube out = in;
+        for (auto &rot : result.path) {
+          out = out.apply(rot);
+        }
+        CHECK(out == Cube());
+        CHECK(result.lower_bound >= plain.lower_bound);
+        if (opts.dual_lookup) {
+          // Every node the dual search visits, the plain one does too.
+          CHECK(result.nodes <= plain.nodes);
+          CHECK(!result.inverse);
+        }
+        inverted += result.inverse;
+      }
+    }
+    CHECK(inverted > 0);
+  }
+
+  SECTION("interleaved") {
+    mt19937 rng(42);
+    vector<Cube> starts{Cube(), rotations.R};
+    for (int trial = 0; trial < 11; ++trial) {
+      starts.push_back(scramble(rng, 9));
+    }
+    for (auto weight : {1.0, 1.5}) {
+      SearchOptions opts;
+      opts.prefetch = true;
+      opts.weight = weight;
+      vector<SearchResult> expected;
+      for (auto &start : starts) {
+        expected.push_back(solve(start, 14, opts));
+      }
+      for (int interleave : {1, 3, 8, 32}) {
+        INFO("weight=" << weight << ", interleave=" << interleave);
+        auto results = solve_interleaved(starts, 14, interleave, opts);
+        REQUIRE(results.size() == starts.size());
+        for (size_t i = 0; i < starts.size(); ++i) {
+          INFO("start " << i);
+          CHECK(results[i].solved == expected[i].solved);
+          CHECK(results[i].path == expected[i].path);
+          CHECK(results[i].lower_bound == expected[i].lower_bound);
+          CHECK(results[i].nodes == expected[i].nodes);
+          CHECK(!results[i].cancelled);
+        }
+      }
+    }
+
+    auto shallow = solve_interleaved(
+        {get<Cube>(from_algorithm("F R U' B2 D")), rotations.R}, 5, 2);
+    CHECK(!shallow[0].solved);
+    CHECK(shallow[0].lower_bound == 6);
+    CHECK(shallow[1].solved);
+
+    CancelToken token;
+    token.cancel();
+    SearchOptions cancelled;
+    cancelled.cancel = &token;
+    for (auto &result : solve_interleaved(starts, 14, 4, cancelled)) {
+      CHECK(!result.solved);
+      CHECK(result.cancelled);
+    }
+  }
+
+  SECTION("max_depth") {
+    auto result = solve(get<Cube>(from_algorithm("F R U' B2 D")), 5);
+    CHECK(!result.solved);
+    CHECK(!result.cancelled);
+    CHECK(result.lower_bound == 6);
+  }
+
+  SECTION("cancelled") {
+    CancelToken token;
+    token.cancel();
+    SearchOptions opts;
+    opts.cancel = &token;
+    vector<Cube> path;
+    CHECK(!search(rotations.R, path, 1, opts));
+    auto result = solve(rotations.R, 12, opts);
+    CHECK(!result.solved);
+    CHECK(result.cancelled);
+    CHECK(result.path.empty());
+
+    EnumerateOptions enumerate_opts;
+    enumerate_opts.cancel = &token;
+    size_t n = enumerate_solutions(
+        rotations.R, 12, [](const vector<Cube> &) { return true; },
+        enumerate_opts);
+    CHECK(n == 0);
+  }
+
+  SECTION("deadline") {
+    auto token = CancelToken::after(chrono::milliseconds(20));
+    for (auto order : {false, true}) {
+      SearchOptions opts;
+      opts.cancel = &token;
+      opts.order_moves = order;
+      auto start = chrono::steady_clock::now();
+      auto result = solve(superflip(), 24, opts);
+      auto elapsed = chrono::steady_clock::now() - start;
+      CHECK(!result.solved);
+      CHECK(result.cancelled);
+      CHECK(result.lower_bound >= 6);
+      CHECK(result.lower_bound <= 24);
+      CHECK(result.nodes > 0);
+      CHECK(elapsed < chrono::seconds(2));
+    }
+  }
+
+  SECTION("cancelled from another thread") {
+    CancelToken token;
+    SearchOptions opts;
+    opts.cancel = &token;
+    opts.prefetch = true;
+    thread canceller([&] {
+      this_thread::sleep_for(chrono::milliseconds(20));
+      token.cancel();
+    });
+    auto result = solve(superflip(), 24, opts);
+    canceller.join();
+    CHECK(result.cancelled);
+  }
+}
+
+TEST_CASE("SymmetryTable", "[rubik]") {
+  SymmetryTable table(symmetries);
+  REQUIRE(table.size() == symmetries.size());
+  mt19937 rng(44);
+  for (int trial = 0; trial < 100; ++trial) {
+    Cube c = scramble(rng, 20);
+    for (size_t i = 0; i < table.size(); ++i) {
+      INFO("trial " << trial << ", symmetry " << i);
+      auto &p = symmetries[i];
+      Cube want = p.second.apply(c.apply(p.first));
+      CHECK(table.conjugate(i, c) == want);
+      auto partial = table.partial_conjugate(i, c);
+      edge_union pe, we;
+      corner_union pc, wc;
+      pe.mm = partial.edges;
+      pc.mm = partial.corners;
+      we.mm = want.getEdges();
+      wc.mm = want.getCorners();
+      CHECK(pe.arr == we.arr);
+      CHECK(pc.arr == wc.arr);
+    }
+  }
+}
+
+TEST_CASE("enumerate_solutions", "[rubik]") {
+  auto solves = [](Cube pos, const vector<Cube> &path) {
+    for (auto &rot : path) {
+      pos = pos.apply(rot);
+    }
+    return pos == Cube();
+  };
+
+  struct {
+    string alg;
+    size_t min_solutions;
+  } tests[] = {
+      {"R", 1},
+      {"R L", 1},
+      {"R2", 1},
+      {"F R U' B2 D", 1},
+      // The checkerboard pattern has many optimal solutions.
+      {"R2 L2 U2 D2 F2 B2", 2},
+  };
+  for (auto &tc : tests) {
+    INFO("enumerate_solutions(\"" << tc.alg << "\")");
+    Cube in = get<Cube>(from_algorithm(tc.alg));
+
+    vector<vector<Cube>> serial;
+    enumerate_solutions(in, 12, [&](const vector<Cube> &path) {
+      serial.push_back(path);
+      return true;
+    });
+    REQUIRE(serial.size() >= tc.min_solutions);
+    for (auto &path : serial) {
+      CHECK(solves(in, path));
+      CHECK(path.size() == serial.front().size());
+    }
+    vector<Cube> first;
+    int optimal = 0;
+    while (!search(in, first, optimal)) {
+      ++optimal;
+    }
+    CHECK(serial.front().size() == (size_t)optimal);
+    for (auto &p1 : serial) {
+      for (auto &p2 : serial) {
+        if (&p1 != &p2) {
+          CHECK(p1 != p2);
+        }
+      }
+    }
+
+    EnumerateOptions opts;
+    opts.threads = 4;
+    opts.ordered = true;
+    vector<vector<Cube>> ordered;
+    enumerate_solutions(
+        in, 12,
+        [&](const vector<Cube> &path) {
+          ordered.push_back(path);
+          return true;
+        },
+        opts);
+    CHECK(ordered == serial);
+
+    opts.ordered = false;
+    vector<vector<Cube>> unordered;
+    size_t n = enumerate_solutions(
+        in, 12,
+        [&](const vector<Cube> &path) {
+          unordered.push_back(path);
+          return true;
+        },
+        opts);
+    CHECK(n == serial.size());
+    for (auto &path : unordered) {
+      CHECK(find(serial.begin(), serial.end(), path) != serial.end());
+    }
+  }
+
+  SECTION("all solutions up to max_depth") {
+    Cube in = rotations.R;
+    EnumerateOptions opts;
+    opts.optimal_only = false;
+    size_t longer = 0;
+    enumerate_solutions(
+        in, 5,
+        [&](const vector<Cube> &path) {
+          CHECK(solves(in, path));
+          for (size_t i = 1; i < path.size(); ++i) {
+            CHECK(!solves(in, vector<Cube>(path.begin(), path.begin() + i)));
+          }
+          if (path.size() > 1) {
+            ++longer;
+          }
+          return true;
+        },
+        opts);
+    CHECK(longer > 0);
+
+    // Dual lookups prune more, but never a solution.
+    auto all = enumerate_solutions(
+        in, 5, [](const vector<Cube> &) { return true; }, opts);
+    opts.dual_lookup = true;
+    CHECK(enumerate_solutions(
+              in, 5, [](const vector<Cube> &) { return true; }, opts) == all);
+  }
+
+  SECTION("stop early") {
+    Cube in = get<Cube>(from_algorithm("R2 L2 U2 D2 F2 B2"));
+    for (int threads : {1, 4}) {
+      EnumerateOptions opts;
+      opts.threads = threads;
+      size_t calls = 0;
+      size_t n = enumerate_solutions(
+          in, 12,
+          [&](const vector<Cube> &) {
+            ++calls;
+            return false;
+          },
+          opts);
+      CHECK(calls == 1);
+      CHECK(n == 1);
+    }
+  }
+}
+
+TEST_CASE("PackedDistTable", "[rubik]") {
+  PackedDistTable<7> table;
+  table.packed.fill(0xff);
+  for (size_t i = 0; i < table.size(); ++i) {
+    CHECK(table[i] == kUnknownDist);
+  }
+  for (size_t i = 0; i < table.size(); ++i) {
+    table.set(i, i * 2);
+  }
+  for (size_t i = 0; i < table.size(); ++i) {
+    CHECK(table[i] == (int)i * 2);
+  }
+  table.set(3, 0);
+  CHECK(table[2] == 4);
+  CHECK(table[3] == 0);
+  CHECK(table[4] == 8);
+
+  // The solved cube has edges 0, 1 and corners 0, 1 in place.
+  CHECK(quad01_dist[(0 << 15) | (1 << 10) | (0 << 5) | 1] == 0);
+  CHECK(pair0_dist[0] == 0);
+}
+
+TEST_CASE("NUMA table replicas", "[rubik]") {
+  auto topo = NumaTopology::simulate(3);
+  REQUIRE(topo.nodes.size() == 3);
+  for (auto &node : topo.nodes) {
+    CHECK(node.id == -1);
+    CHECK(!node.cpus.empty());
+  }
+  CHECK(topo.node_of_cpu(topo.nodes[0].cpus.front()) == 0);
+
+  auto same_table = [](const QuadTable &table) {
+    return memcmp(&table, &quad01_dist, sizeof(table)) == 0;
+  };
+
+  SECTION("replicated") {
+    TableReplicas tables(topo);
+    CHECK(tables.placement() == TableReplicas::Replicated);
+    CHECK(!tables.bound());
+    for (int node = 0; node < 3; ++node) {
+      CHECK(same_table(tables.quad(node)));
+      CHECK(&tables.quad(node) != &quad01_dist);
+    }
+    CHECK(&tables.quad(0) != &tables.quad(1));
+
+    Cube in = get<Cube>(from_algorithm("F R U' B2 D"));
+    vector<Cube> plain;
+    REQUIRE(search(in, plain, 7));
+    for (int node = -1; node < 5; ++node) {
+      SearchOptions opts;
+      opts.tables = &tables;
+      opts.numa_node = node;
+      vector<Cube> path;
+      REQUIRE(search(in, path, 7, opts));
+      CHECK(path == plain);
+    }
+
+    EnumerateOptions opts;
+    size_t serial = enumerate_solutions(
+        in, 12, [](const vector<Cube> &) { return true; }, opts);
+    opts.threads = 4;
+    opts.tables = &tables;
+    CHECK(enumerate_solutions(
+              in, 12, [](const vector<Cube> &) { return true; }, opts) ==
+          serial);
+  }
+
+  SECTION("falls back to interleaving without room for replicas") {
+    topo.nodes[1].free_bytes = sizeof(QuadTable) / 2;
+    TableReplicas tables(topo);
+    CHECK(tables.placement() == TableReplicas::Interleaved);
+    CHECK(same_table(tables.quad(0)));
+    CHECK(&tables.quad(0) == &tables.quad(2));
+  }
+
+  SECTION("detect") {
+    auto detected = NumaTopology::detect();
+    REQUIRE(!detected.nodes.empty());
+    TableReplicas tables(detected, TableReplicas::Interleaved);
+    CHECK(same_table(tables.quad(0)));
+  }
+}
+
 /*
   Sadly, this requires googletest
 
@@ -191,3 +841,1331 @@ TEST_CASE("Hashing", "[rubik]") {
     }));
 }
 */
+
+TEST_CASE("Benchmark statistics", "[bench]") {
+  SECTION("estimate") {
+    auto est = estimate({5, 1, 4, 2, 3});
+    REQUIRE(est.median == 3);
+    REQUIRE(est.mad == 1);
+    REQUIRE(est.ci_low == 1);
+    REQUIRE(est.ci_high == 5);
+
+    vector<double> samples;
+    for (int i = 1; i <= 100; ++i) {
+      samples.push_back(i);
+    }
+    est = estimate(samples);
+    REQUIRE(est.median == 50.5);
+    REQUIRE(est.mad == 25);
+    REQUIRE(est.ci_low == 40);
+    REQUIRE(est.ci_high == 61);
+  }
+
+  BenchResult base{"search-14", 1, {100, 101, 102, 99, 98}, {}, {}};
+  base.ns_per_op = estimate(base.trials);
+
+  SECTION("JSON round trip") {
+    base.counters = {{"instructions", 1234}, {"llc-misses", 5}};
+    auto parsed = results_from_json(to_json({base, base}));
+    REQUIRE(absl::holds_alternative<vector<BenchResult>>(parsed));
+    auto &results = absl::get<vector<BenchResult>>(parsed);
+    REQUIRE(results.size() == 2);
+    REQUIRE(results[0].name == "search-14");
+    REQUIRE(results[0].trials == base.trials);
+    REQUIRE(results[0].ns_per_op.median == base.ns_per_op.median);
+    REQUIRE(results[0].ns_per_op.ci_high == base.ns_per_op.ci_high);
+    REQUIRE(results[0].counters == base.counters);
+
+    REQUIRE(absl::holds_alternative<Error>(results_from_json("{")));
+    REQUIRE(absl::holds_alternative<Error>(results_from_json("{}")));
+    REQUIRE(absl::holds_alternative<Error>(
+        results_from_json("{\"benchmarks\": [{\"name\": \"x\"}]}")));
+  }
+
+  SECTION("compare") {
+    auto shifted = [&](double by) {
+      BenchResult r = base;
+      for (auto &t : r.trials) {
+        t += by;
+      }
+      r.ns_per_op = estimate(r.trials);
+      return r;
+    };
+    REQUIRE(compare(base, shifted(1), 0.05).verdict == Comparison::Unchanged);
+    REQUIRE(compare(base, shifted(20), 0.05).verdict == Comparison::Slower);
+    REQUIRE(compare(base, shifted(-20), 0.05).verdict == Comparison::Faster);
+    // Slower than the threshold allows, but within the noise.
+    BenchResult noisy = shifted(10);
+    noisy.trials = {90, 110, 130, 105, 115};
+    noisy.ns_per_op = estimate(noisy.trials);
+    REQUIRE(compare(base, noisy, 0.05).verdict == Comparison::Unchanged);
+  }
+}
+
+TEST_CASE("MoveDictionary", "[dictionary]") {
+  static const auto dict = MoveDictionary::build(4);
+  REQUIRE(dict.depth() == 4);
+  REQUIRE(dict.size() == 46741);
+
+  auto moves = [](const char *alg) {
+    return get<vector<Cube>>(algorithm_moves(alg));
+  };
+  auto product = [](const vector<Cube> &path) {
+    Cube pos;
+    for (auto &m : path) {
+      pos = pos.apply(m);
+    }
+    return pos;
+  };
+
+  SECTION("lookup") {
+    vector<Cube> out;
+    REQUIRE(dict.lookup(Cube(), out));
+    CHECK(out.empty());
+    REQUIRE(dict.lookup(product(moves("R R")), out));
+    CHECK(out == moves("R2"));
+    REQUIRE(dict.lookup(product(moves("R L R'")), out));
+    CHECK(out == moves("L"));
+    REQUIRE(dict.lookup(product(moves("U R2 F' D")), out));
+    CHECK(out.size() == 4);
+    CHECK(product(out) == product(moves("U R2 F' D")));
+    CHECK(!dict.lookup(product(moves("U R2 F' D B")), out));
+  }
+
+  SECTION("shorten") {
+    CHECK(dict.shorten(moves("R R R")) == moves("R'"));
+    CHECK(dict.shorten(moves("R L R'")) == moves("L"));
+    CHECK(dict.shorten(moves("U R R' U'")).empty());
+    CHECK(dict.shorten(moves("F R U R' U' F'")) == moves("F R U R' U' F'"));
+    // Cancels only once the inner pair is gone.
+    CHECK(dict.shorten(moves("F U R L R' L' U' F'")).empty());
+
+    mt19937 rng(37);
+    Rotations r;
+    const Cube faces[] = {r.R, r.Rinv, r.R2, r.L, r.Linv, r.L2,
+                          r.F, r.Finv, r.F2, r.B, r.Binv, r.B2,
+                          r.U, r.Uinv, r.U2, r.D, r.Dinv, r.D2};
+    for (int trial = 0; trial < 50; ++trial) {
+      vector<Cube> in;
+      for (int i = 0; i < 30; ++i) {
+        in.push_back(faces[rng() % 18]);
+      }
+      auto out = dict.shorten(in);
+      REQUIRE(out.size() <= in.size());
+      REQUIRE(product(out) == product(in));
+      // No window of up to depth() moves has a shorter equivalent.
+      vector<Cube> best;
+      for (size_t i = 0; i < out.size(); ++i) {
+        for (size_t len = 1; len <= 4 && i + len <= out.size(); ++len) {
+          vector<Cube> window(out.begin() + i, out.begin() + i + len);
+          REQUIRE(dict.lookup(product(window), best));
+          REQUIRE(best.size() == len);
+        }
+      }
+    }
+  }
+
+  SECTION("save and open") {
+    char path[] = "/tmp/rubik_dict_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    auto saved = dict.save(path);
+    REQUIRE(absl::holds_alternative<size_t>(saved));
+
+    auto opened = MoveDictionary::open(path);
+    REQUIRE(absl::holds_alternative<MoveDictionary>(opened));
+    auto &mapped = get<MoveDictionary>(opened);
+    CHECK(mapped.depth() == 4);
+    CHECK(mapped.size() == dict.size());
+    vector<Cube> out;
+    REQUIRE(mapped.lookup(product(moves("U R2 F' D")), out));
+    CHECK(product(out) == product(moves("U R2 F' D")));
+    CHECK(mapped.shorten(moves("U R R' U'")).empty());
+
+    REQUIRE(truncate(path, get<size_t>(saved) - 1) == 0);
+    CHECK(absl::holds_alternative<Error>(MoveDictionary::open(path)));
+    unlink(path);
+    CHECK(absl::holds_alternative<Error>(MoveDictionary::open(path)));
+  }
+}
+
+TEST_CASE("CubeMask", "[mask]") {
+  auto apply = [](Cube pos, const vector<Cube> &path) {
+    for (auto &m : path) {
+      pos = pos.apply(m);
+    }
+    return pos;
+  };
+  const auto cross = CubeMask::layer(Face::Down).edges();
+
+  SECTION("masks") {
+    CHECK(CubeMask().empty());
+    CHECK(CubeMask::all().pieces() == 20);
+    CHECK(CubeMask::layer(Face::Up) ==
+          CubeMask().edge(0).edge(1).edge(2).edge(3).corner(0).corner(1)
+              .corner(2).corner(3));
+    CHECK(cross == CubeMask().edge(8).edge(9).edge(10).edge(11));
+    CHECK(CubeMask::layer(Face::Down).corners().pieces() == 4);
+    CHECK(CubeMask::all().without(cross).pieces() == 16);
+    CHECK((cross | CubeMask().edge(8, false)).edge_oriented(8));
+    CHECK(!CubeMask().edge(8, false).edge_oriented(8));
+  }
+
+  SECTION("solved") {
+    CHECK(CubeMask::all().solved(Cube()));
+    CHECK(!CubeMask::all().solved(rotations.D));
+    CHECK(CubeMask().solved(superflip()));
+    CHECK(CubeMask::layer(Face::Up).solved(rotations.D));
+    CHECK(!cross.solved(rotations.D));
+    CHECK(cross.solved(rotations.D2.apply(rotations.D2)));
+    // Superflip leaves every piece home, flipped.
+    CHECK(!cross.solved(superflip()));
+    CHECK(CubeMask::all(false).solved(superflip()));
+  }
+
+  SECTION("tables") {
+    MaskTable pair0(CubeMask().edge(0).corner(0));
+    REQUIRE(pair0.size() == 1024);
+    for (size_t i = 0; i < pair0.size(); ++i) {
+      REQUIRE(pair0[i] == pair0_dist[i]);
+    }
+    MaskTable quad(CubeMask().edge(0).edge(1).corner(0).corner(1));
+    REQUIRE(quad.size() == quad01_dist.size());
+    size_t differ = 0;
+    for (size_t i = 0; i < quad.size(); ++i) {
+      differ += quad[i] != quad01_dist[i];
+    }
+    CHECK(differ == 0);
+    MaskTable edges(cross);
+    CHECK(edges.distance(Cube()) == 0);
+    CHECK(edges.distance(rotations.D) == 1);
+    CHECK(edges.distance(rotations.F2) == 2);
+    CHECK(edges.distance(rotations.U) == 0);
+
+    CHECK(MaskedHeuristic::get(cross) == MaskedHeuristic::get(cross));
+    CHECK(MaskedHeuristic::get(cross) != MaskedHeuristic::get(cross.corners()));
+    auto f2l = MaskedHeuristic::get(CubeMask::all().without(
+        CubeMask::layer(Face::Up)));
+    CHECK(f2l->tables().size() == 3);
+    CHECK((*f2l)(Cube()) == 0);
+
+    // Concurrent callers share one build per mask.
+    const CubeMask layers[] = {CubeMask::layer(Face::Down),
+                               CubeMask::layer(Face::Left)};
+    vector<shared_ptr<const MaskedHeuristic>> got(6);
+    vector<thread> threads;
+    for (size_t i = 0; i < got.size(); ++i) {
+      threads.emplace_back(
+          [&, i] { got[i] = MaskedHeuristic::get(layers[i % 2]); });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    for (size_t i = 0; i < got.size(); ++i) {
+      CHECK(got[i] == MaskedHeuristic::get(layers[i % 2]));
+    }
+    CHECK(got[0] != got[1]);
+  }
+
+  SECTION("solve_masked") {
+    mt19937 rng(38);
+    const CubeMask masks[] = {
+        cross,
+        CubeMask::layer(Face::Front),
+        CubeMask::layer(Face::Down).corners(),
+        CubeMask().edge(1, false).corner(5, false).corner(6),
+    };
+    for (auto &mask : masks) {
+      for (int trial = 0; trial < 8; ++trial) {
+        Cube in = scramble(rng, 5);
+        // Brute force the optimal length, with no pruning.
+        int optimal = 0;
+        while (!search(
+            in, *qtm_root, optimal,
+            [&](const Cube &pos, int) { return mask.solved(pos); },
+            [](const Cube &, int) { return false; },
+            [](int, const Cube &) {})) {
+          ++optimal;
+        }
+        for (auto order : {false, true}) {
+          INFO("mask " << mask.key() << ", trial " << trial
+                       << ", order_moves=" << order);
+          SearchOptions opts;
+          opts.order_moves = order;
+          auto result = solve_masked(in, mask, 12, opts);
+          REQUIRE(result.solved);
+          CHECK(result.path.size() == size_t(optimal));
+          CHECK(result.lower_bound <= optimal);
+          CHECK(mask.solved(apply(in, result.path)));
+        }
+      }
+    }
+
+    auto result = solve_masked(superflip(), cross, 12);
+    REQUIRE(result.solved);
+    CHECK(cross.solved(apply(superflip(), result.path)));
+
+    CancelToken token;
+    token.cancel();
+    SearchOptions opts;
+    opts.cancel = &token;
+    result = solve_masked(superflip(), CubeMask::all(), 20, opts);
+    CHECK(!result.solved);
+    CHECK(result.cancelled);
+  }
+}
+
+TEST_CASE("enumerate_masked", "[mask]") {
+  auto collect = [](const CubePattern &from, const CubePattern &to,
+                    int max_depth, const EnumerateOptions &opts) {
+    vector<vector<Cube>> out;
+    auto n = enumerate_masked(from, to, max_depth,
+                              [&](const vector<Cube> &path) {
+                                out.push_back(path);
+                                return true;
+                              },
+                              opts);
+    REQUIRE(absl::holds_alternative<size_t>(n));
+    REQUIRE(get<size_t>(n) == out.size());
+    return out;
+  };
+  EnumerateOptions all;
+  all.optimal_only = false;
+
+  SECTION("full patterns") {
+    // With every piece specified, this is enumerate_solutions.
+    Cube goal = get<Cube>(from_algorithm("R U F'"));
+    vector<vector<Cube>> want;
+    enumerate_solutions(goal.invert(), 5,
+                        [&](const vector<Cube> &path) {
+                          want.push_back(path);
+                          return true;
+                        },
+                        all);
+    CHECK(collect({Cube(), CubeMask::all()}, {goal, CubeMask::all()}, 5,
+                  all) == want);
+    auto optimal = collect({Cube(), CubeMask::all()},
+                           {goal, CubeMask::all()}, 5, EnumerateOptions());
+    REQUIRE(optimal.size() == 1);
+    CHECK(optimal[0].size() == 3);
+  }
+
+  SECTION("wildcards") {
+    // Paths from a scramble that restore the U layer and put edge 4
+    // home, flipped or not.
+    Cube start = get<Cube>(from_algorithm("R U F'"));
+    auto goal = CubeMask::layer(Face::Up) | CubeMask().edge(4, false);
+    vector<vector<Cube>> want;
+    vector<Cube> path;
+    search_all(start, *qtm_root, 5, path,
+               [&](const Cube &pos, int) { return goal.solved(pos); },
+               [](const Cube &, int) { return false; },
+               [&](const vector<Cube> &path) {
+                 want.push_back(path);
+                 return true;
+               });
+    REQUIRE(!want.empty());
+    auto got = collect({start, CubeMask::all()}, {Cube(), goal}, 5, all);
+    CHECK(got == want);
+
+    // Only the pieces the goal names need to be known in the start.
+    CubeMask known;
+    for (int i = 0; i < CubeMask::kEdges; ++i) {
+      known.edge(i);
+    }
+    // Just the slots the U corners are in.
+    corner_union where;
+    where.mm = start.invert().getCorners();
+    for (int i = 0; i < 4; ++i) {
+      known.corner(where.arr[i] & Cube::kCornerPermMask);
+    }
+    CHECK(collect({start, known}, {Cube(), goal}, 5, all) == want);
+
+    EnumerateOptions threaded = all;
+    threaded.threads = 4;
+    threaded.ordered = true;
+    CHECK(collect({start, CubeMask::all()}, {Cube(), goal}, 5, threaded) ==
+          want);
+    threaded.ordered = false;
+    auto unordered =
+        collect({start, CubeMask::all()}, {Cube(), goal}, 5, threaded);
+    sort(unordered.begin(), unordered.end(),
+         [](const vector<Cube> &a, const vector<Cube> &b) {
+           return get<string>(to_algorithm(a)) < get<string>(to_algorithm(b));
+         });
+    auto sorted = want;
+    sort(sorted.begin(), sorted.end(),
+         [](const vector<Cube> &a, const vector<Cube> &b) {
+           return get<string>(to_algorithm(a)) < get<string>(to_algorithm(b));
+         });
+    CHECK(unordered == sorted);
+  }
+
+  SECTION("unknown pieces") {
+    auto up = CubeMask::layer(Face::Up);
+    auto n = enumerate_masked({Cube(), up}, {Cube(), CubeMask().edge(8)}, 4,
+                              [](const vector<Cube> &) { return true; });
+    CHECK(absl::holds_alternative<Error>(n));
+    n = enumerate_masked({Cube(), CubeMask::layer(Face::Up, false)},
+                         {Cube(), CubeMask().edge(0)}, 4,
+                         [](const vector<Cube> &) { return true; });
+    CHECK(absl::holds_alternative<Error>(n));
+    n = enumerate_masked({Cube(), CubeMask::layer(Face::Up, false)},
+                         {Cube(), CubeMask().edge(0, false)}, 4,
+                         [](const vector<Cube> &) { return true; });
+    REQUIRE(absl::holds_alternative<size_t>(n));
+    CHECK(get<size_t>(n) == 1);
+  }
+}
+
+TEST_CASE("AlgorithmDatabase", "[database]") {
+  char dir[] = "/tmp/rubik_algdb_XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  string path = string(dir) + "/db", sorted_path = string(dir) + "/db2";
+
+  // The number of paths of up to 4 moves down the qtm tree.
+  std::function<size_t(const search_moves &, int)> paths =
+      [&](const search_moves &moves, int depth) -> size_t {
+    size_t n = 1;
+    if (depth > 0) {
+      for (auto &node : moves) {
+        n += paths(*node.next, depth - 1);
+      }
+    }
+    return n;
+  };
+  auto built = AlgorithmDatabase::build(path, 4);
+  REQUIRE(absl::holds_alternative<size_t>(built));
+  CHECK(get<size_t>(built) == paths(*qtm_root, 4));
+  // Sorting externally, in many small runs, writes the same file.
+  DatabaseBuildOptions small_runs;
+  small_runs.run_entries = 1000;
+  REQUIRE(get<size_t>(AlgorithmDatabase::build(sorted_path, 4, small_runs)) ==
+          get<size_t>(built));
+  {
+    ifstream a(path, ios::binary), b(sorted_path, ios::binary);
+    CHECK(string(istreambuf_iterator<char>(a), {}) ==
+          string(istreambuf_iterator<char>(b), {}));
+  }
+
+  auto opened = AlgorithmDatabase::open(path);
+  REQUIRE(absl::holds_alternative<AlgorithmDatabase>(opened));
+  auto &db = get<AlgorithmDatabase>(opened);
+  CHECK(db.depth() == 4);
+  CHECK(db.size() == get<size_t>(built));
+
+  auto moves = [](const char *alg) {
+    return get<vector<Cube>>(algorithm_moves(alg));
+  };
+  auto product = [](const vector<Cube> &path) {
+    Cube pos;
+    for (auto &m : path) {
+      pos = pos.apply(m);
+    }
+    return pos;
+  };
+  auto is_turn = [](const Cube &move) {
+    auto &turns = face_turns();
+    return find(turns.begin(), turns.end(), move) != turns.end();
+  };
+  auto fits = [&](const AlgorithmMatch &m, const Cube &pos) {
+    Cube out;
+    for (int i = 0; i < m.pre_u; ++i) {
+      out = out.apply(rotations.U);
+    }
+    out = out.apply(product(m.moves));
+    for (int i = 0; i < m.post_u; ++i) {
+      out = out.apply(rotations.U);
+    }
+    return out == pos &&
+           all_of(m.moves.begin(), m.moves.end(), is_turn);
+  };
+
+  SECTION("lookup") {
+    Cube pos = product(moves("R U F'"));
+    auto found = db.lookup(pos);
+    REQUIRE(found.size() == db.count(pos));
+    CHECK(found.size() == 1);
+    CHECK(found[0].moves == moves("R U F'"));
+    // Both orders of commuting turns are in the tree.
+    CHECK(db.count(product(moves("R L"))) >= 1);
+    CHECK(db.count(Cube()) >= 1);
+    CHECK(db.lookup(product(moves("R U F' D B"))).empty());
+  }
+
+  SECTION("rotations and AUF") {
+    DatabaseLookupOptions opts;
+    opts.rotations = true;
+    Cube pos = product(moves("F U"));
+    auto found = db.lookup(pos, opts);
+    for (auto &m : found) {
+      CHECK(fits(m, pos));
+    }
+    // The case itself, and the same case rotated to each of 24 frames.
+    CHECK(found.size() == 24);
+
+    opts.rotations = false;
+    opts.auf = true;
+    pos = product(moves("U R U'"));
+    found = db.lookup(pos, opts);
+    CHECK(any_of(found.begin(), found.end(), [&](const AlgorithmMatch &m) {
+      return m.pre_u == 1 && m.post_u == 3 && m.moves == moves("R");
+    }));
+    for (auto &m : found) {
+      CHECK(fits(m, pos));
+    }
+  }
+
+  SECTION("bad files") {
+    CHECK(absl::holds_alternative<Error>(
+        AlgorithmDatabase::build(path, AlgorithmDatabase::kMaxDepth + 1)));
+    // A fanout index that points past the entries,
+    int fd = open(sorted_path.c_str(), O_RDWR);
+    REQUIRE(fd >= 0);
+    uint64_t old, bad = ~uint64_t(0);
+    REQUIRE(pread(fd, &old, 8, 32 + 100 * 8) == 8);
+    REQUIRE(pwrite(fd, &bad, 8, 32 + 100 * 8) == 8);
+    CHECK(absl::holds_alternative<Error>(AlgorithmDatabase::open(sorted_path)));
+    // or a size that only matches the file's modulo 2^64.
+    uint64_t size = db.size() + (uint64_t(1) << 60);
+    REQUIRE(pwrite(fd, &old, 8, 32 + 100 * 8) == 8);
+    CHECK(absl::holds_alternative<AlgorithmDatabase>(
+        AlgorithmDatabase::open(sorted_path)));
+    REQUIRE(pwrite(fd, &size, 8, 16) == 8);
+    CHECK(absl::holds_alternative<Error>(AlgorithmDatabase::open(sorted_path)));
+    close(fd);
+    REQUIRE(truncate(sorted_path.c_str(), 100) == 0);
+    CHECK(absl::holds_alternative<Error>(AlgorithmDatabase::open(sorted_path)));
+  }
+  unlink(path.c_str());
+  unlink(sorted_path.c_str());
+  rmdir(dir);
+}
+
+TEST_CASE("Distributed search", "[distributed]") {
+  mt19937 rng(46);
+  vector<Cube> cases;
+  for (auto alg : {"F R U' B2 D", "L U' F2 R D' B L2"}) {
+    cases.push_back(get<Cube>(from_algorithm(alg)));
+  }
+  for (int i = 0; i < 2; ++i) {
+    cases.push_back(scramble(rng, 10));
+  }
+  vector<SearchResult> want;
+  for (auto &c : cases) {
+    want.push_back(solve(c, 16));
+    REQUIRE(want.back().solved);
+  }
+  auto check = [&](const Cube &in, const SearchResult &want,
+                   const Result<SearchResult, Error> &got) {
+    REQUIRE(absl::holds_alternative<SearchResult>(got));
+    auto &result = get<SearchResult>(got);
+    REQUIRE(result.solved);
+    CHECK(!result.cancelled);
+    CHECK(result.path.size() == want.path.size());
+    CHECK(result.lower_bound == want.lower_bound);
+    CHECK(result.nodes > 0);
+    Cube out = in;
+    for (auto &rot : result.path) {
+      out = out.apply(rot);
+    }
+    CHECK(out == Cube());
+  };
+
+  SECTION("worker processes") {
+    for (int split : {0, 1, 2, 3}) {
+      DistributedOptions opts;
+      opts.processes = 3;
+      opts.split_depth = split;
+      opts.search.prefetch = split % 2 == 0;
+      for (size_t i = 0; i < cases.size(); ++i) {
+        INFO("split " << split << ", case " << i);
+        check(cases[i], want[i], solve_distributed(cases[i], 16, opts));
+      }
+    }
+    auto solved = solve_distributed(Cube(), 16);
+    REQUIRE(absl::holds_alternative<SearchResult>(solved));
+    CHECK(get<SearchResult>(solved).solved);
+    CHECK(get<SearchResult>(solved).path.empty());
+  }
+
+  SECTION("worker threads") {
+    // serve_search_jobs works over any stream socket, so the workers can
+    // as well be threads of this process.
+    vector<thread> threads;
+    {
+      SearchCoordinator coordinator;
+      for (int i = 0; i < 2; ++i) {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        coordinator.add_worker(fds[0]);
+        threads.emplace_back([fd = fds[1]] {
+          serve_search_jobs(fd);
+          close(fd);
+        });
+      }
+      for (size_t i = 0; i < cases.size(); ++i) {
+        INFO("case " << i);
+        check(cases[i], want[i], coordinator.solve(cases[i], 16));
+      }
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  SECTION("lost workers") {
+    SearchCoordinator coordinator;
+    vector<pid_t> pids;
+    for (int i = 0; i < 3; ++i) {
+      auto pid = coordinator.spawn_worker();
+      REQUIRE(absl::holds_alternative<pid_t>(pid));
+      pids.push_back(get<pid_t>(pid));
+    }
+    // A worker that died before the search started,
+    REQUIRE(kill(pids[0], SIGKILL) == 0);
+    check(cases.back(), want.back(), coordinator.solve(cases.back(), 16));
+    CHECK(coordinator.live_workers() == 2);
+
+    // and one that dies while it searches.
+    thread killer([&] {
+      this_thread::sleep_for(chrono::milliseconds(1));
+      kill(pids[1], SIGKILL);
+    });
+    for (size_t i = 0; i < cases.size(); ++i) {
+      INFO("case " << i);
+      check(cases[i], want[i], coordinator.solve(cases[i], 16));
+    }
+    killer.join();
+    check(cases.back(), want.back(), coordinator.solve(cases.back(), 16));
+    CHECK(coordinator.live_workers() == 1);
+
+    REQUIRE(kill(pids[2], SIGKILL) == 0);
+    CHECK(absl::holds_alternative<Error>(coordinator.solve(cases.back(), 16)));
+    CHECK(coordinator.live_workers() == 0);
+  }
+
+  SECTION("cancel") {
+    CancelToken cancel;
+    cancel.cancel();
+    DistributedOptions opts;
+    opts.processes = 2;
+    opts.cancel = &cancel;
+    auto got = solve_distributed(cases.back(), 16, opts);
+    REQUIRE(absl::holds_alternative<SearchResult>(got));
+    CHECK(get<SearchResult>(got).cancelled);
+    CHECK(!get<SearchResult>(got).solved);
+  }
+
+  SECTION("weighted") {
+    DistributedOptions opts;
+    opts.processes = 1;
+    opts.search.weight = 2;
+    CHECK(absl::holds_alternative<Error>(
+        solve_distributed(cases.back(), 16, opts)));
+  }
+}
+
+TEST_CASE("Resumable searches", "[checkpoint]") {
+  char tmpl[] = "/tmp/rubik_checkpoint_XXXXXX";
+  int fd = mkstemp(tmpl);
+  REQUIRE(fd >= 0);
+  close(fd);
+  unlink(tmpl);
+  CheckpointOptions checkpoint;
+  checkpoint.path = tmpl;
+  auto exists = [&] { return access(tmpl, F_OK) == 0; };
+
+  SECTION("save and load") {
+    SearchCheckpoint cp;
+    cp.kind = SearchCheckpoint::kEnumerate;
+    cp.start = get<Cube>(from_algorithm("F R U' B2 D"));
+    cp.max_depth = 14;
+    cp.depth = 9;
+    cp.path = {3, 0, 11};
+    cp.done = {true, false, false, true, true, false, true, false, true};
+    cp.nodes = 12345;
+    cp.reported = 6;
+    auto saved = cp.save(tmpl);
+    REQUIRE(absl::holds_alternative<size_t>(saved));
+
+    auto loaded = SearchCheckpoint::load(tmpl);
+    REQUIRE(absl::holds_alternative<SearchCheckpoint>(loaded));
+    auto &got = get<SearchCheckpoint>(loaded);
+    CHECK(got.kind == cp.kind);
+    CHECK(got.start == cp.start);
+    CHECK(got.max_depth == cp.max_depth);
+    CHECK(got.depth == cp.depth);
+    CHECK(got.path == cp.path);
+    CHECK(got.done == cp.done);
+    CHECK(got.nodes == cp.nodes);
+    CHECK(got.reported == cp.reported);
+
+    REQUIRE(truncate(tmpl, get<size_t>(saved) - 1) == 0);
+    CHECK(absl::holds_alternative<Error>(SearchCheckpoint::load(tmpl)));
+    // A search won't start over from a damaged checkpoint.
+    CHECK(absl::holds_alternative<Error>(
+        solve_resumable(cp.start, 14, checkpoint)));
+  }
+
+  SECTION("solve_resumable") {
+    mt19937 rng(47);
+    for (int i = 0; i < 2; ++i) {
+      Cube in = scramble(rng, 14);
+      INFO("case " << i);
+      auto want = solve(in, 16);
+      REQUIRE(want.solved);
+
+      // Stop the search every few milliseconds, and resume it.
+      checkpoint.interval = chrono::milliseconds(1);
+      int resumes = 0;
+      SearchResult result;
+      for (;;) {
+        auto token = CancelToken::after(chrono::milliseconds(5));
+        SearchOptions opts;
+        opts.cancel = &token;
+        auto got = solve_resumable(in, 16, checkpoint, opts);
+        REQUIRE(absl::holds_alternative<SearchResult>(got));
+        result = get<SearchResult>(got);
+        if (!result.cancelled) {
+          break;
+        }
+        CHECK(exists());
+        CHECK(result.lower_bound <= want.lower_bound);
+        ++resumes;
+      }
+      CHECK(resumes > 0);
+      CHECK(!exists());
+      REQUIRE(result.solved);
+      CHECK(result.path.size() == want.path.size());
+      CHECK(result.lower_bound == want.lower_bound);
+      // Resuming only revisits the path down to the checkpoint.
+      CHECK(result.nodes >= want.nodes);
+      CHECK(result.nodes < want.nodes + 100 * resumes);
+      Cube out = in;
+      for (auto &rot : result.path) {
+        out = out.apply(rot);
+      }
+      CHECK(out == Cube());
+    }
+  }
+
+  SECTION("enumerate_resumable") {
+    Cube in = get<Cube>(from_algorithm("R2 L2 U2 D2 F2 B2"));
+    auto alg = [](const vector<Cube> &path) {
+      return get<string>(to_algorithm(path));
+    };
+    vector<string> want;
+    enumerate_solutions(in, 12, [&](const vector<Cube> &path) {
+      want.push_back(alg(path));
+      return true;
+    });
+    REQUIRE(want.size() >= 2);
+    sort(want.begin(), want.end());
+
+    for (int threads : {1, 4}) {
+      INFO(threads << " threads");
+      // Stop after each new solution. A job stopped part-way is searched
+      // again, so with several threads each run must get further than the
+      // last.
+      vector<string> got;
+      set<string> seen;
+      size_t n = 0;
+      int resumes = 0;
+      for (;;) {
+        CancelToken token;
+        EnumerateOptions opts;
+        opts.threads = threads;
+        opts.cancel = &token;
+        auto result = enumerate_resumable(
+            in, 12,
+            [&](const vector<Cube> &path) {
+              got.push_back(alg(path));
+              if (seen.insert(got.back()).second) {
+                token.cancel();
+              }
+              return true;
+            },
+            checkpoint, opts);
+        REQUIRE(absl::holds_alternative<size_t>(result));
+        n = get<size_t>(result);
+        if (!exists()) {
+          break;
+        }
+        ++resumes;
+      }
+      CHECK(resumes > 0);
+      CHECK(!exists());
+      sort(got.begin(), got.end());
+      if (threads == 1) {
+        // Each solution is reported once.
+        CHECK(got == want);
+      } else {
+        got.erase(unique(got.begin(), got.end()), got.end());
+        CHECK(got == want);
+      }
+      CHECK(n == want.size());
+    }
+  }
+
+  SECTION("a different search") {
+    SearchCheckpoint cp;
+    cp.start = rotations.R;
+    cp.max_depth = 12;
+    REQUIRE(absl::holds_alternative<size_t>(cp.save(tmpl)));
+    CHECK(absl::holds_alternative<Error>(
+        solve_resumable(rotations.L, 12, checkpoint)));
+    CHECK(absl::holds_alternative<Error>(
+        solve_resumable(rotations.R, 13, checkpoint)));
+    CHECK(exists());
+    auto resumed = solve_resumable(rotations.R, 12, checkpoint);
+    REQUIRE(absl::holds_alternative<SearchResult>(resumed));
+    CHECK(get<SearchResult>(resumed).path.size() == 1);
+  }
+  unlink(tmpl);
+}
+
+TEST_CASE("MoveSet", "[moveset]") {
+  // paths counts the paths of each length up to `depth` below `moves`.
+  auto paths = [](const search_moves &moves, int depth) {
+    vector<size_t> counts(depth + 1);
+    function<void(const search_moves &, int)> walk =
+        [&](const search_moves &moves, int d) {
+          ++counts[d];
+          if (d < depth) {
+            for (auto &node : moves) {
+              walk(*node.next, d + 1);
+            }
+          }
+        };
+    walk(moves, 0);
+    return counts;
+  };
+  auto apply = [](Cube pos, const vector<Cube> &path) {
+    for (auto &rot : path) {
+      pos = pos.apply(rot);
+    }
+    return pos;
+  };
+  auto alg = [&](const string &alg) {
+    return apply(Cube(), get<vector<Cube>>(algorithm_moves(alg)));
+  };
+  mt19937 rng(48);
+  // shortest finds the optimal length by brute force, over every
+  // sequence of the moves.
+  auto shortest = [](const MoveSet &set, const Cube &start, int max_depth) {
+    function<bool(const Cube &, int)> solves = [&](const Cube &pos, int d) {
+      if (pos == Cube()) {
+        return true;
+      }
+      if (d == 0) {
+        return false;
+      }
+      for (auto &move : set.moves()) {
+        if (solves(pos.apply(move.rotation), d - 1)) {
+          return true;
+        }
+      }
+      return false;
+    };
+    for (int d = 0; d <= max_depth; ++d) {
+      if (solves(start, d)) {
+        return d;
+      }
+    }
+    return -1;
+  };
+
+  SECTION("the quarter turns") {
+    auto qtm = MoveSet::parse("L R U D F B", false, 1);
+    REQUIRE(absl::holds_alternative<MoveSet>(qtm));
+    auto &set = get<MoveSet>(qtm);
+    CHECK(set.moves().size() == 12);
+    CHECK(set.states() == 13);
+    CHECK(set.moved() == CubeMask::all());
+    // The derived tree makes the same cuts as the hand-written one.
+    CHECK(paths(set.root(), 6) == paths(*qtm_root, 6));
+
+    // A longer history cuts more, e.g. L L L.
+    auto deeper = MoveSet::parse("L R U D F B");
+    REQUIRE(absl::holds_alternative<MoveSet>(deeper));
+    auto counts = paths(get<MoveSet>(deeper).root(), 6);
+    CHECK(counts[3] < paths(*qtm_root, 6)[3]);
+
+    Cube in = get<Cube>(from_algorithm("F R U' B2 D"));
+    auto result = solve_moveset(in, get<MoveSet>(deeper), 12);
+    REQUIRE(result.solved);
+    CHECK(result.path.size() == solve(in, 12).path.size());
+    CHECK(apply(in, result.path) == Cube());
+  }
+
+  SECTION("<R, U>") {
+    auto parsed = MoveSet::parse("<R, U>");
+    REQUIRE(absl::holds_alternative<MoveSet>(parsed));
+    auto &set = get<MoveSet>(parsed);
+    CHECK(set.moves().size() == 4);
+    CHECK(set.moved() == (CubeMask::layer(Face::Right) |
+                          CubeMask::layer(Face::Up)));
+    for (int i = 0; i < 8; ++i) {
+      Cube in = scramble(rng, 8, set.moves());
+      INFO("case " << i);
+      auto result = solve_moveset(in, set, 12);
+      REQUIRE(result.solved);
+      CHECK(apply(in, result.path) == Cube());
+      CHECK(int(result.path.size()) == shortest(set, in, 8));
+      for (auto &rot : result.path) {
+        CHECK((rot == rotations.R || rot == rotations.Rinv ||
+               rot == rotations.U || rot == rotations.Uinv));
+      }
+      auto named = set.to_algorithm(result.path);
+      REQUIRE(absl::holds_alternative<string>(named));
+      CHECK(alg(get<string>(named)) == apply(Cube(), result.path));
+    }
+
+    // Nothing in <R, U> turns the left layer.
+    auto result = solve_moveset(rotations.L, set, 10);
+    CHECK(!result.solved);
+    CHECK(result.lower_bound == 11);
+    // Nor flips edges, so its tables know this can't be solved.
+    result = solve_moveset(alg("F R U R' U' F'"), set, 10);
+    CHECK(!result.solved);
+    CHECK(result.lower_bound > 10);
+  }
+
+  SECTION("half turns and slices") {
+    auto parsed = MoveSet::parse("R U M", true);
+    REQUIRE(absl::holds_alternative<MoveSet>(parsed));
+    auto &set = get<MoveSet>(parsed);
+    CHECK(set.moves().size() == 9);
+    for (int i = 0; i < 6; ++i) {
+      Cube in = scramble(rng, 6, set.moves());
+      INFO("case " << i);
+      SearchOptions opts;
+      opts.order_moves = i % 2 == 1;
+      auto result = solve_moveset(in, set, 10, opts);
+      REQUIRE(result.solved);
+      CHECK(apply(in, result.path) == Cube());
+      CHECK(int(result.path.size()) == shortest(set, in, 6));
+    }
+
+    // M U M' U2 M U M' cycles three edges in seven slice and face turns.
+    auto result = solve_moveset(alg("L' R U L R' U2 L' R U L R'"), set, 8);
+    REQUIRE(result.solved);
+    CHECK(result.path.size() <= 7);
+    auto named = set.to_algorithm(result.path);
+    REQUIRE(absl::holds_alternative<string>(named));
+    CHECK(get<string>(named).find('M') != string::npos);
+  }
+
+  SECTION("notation") {
+    Rotations r;
+    auto parsed = MoveSet::parse("M E S r Rw", false, 1);
+    REQUIRE(absl::holds_alternative<MoveSet>(parsed));
+    auto &set = get<MoveSet>(parsed);
+    vector<pair<string, Cube>> want = {
+        {"M", r.Linv.apply(r.R)}, {"E", r.U.apply(r.Dinv)},
+        {"S", r.Finv.apply(r.B)}, {"r", r.L},
+        {"Rw", r.L},
+    };
+    for (auto &w : want) {
+      auto move = find_if(
+          set.moves().begin(), set.moves().end(),
+          [&](const MoveSet::Move &m) { return m.name == w.first; });
+      REQUIRE(move != set.moves().end());
+      CHECK(move->rotation == w.second);
+    }
+    // "Rw" is "r" under another name, so the tree uses only one.
+    CHECK(count_if(set.root().begin(), set.root().end(),
+                   [&](const search_node &node) {
+                     return node.rotation == r.L;
+                   }) == 1);
+
+    CHECK(absl::holds_alternative<Error>(MoveSet::parse("R x")));
+    CHECK(absl::holds_alternative<Error>(MoveSet::parse("R Q")));
+    CHECK(absl::holds_alternative<Error>(MoveSet::parse("")));
+    CHECK(absl::holds_alternative<Error>(
+        MoveSet::create({{"R", r.R}, {"U", r.U}, {"U'", r.Uinv}})));
+    CHECK(absl::holds_alternative<Error>(MoveSet::parse("R U", false, 20)));
+  }
+}
+
+TEST_CASE("HeuristicCascade", "[cascade]") {
+  SECTION("cheap bounds are admissible") {
+    // Every position within five moves, by distance.
+    unordered_set<Cube, absl::Hash<Cube>> seen{Cube()};
+    vector<Cube> frontier{Cube()};
+    for (int depth = 0; depth <= 5; ++depth) {
+      vector<Cube> next;
+      for (auto &pos : frontier) {
+        INFO("depth " << depth);
+        CHECK(flip_heuristic(pos) <= depth);
+        CHECK(edge_heuristic(pos) <= depth);
+        for (auto &move : *qtm_root) {
+          Cube child = pos.apply(move.rotation);
+          if (seen.insert(child).second) {
+            next.push_back(child);
+          }
+        }
+      }
+      frontier.swap(next);
+    }
+    CHECK(flip_heuristic(superflip()) == 6);
+    CHECK(edge_heuristic(superflip()) == 4);
+  }
+
+  SECTION("solve") {
+    mt19937 rng(7);
+    vector<Cube> starts;
+    for (int trial = 0; trial < 8; ++trial) {
+      starts.push_back(scramble(rng, 9));
+    }
+    HeuristicCascade cascade;
+    SearchOptions opts;
+    opts.cascade = &cascade;
+    for (size_t i = 0; i < starts.size(); ++i) {
+      INFO("trial " << i);
+      auto plain = solve(starts[i], 12);
+      auto result = solve(starts[i], 12, opts);
+      REQUIRE(result.solved);
+      CHECK(result.path.size() == plain.path.size());
+      // The cascade prunes every node the quad table does, and more.
+      CHECK(result.nodes <= plain.nodes);
+    }
+
+    // Each stage sees the nodes the stages before it didn't prune.
+    auto stats = cascade.stats();
+    auto &order = cascade.order();
+    REQUIRE(order.size() == 4);
+    CHECK(stats[order[0]].calls > 0);
+    for (size_t i = 1; i < order.size(); ++i) {
+      auto &before = stats[order[i - 1]];
+      CHECK(stats[order[i]].calls == before.calls - before.prunes);
+    }
+    CHECK(stats[HeuristicCascade::kFlip].prunes > 0);
+    CHECK(stats[HeuristicCascade::kQuad].prunes > 0);
+
+    cascade.calibrate(starts);
+    // Where it goes depends on timings, but the quad table prunes nodes
+    // no other stage does, so calibrate keeps it; whatever other stages
+    // it keeps come once each.
+    CHECK(count(order.begin(), order.end(), HeuristicCascade::kQuad) == 1);
+    CHECK(set<HeuristicCascade::Stage>(order.begin(), order.end()).size() ==
+          order.size());
+    CHECK(cascade.stats()[HeuristicCascade::kQuad].calls == 0);
+    auto &costs = cascade.costs();
+    for (int i = 0; i < HeuristicCascade::kStages; ++i) {
+      INFO(HeuristicCascade::name(HeuristicCascade::Stage(i)));
+      CHECK(costs[i].ns > 0);
+      CHECK(costs[i].prune_rate >= 0);
+      CHECK(costs[i].prune_rate <= 1);
+    }
+    // The quad table's pieces include pair0's, so it prunes at least as
+    // much.
+    CHECK(costs[HeuristicCascade::kQuad].prune_rate >=
+          costs[HeuristicCascade::kPair0].prune_rate);
+    for (size_t i = 0; i < starts.size(); ++i) {
+      auto result = solve(starts[i], 12, opts);
+      REQUIRE(result.solved);
+      CHECK(result.path.size() == solve(starts[i], 12).path.size());
+    }
+
+    // Without the quad table the search is still exact, just slower.
+    HeuristicCascade cheap({HeuristicCascade::kFlip, HeuristicCascade::kPair0});
+    opts.cascade = &cheap;
+    auto result = solve(starts[0], 12, opts);
+    REQUIRE(result.solved);
+    CHECK(result.path.size() == solve(starts[0], 12).path.size());
+    CHECK(cheap.stats()[HeuristicCascade::kQuad].calls == 0);
+  }
+}
+
+TEST_CASE("SolutionStore", "[store]") {
+  char tmpl[] = "/tmp/rubik_store_XXXXXX";
+  int fd = mkstemp(tmpl);
+  REQUIRE(fd >= 0);
+  close(fd);
+  unlink(tmpl);
+  SolutionStoreOptions opts;
+  opts.capacity = 64;
+  // Solutions of a few scrambles, with the start each solves.
+  vector<pair<Cube, vector<Cube>>> solved;
+  mt19937 rng(50);
+  for (int i = 0; i < 6; ++i) {
+    Cube in = scramble(rng, 6);
+    auto result = solve(in, 10);
+    REQUIRE(result.solved);
+    solved.emplace_back(in, result.path);
+  }
+  auto ok = [](const Result<bool, Error> &r) {
+    return absl::holds_alternative<bool>(r) && absl::get<bool>(r);
+  };
+
+  SECTION("insert and lookup") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    CHECK(store.capacity() >= 64);
+    vector<Cube> path;
+    CHECK(!store.lookup(solved[0].first, path));
+    for (auto &s : solved) {
+      CHECK(ok(store.insert(s.first, s.second)));
+    }
+    CHECK(store.size() == solved.size());
+    for (auto &s : solved) {
+      REQUIRE(store.lookup(s.first, path));
+      CHECK(path == s.second);
+    }
+
+    // A longer solution is ignored, a shorter one replaces it.
+    auto &first = solved[0];
+    vector<Cube> longer = first.second;
+    longer.insert(longer.begin(), {rotations.R, rotations.Rinv});
+    auto kept = store.insert(first.first, longer);
+    REQUIRE(absl::holds_alternative<bool>(kept));
+    CHECK(!get<bool>(kept));
+    Cube other = solved[1].first;
+    CHECK(ok(store.insert(other.apply(rotations.R),
+                          [&] {
+                            vector<Cube> p{rotations.Rinv, rotations.L,
+                                           rotations.Linv};
+                            p.insert(p.end(), solved[1].second.begin(),
+                                     solved[1].second.end());
+                            return p;
+                          }())));
+    vector<Cube> shorter{rotations.Rinv};
+    shorter.insert(shorter.end(), solved[1].second.begin(),
+                   solved[1].second.end());
+    CHECK(ok(store.insert(other.apply(rotations.R), shorter)));
+    REQUIRE(store.lookup(other.apply(rotations.R), path));
+    CHECK(path == shorter);
+    CHECK(store.size() == solved.size() + 1);
+    CHECK(store.records() == solved.size() + 2);
+
+    CHECK(absl::holds_alternative<Error>(
+        store.insert(first.first, vector<Cube>{rotations.R})));
+    CHECK(absl::holds_alternative<Error>(
+        store.insert(rotations.R, {})));
+
+    // Another mapping, even read-only, sees the same store.
+    SolutionStoreOptions read_only;
+    read_only.read_only = true;
+    auto reader = SolutionStore::open(tmpl, read_only);
+    REQUIRE(absl::holds_alternative<SolutionStore>(reader));
+    REQUIRE(get<SolutionStore>(reader).lookup(first.first, path));
+    CHECK(path == first.second);
+    CHECK(absl::holds_alternative<Error>(
+        get<SolutionStore>(reader).insert(first.first, first.second)));
+    unlink(tmpl);
+    CHECK(absl::holds_alternative<Error>(SolutionStore::open(tmpl, read_only)));
+  }
+
+  SECTION("processes") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    // Each child inserts half the solutions, overlapping in one.
+    vector<pid_t> children;
+    for (int child = 0; child < 2; ++child) {
+      pid_t pid = fork();
+      REQUIRE(pid >= 0);
+      if (pid == 0) {
+        auto mine = SolutionStore::open(tmpl, opts);
+        bool good = absl::holds_alternative<SolutionStore>(mine);
+        for (int i = child * 2; good && i < child * 2 + 4; ++i) {
+          good = absl::holds_alternative<bool>(get<SolutionStore>(mine).insert(
+              solved[i].first, solved[i].second));
+        }
+        _exit(good ? 0 : 1);
+      }
+      children.push_back(pid);
+    }
+    for (auto pid : children) {
+      int status;
+      REQUIRE(waitpid(pid, &status, 0) == pid);
+      CHECK(WIFEXITED(status));
+      CHECK(WEXITSTATUS(status) == 0);
+    }
+    CHECK(store.size() == solved.size());
+    CHECK(store.records() == solved.size());
+    vector<Cube> path;
+    for (auto &s : solved) {
+      REQUIRE(store.lookup(s.first, path));
+      CHECK(path == s.second);
+    }
+    unlink(tmpl);
+  }
+
+  SECTION("recovery") {
+    {
+      auto opened = SolutionStore::open(tmpl, opts);
+      REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+      for (int i = 0; i < 3; ++i) {
+        REQUIRE(ok(get<SolutionStore>(opened).insert(solved[i].first,
+                                                      solved[i].second)));
+      }
+    }
+    // Leave the records committed but not indexed, as a writer that
+    // crashed after committing them would, and tear the second record.
+    int fd = open(tmpl, O_RDWR);
+    REQUIRE(fd >= 0);
+    uint64_t slots;
+    REQUIRE(pread(fd, &slots, 8, 16) == 8);
+    vector<char> zeros(slots * 8 + 24, 0);
+    REQUIRE(pwrite(fd, zeros.data(), 24, 40) == 24);
+    REQUIRE(pwrite(fd, zeros.data(), slots * 8, 4096) == ssize_t(slots * 8));
+    off_t second = 4096 + slots * 8 + ((17 + solved[0].second.size() + 7) & ~7);
+    REQUIRE(pwrite(fd, "\xff", 1, second + 17) == 1);
+    close(fd);
+
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    vector<Cube> path;
+    CHECK(!store.lookup(solved[0].first, path));
+    CHECK(ok(store.insert(solved[3].first, solved[3].second)));
+    CHECK(store.lookup(solved[0].first, path));
+    CHECK(!store.lookup(solved[1].first, path));
+    CHECK(store.lookup(solved[2].first, path));
+    CHECK(store.lookup(solved[3].first, path));
+    CHECK(store.size() == 3);
+    CHECK(store.records() == 4);
+    unlink(tmpl);
+  }
+
+  SECTION("compact") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    for (auto &s : solved) {
+      vector<Cube> longer{rotations.U, rotations.Uinv};
+      longer.insert(longer.end(), s.second.begin(), s.second.end());
+      REQUIRE(ok(store.insert(s.first, longer)));
+      REQUIRE(ok(store.insert(s.first, s.second)));
+    }
+    CHECK(store.records() == 2 * solved.size());
+
+    auto compacted = SolutionStore::compact(tmpl, 1000);
+    REQUIRE(absl::holds_alternative<size_t>(compacted));
+    CHECK(get<size_t>(compacted) == solved.size());
+    CHECK(store.stale());
+    vector<Cube> path;
+    CHECK(store.lookup(solved[0].first, path));
+    CHECK(absl::holds_alternative<Error>(
+        store.insert(solved[0].first, solved[0].second)));
+
+    auto refreshed = store.refresh();
+    REQUIRE(absl::holds_alternative<bool>(refreshed));
+    CHECK(get<bool>(refreshed));
+    CHECK(!store.stale());
+    CHECK(store.capacity() >= 1000);
+    CHECK(store.size() == solved.size());
+    CHECK(store.records() == solved.size());
+    for (auto &s : solved) {
+      REQUIRE(store.lookup(s.first, path));
+      CHECK(path == s.second);
+    }
+    unlink(tmpl);
+  }
+
+  SECTION("solve_stored") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    auto &s = solved[4];
+    Error err;
+    auto first = solve_stored(s.first, 10, store, SearchOptions(), &err);
+    CHECK(err.error == "");
+    CHECK(first.solved);
+    CHECK(first.nodes > 0);
+    auto again = solve_stored(s.first, 10, store);
+    CHECK(again.solved);
+    CHECK(again.nodes == 0);
+    CHECK(again.path == first.path);
+    int length = s.second.size();
+    auto short_of = solve_stored(s.first, length - 1, store);
+    CHECK(!short_of.solved);
+    CHECK(short_of.lower_bound == length);
+
+    // Weighted solutions aren't stored.
+    SearchOptions weighted;
+    weighted.weight = 2;
+    CHECK(solve_stored(solved[5].first, 20, store, weighted).solved);
+    vector<Cube> path;
+    CHECK(!store.lookup(solved[5].first, path));
+    unlink(tmpl);
+  }
+
+  SECTION("solve_stored read-only") {
+    {
+      auto created = SolutionStore::open(tmpl, opts);
+      REQUIRE(absl::holds_alternative<SolutionStore>(created));
+    }
+    SolutionStoreOptions ro = opts;
+    ro.read_only = true;
+    auto opened = SolutionStore::open(tmpl, ro);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    Error err;
+    auto result =
+        solve_stored(solved[0].first, 10, store, SearchOptions(), &err);
+    CHECK(err.error == "");
+    CHECK(result.solved);
+    CHECK(result.path.size() == solved[0].second.size());
+    vector<Cube> path;
+    CHECK(!store.lookup(solved[0].first, path));
+    CHECK(store.size() == 0);
+    unlink(tmpl);
+  }
+
+  SECTION("solve_stored after compact") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    REQUIRE(ok(store.insert(solved[0].first, solved[0].second)));
+    REQUIRE(absl::holds_alternative<size_t>(SolutionStore::compact(tmpl, 64)));
+    REQUIRE(store.stale());
+    Error err;
+    auto result =
+        solve_stored(solved[1].first, 10, store, SearchOptions(), &err);
+    CHECK(err.error == "");
+    CHECK(result.solved);
+    CHECK(!store.stale());
+    vector<Cube> path;
+    REQUIRE(store.lookup(solved[1].first, path));
+    CHECK(path == result.path);
+    REQUIRE(store.lookup(solved[0].first, path));
+    CHECK(path == solved[0].second);
+    unlink(tmpl);
+  }
+
+  SECTION("concurrent readers") {
+    auto opened = SolutionStore::open(tmpl, opts);
+    REQUIRE(absl::holds_alternative<SolutionStore>(opened));
+    auto &store = get<SolutionStore>(opened);
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    vector<thread> readers;
+    for (int t = 0; t < 3; ++t) {
+      readers.emplace_back([&] {
+        vector<Cube> path;
+        while (!done) {
+          for (auto &s : solved) {
+            if (store.lookup(s.first, path) && path != s.second) {
+              ++bad;
+            }
+          }
+        }
+      });
+    }
+    for (auto &s : solved) {
+      CHECK(ok(store.insert(s.first, s.second)));
+    }
+    done = true;
+    for (auto &t : readers) {
+      t.join();
+    }
+    CHECK(bad == 0);
+    unlink(tmpl);
+  }
+}
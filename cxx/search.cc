@@ -1,10 +1,30 @@
+#include "cascade.h"
+#include "checkpoint.h"
+#include "mask.h"
+#include "moveset.h"
+#include "numa.h"
 #include "rubik.h"
 #include "rubik_impl.h"
+#include "symmetry.h"
 #include "tables.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
 #include <emmintrin.h>
 #include <smmintrin.h>
 #include <tmmintrin.h>
@@ -16,53 +36,41 @@ namespace rubik {
 namespace {
 Cube solved;
 
-Cube must_parse(const std::string &str) {
-  auto r = rubik::from_facelets(str);
-  if (!absl::holds_alternative<Cube>(r)) {
-    cerr << "bad: " << str << ": " << get<rubik::Error>(r).error << "\n";
-    abort();
-  }
-  return get<Cube>(r);
+// The symmetries are whole-cube rotations: a quarter turn of the cube
+// about each axis, its half turn and its inverse.
+constexpr CubeBytes kYaw = {
+    {0x03, 0x00, 0x01, 0x02, 0x17, 0x04, 0x15, 0x06, 0x0b, 0x08, 0x09, 0x0a},
+    {0x03, 0x00, 0x01, 0x02, 0x07, 0x04, 0x05, 0x06}};
+constexpr CubeBytes kPitch = {
+    {0x07, 0x13, 0x16, 0x1b, 0x00, 0x12, 0x1a, 0x08, 0x04, 0x11, 0x15, 0x19},
+    {0x0b, 0x12, 0x0e, 0x17, 0x10, 0x09, 0x15, 0x0c}};
+constexpr CubeBytes kRoll = {
+    {0x18, 0x14, 0x10, 0x17, 0x19, 0x01, 0x03, 0x1b, 0x1a, 0x05, 0x12, 0x06},
+    {0x14, 0x08, 0x13, 0x0f, 0x0d, 0x11, 0x0a, 0x16}};
+
+constexpr pair<Cube, Cube> symmetry(const CubeBytes &sym) {
+  return {Cube(sym), Cube(sym.invert())};
 }
+}; // namespace
 
-vector<pair<Cube, Cube>> compute_symmetries() {
-  auto yaw =
-      must_parse("GGGGWGGGGYYYRRRWWWOOOYGYRRRWBWOOOYYYRRRWWWOOOBBBBYBBBB");
-  auto pitch =
-      must_parse("RRRRWRRRRGGGYYYBBBWWWGGGYRYBBBWOWGGGYYYBBBWWWOOOOYOOOO");
-  auto roll =
-      must_parse("WWWWWWWWWOOOGGGRRRBBBOGOGRGRBRBOBOOOGGGRRRBBBYYYYYYYYY");
+constexpr array<pair<Cube, Cube>, 9> symmetries = {{
+    symmetry(kYaw),
+    symmetry(kYaw.apply(kYaw)),
+    symmetry(kYaw.invert()),
+    symmetry(kPitch),
+    symmetry(kPitch.apply(kPitch)),
+    symmetry(kPitch.invert()),
+    symmetry(kRoll),
+    symmetry(kRoll.apply(kRoll)),
+    symmetry(kRoll.invert()),
+}};
 
-  vector<Cube> symmetries{
-      yaw,   yaw.apply(yaw),     yaw.invert(),
-      pitch, pitch.apply(pitch), pitch.invert(),
-      roll,  roll.apply(roll),   roll.invert(),
-  };
-
-  if (debug_mode) {
-    for (const auto &s1 : symmetries) {
-      for (const auto &s2 : symmetries) {
-        if (&s1 == &s2)
-          continue;
-        if (s1 == s2) {
-          cerr << "identical symmetries: " << (&s1 - &symmetries.front()) << "/"
-               << (&s2 - &symmetries.front()) << "\n";
-          abort();
-        }
-      }
-    }
-  }
-  vector<pair<Cube, Cube>> out;
-  out.reserve(symmetries.size());
-  for (auto &sym : symmetries) {
-    out.emplace_back(sym, sym.invert());
-  }
-  return out;
-}
+namespace {
+constexpr SymmetryTable symmetry_table(symmetries);
 
-bool prune_two(const Cube &pos, int depth) __attribute__((used));
-bool prune_two(const Cube &pos, int depth) {
-  auto inv = pos.invert();
+// prune_pair0 probes pair0_dist on `inv`, the inverse of a position,
+// and on its conjugates.
+bool prune_pair0(const Cube &inv, int depth) {
   edge_union eu;
   corner_union cu;
   eu.mm = inv.getEdges();
@@ -71,10 +79,10 @@ bool prune_two(const Cube &pos, int depth) {
   if (d > depth) {
     return true;
   }
-  for (auto &p : symmetries) {
-    auto c = p.second.apply(inv.apply(p.first));
-    eu.mm = c.getEdges();
-    cu.mm = c.getCorners();
+  for (size_t i = 0; i < symmetry_table.size(); ++i) {
+    auto c = symmetry_table.partial_conjugate(i, inv);
+    eu.mm = c.edges;
+    cu.mm = c.corners;
     if (pair0_dist[(eu.arr[0] << 5) | cu.arr[0]] > depth) {
       return true;
     }
@@ -82,34 +90,182 @@ bool prune_two(const Cube &pos, int depth) {
   return false;
 }
 
-bool prune_quad(const Cube &pos, int depth) {
-  auto inv = pos.invert();
-  edge_union eu;
-  corner_union cu;
-  eu.mm = inv.getEdges();
-  cu.mm = inv.getCorners();
-  int d = rubik::quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
-                             (cu.arr[0] << 5) | (cu.arr[1])];
-  assert(d >= 0);
-  if (d > depth) {
-    return true;
+constexpr size_t kHugePage = 2 << 20;
+
+// huge_page_copy copies a read-only table into memory we have asked the
+// kernel to back with transparent huge pages, so that probes into it
+// don't also miss in the TLB. If the allocation fails we keep using the
+// original.
+template <typename T> const T *huge_page_copy(const T &table) {
+  size_t size = (sizeof(table) + kHugePage - 1) & ~(kHugePage - 1);
+  void *mem;
+  if (posix_memalign(&mem, kHugePage, size) != 0) {
+    return &table;
   }
-  for (auto &p : symmetries) {
-    auto c = p.second.apply(inv.apply(p.first));
-    eu.mm = c.getEdges();
-    cu.mm = c.getCorners();
-    auto d = rubik::quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
-                                (cu.arr[0] << 5) | (cu.arr[1])];
-    if (d > depth) {
+  madvise(mem, size, MADV_HUGEPAGE);
+  memcpy(mem, &table, sizeof(table));
+  return static_cast<const T *>(mem);
+}
+
+// quad_table is our huge-page copy of quad01_dist, made on first use
+// rather than at startup, so that processes that never search don't
+// pay for it.
+const QuadTable &quad_table() {
+  static const QuadTable *table = huge_page_copy(quad01_dist);
+  return *table;
+}
+
+// quad_index packs the five-bit bytes of edges 0-1 and corners 0-1
+// into a table offset, e0 << 15 | e1 << 10 | c0 << 5 | c1, without
+// leaving SIMD registers: the unpack puts the corner pair and edge pair
+// side by side, maddubs folds each pair into a ten-bit word, and madd
+// joins the two words.
+uint32_t quad_index(const __m128i &edges, const __m128i &corners) {
+  auto pairs = _mm_unpacklo_epi16(corners, edges);
+  auto words = _mm_maddubs_epi16(pairs, _mm_set1_epi16(1 << 8 | 1 << 5));
+  return _mm_cvtsi128_si32(
+      _mm_madd_epi16(words, _mm_setr_epi16(1, 1 << 10, 0, 0, 0, 0, 0, 0)));
+}
+
+uint32_t quad_index(const Cube &c) {
+  return quad_index(c.getEdges(), c.getCorners());
+}
+
+uint32_t quad_index(const SymmetryTable::Partial &c) {
+  return quad_index(c.edges, c.corners);
+}
+
+int quad_lookup(const QuadTable &table, const Cube &c) {
+  return table[quad_index(c)];
+}
+
+// The quad table is indexed by the inverse of a position, and bounds
+// the moves to solve the position. Since a sequence solves a position
+// exactly when its inverse solves the inverse, probing the table on the
+// position itself bounds the same distance: a dual lookup. Each probe,
+// of either the inverse or the position, is repeated for their
+// symmetry conjugates.
+
+// quad_key is what prune_quad needs to know about a position: the
+// position and its inverse, and the quad table offset of the inverse.
+struct quad_key {
+  Cube pos;
+  Cube inv;
+  uint32_t index;
+};
+
+// prefetch_quad computes the first table offset prune_quad will probe
+// and prefetches it. The offsets of the symmetry conjugates are left to
+// prune_quad, since the first probe alone prunes most nodes and the
+// conjugations cost more than the misses they would hide.
+quad_key prefetch_quad(const QuadTable &table, const Cube &pos) {
+  auto inv = pos.invert();
+  auto index = quad_index(inv);
+  __builtin_prefetch(table.address(index));
+  return quad_key{pos, inv, index};
+}
+
+bool prune_conjugates(const QuadTable &table, const Cube &c, int depth) {
+  for (size_t i = 0; i < symmetry_table.size(); ++i) {
+    if (table[quad_index(symmetry_table.partial_conjugate(i, c))] > depth) {
       return true;
     }
   }
   return false;
 }
 
-}; // namespace
+// expand_quad computes the keys of every child of the node with key
+// `parent`. It derives each child's inverse from the parent's (see
+// search_node::inverse) rather than inverting the child, and prefetches
+// the child's table offset; once all of the offsets are in flight, it
+// reads each child's first probe into hs.
+void expand_quad(const QuadTable &table, const quad_key &parent,
+                 const search_moves &moves, quad_key *keys, int *hs) {
+  for (size_t i = 0; i < moves.size(); ++i) {
+    auto &rot = moves[i];
+    auto inv = rot.inverse.apply(parent.inv);
+    auto index = quad_index(inv);
+    __builtin_prefetch(table.address(index));
+    new (&keys[i]) quad_key{parent.pos.apply(rot.rotation), inv, index};
+  }
+  for (size_t i = 0; i < moves.size(); ++i) {
+    hs[i] = table[keys[i].index];
+  }
+}
+
+// prune_quad probes the inverse first, then (with `dual`) the position,
+// and only then their conjugates, since the direct probes are cheap and
+// prune most nodes. `h` is the first probe, table[key.index].
+bool prune_quad(const QuadTable &table, const quad_key &key, int h, int depth,
+                bool dual) {
+  if (h > depth) {
+    return true;
+  }
+  if (dual && quad_lookup(table, key.pos) > depth) {
+    return true;
+  }
+  return prune_conjugates(table, key.inv, depth) ||
+         (dual && prune_conjugates(table, key.pos, depth));
+}
+
+bool prune_quad(const QuadTable &table, const quad_key &key, int depth,
+                bool dual) {
+  return prune_quad(table, key, table[key.index], depth, dual);
+}
+
+bool prune_quad(const QuadTable &table, const Cube &pos, const Cube &inv,
+                int depth, bool dual) {
+  int d = quad_lookup(table, inv);
+  assert(d != kUnknownDist);
+  if (d > depth) {
+    return true;
+  }
+  if (dual && quad_lookup(table, pos) > depth) {
+    return true;
+  }
+  return prune_conjugates(table, inv, depth) ||
+         (dual && prune_conjugates(table, pos, depth));
+}
 
-const vector<pair<Cube, Cube>> symmetries = compute_symmetries();
+bool prune_quad(const QuadTable &table, const Cube &pos, int depth,
+                bool dual) {
+  return prune_quad(table, pos, pos.invert(), depth, dual);
+}
+
+int conjugates_heuristic(const QuadTable &table, const Cube &c) {
+  int d = quad_lookup(table, c);
+  assert(d != kUnknownDist);
+  for (size_t i = 0; i < symmetry_table.size(); ++i) {
+    d = max<int>(d, table[quad_index(symmetry_table.partial_conjugate(i, c))]);
+  }
+  return d;
+}
+
+// Like prune_quad, but computes the full bound instead of stopping at
+// the first table entry that exceeds the depth.
+int quad_heuristic(const QuadTable &table, const Cube &pos, bool dual) {
+  int d = conjugates_heuristic(table, pos.invert());
+  if (dual) {
+    d = max(d, conjugates_heuristic(table, pos));
+  }
+  return d;
+}
+
+// The quad table for a search to probe: the caller's replica if it
+// passed any, else our own copy. A node the replicas don't have is
+// taken to mean the one we are running on.
+const QuadTable &select_quad(const TableReplicas *tables, int node) {
+  if (tables == nullptr) {
+    return quad_table();
+  }
+  if (node < 0 || size_t(node) >= tables->topology().nodes.size()) {
+    int cpu = sched_getcpu();
+    node = cpu < 0 ? 0 : tables->topology().node_of_cpu(cpu);
+  }
+  return tables->quad(node);
+}
+
+}; // namespace
 
 int flip_heuristic(const Cube &pos) {
   auto mask = _mm_slli_epi16(pos.getEdges(), 3);
@@ -131,6 +287,194 @@ int edge_heuristic(const Cube &pos) {
   return lookup[missing];
 }
 
+namespace {
+// cascade_pruner is one search's run of a HeuristicCascade. It counts
+// into its own stats, and adds them to the cascade's when it's done.
+class cascade_pruner {
+public:
+  cascade_pruner(HeuristicCascade &cascade, const QuadTable &table,
+                 bool dual)
+      : cascade_(cascade), table_(table), dual_(dual),
+        size_(cascade.order().size()) {
+    assert(size_ <= HeuristicCascade::kStages);
+    copy(cascade.order().begin(), cascade.order().end(), order_);
+  }
+  ~cascade_pruner() {
+    // Each stage saw the nodes that the stages before it didn't prune.
+    HeuristicCascade::Stats stats;
+    uint64_t calls = calls_;
+    for (size_t i = 0; i < size_; ++i) {
+      stats[order_[i]].calls = calls;
+      stats[order_[i]].prunes = prunes_[i];
+      calls -= prunes_[i];
+    }
+    cascade_.add_stats(stats);
+  }
+
+  bool prune(const Cube &pos, int depth) {
+    ++calls_;
+    // The stages on the inverse share one inversion.
+    Cube inv;
+    bool inverted = false;
+    for (size_t i = 0; i < size_; ++i) {
+      bool pruned;
+      switch (order_[i]) {
+      case HeuristicCascade::kFlip:
+        pruned = flip_heuristic(pos) > depth;
+        break;
+      case HeuristicCascade::kEdges:
+        pruned = edge_heuristic(pos) > depth;
+        break;
+      default:
+        if (!inverted) {
+          inv = pos.invert();
+          inverted = true;
+        }
+        pruned = order_[i] == HeuristicCascade::kPair0
+                     ? prune_pair0(inv, depth)
+                     : prune_quad(table_, pos, inv, depth, dual_);
+      }
+      if (pruned) {
+        ++prunes_[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  HeuristicCascade &cascade_;
+  const QuadTable &table_;
+  bool dual_;
+  HeuristicCascade::Stage order_[HeuristicCascade::kStages];
+  size_t size_;
+  uint64_t calls_ = 0;
+  uint64_t prunes_[HeuristicCascade::kStages] = {};
+};
+
+// calibrate samples this many nodes in all.
+constexpr size_t kCalibrationNodes = 1 << 16;
+}; // namespace
+
+constexpr int HeuristicCascade::kStages;
+
+const char *HeuristicCascade::name(Stage stage) {
+  switch (stage) {
+  case kFlip:
+    return "flip";
+  case kEdges:
+    return "edges";
+  case kPair0:
+    return "pair0";
+  case kQuad:
+    return "quad";
+  }
+  return "unknown";
+}
+
+HeuristicCascade::HeuristicCascade()
+    : HeuristicCascade({kFlip, kEdges, kPair0, kQuad}) {}
+
+HeuristicCascade::HeuristicCascade(vector<Stage> order)
+    : order_(move(order)) {}
+
+HeuristicCascade::Stats HeuristicCascade::stats() const {
+  lock_guard<mutex> lock(mu_);
+  return stats_;
+}
+
+void HeuristicCascade::reset_stats() {
+  lock_guard<mutex> lock(mu_);
+  stats_ = Stats();
+}
+
+void HeuristicCascade::add_stats(const Stats &stats) {
+  lock_guard<mutex> lock(mu_);
+  for (int i = 0; i < kStages; ++i) {
+    stats_[i].calls += stats[i].calls;
+    stats_[i].prunes += stats[i].prunes;
+  }
+}
+
+void HeuristicCascade::calibrate(const vector<Cube> &sample) {
+  const QuadTable &table = quad_table();
+  // Most of a solve's nodes are in its last iterations, so we sample
+  // from searches a couple of moves past each start's bound.
+  vector<pair<Cube, int>> nodes;
+  size_t per_start = kCalibrationNodes / max<size_t>(sample.size(), 1);
+  for (auto &start : sample) {
+    size_t limit = nodes.size() + per_start;
+    search(start, *qtm_root, quad_heuristic(table, start, false) + 2,
+           [](const Cube &, int) { return false; },
+           [&](const Cube &pos, int depth) {
+             if (nodes.size() >= limit) {
+               return true;
+             }
+             nodes.emplace_back(pos, depth);
+             return prune_quad(table, pos, depth, false);
+           },
+           [](int, const Cube &) {});
+  }
+
+  // time_stage runs one stage alone on `nodes`, returning the time per
+  // node and leaving the nodes it doesn't prune in `pass`.
+  auto time_stage = [&](Stage stage, const vector<pair<Cube, int>> &nodes,
+                        vector<pair<Cube, int>> &pass) {
+    HeuristicCascade alone({stage});
+    pass.clear();
+    pass.reserve(nodes.size());
+    auto begin = chrono::steady_clock::now();
+    {
+      cascade_pruner pruner(alone, table, false);
+      for (auto &node : nodes) {
+        if (!pruner.prune(node.first, node.second)) {
+          pass.push_back(node);
+        }
+      }
+    }
+    chrono::duration<double, nano> elapsed =
+        chrono::steady_clock::now() - begin;
+    return elapsed.count() / nodes.size();
+  };
+
+  costs_ = decltype(costs_)();
+  vector<pair<Cube, int>> pass;
+  for (int i = 0; i < kStages && !nodes.empty(); ++i) {
+    costs_[i].ns = time_stage(Stage(i), nodes, pass);
+    costs_[i].prune_rate = 1 - double(pass.size()) / nodes.size();
+  }
+
+  // Pick stages greedily: next, the one that spends the least time per
+  // node it prunes out of those the stages before it pass.
+  vector<Stage> left = move(order_), order;
+  while (!left.empty() && !nodes.empty()) {
+    auto best = left.end();
+    double best_cost = HUGE_VAL;
+    vector<pair<Cube, int>> best_pass;
+    for (auto it = left.begin(); it != left.end(); ++it) {
+      double ns = time_stage(*it, nodes, pass);
+      size_t prunes = nodes.size() - pass.size();
+      if (prunes > 0 && ns * nodes.size() / prunes < best_cost) {
+        best = it;
+        best_cost = ns * nodes.size() / prunes;
+        best_pass.swap(pass);
+      }
+    }
+    if (best == left.end()) {
+      break;
+    }
+    order.push_back(*best);
+    left.erase(best);
+    nodes.swap(best_pass);
+  }
+  // Without any samples to judge by, keep the stages we were given.
+  if (order.empty()) {
+    order = move(left);
+  }
+  order_ = move(order);
+  reset_stats();
+}
+
 namespace {
 constexpr bool kCollectStats =
 #ifdef COLLECT_STATS
@@ -172,32 +516,1106 @@ public:
 
 } // namespace
 
-bool search(Cube start, vector<Cube> &path, int max_depth) {
+namespace {
+// The slack in weighted bounds, so that e.g. 1.2 * 5 counts as 6.
+constexpr double kWeightEpsilon = 1e-9;
+
+// weighted_heuristic is the smallest integer depth that a weighted
+// search won't prune a node with heuristic h at, ceil(w * h).
+int weighted_heuristic(int h, double weight) {
+  return ceil(weight * h - kWeightEpsilon);
+}
+
+// weighted_depth is the largest h that weighted_heuristic allows at
+// `depth`, floor(depth / w).
+int weighted_depth(int depth, double weight) {
+  return floor(depth / weight + kWeightEpsilon);
+}
+
+// simplify_path shortens a path of quarter turns by merging the turns
+// of each run of moves on one axis (which commute) into at most one
+// turn or half turn per face. The qtm tree never produces such runs at
+// optimal depth, but weighted searches can: e.g. "L L L" for "L'".
+void simplify_path(vector<Cube> &path) {
+  static const Rotations rotations;
+  // Faces in axis order, so that faces 2a and 2a+1 share axis a.
+  static const Cube faces[6] = {rotations.L, rotations.R, rotations.U,
+                                rotations.D, rotations.F, rotations.B};
+  static const Cube inverses[6] = {rotations.Linv, rotations.Rinv,
+                                   rotations.Uinv, rotations.Dinv,
+                                   rotations.Finv, rotations.Binv};
+  // The face of a move, and its turn (1 or 3 quarter turns).
+  auto classify = [&](const Cube &move, int &face, int &turn) {
+    for (face = 0; face < 6; ++face) {
+      if (move == faces[face]) {
+        turn = 1;
+        return;
+      }
+      if (move == inverses[face]) {
+        turn = 3;
+        return;
+      }
+    }
+    assert(false);
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    vector<Cube> out;
+    for (size_t i = 0; i < path.size();) {
+      int face = 0, turn = 0;
+      classify(path[i], face, turn);
+      int axis = face / 2;
+      int net[2] = {0, 0};
+      size_t j = i;
+      for (; j < path.size(); ++j) {
+        classify(path[j], face, turn);
+        if (face / 2 != axis) {
+          break;
+        }
+        net[face % 2] = (net[face % 2] + turn) % 4;
+      }
+      size_t before = out.size();
+      for (int side = 0; side < 2; ++side) {
+        int f = 2 * axis + side;
+        if (net[side] == 3) {
+          out.push_back(inverses[f]);
+        } else {
+          out.insert(out.end(), net[side], faces[f]);
+        }
+      }
+      changed = changed || out.size() - before != j - i;
+      i = j;
+    }
+    path.swap(out);
+  }
+}
+
+// search_depth is search() below the node whose moves are `moves`,
+// polling `poll` for cancellation. A cancelled search returns false.
+bool search_depth(const Cube &start, const search_moves &moves,
+                  vector<Cube> &path, int max_depth,
+                  const SearchOptions &opts, cancel_poll &poll) {
   collect_stats<> collect;
   path.resize(0);
+  const QuadTable &table = select_quad(opts.tables, opts.numa_node);
 
-  bool ok = search(
-      start, *qtm_root, max_depth,
-      [&](const Cube &pos, int) {
-        collect.inc(&stats::visit);
+  // Weighted pruning cuts a node with `depth` moves left if w * h >
+  // depth. Since h is an integer, that is h > floor(depth / w), so we
+  // prune as if the node had only floor(depth / w) moves left.
+  assert(opts.weight >= 1);
+  vector<int> scaled(max_depth + 1);
+  for (int d = 0; d <= max_depth; ++d) {
+    scaled[d] = weighted_depth(d, opts.weight);
+  }
 
-        return (pos == solved);
-      },
-      [&](const Cube &pos, int depth) {
-        if (prune_quad(pos, depth)) {
-          collect.inc(&stats::prune);
-          return true;
-        };
-        return false;
-      },
-      [&](int depth, const Cube &rot) { path.push_back(rot); });
+  auto check = [&](const Cube &pos, int) {
+    collect.inc(&stats::visit);
+    poll.visit();
+
+    return (pos == solved);
+  };
+  auto unwind = [&](int depth, const Cube &rot) { path.push_back(rot); };
+
+  bool ok;
+  if (opts.order_moves) {
+    // A cancelled search reports every child as out of reach.
+    constexpr int kUnreachable = 1 << 10;
+    ok = ordered_search(start, moves, max_depth, check,
+                        [&](const Cube &pos) {
+                          return poll.stop() ? kUnreachable
+                                             : weighted_heuristic(
+                                                   quad_heuristic(
+                                                       table, pos,
+                                                       opts.dual_lookup),
+                                                   opts.weight);
+                        },
+                        unwind);
+  } else if (opts.prefetch) {
+    auto prune = [&](const quad_key &key, int h, int depth) {
+      if (poll.stop() ||
+          prune_quad(table, key, h, scaled[depth], opts.dual_lookup)) {
+        collect.inc(&stats::prune);
+        return true;
+      };
+      return false;
+    };
+    auto root = prefetch_quad(table, start);
+    ok = !prune(root, table[root.index], max_depth) &&
+         expand_search(root, moves, max_depth, check,
+                       [&](const quad_key &key,
+                           const search_moves &moves, quad_key *keys,
+                           int *hs) { expand_quad(table, key, moves, keys, hs); },
+                       prune, unwind);
+  } else if (opts.cascade != nullptr) {
+    cascade_pruner cascade(*opts.cascade, table, opts.dual_lookup);
+    ok = search(
+        start, moves, max_depth, check,
+        [&](const Cube &pos, int depth) {
+          if (poll.stop() || cascade.prune(pos, scaled[depth])) {
+            collect.inc(&stats::prune);
+            return true;
+          };
+          return false;
+        },
+        unwind);
+  } else {
+    ok = search(
+        start, moves, max_depth, check,
+        [&](const Cube &pos, int depth) {
+          if (poll.stop() ||
+              prune_quad(table, pos, scaled[depth], opts.dual_lookup)) {
+            collect.inc(&stats::prune);
+            return true;
+          };
+          return false;
+        },
+        unwind);
+  }
+  ok = ok && !poll.stopped();
 
   collect.report(max_depth, ok);
 
   if (ok) {
     reverse(path.begin(), path.end());
+  } else {
+    path.resize(0);
   }
   return ok;
 }
+}; // namespace
+
+bool search(Cube start, vector<Cube> &path, int max_depth,
+            const SearchOptions &opts) {
+  cancel_poll poll(opts.cancel);
+  return search_depth(start, *qtm_root, path, max_depth, opts, poll);
+}
+
+SearchResult search_subtree(const Cube &start, const search_moves &moves,
+                            int depth, const SearchOptions &opts) {
+  cancel_poll poll(opts.cancel);
+  SearchResult result;
+  result.solved = search_depth(start, moves, result.path, depth, opts, poll);
+  result.cancelled = poll.stopped();
+  result.nodes = poll.nodes();
+  return result;
+}
+
+namespace {
+// finish_result fills in what a search's result derives from its path
+// and the nodes it visited.
+void finish_result(SearchResult &result, const SearchOptions &opts,
+                   const cancel_poll &poll) {
+  if (result.solved && opts.weight != 1) {
+    simplify_path(result.path);
+  }
+  if (result.solved && result.lower_bound > 0) {
+    result.suboptimality = double(result.path.size()) / result.lower_bound;
+  }
+  result.nodes = poll.nodes();
+}
+
+// deepen runs `search_at(depth, path)` at each depth from the weighted
+// bound of the start's heuristic `h` up to max_depth, until it finds a
+// solution or `poll` is cancelled.
+template <typename SearchAt>
+SearchResult deepen(int h, int max_depth, const SearchOptions &opts,
+                    cancel_poll &poll, const SearchAt &search_at) {
+  SearchResult result;
+  // Depths below the start's weighted heuristic bound would be pruned at
+  // the root, so we begin there.
+  result.lower_bound = h;
+  for (int depth = weighted_heuristic(h, opts.weight); depth <= max_depth;
+       ++depth) {
+    if (search_at(depth, result.path)) {
+      result.solved = true;
+      break;
+    }
+    if (poll.stopped()) {
+      result.cancelled = true;
+      break;
+    }
+    // No node on an optimal path of length c is pruned once depth >=
+    // w * c, so exhausting `depth` proves c > depth / w.
+    result.lower_bound =
+        max(result.lower_bound, weighted_depth(depth, opts.weight) + 1);
+  }
+  finish_result(result, opts, poll);
+  return result;
+}
+
+// masked_search_depth is search_depth() for a partial goal, searching
+// the tree under `root`.
+bool masked_search_depth(const Cube &start, const search_moves &root,
+                         vector<Cube> &path, int max_depth,
+                         const CubeMask &mask, const MaskedHeuristic &h,
+                         const SearchOptions &opts, cancel_poll &poll) {
+  path.resize(0);
+  vector<int> scaled(max_depth + 1);
+  for (int d = 0; d <= max_depth; ++d) {
+    scaled[d] = weighted_depth(d, opts.weight);
+  }
+  auto check = [&](const Cube &pos, int) {
+    poll.visit();
+    return mask.solved(pos);
+  };
+  auto unwind = [&](int depth, const Cube &rot) { path.push_back(rot); };
+
+  bool ok;
+  if (opts.order_moves) {
+    constexpr int kUnreachable = 1 << 10;
+    ok = ordered_search(start, root, max_depth, check,
+                        [&](const Cube &pos) {
+                          return poll.stop()
+                                     ? kUnreachable
+                                     : weighted_heuristic(h(pos), opts.weight);
+                        },
+                        unwind);
+  } else {
+    ok = search(start, root, max_depth, check,
+                [&](const Cube &pos, int depth) {
+                  return poll.stop() || h.prune(pos, scaled[depth]);
+                },
+                unwind);
+  }
+  ok = ok && !poll.stopped();
+  if (ok) {
+    reverse(path.begin(), path.end());
+  } else {
+    path.resize(0);
+  }
+  return ok;
+}
+}; // namespace
+
+SearchResult solve(Cube start, int max_depth, const SearchOptions &opts) {
+  cancel_poll poll(opts.cancel);
+  auto &table = select_quad(opts.tables, opts.numa_node);
+  int h = quad_heuristic(table, start, opts.dual_lookup);
+  bool inverse = false;
+  if (opts.dual_search) {
+    // The inverse position has the same optimal solutions, inverted and
+    // reversed; if the tables bound it higher, searching it prunes more.
+    Cube inv = start.invert();
+    int inv_h = quad_heuristic(table, inv, opts.dual_lookup);
+    if (inv_h > h) {
+      start = inv;
+      h = inv_h;
+      inverse = true;
+    }
+  }
+  auto result = deepen(h, max_depth, opts, poll,
+                       [&](int depth, vector<Cube> &path) {
+                         return search_depth(start, *qtm_root, path, depth,
+                                             opts, poll);
+                       });
+  if (inverse) {
+    reverse(result.path.begin(), result.path.end());
+    for (auto &move : result.path) {
+      move = move.invert();
+    }
+    result.inverse = true;
+  }
+  return result;
+}
+
+SearchResult solve_masked(Cube start, const CubeMask &mask, int max_depth,
+                          const SearchOptions &opts) {
+  assert(opts.weight >= 1);
+  cancel_poll poll(opts.cancel);
+  auto heuristic = MaskedHeuristic::get(mask);
+  return deepen((*heuristic)(start), max_depth, opts, poll,
+                [&](int depth, vector<Cube> &path) {
+                  return masked_search_depth(start, *qtm_root, path, depth,
+                                             mask, *heuristic, opts, poll);
+                });
+}
+
+SearchResult solve_moveset(Cube start, const MoveSet &moves, int max_depth,
+                           const SearchOptions &opts) {
+  if (!CubeMask::all().without(moves.moved()).solved(start)) {
+    SearchResult result;
+    result.lower_bound = max_depth + 1;
+    return result;
+  }
+  // Weighted searches simplify their paths as quarter turns.
+  SearchOptions unweighted;
+  unweighted.order_moves = opts.order_moves;
+  unweighted.cancel = opts.cancel;
+  cancel_poll poll(opts.cancel);
+  auto &heuristic = moves.heuristic();
+  auto mask = CubeMask::all();
+  return deepen(heuristic(start), max_depth, unweighted, poll,
+                [&](int depth, vector<Cube> &path) {
+                  return masked_search_depth(start, moves.root(), path, depth,
+                                             mask, heuristic, unweighted,
+                                             poll);
+                });
+}
+
+vector<SearchResult> solve_interleaved(const vector<Cube> &starts,
+                                       int max_depth, int interleave,
+                                       const SearchOptions &opts) {
+  assert(opts.weight >= 1);
+  assert(interleave >= 1);
+  const QuadTable &table = select_quad(opts.tables, opts.numa_node);
+  vector<int> scaled(max_depth + 1);
+  for (int d = 0; d <= max_depth; ++d) {
+    scaled[d] = weighted_depth(d, opts.weight);
+  }
+
+  // Each slot deepens one start at a time, as deepen() does, and moves
+  // on to the next unclaimed start when it is done.
+  struct slot {
+    size_t start;
+    int depth;
+    cancel_poll poll;
+    SearchResult result;
+    stepped_search<quad_key> search;
+  };
+  vector<SearchResult> results(starts.size());
+  vector<slot> slots(min(starts.size(), size_t(interleave)),
+                     slot{0, -1, cancel_poll(opts.cancel), SearchResult(),
+                          stepped_search<quad_key>()});
+  size_t next_start = 0;
+
+  auto prepare = [&](const Cube &pos) { return prefetch_quad(table, pos); };
+  auto check = [](slot &s) {
+    return [&s](const Cube &pos, int) {
+      s.poll.visit();
+      return pos == solved;
+    };
+  };
+  auto prune = [&](slot &s) {
+    return [&](const quad_key &key, int depth) {
+      return s.poll.stop() ||
+             prune_quad(table, key, scaled[depth], opts.dual_lookup);
+    };
+  };
+  // finish records the result of a slot's start, leaving the slot
+  // free to claim another.
+  auto finish = [&](slot &s) {
+    finish_result(s.result, opts, s.poll);
+    results[s.start] = move(s.result);
+    s.depth = -1;
+  };
+  // settle handles a slot whose search just stopped running: it records
+  // a solution, deepens, or claims the next start, until the slot has a
+  // search running or there are no starts left. It returns whether the
+  // slot is still busy.
+  auto settle = [&](slot &s) {
+    while (true) {
+      auto state = s.search.state();
+      if (state == stepped_search<quad_key>::status::running) {
+        return true;
+      }
+      if (s.depth >= 0) {
+        if (state == stepped_search<quad_key>::status::found) {
+          s.result.solved = true;
+          s.result.path = s.search.path();
+          finish(s);
+        } else if (s.poll.stopped()) {
+          s.result.cancelled = true;
+          finish(s);
+        } else {
+          s.result.lower_bound = max(s.result.lower_bound,
+                                     weighted_depth(s.depth, opts.weight) + 1);
+          if (++s.depth <= max_depth) {
+            s.search.reset(starts[s.start], *qtm_root, s.depth, check(s),
+                           prepare, prune(s));
+            continue;
+          }
+          finish(s);
+        }
+      }
+      if (next_start == starts.size()) {
+        return false;
+      }
+      s.start = next_start++;
+      s.poll = cancel_poll(opts.cancel);
+      s.result = SearchResult();
+      int h = quad_heuristic(table, starts[s.start], opts.dual_lookup);
+      s.result.lower_bound = h;
+      s.depth = weighted_heuristic(h, opts.weight);
+      if (s.depth > max_depth) {
+        finish(s);
+        continue;
+      }
+      s.search.reset(starts[s.start], *qtm_root, s.depth, check(s), prepare,
+                     prune(s));
+    }
+  };
+
+  // A slot starts out with no start, so settling it claims one.
+  size_t busy = 0;
+  for (auto &s : slots) {
+    busy += settle(s);
+  }
+  while (busy > 0) {
+    for (auto &s : slots) {
+      if (s.search.state() != stepped_search<quad_key>::status::running) {
+        continue;
+      }
+      if (s.search.step(check(s), prepare, prune(s)) !=
+              stepped_search<quad_key>::status::running &&
+          !settle(s)) {
+        --busy;
+      }
+    }
+  }
+  return results;
+}
+
+namespace {
+// How many moves deep enumerate_solutions splits the tree into jobs for
+// its worker threads. Two moves gives ~100 subtrees from the qtm root.
+constexpr int kSplitDepth = 2;
+
+struct enumerate_job {
+  Cube pos;
+  const search_moves *moves;
+  vector<Cube> prefix;
+};
+
+template <typename Check>
+void split_jobs(const Cube &pos, const search_moves &moves, int depth,
+                const Check &check, vector<Cube> &prefix,
+                vector<enumerate_job> &out) {
+  if (depth == 0 || check(pos, depth)) {
+    out.push_back(enumerate_job{pos, &moves, prefix});
+    return;
+  }
+  for (auto &rot : moves) {
+    prefix.push_back(rot.rotation);
+    split_jobs(pos.apply(rot.rotation), *rot.next, depth - 1, check, prefix,
+               out);
+    prefix.pop_back();
+  }
+}
+
+// A job_log lets a split enumeration resume: enumerate_paths skips the
+// jobs in `skip`, and calls `record(i, n)`, holding its lock, once job
+// i's n solutions have all been reported. If `skip` is for a different
+// number of jobs, enumerate_paths sets `mismatch` and does nothing.
+struct job_log {
+  vector<bool> skip;
+  function<void(size_t, size_t)> record;
+  bool mismatch = false;
+};
+
+// enumerate_paths reports every path of up to `depth` moves from `start`
+// to a position `check` accepts, as enumerate_solutions describes.
+// `bound(w)` returns the prune callback for worker w, called on that
+// worker's thread (w is -1 for the calling thread). With a `log`, it
+// splits the tree into jobs even on one thread.
+template <typename Check, typename Bound>
+size_t
+enumerate_paths(const Cube &start, int depth, const Check &check,
+                const Bound &bound,
+                const std::function<bool(const std::vector<Cube> &)> &found,
+                const EnumerateOptions &opts, job_log *log = nullptr) {
+  atomic<bool> stopped(false);
+  // Each thread polls opts.cancel itself, and on cancellation stops the
+  // other threads through `stopped`.
+  auto pruner = [&](int w, cancel_poll &poll) {
+    return [&stopped, p = &poll, prune = bound(w)](const Cube &pos,
+                                                   int depth) {
+      p->visit();
+      if (p->stop()) {
+        stopped.store(true, memory_order_relaxed);
+      }
+      return stopped.load(memory_order_relaxed) || prune(pos, depth);
+    };
+  };
+
+  int threads = opts.threads;
+  if (threads <= 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  size_t count = 0;
+  if (threads == 1 && log == nullptr) {
+    vector<Cube> path;
+    cancel_poll poll(opts.cancel);
+    search_all(start, *qtm_root, depth, path, check, pruner(-1, poll),
+               [&](const vector<Cube> &path) {
+                 ++count;
+                 return found(path);
+               });
+    return count;
+  }
+
+  vector<Cube> prefix;
+  vector<enumerate_job> jobs;
+  split_jobs(start, *qtm_root, min(depth, kSplitDepth), check, prefix, jobs);
+  if (log != nullptr && log->skip.size() != jobs.size()) {
+    if (!log->skip.empty()) {
+      log->mismatch = true;
+      return 0;
+    }
+    log->skip.resize(jobs.size());
+  }
+
+  // In ordered mode, each job's solutions are held in pending[i] until
+  // every earlier job has been reported.
+  mutex mu;
+  vector<vector<vector<Cube>>> pending(jobs.size());
+  vector<bool> done(jobs.size());
+  size_t next_report = 0;
+  auto report = [&](const vector<Cube> &path) {
+    if (stopped.load(memory_order_relaxed)) {
+      return false;
+    }
+    ++count;
+    if (!found(path)) {
+      stopped.store(true, memory_order_relaxed);
+      return false;
+    }
+    return true;
+  };
+
+  atomic<size_t> next_job(0);
+  auto worker = [&](int w) {
+    cancel_poll poll(opts.cancel);
+    auto prune = pruner(w, poll);
+    for (size_t i; (i = next_job.fetch_add(1)) < jobs.size();) {
+      auto &job = jobs[i];
+      bool skip = log != nullptr && log->skip[i];
+      size_t reported = 0;
+      if (!skip) {
+        search_all(job.pos, *job.moves, depth - job.prefix.size(), job.prefix,
+                   check, prune, [&](const vector<Cube> &path) {
+                     if (opts.ordered) {
+                       pending[i].push_back(path);
+                       return !stopped.load(memory_order_relaxed);
+                     }
+                     lock_guard<mutex> guard(mu);
+                     ++reported;
+                     return report(path);
+                   });
+      }
+      // A job cut short by a stop isn't finished.
+      bool finished = !skip && !stopped.load(memory_order_relaxed);
+      if (!opts.ordered) {
+        if (log != nullptr && finished) {
+          lock_guard<mutex> guard(mu);
+          log->record(i, reported);
+        }
+        continue;
+      }
+      lock_guard<mutex> guard(mu);
+      done[i] = true;
+      for (; next_report < jobs.size() && done[next_report]; ++next_report) {
+        for (auto &path : pending[next_report]) {
+          if (!report(path)) {
+            break;
+          }
+        }
+        if (log != nullptr && !log->skip[next_report] &&
+            !stopped.load(memory_order_relaxed)) {
+          log->record(next_report, pending[next_report].size());
+        }
+        vector<vector<Cube>>().swap(pending[next_report]);
+      }
+    }
+  };
+
+  vector<thread> pool;
+  for (int i = 0; i < threads; ++i) {
+    pool.emplace_back(worker, i);
+  }
+  for (auto &t : pool) {
+    t.join();
+  }
+  return count;
+}
+}; // namespace
+
+namespace {
+// quad_bound is enumerate_paths' `bound` for enumerate_solutions. With
+// replicas, worker w runs on node w mod nodes, and reads that node's
+// copy of the tables.
+auto quad_bound(const EnumerateOptions &opts) {
+  return [&opts](int w) {
+    const QuadTable *table = &select_quad(opts.tables, -1);
+    if (w >= 0 && opts.tables != nullptr) {
+      auto &nodes = opts.tables->topology().nodes;
+      int node = w % nodes.size();
+      pin_to_node(nodes[node]);
+      table = &opts.tables->quad(node);
+    }
+    return [table, dual = opts.dual_lookup](const Cube &pos, int depth) {
+      return prune_quad(*table, pos, depth, dual);
+    };
+  };
+}
+}; // namespace
+
+size_t enumerate_solutions(
+    Cube start, int max_depth,
+    const std::function<bool(const std::vector<Cube> &)> &found,
+    const EnumerateOptions &opts) {
+  int depth = max_depth;
+  if (opts.optimal_only) {
+    SearchOptions search_opts;
+    search_opts.tables = opts.tables;
+    search_opts.cancel = opts.cancel;
+    search_opts.dual_lookup = opts.dual_lookup;
+    auto optimal = solve(start, max_depth, search_opts);
+    if (!optimal.solved) {
+      return 0;
+    }
+    depth = optimal.path.size();
+  }
+
+  return enumerate_paths(
+      start, depth, [](const Cube &pos, int) { return pos == solved; },
+      quad_bound(opts), found, opts);
+}
+
+
+namespace {
+// checkpoint_timer tells a search when its next checkpoint is due. Like
+// cancel_poll, it reads the clock only every few thousand nodes.
+class checkpoint_timer {
+  using clock = std::chrono::steady_clock;
+  static constexpr uint64_t kPollInterval = 4096;
+
+  const CheckpointOptions &opts_;
+  clock::time_point next_save_;
+  uint64_t nodes_ = 0;
+  uint64_t next_poll_ = kPollInterval;
+
+public:
+  explicit checkpoint_timer(const CheckpointOptions &opts)
+      : opts_(opts), next_save_(clock::now() + opts.interval) {}
+
+  // due is called on every node.
+  bool due() {
+    if (++nodes_ < next_poll_) {
+      return false;
+    }
+    next_poll_ = nodes_ + kPollInterval;
+    return clock::now() >= next_save_;
+  }
+  // due_now is for coarser events, like finishing a job.
+  bool due_now() const { return clock::now() >= next_save_; }
+
+  Result<size_t, Error> save(const SearchCheckpoint &cp) {
+    next_save_ = clock::now() + opts_.interval;
+    return cp.save(opts_.path);
+  }
+};
+
+// load_checkpoint sets `cp` to the checkpoint in `path` and returns
+// true, or returns false if there is none. It's an error if the
+// checkpoint is for a different search.
+Result<bool, Error> load_checkpoint(const string &path, const Cube &start,
+                                    int max_depth, SearchCheckpoint &cp) {
+  if (access(path.c_str(), F_OK) != 0 && errno == ENOENT) {
+    return false;
+  }
+  auto loaded = SearchCheckpoint::load(path);
+  if (auto err = absl::get_if<Error>(&loaded)) {
+    return *err;
+  }
+  cp = move(absl::get<SearchCheckpoint>(loaded));
+  if (cp.start != start || cp.max_depth != max_depth) {
+    return Error{absl::StrCat(path, ": checkpoint of a different search")};
+  }
+  return true;
+}
+
+// resume_path checks that a checkpoint's path names a node of the qtm
+// tree within `depth` moves.
+bool resume_path(const vector<uint8_t> &path, int depth) {
+  const search_moves *moves = qtm_root;
+  for (auto i : path) {
+    if (i >= moves->size()) {
+      return false;
+    }
+    moves = (*moves)[i].next;
+  }
+  return int(path.size()) <= depth;
+}
+
+// solve_checkpointed runs solve_resumable's search, resuming from `cp`
+// if `resumed`, and leaves `cp` at the end of the search. It saves a
+// checkpoint if the search is cancelled, but doesn't remove the file
+// when it finishes.
+Result<SearchResult, Error>
+solve_checkpointed(const Cube &start, int max_depth,
+                   const CheckpointOptions &checkpoint,
+                   const SearchOptions &opts, SearchCheckpoint &cp,
+                   bool resumed) {
+  assert(opts.weight >= 1);
+  const QuadTable &table = select_quad(opts.tables, opts.numa_node);
+  int h = quad_heuristic(table, start, opts.dual_lookup);
+  int first = weighted_heuristic(h, opts.weight);
+  SearchResult result;
+  result.lower_bound = h;
+  if (!resumed) {
+    cp = SearchCheckpoint();
+    cp.kind = SearchCheckpoint::kSolve;
+    cp.start = start;
+    cp.max_depth = max_depth;
+    cp.depth = first;
+  } else if (cp.depth > first) {
+    // Every depth before the checkpoint's was exhausted.
+    result.lower_bound = max(h, weighted_depth(cp.depth - 1, opts.weight) + 1);
+  }
+  if (!resume_path(cp.path, cp.depth)) {
+    return Error{absl::StrCat(checkpoint.path, ": bad search path")};
+  }
+
+  cancel_poll poll(opts.cancel);
+  checkpoint_timer timer(checkpoint);
+  uint64_t base_nodes = cp.nodes;
+  Result<size_t, Error> saved = size_t(0);
+  vector<uint8_t> at;
+  // Where the search stopped, when it's cancelled or a save fails: the
+  // first node it cut short.
+  bool stopped = false;
+  for (int depth = cp.depth; depth <= max_depth; ++depth) {
+    vector<int> scaled(depth + 1);
+    for (int d = 0; d <= depth; ++d) {
+      scaled[d] = weighted_depth(d, opts.weight);
+    }
+    vector<uint8_t> resume = move(cp.path);
+    cp.path.clear();
+    cp.depth = depth;
+    vector<Cube> path;
+    bool found = false;
+    resumable_search_all(
+        start, *qtm_root, depth, path, at, resume.data(),
+        resume.data() + resume.size(),
+        [&](const Cube &pos, int) {
+          poll.visit();
+          return pos == solved;
+        },
+        [&](const Cube &pos, int depth) {
+          if (stopped || poll.stop()) {
+            if (!stopped) {
+              stopped = true;
+              cp.path = at;
+            }
+            return true;
+          }
+          return prune_quad(table, pos, scaled[depth], opts.dual_lookup);
+        },
+        [&](const vector<Cube> &solution) {
+          result.path = solution;
+          found = true;
+          return false;
+        },
+        [&](const vector<uint8_t> &at) {
+          if (!stopped && timer.due()) {
+            cp.path = at;
+            cp.nodes = base_nodes + poll.nodes();
+            saved = timer.save(cp);
+            cp.path.clear();
+            if (absl::holds_alternative<Error>(saved)) {
+              stopped = true;
+            }
+          }
+        });
+    if (auto err = absl::get_if<Error>(&saved)) {
+      return *err;
+    }
+    if (found) {
+      result.solved = true;
+      break;
+    }
+    if (stopped) {
+      result.cancelled = true;
+      cp.nodes = base_nodes + poll.nodes();
+      saved = timer.save(cp);
+      if (auto err = absl::get_if<Error>(&saved)) {
+        return *err;
+      }
+      break;
+    }
+    result.lower_bound =
+        max(result.lower_bound, weighted_depth(depth, opts.weight) + 1);
+  }
+  finish_result(result, opts, poll);
+  result.nodes += base_nodes;
+  cp.nodes = result.nodes;
+  return result;
+}
+}; // namespace
+
+Result<SearchResult, Error> solve_resumable(Cube start, int max_depth,
+                                            const CheckpointOptions &checkpoint,
+                                            const SearchOptions &opts) {
+  SearchCheckpoint cp;
+  auto resumed = load_checkpoint(checkpoint.path, start, max_depth, cp);
+  if (auto err = absl::get_if<Error>(&resumed)) {
+    return *err;
+  }
+  if (absl::get<bool>(resumed) && cp.kind != SearchCheckpoint::kSolve) {
+    return Error{
+        absl::StrCat(checkpoint.path, ": checkpoint of a different search")};
+  }
+  auto result = solve_checkpointed(start, max_depth, checkpoint, opts, cp,
+                                   absl::get<bool>(resumed));
+  if (absl::holds_alternative<SearchResult>(result) &&
+      !absl::get<SearchResult>(result).cancelled) {
+    unlink(checkpoint.path.c_str());
+  }
+  return result;
+}
+
+Result<size_t, Error> enumerate_resumable(
+    Cube start, int max_depth,
+    const std::function<bool(const std::vector<Cube> &)> &found,
+    const CheckpointOptions &checkpoint, const EnumerateOptions &opts) {
+  SearchCheckpoint cp;
+  auto loaded = load_checkpoint(checkpoint.path, start, max_depth, cp);
+  if (auto err = absl::get_if<Error>(&loaded)) {
+    return *err;
+  }
+  bool resumed = absl::get<bool>(loaded);
+  checkpoint_timer timer(checkpoint);
+
+  if (!resumed || cp.kind == SearchCheckpoint::kSolve) {
+    int depth = max_depth;
+    if (opts.optimal_only) {
+      // The optimal solve checkpoints to the same file.
+      SearchOptions search_opts;
+      search_opts.tables = opts.tables;
+      search_opts.cancel = opts.cancel;
+      search_opts.dual_lookup = opts.dual_lookup;
+      auto optimal = solve_checkpointed(start, max_depth, checkpoint,
+                                        search_opts, cp, resumed);
+      if (auto err = absl::get_if<Error>(&optimal)) {
+        return *err;
+      }
+      auto &result = absl::get<SearchResult>(optimal);
+      if (result.cancelled) {
+        return size_t(0);
+      }
+      if (!result.solved) {
+        unlink(checkpoint.path.c_str());
+        return size_t(0);
+      }
+      depth = result.path.size();
+    } else if (resumed) {
+      return Error{
+          absl::StrCat(checkpoint.path, ": checkpoint of a different search")};
+    }
+    cp = SearchCheckpoint();
+    cp.kind = SearchCheckpoint::kEnumerate;
+    cp.start = start;
+    cp.max_depth = max_depth;
+    cp.depth = depth;
+    resumed = false;
+  }
+  if (cp.depth > max_depth || !resume_path(cp.path, cp.depth)) {
+    return Error{absl::StrCat(checkpoint.path, ": bad search path")};
+  }
+
+  // A checkpoint resumes the way it was taken: by position in the tree,
+  // or by job.
+  bool by_jobs = resumed ? !cp.done.empty() : opts.threads != 1;
+  Result<size_t, Error> saved = size_t(0);
+  size_t count = cp.reported;
+  bool stopped = false;
+  if (!by_jobs) {
+    cancel_poll poll(opts.cancel);
+    auto prune = quad_bound(opts)(-1);
+    vector<uint8_t> resume = move(cp.path);
+    cp.path.clear();
+    vector<Cube> path;
+    vector<uint8_t> at;
+    bool more = resumable_search_all(
+        start, *qtm_root, cp.depth, path, at, resume.data(),
+        resume.data() + resume.size(),
+        [](const Cube &pos, int) { return pos == solved; },
+        [&](const Cube &pos, int depth) {
+          poll.visit();
+          if (stopped || poll.stop()) {
+            if (!stopped) {
+              stopped = true;
+              cp.path = at;
+            }
+            return true;
+          }
+          return prune(pos, depth);
+        },
+        [&](const vector<Cube> &solution) {
+          ++count;
+          return found(solution);
+        },
+        [&](const vector<uint8_t> &at) {
+          if (!stopped && timer.due()) {
+            cp.path = at;
+            cp.reported = count;
+            saved = timer.save(cp);
+            cp.path.clear();
+            if (absl::holds_alternative<Error>(saved)) {
+              stopped = true;
+            }
+          }
+        });
+    // The caller asked to stop; the enumeration is over.
+    stopped = stopped && more;
+  } else {
+    job_log log;
+    log.skip = move(cp.done);
+    cp.done = log.skip;
+    log.record = [&](size_t job, size_t reported) {
+      cp.done.resize(log.skip.size());
+      cp.done[job] = true;
+      cp.reported += reported;
+      if (timer.due_now() && absl::holds_alternative<size_t>(saved)) {
+        saved = timer.save(cp);
+      }
+    };
+    count += enumerate_paths(
+        start, cp.depth, [](const Cube &pos, int) { return pos == solved; },
+        quad_bound(opts), found, opts, &log);
+    if (log.mismatch) {
+      return Error{absl::StrCat(checkpoint.path, ": bad job list")};
+    }
+    stopped = opts.cancel != nullptr && opts.cancel->cancelled() &&
+              size_t(std::count(cp.done.begin(), cp.done.end(), true)) <
+                  log.skip.size();
+  }
+  if (auto err = absl::get_if<Error>(&saved)) {
+    return *err;
+  }
+  if (stopped) {
+    if (!by_jobs) {
+      cp.reported = count;
+    }
+    saved = timer.save(cp);
+    if (auto err = absl::get_if<Error>(&saved)) {
+      return *err;
+    }
+  } else {
+    unlink(checkpoint.path.c_str());
+  }
+  return count;
+}
+
+namespace {
+// masked_goal reduces enumerate_masked to a masked search: it returns a
+// start and a mask such that a path takes `from` to `to` exactly when
+// it takes the start to a cube with the mask's pieces home.
+Result<pair<Cube, CubeMask>, Error> masked_goal(const CubePattern &from,
+                                                const CubePattern &to) {
+  edge_union fe, te;
+  corner_union fc, tc;
+  fe.mm = from.cube.getEdges();
+  te.mm = to.cube.getEdges();
+  fc.mm = from.cube.getCorners();
+  tc.mm = to.cube.getCorners();
+
+  // The goal pins down slot i of a matching path: the slot of `from`
+  // that holds the piece `to` wants in slot i, and (for the pieces whose
+  // orientation `to` asks for) how the path must turn it.
+  CubeMask mask;
+  array<uint8_t, 12> edges;
+  array<uint8_t, 8> corners;
+  array<bool, 12> edge_used{};
+  array<bool, 8> corner_used{};
+  for (int i = 0; i < CubeMask::kEdges; ++i) {
+    if (!to.mask.has_edge(i)) {
+      continue;
+    }
+    int piece = te.arr[i] & Cube::kEdgePermMask;
+    int j = 0;
+    while ((fe.arr[j] & Cube::kEdgePermMask) != piece) {
+      ++j;
+    }
+    bool oriented = to.mask.edge_oriented(i);
+    if (!from.mask.has_edge(j) ||
+        (oriented && !from.mask.edge_oriented(j))) {
+      return Error{absl::StrCat("edge ", piece, " is not ",
+                                oriented ? "oriented" : "placed",
+                                " in the start pattern")};
+    }
+    edges[i] = j | ((te.arr[i] ^ fe.arr[j]) & Cube::kEdgeAlignMask);
+    edge_used[j] = true;
+    mask.edge(i, oriented);
+  }
+  for (int i = 0; i < CubeMask::kCorners; ++i) {
+    if (!to.mask.has_corner(i)) {
+      continue;
+    }
+    int piece = tc.arr[i] & Cube::kCornerPermMask;
+    int j = 0;
+    while ((fc.arr[j] & Cube::kCornerPermMask) != piece) {
+      ++j;
+    }
+    bool oriented = to.mask.corner_oriented(i);
+    if (!from.mask.has_corner(j) ||
+        (oriented && !from.mask.corner_oriented(j))) {
+      return Error{absl::StrCat("corner ", piece, " is not ",
+                                oriented ? "oriented" : "placed",
+                                " in the start pattern")};
+    }
+    int twist = (tc.arr[i] >> Cube::kCornerAlignShift) + 3 -
+                (fc.arr[j] >> Cube::kCornerAlignShift);
+    corners[i] = j | (twist % 3) << Cube::kCornerAlignShift;
+    corner_used[j] = true;
+    mask.corner(i, oriented);
+  }
+
+  // The slots outside the mask can hold anything; fill them in to make
+  // a permutation, which we invert to get the start.
+  for (int i = 0, j = 0; i < CubeMask::kEdges; ++i) {
+    if (!to.mask.has_edge(i)) {
+      while (edge_used[j]) {
+        ++j;
+      }
+      edges[i] = j++;
+    }
+  }
+  for (int i = 0, j = 0; i < CubeMask::kCorners; ++i) {
+    if (!to.mask.has_corner(i)) {
+      while (corner_used[j]) {
+        ++j;
+      }
+      corners[i] = j++;
+    }
+  }
+  return make_pair(Cube(edges, corners).invert(), mask);
+}
+}; // namespace
+
+Result<size_t, Error>
+enumerate_masked(const CubePattern &from, const CubePattern &to,
+                 int max_depth,
+                 const std::function<bool(const std::vector<Cube> &)> &found,
+                 const EnumerateOptions &opts) {
+  auto goal = masked_goal(from, to);
+  if (auto err = absl::get_if<Error>(&goal)) {
+    return *err;
+  }
+  const Cube &start = absl::get<0>(goal).first;
+  const CubeMask &mask = absl::get<0>(goal).second;
+
+  int depth = max_depth;
+  if (opts.optimal_only) {
+    SearchOptions search_opts;
+    search_opts.cancel = opts.cancel;
+    auto optimal = solve_masked(start, mask, max_depth, search_opts);
+    if (!optimal.solved) {
+      return size_t(0);
+    }
+    depth = optimal.path.size();
+  }
+
+  auto heuristic = MaskedHeuristic::get(mask);
+  return enumerate_paths(
+      start, depth, [&](const Cube &pos, int) { return mask.solved(pos); },
+      [&](int) {
+        return [h = heuristic.get()](const Cube &pos, int depth) {
+          return h->prune(pos, depth);
+        };
+      },
+      found, opts);
+}
 
 }; // namespace rubik
@@ -0,0 +1,534 @@
+#include "store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
+#include "io.h"
+
+using namespace std;
+
+namespace rubik {
+
+namespace {
+constexpr char kMagic[8] = {'R', 'U', 'B', 'I', 'K', 'S', 'O', 'L'};
+constexpr uint32_t kVersion = 1;
+
+// The header takes the first page, the index the slots after it, and
+// the log the rest of the file.
+constexpr size_t kHeaderBytes = 4096;
+// A record is the position's rank in two words, the solution's length
+// in a byte and its face turns in a byte each, padded to a word.
+constexpr size_t kKeyBytes = 16;
+constexpr size_t kRecordAlign = 8;
+// The log has room for each position's record at this size: 20 moves.
+constexpr size_t kRecordBytes = 40;
+
+// An index slot holds the top bits of the position's hash, to skip most
+// other positions' records unread, and the offset of its record in the
+// log in words, plus one; 0 is an empty slot.
+constexpr int kOffsetBits = 40;
+constexpr uint64_t kOffsetMask = (uint64_t(1) << kOffsetBits) - 1;
+
+size_t record_size(size_t length) {
+  return (kKeyBytes + 1 + length + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+// The header and index are shared with other processes, which read them
+// while we write; these accesses are atomic, and order the record's
+// bytes before the slot that points to them.
+template <typename T> T load_acquire(const T &v) {
+  return __atomic_load_n(&v, __ATOMIC_ACQUIRE);
+}
+
+template <typename T> void store_release(T &v, T x) {
+  __atomic_store_n(&v, x, __ATOMIC_RELEASE);
+}
+
+void rank_key(const Cube &pos, uint64_t key[2]) {
+  auto rank = pos.rank();
+  key[0] = absl::Uint128Low64(rank);
+  key[1] = absl::Uint128High64(rank);
+}
+
+// flock_guard holds an exclusive flock() on a store's file.
+class flock_guard {
+public:
+  explicit flock_guard(int fd) : fd_(fd) {
+    while (flock(fd_, LOCK_EX) != 0 && errno == EINTR) {
+    }
+  }
+  ~flock_guard() { flock(fd_, LOCK_UN); }
+  flock_guard(const flock_guard &) = delete;
+  flock_guard &operator=(const flock_guard &) = delete;
+
+private:
+  int fd_;
+};
+}; // namespace
+
+struct SolutionStore::Header {
+  char magic[8];
+  uint32_t version;
+  // Set once compact() has renamed a new store over this one.
+  uint32_t retired;
+  // A power of two, twice the capacity.
+  uint64_t slots;
+  uint64_t log_bytes;
+  // The records in the log end at `committed`, and those before
+  // `indexed` are in the index.
+  uint64_t committed;
+  uint64_t indexed;
+  uint64_t entries;
+  uint64_t records;
+};
+
+constexpr size_t SolutionStore::kMaxLength;
+
+Result<bool, Error> SolutionStore::create(const string &path,
+                                          size_t capacity) {
+  // We build the store under a temporary name and link it into place,
+  // so that a process that finds the file finds a whole store, and of
+  // two processes creating it at once, one wins.
+  string tmp = absl::StrCat(path, ".new.", getpid());
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Error{absl::StrCat(tmp, ": ", strerror(errno))};
+  }
+  capacity = max<size_t>(capacity, 1);
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.slots = 2;
+  while (header.slots < 2 * capacity) {
+    header.slots *= 2;
+  }
+  header.log_bytes = capacity * kRecordBytes;
+  off_t size = kHeaderBytes + header.slots * sizeof(uint64_t) +
+               header.log_bytes;
+  bool ok = ftruncate(fd, size) == 0 &&
+            pwrite_all(fd, &header, sizeof(header), 0) &&
+            fsync(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok) {
+    unlink(tmp.c_str());
+    return Error{absl::StrCat(tmp, ": write failed")};
+  }
+  int linked = link(tmp.c_str(), path.c_str());
+  int err = errno;
+  unlink(tmp.c_str());
+  if (linked != 0 && err != EEXIST) {
+    return Error{absl::StrCat(path, ": ", strerror(err))};
+  }
+  return linked == 0;
+}
+
+Result<SolutionStore, Error>
+SolutionStore::map(const string &path, const SolutionStoreOptions &opts) {
+  int fd = ::open(path.c_str(), opts.read_only ? O_RDONLY : O_RDWR);
+  if (fd < 0) {
+    return Error{absl::StrCat(path, ": ", strerror(errno))};
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < kHeaderBytes) {
+    ::close(fd);
+    return Error{absl::StrCat(path, ": not a solution store")};
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size,
+                   opts.read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    int err = errno;
+    ::close(fd);
+    return Error{absl::StrCat(path, ": ", strerror(err))};
+  }
+
+  auto *header = static_cast<Header *>(map);
+  uint64_t slots = header->slots, log_bytes = header->log_bytes;
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || slots == 0 ||
+      (slots & (slots - 1)) != 0 || log_bytes >> (kOffsetBits + 3) != 0 ||
+      size != kHeaderBytes + slots * sizeof(uint64_t) + log_bytes ||
+      load_acquire(header->indexed) > load_acquire(header->committed) ||
+      load_acquire(header->committed) > log_bytes) {
+    munmap(map, size);
+    ::close(fd);
+    return Error{absl::StrCat(path, ": not a solution store")};
+  }
+  // Readers need the descriptor only to map the file.
+  if (opts.read_only) {
+    ::close(fd);
+    fd = -1;
+  }
+
+  SolutionStore store;
+  store.path_ = path;
+  store.opts_ = opts;
+  store.fd_ = fd;
+  store.map_ = map;
+  store.map_size_ = size;
+  store.header_ = header;
+  store.slots_ = reinterpret_cast<uint64_t *>(static_cast<char *>(map) +
+                                              kHeaderBytes);
+  store.log_ = reinterpret_cast<uint8_t *>(store.slots_ + slots);
+  store.mu_.reset(new mutex);
+  return move(store);
+}
+
+Result<SolutionStore, Error>
+SolutionStore::open(const string &path, const SolutionStoreOptions &opts) {
+  if (!opts.read_only && access(path.c_str(), F_OK) != 0) {
+    auto created = create(path, opts.capacity);
+    if (auto err = absl::get_if<Error>(&created)) {
+      return *err;
+    }
+  }
+  return map(path, opts);
+}
+
+SolutionStore::SolutionStore(SolutionStore &&other) { *this = move(other); }
+
+SolutionStore &SolutionStore::operator=(SolutionStore &&other) {
+  if (this == &other) {
+    return *this;
+  }
+  unmap();
+  path_ = move(other.path_);
+  opts_ = other.opts_;
+  fd_ = other.fd_;
+  map_ = other.map_;
+  map_size_ = other.map_size_;
+  header_ = other.header_;
+  slots_ = other.slots_;
+  log_ = other.log_;
+  mu_ = move(other.mu_);
+  other.fd_ = -1;
+  other.map_ = nullptr;
+  other.header_ = nullptr;
+  other.slots_ = nullptr;
+  other.log_ = nullptr;
+  return *this;
+}
+
+SolutionStore::~SolutionStore() { unmap(); }
+
+void SolutionStore::unmap() {
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+    map_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+const uint8_t *SolutionStore::record(uint64_t value) const {
+  uint64_t offset = ((value & kOffsetMask) - 1) * kRecordAlign;
+  uint64_t log_bytes = header_->log_bytes;
+  if (offset + kKeyBytes + 1 > log_bytes) {
+    return nullptr;
+  }
+  const uint8_t *rec = log_ + offset;
+  if (offset + record_size(rec[kKeyBytes]) > log_bytes) {
+    return nullptr;
+  }
+  return rec;
+}
+
+int64_t SolutionStore::find(uint64_t hash, const uint64_t key[2],
+                            uint64_t &value) const {
+  uint64_t slots = header_->slots, mask = slots - 1;
+  for (uint64_t n = 0, i = hash & mask; n < slots; ++n, i = (i + 1) & mask) {
+    value = load_acquire(slots_[i]);
+    if (value == 0) {
+      return i;
+    }
+    if ((value ^ hash) >> kOffsetBits != 0) {
+      continue;
+    }
+    auto *rec = record(value);
+    if (rec != nullptr && memcmp(rec, key, kKeyBytes) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool SolutionStore::lookup(const Cube &pos, vector<Cube> &path) const {
+  uint64_t key[2];
+  rank_key(pos, key);
+  uint64_t value;
+  if (find(stable_hash(pos), key, value) < 0 || value == 0) {
+    return false;
+  }
+  auto *rec = record(value);
+  size_t length = rec[kKeyBytes];
+  vector<Cube> out;
+  out.reserve(length);
+  Cube at = pos;
+  for (size_t i = 0; i < length; ++i) {
+    uint8_t turn = rec[kKeyBytes + 1 + i];
+    if (turn >= face_turns().size()) {
+      return false;
+    }
+    out.push_back(face_turns()[turn]);
+    at = at.apply(out.back());
+  }
+  if (at != Cube()) {
+    return false;
+  }
+  path = move(out);
+  return true;
+}
+
+void SolutionStore::flush(const void *addr, size_t len) const {
+  if (!opts_.sync) {
+    return;
+  }
+  static const uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + len;
+  msync(reinterpret_cast<void *>(begin), end - begin, MS_SYNC);
+}
+
+void SolutionStore::index(uint64_t offset) {
+  const uint8_t *rec = log_ + offset;
+  size_t length = rec[kKeyBytes];
+  uint64_t key[2];
+  memcpy(key, rec, kKeyBytes);
+  absl::uint128 rank = absl::MakeUint128(key[1], key[0]);
+
+  // A record that doesn't solve its position is one a crash tore, and
+  // stays out of the index.
+  bool valid = rank < kCubeStates;
+  Cube pos;
+  if (valid) {
+    pos = Cube::unrank(rank);
+    Cube at = pos;
+    for (size_t i = 0; valid && i < length; ++i) {
+      uint8_t turn = rec[kKeyBytes + 1 + i];
+      valid = turn < face_turns().size();
+      if (valid) {
+        at = at.apply(face_turns()[turn]);
+      }
+    }
+    valid = valid && at == Cube();
+  }
+  uint64_t hash = stable_hash(pos), value;
+  int64_t slot = valid ? find(hash, key, value) : -1;
+  if (slot >= 0 && (value == 0 || record(value)[kKeyBytes] > length)) {
+    store_release(slots_[slot], (hash & ~kOffsetMask) |
+                                    (offset / kRecordAlign + 1));
+    flush(&slots_[slot], sizeof(uint64_t));
+    if (value == 0) {
+      store_release(header_->entries, header_->entries + 1);
+    }
+  }
+  store_release(header_->records, header_->records + 1);
+  store_release(header_->indexed, offset + record_size(length));
+}
+
+void SolutionStore::recover() {
+  uint64_t committed = header_->committed;
+  while (header_->indexed < committed) {
+    uint64_t offset = header_->indexed;
+    if (offset + kKeyBytes + 1 > committed ||
+        offset + record_size(log_[offset + kKeyBytes]) > committed) {
+      store_release(header_->indexed, committed);
+      break;
+    }
+    index(offset);
+  }
+}
+
+Result<bool, Error> SolutionStore::insert(const Cube &pos,
+                                          const vector<Cube> &path) {
+  if (opts_.read_only) {
+    return Error{absl::StrCat(path_, ": opened read-only")};
+  }
+  if (path.size() >= kMaxLength) {
+    return Error{absl::StrCat("a solution of ", path.size(),
+                              " moves is too long to store")};
+  }
+  string rec(record_size(path.size()), '\0');
+  uint64_t key[2];
+  rank_key(pos, key);
+  memcpy(&rec[0], key, kKeyBytes);
+  rec[kKeyBytes] = path.size();
+  Cube at = pos;
+  for (size_t i = 0; i < path.size(); ++i) {
+    auto &turns = face_turns();
+    auto it = std::find(turns.begin(), turns.end(), path[i]);
+    if (it == turns.end()) {
+      return Error{"a stored solution must be face turns"};
+    }
+    rec[kKeyBytes + 1 + i] = it - turns.begin();
+    at = at.apply(path[i]);
+  }
+  if (at != Cube()) {
+    return Error{"the path doesn't solve the position"};
+  }
+
+  lock_guard<mutex> lock(*mu_);
+  flock_guard file_lock(fd_);
+  if (load_acquire(header_->retired)) {
+    return Error{absl::StrCat(path_, ": compacted since we opened it")};
+  }
+  recover();
+  uint64_t value;
+  int64_t slot = find(stable_hash(pos), key, value);
+  if (slot >= 0 && value != 0 && record(value)[kKeyBytes] <= path.size()) {
+    return false;
+  }
+  uint64_t committed = header_->committed;
+  if (slot < 0 || (value == 0 && header_->entries >= capacity()) ||
+      committed + rec.size() > header_->log_bytes) {
+    return Error{absl::StrCat(path_, ": full; compact it")};
+  }
+
+  // Append and commit the record, then index it.
+  memcpy(log_ + committed, rec.data(), rec.size());
+  flush(log_ + committed, rec.size());
+  store_release(header_->committed, committed + rec.size());
+  flush(header_, sizeof(Header));
+  index(committed);
+  return true;
+}
+
+bool SolutionStore::stale() const { return load_acquire(header_->retired); }
+
+Result<bool, Error> SolutionStore::refresh() {
+  if (!stale()) {
+    return false;
+  }
+  auto fresh = map(path_, opts_);
+  if (auto err = absl::get_if<Error>(&fresh)) {
+    return *err;
+  }
+  *this = move(absl::get<SolutionStore>(fresh));
+  return true;
+}
+
+size_t SolutionStore::size() const { return load_acquire(header_->entries); }
+size_t SolutionStore::capacity() const { return header_->slots / 2; }
+size_t SolutionStore::records() const {
+  return load_acquire(header_->records);
+}
+size_t SolutionStore::log_used() const {
+  return load_acquire(header_->committed);
+}
+size_t SolutionStore::log_bytes() const { return header_->log_bytes; }
+
+bool SolutionStore::full() const {
+  return size() >= capacity() ||
+         log_used() + record_size(kMaxLength - 1) > log_bytes();
+}
+
+Result<size_t, Error> SolutionStore::compact(const string &path,
+                                             size_t capacity) {
+  SolutionStoreOptions opts;
+  auto opened = map(path, opts);
+  if (auto err = absl::get_if<Error>(&opened)) {
+    return *err;
+  }
+  auto &old = absl::get<SolutionStore>(opened);
+  flock_guard file_lock(old.fd_);
+  if (old.stale()) {
+    return Error{absl::StrCat(path, ": compacted concurrently")};
+  }
+  old.recover();
+
+  // The new store takes no syncs until it's whole, and is flushed once
+  // before it replaces the old.
+  string tmp = path + ".compact";
+  unlink(tmp.c_str());
+  auto created = create(tmp, max(capacity, 2 * old.size()));
+  if (auto err = absl::get_if<Error>(&created)) {
+    return *err;
+  }
+  opts.sync = false;
+  auto mapped = map(tmp, opts);
+  if (auto err = absl::get_if<Error>(&mapped)) {
+    unlink(tmp.c_str());
+    return *err;
+  }
+  auto &fresh = absl::get<SolutionStore>(mapped);
+  for (uint64_t i = 0; i < old.header_->slots; ++i) {
+    uint64_t value = old.slots_[i];
+    auto *rec = value == 0 ? nullptr : old.record(value);
+    if (rec == nullptr) {
+      continue;
+    }
+    size_t size = record_size(rec[kKeyBytes]);
+    uint64_t committed = fresh.header_->committed;
+    memcpy(fresh.log_ + committed, rec, size);
+    fresh.header_->committed = committed + size;
+    fresh.index(committed);
+  }
+  bool ok = msync(fresh.map_, fresh.map_size_, MS_SYNC) == 0 &&
+            fsync(fresh.fd_) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    unlink(tmp.c_str());
+    return Error{absl::StrCat(path, ": compaction failed")};
+  }
+  store_release(old.header_->retired, uint32_t(1));
+  old.flush(old.header_, sizeof(Header));
+  return fresh.size();
+}
+
+SearchResult solve_stored(Cube start, int max_depth, SolutionStore &store,
+                          const SearchOptions &opts, Error *store_error) {
+  auto report = [&](const Error &err) {
+    if (store_error != nullptr) {
+      *store_error = err;
+    }
+  };
+  // A compacted store still answers lookups, so if we can't map the new
+  // one we carry on with the old.
+  if (store.stale()) {
+    auto refreshed = store.refresh();
+    if (auto err = absl::get_if<Error>(&refreshed)) {
+      report(*err);
+    }
+  }
+  SearchResult result;
+  if (store.lookup(start, result.path)) {
+    result.lower_bound = result.path.size();
+    result.solved = int(result.path.size()) <= max_depth;
+    if (!result.solved) {
+      result.path.clear();
+    }
+    return result;
+  }
+  result = solve(start, max_depth, opts);
+  if (!result.solved || opts.weight != 1 || store.read_only() ||
+      store.full()) {
+    return result;
+  }
+  auto inserted = store.insert(start, result.path);
+  // The store may have been compacted since we refreshed it.
+  if (absl::holds_alternative<Error>(inserted) && store.stale()) {
+    auto refreshed = store.refresh();
+    if (auto err = absl::get_if<Error>(&refreshed)) {
+      report(*err);
+      return result;
+    }
+    inserted = store.insert(start, result.path);
+  }
+  if (auto err = absl::get_if<Error>(&inserted)) {
+    report(*err);
+  }
+  return result;
+}
+}; // namespace rubik
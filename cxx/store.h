@@ -0,0 +1,153 @@
+#ifndef RUBIK_STORE_H
+#define RUBIK_STORE_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rubik.h"
+
+namespace rubik {
+// Options for SolutionStore::open().
+struct SolutionStoreOptions {
+  // Map the store read-only. A reader never blocks, nor is blocked by,
+  // the writers.
+  bool read_only = false;
+  // If there is no store at the path (and we may write), create one
+  // with room for this many positions.
+  size_t capacity = size_t(1) << 20;
+  // Flush each insert to disk before publishing it, so that a crash of
+  // the machine loses at most the insert in progress. Without it, such a
+  // crash can lose recent inserts too (but a crash of the process
+  // can't).
+  bool sync = true;
+};
+
+// A SolutionStore is a file of optimal solutions, keyed by position,
+// that many local processes share: each maps it, looks positions up
+// before searching for them, and inserts what it solves.
+//
+// The file is an open-addressed hash index over an append-only log of
+// records, each a position's rank, the length of its solution and the
+// solution's face turns. An insert appends its record to the log, then
+// commits it by advancing the log's end, and only then publishes it in
+// the index with a single atomic store; lookups read the index and the
+// record without any lock. Writers take turns with flock(), and a writer
+// that finds records committed but not indexed (its predecessor
+// crashed) indexes them first. A lookup also replays each record it
+// returns, so a record torn by a crash of the machine is never served.
+//
+// The log never shrinks: a shorter solution for a stored position is
+// appended and replaces the old one in the index. compact() rewrites
+// the store without the replaced records, and with room for more.
+class SolutionStore {
+public:
+  // A solution of this many face turns or more can't be stored.
+  static constexpr size_t kMaxLength = 256;
+
+  // open maps the store at `path`, creating it unless opts.read_only.
+  static Result<SolutionStore, Error>
+  open(const std::string &path,
+       const SolutionStoreOptions &opts = SolutionStoreOptions());
+  // compact rewrites the store at `path` with only the current solution
+  // of each position, and room for `capacity` positions (or twice as
+  // many as it has, if that's more), and renames the result over it. It
+  // returns the positions kept. Writers wait for it; readers still see
+  // the old store until they refresh().
+  static Result<size_t, Error> compact(const std::string &path,
+                                       size_t capacity = 0);
+
+  SolutionStore(SolutionStore &&other);
+  SolutionStore &operator=(SolutionStore &&other);
+  SolutionStore(const SolutionStore &) = delete;
+  SolutionStore &operator=(const SolutionStore &) = delete;
+  ~SolutionStore();
+
+  // lookup sets `path` to the stored solution of `pos`, if any.
+  bool lookup(const Cube &pos, std::vector<Cube> &path) const;
+  // insert stores `path`, which must be face turns that solve `pos`, as
+  // its solution. It returns false, leaving the store as it was, if the
+  // store already has a solution at least as short.
+  Result<bool, Error> insert(const Cube &pos, const std::vector<Cube> &path);
+
+  // Whether compact() has replaced the file we have mapped; refresh()
+  // maps the new one if so. Inserts into a stale store fail. Lookups and
+  // inserts may run on several threads at once, but refresh() must run
+  // alone.
+  bool stale() const;
+  Result<bool, Error> refresh();
+
+  bool read_only() const { return opts_.read_only; }
+
+  // The positions stored, and the most the index takes.
+  size_t size() const;
+  size_t capacity() const;
+  // Records in the log, including those that a shorter solution has
+  // replaced, and the log's bytes used and in all.
+  size_t records() const;
+  size_t log_used() const;
+  size_t log_bytes() const;
+  // Whether an insert of a new position could fail for lack of room.
+  bool full() const;
+
+private:
+  struct Header;
+
+  SolutionStore() = default;
+  static Result<SolutionStore, Error> map(const std::string &path,
+                                          const SolutionStoreOptions &opts);
+  // create writes an empty store to `path`, unless a file is there. It
+  // returns whether it did.
+  static Result<bool, Error> create(const std::string &path, size_t capacity);
+
+  // find returns the index slot holding `key`, or else the empty slot
+  // that ends its probe sequence, and sets `value` to what the slot
+  // holds; -1 if it finds neither.
+  int64_t find(uint64_t hash, const uint64_t key[2], uint64_t &value) const;
+  // record returns the record a slot value points to, or nullptr if the
+  // value points outside the log.
+  const uint8_t *record(uint64_t value) const;
+  // index adds the committed record at `offset` to the index, unless
+  // its position has a solution at least as short, and marks it indexed.
+  void index(uint64_t offset);
+  // recover indexes the records committed but not yet indexed.
+  void recover();
+  void flush(const void *addr, size_t len) const;
+  void unmap();
+
+  std::string path_;
+  SolutionStoreOptions opts_;
+  int fd_ = -1;
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+  Header *header_ = nullptr;
+  uint64_t *slots_ = nullptr;
+  uint8_t *log_ = nullptr;
+  // Serializes this process's writers, which share one flock().
+  std::unique_ptr<std::mutex> mu_;
+};
+
+// solve_stored is solve() that checks `store` first, and inserts what it
+// solves. A stored solution comes back with no nodes visited, or as
+// unsolved with the solution's length as lower bound if that's more
+// than max_depth. Weighted solutions aren't optimal and aren't stored,
+// nor is anything in a read-only or full store.
+//
+// The store is only a cache: solve_stored always returns the search's
+// result, and sets `store_error` (if given) when it couldn't refresh the
+// store or insert into it. That error comes separately, rather than as
+// a Result<SearchResult, Error>, because it doesn't undo the search: a
+// caller gets the solution and, if it cares, why it wasn't stored.
+//
+// solve_stored refreshes a stale store, before the lookup and again if
+// an insert finds the store compacted, so it must not run while other
+// threads use the store.
+SearchResult solve_stored(Cube start, int max_depth, SolutionStore &store,
+                          const SearchOptions &opts = SearchOptions(),
+                          Error *store_error = nullptr);
+}; // namespace rubik
+
+#endif
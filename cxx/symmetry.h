@@ -0,0 +1,115 @@
+#ifndef RUBIK_SYMMETRY_H
+#define RUBIK_SYMMETRY_H
+#include <stddef.h>
+
+#include <array>
+#include <utility>
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <tmmintrin.h>
+
+#include "rubik.h"
+
+namespace rubik {
+// A SymmetryTable conjugates positions by a fixed list of symmetries,
+// given as pairs of a symmetry s and its inverse (like `symmetries`):
+// the conjugate of c by the i'th pair is s_inv.apply(c.apply(s)).
+//
+// Two apply()s shuffle every cubie twice and fix up its orientation
+// twice. The table compiles each symmetry into one kernel instead: a
+// shuffle of c by s's permutation, a shuffle of s_inv by the result,
+// and a single orientation fix-up that adds in s's orientations, which
+// are constants.
+class SymmetryTable {
+public:
+  // The size of the cube's symmetry group, and so the most symmetries
+  // a table can hold.
+  static constexpr size_t kMaxSymmetries = 48;
+
+  // The table for a constant list of symmetries is itself constant.
+  template <size_t N>
+  constexpr explicit SymmetryTable(
+      const std::array<std::pair<Cube, Cube>, N> &symmetries)
+      : kernels_{}, size_(N) {
+    static_assert(N <= kMaxSymmetries, "too many symmetries");
+    for (size_t i = 0; i < N; ++i) {
+      kernels_[i] = make_kernel(symmetries[i].first, symmetries[i].second);
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  // A partial conjugate holds the cubie bytes of a conjugate in the
+  // layout of Cube, but only the bytes of real slots are meaningful:
+  // the padding is left as whatever the shuffles produce. It's for
+  // callers that read a few slots, like a table index.
+  struct Partial {
+    __m128i edges;
+    __m128i corners;
+  };
+
+  Partial partial_conjugate(size_t i, const Cube &c) const {
+    const kernel &k = kernels_[i];
+    auto e = _mm_shuffle_epi8(c.getEdges(), k.edge_perm);
+    auto edges = _mm_xor_si128(
+        _mm_shuffle_epi8(k.inv_edges,
+                         _mm_and_si128(e, _mm_set1_epi8(Cube::kEdgePermMask))),
+        _mm_xor_si128(_mm_and_si128(e, _mm_set1_epi8(Cube::kEdgeAlignMask)),
+                      k.edge_flip));
+
+    auto c8 = _mm_shuffle_epi8(c.getCorners(), k.corner_perm);
+    auto corners = _mm_add_epi8(
+        _mm_shuffle_epi8(k.inv_corners, _mm_and_si128(c8, _mm_set1_epi8(
+                                                              Cube::kCornerPermMask))),
+        _mm_add_epi8(_mm_and_si128(c8, _mm_set1_epi8(Cube::kCornerAlignMask)),
+                     k.corner_twist));
+    // Three twists of at most 2 add up to at most 6, so reducing mod 3
+    // takes up to two subtractions.
+    auto lim = _mm_set1_epi8(3 << Cube::kCornerAlignShift);
+    corners = _mm_sub_epi8(
+        corners, _mm_andnot_si128(_mm_cmplt_epi8(corners, lim), lim));
+    corners = _mm_sub_epi8(
+        corners, _mm_andnot_si128(_mm_cmplt_epi8(corners, lim), lim));
+    return Partial{edges, corners};
+  }
+
+  // conjugate(i, c) == symmetries[i].second.apply(c.apply(symmetries[i].first)).
+  Cube conjugate(size_t i, const Cube &c) const {
+    auto p = partial_conjugate(i, c);
+    return Cube(_mm_and_si128(p.edges, edge_slots()),
+                _mm_and_si128(p.corners, corner_slots()));
+  }
+
+private:
+  static __m128i edge_slots() { return _mm_setr_epi32(-1, -1, -1, 0); }
+  static __m128i corner_slots() { return _mm_setr_epi32(-1, -1, 0, 0); }
+
+  struct kernel {
+    // s's permutation and orientations, and s_inv's cubies.
+    __m128i edge_perm, edge_flip, inv_edges;
+    __m128i corner_perm, corner_twist, inv_corners;
+  };
+
+  // Each byte of a mask, as a constant vector.
+  static constexpr __m128i splat(uint8_t mask) {
+    return __m128i{(long long)(0x0101010101010101ull * mask),
+                   (long long)(0x0101010101010101ull * mask)};
+  }
+  static constexpr kernel make_kernel(const Cube &s, const Cube &s_inv) {
+    return kernel{
+        s.getEdges() & splat(Cube::kEdgePermMask),
+        s.getEdges() & splat(Cube::kEdgeAlignMask),
+        s_inv.getEdges(),
+        s.getCorners() & splat(Cube::kCornerPermMask),
+        s.getCorners() & splat(Cube::kCornerAlignMask),
+        s_inv.getCorners(),
+    };
+  }
+
+  kernel kernels_[kMaxSymmetries];
+  size_t size_;
+};
+}; // namespace rubik
+
+#endif
@@ -1,9 +1,37 @@
+#ifndef RUBIK_TABLES_H
+#define RUBIK_TABLES_H
 #include <array>
+#include <stddef.h>
 #include <stdint.h>
 
 namespace rubik {
-extern std::array<int8_t, 32 * 32> edge_dist;
-extern std::array<int8_t, 32 * 32> corner_dist;
-extern std::array<int8_t, 32 * 32> pair0_dist;
-extern std::array<int8_t, 32 * 32 * 32 * 32> quad01_dist;
+// PackedDistTable stores one 4-bit distance per entry, two entries per
+// byte with the even entry in the low nibble. Entries that were never
+// reached (or that no legal cube can index) hold kUnknownDist.
+constexpr int kUnknownDist = 0xf;
+
+template <size_t n> struct PackedDistTable {
+  std::array<uint8_t, (n + 1) / 2> packed;
+
+  static constexpr size_t size() { return n; }
+
+  int operator[](size_t i) const {
+    return (packed[i >> 1] >> ((i & 1) << 2)) & 0xf;
+  }
+
+  void set(size_t i, int v) {
+    int shift = (i & 1) << 2;
+    packed[i >> 1] = (packed[i >> 1] & ~(0xf << shift)) | ((v & 0xf) << shift);
+  }
+
+  // The byte holding entry `i`, for prefetching.
+  const void *address(size_t i) const { return &packed[i >> 1]; }
+};
+
+extern PackedDistTable<32 * 32> edge_dist;
+extern PackedDistTable<32 * 32> corner_dist;
+extern PackedDistTable<32 * 32> pair0_dist;
+extern PackedDistTable<32 * 32 * 32 * 32> quad01_dist;
 }; // namespace rubik
+
+#endif
@@ -0,0 +1,119 @@
+// algdb builds and queries an AlgorithmDatabase.
+//
+//   algdb --build=DEPTH [--run-entries=N] DB
+//   algdb [--rotations] [--auf] DB [ALG...]
+//
+// A query prints every sequence in the database that produces the
+// position of each algorithm (read from the arguments, or one per line
+// from stdin), with any U turns before and after it.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "database.h"
+#include "tools/flags.h"
+
+using namespace std;
+using namespace rubik;
+
+namespace {
+int usage() {
+  cerr << "usage: algdb --build=DEPTH [--run-entries=N] DB\n"
+          "       algdb [--rotations] [--auf] DB [ALG...]\n";
+  return 2;
+}
+
+string auf(int turns) {
+  static const char *names[] = {"", "U", "U2", "U'"};
+  return names[turns];
+}
+}; // namespace
+
+int main(int argc, char **argv) {
+  int build_depth = -1;
+  DatabaseBuildOptions build_opts;
+  DatabaseLookupOptions lookup_opts;
+  vector<string> args;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i], value;
+    if (flag_value(arg, "--build=", value)) {
+      build_depth = atoi(value.c_str());
+    } else if (flag_value(arg, "--run-entries=", value)) {
+      build_opts.run_entries = strtoull(value.c_str(), nullptr, 10);
+    } else if (arg == "--rotations") {
+      lookup_opts.rotations = true;
+    } else if (arg == "--auf") {
+      lookup_opts.auf = true;
+    } else if (arg.substr(0, 2) == "--") {
+      return usage();
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (args.empty()) {
+    return usage();
+  }
+  string path = args.front();
+  args.erase(args.begin());
+
+  if (build_depth >= 0) {
+    if (!args.empty()) {
+      return usage();
+    }
+    auto start = chrono::steady_clock::now();
+    auto built = AlgorithmDatabase::build(path, build_depth, build_opts);
+    if (auto err = absl::get_if<Error>(&built)) {
+      cerr << err->error << "\n";
+      return 1;
+    }
+    cerr << path << ": " << absl::get<size_t>(built) << " sequences, "
+         << chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now() - start)
+                .count()
+         << "ms\n";
+    return 0;
+  }
+
+  auto opened = AlgorithmDatabase::open(path);
+  if (auto err = absl::get_if<Error>(&opened)) {
+    cerr << err->error << "\n";
+    return 1;
+  }
+  auto &db = absl::get<AlgorithmDatabase>(opened);
+
+  if (args.empty()) {
+    for (string line; getline(cin, line);) {
+      args.push_back(line);
+    }
+  }
+  int status = 0;
+  for (auto &alg : args) {
+    auto pos = from_algorithm(alg);
+    if (auto err = absl::get_if<Error>(&pos)) {
+      cerr << alg << ": " << err->error << "\n";
+      status = 1;
+      continue;
+    }
+    auto start = chrono::steady_clock::now();
+    auto found = db.lookup(absl::get<Cube>(pos), lookup_opts);
+    auto elapsed = chrono::steady_clock::now() - start;
+    cout << alg << ": " << found.size() << " sequences ("
+         << chrono::duration_cast<chrono::microseconds>(elapsed).count()
+         << "us)\n";
+    for (auto &m : found) {
+      cout << "  ";
+      if (m.pre_u != 0) {
+        cout << "(" << auf(m.pre_u) << ") ";
+      }
+      cout << absl::get<string>(to_algorithm(m.moves));
+      if (m.post_u != 0) {
+        cout << " (" << auf(m.post_u) << ")";
+      }
+      cout << "\n";
+    }
+  }
+  return status;
+}
@@ -0,0 +1,20 @@
+#ifndef RUBIK_TOOLS_FLAGS_H
+#define RUBIK_TOOLS_FLAGS_H
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace rubik {
+// flag_value sets `value` to what follows `name` (e.g. "--depth=") in
+// the command-line argument `arg`, if `arg` starts with it.
+inline bool flag_value(const std::string &arg, absl::string_view name,
+                       std::string &value) {
+  if (absl::string_view(arg).substr(0, name.size()) != name) {
+    return false;
+  }
+  value = arg.substr(name.size());
+  return true;
+}
+}; // namespace rubik
+
+#endif
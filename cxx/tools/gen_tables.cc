@@ -1,9 +1,12 @@
 #include <assert.h>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 
+#include "mask.h"
 #include "rubik.h"
 #include "rubik_impl.h"
+#include "tables.h"
 
 #include <emmintrin.h>
 #include <smmintrin.h>
@@ -13,10 +16,10 @@ using namespace std;
 using namespace rubik;
 
 namespace rubik {
-array<int8_t, 32 * 32> corner_dist;
-array<int8_t, 32 * 32> edge_dist;
-array<int8_t, 32 * 32> pair0_dist;
-array<int8_t, 32 * 32 * 32 * 32> quad01_dist;
+PackedDistTable<32 * 32> corner_dist;
+PackedDistTable<32 * 32> edge_dist;
+PackedDistTable<32 * 32> pair0_dist;
+PackedDistTable<32 * 32 * 32 * 32> quad01_dist;
 }; // namespace rubik
 
 void floyd_warshall(size_t n, array<int8_t, 32 * 32> &grid) {
@@ -32,33 +35,32 @@ void floyd_warshall(size_t n, array<int8_t, 32 * 32> &grid) {
 
 const int8_t kInfinity = 50;
 
-void render(const string &name, int8_t *vals, size_t n) {
-  cout << "std::array<int8_t, " << n << "> " << name << " {\n";
-  for (size_t i = 0; i < n;) {
-    cout << "    ";
-    for (int j = 0; j < 32 && i < n; j++, i++) {
-      auto v = vals[i];
-      if (v >= kInfinity) {
-        cout << "-1";
-      } else {
-        cout << (int)v;
-      }
-      cout << ",";
-      if (j != 31) {
-        cout << ' ';
-      }
-    }
-    cout << "\n";
+template <size_t n>
+void pack(const array<int8_t, n> &vals, PackedDistTable<n> &table) {
+  for (size_t i = 0; i < n; ++i) {
+    assert(vals[i] < kUnknownDist || vals[i] >= kInfinity);
+    table.set(i, vals[i] >= kInfinity ? kUnknownDist : vals[i]);
   }
-  cout << "};\n";
 }
 
-template <size_t n> void render(const string &name, array<int8_t, n> &vals) {
-  render(name, &vals[0], n);
+template <size_t n>
+void render(const string &name, const PackedDistTable<n> &table) {
+  cout << "PackedDistTable<" << n << "> " << name << " {{\n";
+  auto &bytes = table.packed;
+  for (size_t i = 0; i < bytes.size();) {
+    cout << "   ";
+    for (int j = 0; j < 16 && i < bytes.size(); j++, i++) {
+      cout << " 0x" << hex << setw(2) << setfill('0') << (int)bytes[i] << dec
+           << ",";
+    }
+    cout << "\n";
+  }
+  cout << "}};\n";
 }
 
 void compute_edge_dist(vector<Cube> &all_moves) {
-  fill(edge_dist.begin(), edge_dist.end(), kInfinity);
+  array<int8_t, 32 * 32> dist;
+  fill(dist.begin(), dist.end(), kInfinity);
   for (const auto &m : all_moves) {
     rubik::edge_union eu;
     eu.mm = m.getEdges();
@@ -66,18 +68,20 @@ void compute_edge_dist(vector<Cube> &all_moves) {
       for (int a = 0; a < 2; a++) {
         uint from = (a << rubik::Cube::kEdgeAlignShift) | i;
         uint to = eu.arr[i] ^ (a << rubik::Cube::kEdgeAlignShift);
-        edge_dist[from * 32 + to] = 1;
+        dist[from * 32 + to] = 1;
       }
     }
   }
   for (int i = 0; i < 32; ++i) {
-    edge_dist[i * 32 + i] = 0;
+    dist[i * 32 + i] = 0;
   }
-  floyd_warshall(32, edge_dist);
+  floyd_warshall(32, dist);
+  pack(dist, edge_dist);
 }
 
 void compute_corner_dist(vector<Cube> &all_moves) {
-  fill(corner_dist.begin(), corner_dist.end(), kInfinity);
+  array<int8_t, 32 * 32> dist;
+  fill(dist.begin(), dist.end(), kInfinity);
   for (const auto &m : all_moves) {
     rubik::corner_union cu;
     cu.mm = m.getCorners();
@@ -91,151 +95,32 @@ void compute_corner_dist(vector<Cube> &all_moves) {
         }
         assert(from < 32);
         assert(to < 32);
-        corner_dist[from * 32 + to] = 1;
+        dist[from * 32 + to] = 1;
       }
     }
   }
   for (int i = 0; i < 32; ++i) {
-    corner_dist[i * 32 + i] = 0;
-  }
-  floyd_warshall(32, corner_dist);
-}
-
-bool prefix_prune(const Cube &pos, int n, int depth) {
-  rubik::edge_union eu;
-  rubik::corner_union cu;
-
-  eu.mm = pos.getEdges();
-  cu.mm = pos.getCorners();
-
-  for (uint i = 0; i < eu.arr.size(); ++i) {
-    auto v = eu.arr[i];
-    if ((v & rubik::Cube::kEdgePermMask) >= n)
-      continue;
-    if (edge_dist[(i << 5) | v] > depth) {
-      return true;
-    }
-  }
-  for (uint i = 0; i < cu.arr.size(); ++i) {
-    auto v = cu.arr[i];
-    if ((v & rubik::Cube::kCornerPermMask) >= n)
-      continue;
-    if (corner_dist[(i << 5) | v] > depth) {
-      return true;
-    }
-  }
-  return false;
-}
-
-int prefix_search(const Cube &init, int n) {
-  union {
-    uint8_t bits[16];
-    __m128i mm;
-  } maskbits;
-  for (int i = 0; i < 16; i++) {
-    if (i < n) {
-      maskbits.bits[i] = 0xff;
-    } else {
-      maskbits.bits[i] = 0;
-    }
-  }
-  const auto mask = maskbits.mm;
-  Cube solved;
-
-  for (int depth = 0;; ++depth) {
-    bool ok = search(
-        init, *qtm_root, depth,
-        [&](const Cube &pos, int) {
-          return _mm_test_all_zeros(
-              _mm_or_si128(
-                  _mm_xor_si128(pos.getEdges(), solved.getEdges()),
-                  _mm_xor_si128(pos.getCorners(), solved.getCorners())),
-              mask);
-        },
-        [&](const Cube &pos, int depth) {
-          if (prefix_prune(pos, n, depth)) {
-            return true;
-          }
-          if (n >= 2) {
-            auto inv = pos.invert();
-            edge_union eu;
-            corner_union cu;
-            eu.mm = inv.getEdges();
-            cu.mm = inv.getCorners();
-            auto d = pair0_dist[(eu.arr[0] << 5) | cu.arr[0]];
-            if (d > depth) {
-              return true;
-            }
-          }
-          return false;
-        },
-        [&](int, const Cube &) {});
-    if (ok) {
-      return depth;
-    }
+    dist[i * 32 + i] = 0;
   }
+  floyd_warshall(32, dist);
+  pack(dist, corner_dist);
 }
 
 void compute_pair0_dist() {
-  Cube solved;
-
-  vector<int8_t> all_edge;
-  vector<int8_t> all_corner;
-  for (int e = 0; e < 12; ++e) {
-    for (int ea = 0; ea < 2; ++ea) {
-      all_edge.push_back((ea << rubik::Cube::kEdgeAlignShift) | e);
-    }
-  }
-  for (int c = 0; c < 8; ++c) {
-    for (int ca = 0; ca < 3; ++ca) {
-      all_corner.push_back((ca << rubik::Cube::kCornerAlignShift) | c);
-    }
-  }
-
-  for (auto e : all_edge) {
-    for (auto c : all_corner) {
-      rubik::edge_union eu;
-      rubik::corner_union cu;
-      eu.mm = solved.getEdges();
-      cu.mm = solved.getCorners();
-
-      eu.arr[e & rubik::Cube::kEdgePermMask] = 0;
-      eu.arr[0] = e;
-      cu.arr[c & rubik::Cube::kCornerPermMask] = 0;
-      cu.arr[0] = c;
-
-      Cube pos(eu.mm, cu.mm);
-      int d = prefix_search(pos.invert(), 1);
-      pair0_dist[(e << 5) | c] = d;
-    }
+  MaskTable table(CubeMask().edge(0).corner(0));
+  for (size_t i = 0; i < table.size(); ++i) {
+    pair0_dist.set(i, table[i]);
   }
 }
 
+// quad01_dist is laid out like the MaskTable for edges 0 and 1 and
+// corners 0 and 1, which a breadth-first search over the four pieces'
+// places builds in well under a second. (A tree search of the whole cube
+// to the table's depth, as for a search, takes hours.)
 void compute_quad01_dist() {
-  Cube solved;
-
-  fill(quad01_dist.begin(), quad01_dist.end(), kInfinity);
-
-  int64_t progress = 1;
-  for (int depth = 1; progress; ++depth) {
-    progress = 0;
-    search(solved, *qtm_root, depth, [&](const Cube &pos, int todo) {
-      edge_union eu;
-      corner_union cu;
-      eu.mm = pos.getEdges();
-      cu.mm = pos.getCorners();
-      int d = depth - todo;
-      int8_t &dst = quad01_dist[(eu.arr[0] << 15) | (eu.arr[1] << 10) |
-                                (cu.arr[0] << 5) | (cu.arr[1])];
-      if (dst == kInfinity) {
-        dst = d;
-        progress++;
-      } else {
-        assert(dst <= d);
-      }
-      return false;
-    });
-    cerr << "quad_search depth=" << depth << " progress=" << progress << "\n";
+  MaskTable table(CubeMask().edge(0).edge(1).corner(0).corner(1));
+  for (size_t i = 0; i < table.size(); ++i) {
+    quad01_dist.set(i, table[i]);
   }
 }
 
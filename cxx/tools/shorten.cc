@@ -0,0 +1,118 @@
+// shorten rewrites algorithms into equivalent, shorter ones using a
+// MoveDictionary.
+//
+//   shorten --build=DEPTH DICT     build a dictionary and save it
+//   shorten [--window=N] [--stats] DICT [ALG...]
+//
+// Algorithms are read from the arguments, or one per line from stdin,
+// and written one per line to stdout. --stats reports throughput and
+// moves saved on stderr.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "tools/flags.h"
+
+using namespace std;
+using namespace rubik;
+
+namespace {
+int usage() {
+  cerr << "usage: shorten --build=DEPTH DICT\n"
+          "       shorten [--window=N] [--stats] DICT [ALG...]\n";
+  return 2;
+}
+}; // namespace
+
+int main(int argc, char **argv) {
+  int build_depth = -1;
+  int window = 0;
+  bool stats = false;
+  vector<string> args;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i], value;
+    if (flag_value(arg, "--build=", value)) {
+      build_depth = atoi(value.c_str());
+      if (build_depth < 0 || build_depth > MoveDictionary::kMaxDepth) {
+        cerr << "--build depth must be between 0 and "
+             << MoveDictionary::kMaxDepth << "\n";
+        return 2;
+      }
+    } else if (flag_value(arg, "--window=", value)) {
+      window = atoi(value.c_str());
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if (arg.substr(0, 2) == "--") {
+      return usage();
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (args.empty()) {
+    return usage();
+  }
+  string path = args.front();
+  args.erase(args.begin());
+
+  if (build_depth >= 0) {
+    if (!args.empty()) {
+      return usage();
+    }
+    auto start = chrono::steady_clock::now();
+    auto dict = MoveDictionary::build(build_depth);
+    auto saved = dict.save(path);
+    if (auto err = absl::get_if<Error>(&saved)) {
+      cerr << err->error << "\n";
+      return 1;
+    }
+    cerr << path << ": " << dict.size() << " positions, "
+         << absl::get<size_t>(saved) << " bytes, "
+         << chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now() - start)
+                .count()
+         << "ms\n";
+    return 0;
+  }
+
+  auto opened = MoveDictionary::open(path);
+  if (auto err = absl::get_if<Error>(&opened)) {
+    cerr << err->error << "\n";
+    return 1;
+  }
+  auto &dict = absl::get<MoveDictionary>(opened);
+
+  if (args.empty()) {
+    for (string line; getline(cin, line);) {
+      args.push_back(line);
+    }
+  }
+  int status = 0;
+  size_t in_moves = 0, out_moves = 0;
+  chrono::steady_clock::duration elapsed{};
+  for (auto &alg : args) {
+    auto parsed = algorithm_moves(alg);
+    if (auto err = absl::get_if<Error>(&parsed)) {
+      cerr << alg << ": " << err->error << "\n";
+      status = 1;
+      continue;
+    }
+    auto &moves = absl::get<vector<Cube>>(parsed);
+    auto start = chrono::steady_clock::now();
+    auto shorter = dict.shorten(moves, window);
+    elapsed += chrono::steady_clock::now() - start;
+    in_moves += moves.size();
+    out_moves += shorter.size();
+    cout << absl::get<string>(to_algorithm(shorter)) << "\n";
+  }
+  if (stats) {
+    double secs = chrono::duration<double>(elapsed).count();
+    cerr << args.size() << " algorithms, " << in_moves << " -> " << out_moves
+         << " moves, " << (secs > 0 ? args.size() / secs : 0)
+         << " algorithms/s\n";
+  }
+  return status;
+}
@@ -0,0 +1,191 @@
+// solve reads scrambles, one per line, from its arguments or stdin,
+// and prints a solution for each.
+//
+//   solve [--facelets] [--order-moves] [--weight=W] [--max-depth=N]
+//         [--timeout-ms=T] [--processes=N]
+//         [--moves=GENERATORS [--half-turns]] [--store=PATH] [SCRAMBLE...]
+//
+// Scrambles are algorithms, or facelet strings with --facelets.
+// --weight trades solution length for speed (see SearchOptions::weight).
+// --processes spreads each search over N worker processes (see
+// SearchCoordinator); it can't be combined with --weight.
+// --moves solves with only the given generators, like "R,U" or "R,U,M"
+// (see MoveSet::parse), counting each turn as one move; --half-turns
+// adds their half turns. It can't be combined with --weight or
+// --processes.
+// --store looks each scramble up in a SolutionStore shared with other
+// processes before searching, and stores what it solves optimally (see
+// solve_stored). It can't be combined with --processes or --moves.
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "distributed.h"
+#include "moveset.h"
+#include "rubik.h"
+#include "store.h"
+#include "tools/flags.h"
+
+using namespace std;
+using namespace rubik;
+
+namespace {
+int usage() {
+  cerr << "usage: solve [--facelets] [--order-moves] [--weight=W] "
+          "[--max-depth=N] [--timeout-ms=T] [--processes=N] "
+          "[--moves=GENERATORS [--half-turns]] [--store=PATH] [SCRAMBLE...]\n";
+  return 2;
+}
+}; // namespace
+
+int main(int argc, char **argv) {
+  bool facelets = false;
+  SearchOptions opts;
+  // The qtm diameter; weighted searches scale it by the weight.
+  int max_depth = 0;
+  long timeout_ms = 0;
+  int processes = 0;
+  string generators;
+  bool half_turns = false;
+  string store_path;
+  vector<string> scrambles;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i], value;
+    if (arg == "--facelets") {
+      facelets = true;
+    } else if (arg == "--order-moves") {
+      opts.order_moves = true;
+    } else if (flag_value(arg, "--weight=", value)) {
+      opts.weight = atof(value.c_str());
+      if (opts.weight < 1) {
+        cerr << "--weight must be at least 1\n";
+        return 2;
+      }
+    } else if (flag_value(arg, "--max-depth=", value)) {
+      max_depth = atoi(value.c_str());
+    } else if (flag_value(arg, "--timeout-ms=", value)) {
+      timeout_ms = atol(value.c_str());
+    } else if (flag_value(arg, "--processes=", value)) {
+      processes = atoi(value.c_str());
+    } else if (flag_value(arg, "--moves=", value)) {
+      generators = value;
+    } else if (arg == "--half-turns") {
+      half_turns = true;
+    } else if (flag_value(arg, "--store=", value)) {
+      store_path = value;
+    } else if (arg.substr(0, 2) == "--") {
+      return usage();
+    } else {
+      scrambles.push_back(arg);
+    }
+  }
+  if (processes > 0 && opts.weight != 1) {
+    cerr << "--processes can't be combined with --weight\n";
+    return 2;
+  }
+  if (!generators.empty() && (processes > 0 || opts.weight != 1)) {
+    cerr << "--moves can't be combined with --processes or --weight\n";
+    return 2;
+  }
+  if (!store_path.empty() && (processes > 0 || !generators.empty())) {
+    cerr << "--store can't be combined with --processes or --moves\n";
+    return 2;
+  }
+  Result<SolutionStore, Error> store = Error{};
+  if (!store_path.empty()) {
+    store = SolutionStore::open(store_path);
+    if (auto err = absl::get_if<Error>(&store)) {
+      cerr << err->error << "\n";
+      return 1;
+    }
+  }
+  Result<MoveSet, Error> move_set = Error{};
+  if (!generators.empty()) {
+    move_set = MoveSet::parse(generators, half_turns);
+    if (auto err = absl::get_if<Error>(&move_set)) {
+      cerr << generators << ": " << err->error << "\n";
+      return 2;
+    }
+  }
+  if (max_depth == 0) {
+    max_depth = ceil(26 * opts.weight);
+  }
+  if (scrambles.empty()) {
+    for (string line; getline(cin, line);) {
+      if (!line.empty()) {
+        scrambles.push_back(line);
+      }
+    }
+  }
+
+  // The workers are started once, and serve every scramble.
+  SearchCoordinator coordinator;
+  for (int i = 0; i < processes; ++i) {
+    auto pid = coordinator.spawn_worker(opts);
+    if (auto err = absl::get_if<Error>(&pid)) {
+      cerr << err->error << "\n";
+      return 1;
+    }
+  }
+
+  int status = 0;
+  for (auto &scramble : scrambles) {
+    auto parsed = facelets ? from_facelets(scramble) : from_algorithm(scramble);
+    if (auto err = absl::get_if<Error>(&parsed)) {
+      cerr << scramble << ": " << err->error << "\n";
+      status = 1;
+      continue;
+    }
+
+    CancelToken token = timeout_ms > 0
+                            ? CancelToken::after(chrono::milliseconds(timeout_ms))
+                            : CancelToken();
+    opts.cancel = &token;
+    auto start = chrono::steady_clock::now();
+    SearchResult result;
+    if (processes > 0) {
+      DistributedOptions dopts;
+      dopts.search = opts;
+      dopts.cancel = &token;
+      auto solved =
+          coordinator.solve(absl::get<Cube>(parsed), max_depth, dopts);
+      if (auto err = absl::get_if<Error>(&solved)) {
+        cerr << err->error << "\n";
+        return 1;
+      }
+      result = absl::get<SearchResult>(solved);
+    } else if (auto set = absl::get_if<MoveSet>(&move_set)) {
+      result = solve_moveset(absl::get<Cube>(parsed), *set, max_depth, opts);
+    } else if (auto st = absl::get_if<SolutionStore>(&store)) {
+      Error store_error;
+      result = solve_stored(absl::get<Cube>(parsed), max_depth, *st, opts,
+                            &store_error);
+      if (!store_error.error.empty()) {
+        cerr << store_path << ": " << store_error.error << "\n";
+      }
+    } else {
+      result = solve(absl::get<Cube>(parsed), max_depth, opts);
+    }
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - start);
+
+    if (result.solved) {
+      auto set = absl::get_if<MoveSet>(&move_set);
+      cout << absl::get<string>(set != nullptr ? set->to_algorithm(result.path)
+                                               : to_algorithm(result.path))
+           << " ("
+           << result.path.size() << " moves, <= " << result.suboptimality
+           << "x optimal";
+    } else {
+      cout << (result.cancelled ? "timed out" : "no solution") << " (>= "
+           << result.lower_bound << " moves";
+      status = 1;
+    }
+    cout << ", " << result.nodes << " nodes, " << elapsed.count() << "ms)\n";
+  }
+  return status;
+}
@@ -0,0 +1,116 @@
+// store_tool reports on and compacts a SolutionStore, and looks positions up
+// in it.
+//
+//   store_tool PATH
+//   store_tool --compact[=CAPACITY] PATH
+//   store_tool --lookup PATH [ALG...]
+//
+// With no flags it prints the store's positions and how much of its
+// index and log they fill. --compact rewrites it without the solutions
+// that shorter ones replaced, with room for CAPACITY positions or twice
+// as many as it holds; the processes using it carry on, and pick up the
+// new file when they next refresh. --lookup prints the stored solution
+// of each algorithm's position (read from the arguments, or one per line
+// from stdin).
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "store.h"
+#include "tools/flags.h"
+
+using namespace std;
+using namespace rubik;
+
+namespace {
+int usage() {
+  cerr << "usage: store_tool PATH\n"
+          "       store_tool --compact[=CAPACITY] PATH\n"
+          "       store_tool --lookup PATH [ALG...]\n";
+  return 2;
+}
+}; // namespace
+
+int main(int argc, char **argv) {
+  bool compact = false, lookup = false;
+  size_t capacity = 0;
+  vector<string> args;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i], value;
+    if (arg == "--compact") {
+      compact = true;
+    } else if (flag_value(arg, "--compact=", value)) {
+      compact = true;
+      capacity = strtoull(value.c_str(), nullptr, 10);
+    } else if (arg == "--lookup") {
+      lookup = true;
+    } else if (arg.substr(0, 2) == "--") {
+      return usage();
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (args.empty() || (compact && lookup) || (!lookup && args.size() != 1)) {
+    return usage();
+  }
+  string path = args.front();
+  args.erase(args.begin());
+
+  if (compact) {
+    auto start = chrono::steady_clock::now();
+    auto kept = SolutionStore::compact(path, capacity);
+    if (auto err = absl::get_if<Error>(&kept)) {
+      cerr << err->error << "\n";
+      return 1;
+    }
+    cerr << path << ": kept " << absl::get<size_t>(kept) << " positions, "
+         << chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now() - start)
+                .count()
+         << "ms\n";
+  }
+
+  SolutionStoreOptions opts;
+  opts.read_only = true;
+  auto opened = SolutionStore::open(path, opts);
+  if (auto err = absl::get_if<Error>(&opened)) {
+    cerr << err->error << "\n";
+    return 1;
+  }
+  auto &store = absl::get<SolutionStore>(opened);
+
+  if (!lookup) {
+    cout << path << ": " << store.size() << " positions of "
+         << store.capacity() << ", " << store.records() << " records, "
+         << store.log_used() << " of " << store.log_bytes()
+         << " log bytes\n";
+    return 0;
+  }
+
+  if (args.empty()) {
+    for (string line; getline(cin, line);) {
+      args.push_back(line);
+    }
+  }
+  int status = 0;
+  for (auto &alg : args) {
+    auto pos = from_algorithm(alg);
+    if (auto err = absl::get_if<Error>(&pos)) {
+      cerr << alg << ": " << err->error << "\n";
+      status = 1;
+      continue;
+    }
+    vector<Cube> solution;
+    if (!store.lookup(absl::get<Cube>(pos), solution)) {
+      cout << alg << ": not stored\n";
+      status = 1;
+      continue;
+    }
+    cout << alg << ": " << absl::get<string>(to_algorithm(solution)) << " ("
+         << solution.size() << " moves)\n";
+  }
+  return status;
+}
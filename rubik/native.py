@@ -0,0 +1,95 @@
+"""The C++ cube and search, with the same interface as rubik.cube.
+
+Batches of cubes are numpy uint8 arrays of shape (n, 16), one packed
+cube (see Cube.pack) per row. The batch functions never create a Python
+object per cube, and search_batch releases the GIL while it solves.
+"""
+import numpy as np
+
+from . import _native
+from . import cube as _cube
+from .render import Renderer, render
+
+MOVES = _native.MOVES
+PACKED_SIZE = _native.PACKED_SIZE
+
+class Cube(_native.Cube):
+  __slots__ = ()
+
+  R,G,W,B,Y,O = range(6)
+  EDGE_COLORS   = _cube.Cube.EDGE_COLORS
+  CORNER_COLORS = _cube.Cube.CORNER_COLORS
+  FACE_MAP      = _cube.Cube.FACE_MAP
+
+  facelet_color = _cube.Cube.facelet_color
+
+class Rotation(object):
+  L, L2, Linv = (Cube.from_algorithm(m) for m in ("L", "L2", "L'"))
+  R, R2, Rinv = (Cube.from_algorithm(m) for m in ("R", "R2", "R'"))
+  U, U2, Uinv = (Cube.from_algorithm(m) for m in ("U", "U2", "U'"))
+  D, D2, Dinv = (Cube.from_algorithm(m) for m in ("D", "D2", "D'"))
+  F, F2, Finv = (Cube.from_algorithm(m) for m in ("F", "F2", "F'"))
+  B, B2, Binv = (Cube.from_algorithm(m) for m in ("B", "B2", "B'"))
+
+NOTATION = {
+  name: Cube.from_algorithm(name) for name in _cube.NOTATION
+}
+
+def algorithm(txt):
+  return Cube.from_algorithm(txt)
+
+def from_facelets(txt):
+  return Cube.from_facelets(txt)
+
+def to_algorithm(moves):
+  return _native.to_algorithm(moves)
+
+def search(cube, max_depth):
+  """Returns the moves of an optimal solution to `cube` of at most
+  `max_depth` quarter turns, or None."""
+  return _native.search(cube, max_depth)
+
+def _packed(buf):
+  return np.frombuffer(buf, dtype=np.uint8).reshape(-1, PACKED_SIZE)
+
+def _as_packed(cubes):
+  if isinstance(cubes, (bytes, bytearray, memoryview)):
+    cubes = np.frombuffer(cubes, dtype=np.uint8)
+  cubes = np.ascontiguousarray(cubes, dtype=np.uint8)
+  if cubes.shape[-1:] != (PACKED_SIZE,):
+    raise ValueError("packed cubes must have shape (..., {})".format(PACKED_SIZE))
+  return cubes
+
+def pack(cubes):
+  """Packs a sequence of Cubes into an (n, 16) array."""
+  return _packed(b''.join(c.pack() for c in cubes))
+
+def unpack(cubes):
+  """Returns a list of Cubes from an (n, 16) array."""
+  return [Cube.unpack(row) for row in _as_packed(cubes).reshape(-1, PACKED_SIZE)]
+
+def apply_batch(a, b):
+  """Returns a[i].apply(b[i]) for each row. Either may be a single cube."""
+  return _packed(_native.apply_batch(_as_packed(a), _as_packed(b)))
+
+def invert_batch(a):
+  return _packed(_native.invert_batch(_as_packed(a)))
+
+def from_algorithm_lines(txt):
+  return _packed(_native.from_algorithm_lines(txt))
+
+def from_facelets_lines(txt):
+  return _packed(_native.from_facelets_lines(txt))
+
+def search_batch(cubes, max_depth, threads=1):
+  """Solves each packed cube optimally, in at most `max_depth` quarter
+  turns, on `threads` threads (0 for one per core).
+
+  Returns (lengths, moves). lengths[i] is the length of the solution to
+  cubes[i], or -1 if it has none within max_depth; moves[i, :lengths[i]]
+  are its moves as indices into MOVES, and the rest of the row is 255.
+  """
+  cubes = _as_packed(cubes).reshape(-1, PACKED_SIZE)
+  lengths, moves = _native.search_batch(cubes, max_depth, threads)
+  return (np.frombuffer(lengths, dtype=np.int8),
+          np.frombuffer(moves, dtype=np.uint8).reshape(len(cubes), max_depth))
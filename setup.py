@@ -1,7 +1,58 @@
-from distutils.core import setup
+import os
+import sys
+
+from setuptools import Extension, setup
+
+# rubik._native links the C++ sources directly. The pattern tables are
+# generated (`bazel build //cxx:tables`, or gen_tables by hand), so we
+# look for them next to the sources and in the bazel output trees; if
+# they're missing we install only the pure-Python package.
+def find_generated(name):
+  for d in ('cxx', 'bazel-bin/cxx', 'bazel-genfiles/cxx'):
+    path = os.path.join(d, name)
+    if os.path.exists(path):
+      return path
+  return None
+
+# Set ABSL_PREFIX to an abseil install if it isn't in the default paths.
+ABSL_PREFIX = os.environ.get('ABSL_PREFIX')
+ABSL_LIBS = [
+  'absl_strings', 'absl_int128', 'absl_hash', 'absl_city',
+  'absl_low_level_hash', 'absl_bad_variant_access', 'absl_throw_delegate',
+  'absl_raw_logging_internal',
+]
+
+tables = [find_generated(n) for n in ('tables.cc', 'quad01.cc')]
+ext_modules = []
+if None in tables:
+  sys.stderr.write("rubik: pattern tables not found; not building rubik._native\n")
+else:
+  ext_modules.append(Extension(
+    'rubik._native',
+    sources=[
+      'cxx/python/native.cc',
+      'cxx/checkpoint.cc',
+      'cxx/encoding.cc',
+      'cxx/io.cc',
+      'cxx/mask.cc',
+      'cxx/moveset.cc',
+      'cxx/numa.cc',
+      'cxx/rubik.cc',
+      'cxx/search.cc',
+    ] + tables,
+    include_dirs=['cxx'] + ([os.path.join(ABSL_PREFIX, 'include')] if ABSL_PREFIX else []),
+    library_dirs=[os.path.join(ABSL_PREFIX, 'lib')] if ABSL_PREFIX else [],
+    libraries=ABSL_LIBS,
+    define_macros=[('NDEBUG', None)],
+    extra_compile_args=['-std=c++14', '-msse4.2', '-pthread'],
+    extra_link_args=['-pthread'],
+    language='c++',
+  ))
 
 setup(
   name='rubik',
   version='0.1',
-  py_modules=['rubik'],
+  packages=['rubik'],
+  install_requires=['attrs', 'numpy'],
+  ext_modules=ext_modules,
 )
@@ -1,16 +1,31 @@
+import pytest
+
 import rubik
 
+try:
+  from rubik import native
+except ImportError:
+  native = None
+
+@pytest.fixture(params=['python', 'native'])
+def backend(request):
+  if request.param == 'python':
+    return rubik
+  if native is None:
+    pytest.skip("rubik._native is not built")
+  return native
+
 
-def test_colors():
-  assert len(set(rubik.Cube.EDGE_COLORS)) == len(rubik.Cube.EDGE_COLORS)
-  assert len(set(rubik.Cube.CORNER_COLORS)) == len(rubik.Cube.CORNER_COLORS)
+def test_colors(backend):
+  assert len(set(backend.Cube.EDGE_COLORS)) == len(backend.Cube.EDGE_COLORS)
+  assert len(set(backend.Cube.CORNER_COLORS)) == len(backend.Cube.CORNER_COLORS)
 
-def test_facemap():
+def test_facemap(backend):
   edges = []
   corners = []
   corner_idx = [0, 2, 6, 8]
   edge_idx   = [1, 3, 5, 7]
-  for face in rubik.Cube.FACE_MAP.values():
+  for face in backend.Cube.FACE_MAP.values():
     edges.extend([face[i] for i in edge_idx])
     corners.extend([face[i] for i in corner_idx])
   assert (
@@ -22,15 +37,15 @@ def test_facemap():
     [(i, j) for i in range(8) for j in range(3)]
   )
 
-def test_render():
-  cube = rubik.Cube()
-  renderer = rubik.Renderer(cube)
+def test_render(backend):
+  cube = backend.Cube()
+  renderer = backend.Renderer(cube)
   renderer.render()
 
-def test_moves():
-  id = rubik.Cube()
+def test_moves(backend):
+  id = backend.Cube()
   for face in 'LRUDFB':
-    rotation = getattr(rubik.Rotation, face)
+    rotation = getattr(backend.Rotation, face)
     cube = id
     for i in range(4):
       cube = cube.apply(rotation)
@@ -38,11 +53,11 @@ def test_moves():
         assert cube == rotation, "Cube() is the identity"
     assert cube == id, "{}x4 is the identity".format(face)
 
-def test_invert():
-  id = rubik.Cube()
+def test_invert(backend):
+  id = backend.Cube()
   assert id == id.invert()
 
   for face in 'LRUDFB':
-    rotation = getattr(rubik.Rotation, face)
+    rotation = getattr(backend.Rotation, face)
     assert rotation.apply(rotation.invert()) == id, "{}' {} is the identity".format(face, face)
     assert rotation.invert().apply(rotation) == id, "{} {}' is the identity".format(face, face)
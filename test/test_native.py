@@ -0,0 +1,101 @@
+import random
+import threading
+
+import numpy as np
+import pytest
+
+import rubik
+
+try:
+  from rubik import native
+except ImportError:
+  pytest.skip("rubik._native is not built", allow_module_level=True)
+
+def random_algorithm(rng, n):
+  return " ".join(rng.choice(list(rubik.NOTATION)) for _ in range(n))
+
+def same(pure, cube):
+  return (
+    pure.edge_perm == cube.edge_perm and
+    pure.edge_align == cube.edge_align and
+    pure.corner_perm == cube.corner_perm and
+    pure.corner_align == cube.corner_align
+  )
+
+def test_matches_pure():
+  rng = random.Random(1)
+  for _ in range(100):
+    alg = random_algorithm(rng, 20)
+    pure = rubik.algorithm(alg)
+    cube = native.algorithm(alg)
+    assert same(pure, cube), alg
+    assert same(pure.invert(), cube.invert()), alg
+    assert native.Cube(*(getattr(pure, f) for f in
+                         ('edge_perm', 'edge_align', 'corner_perm', 'corner_align'))) == cube
+
+def test_cube():
+  cube = native.algorithm("R U F'")
+  assert isinstance(cube.apply(cube), native.Cube)
+  assert native.Cube.unpack(cube.pack()) == cube
+  assert hash(cube) == hash(native.algorithm("R U F'"))
+  assert native.to_algorithm([native.Rotation.R, native.Rotation.Uinv]) == "R U'"
+  with pytest.raises(ValueError):
+    native.algorithm("R X")
+  with pytest.raises(ValueError):
+    native.Cube(edge_perm=(0,) * 12)
+  with pytest.raises(ValueError):
+    native.Cube.unpack(b'\xff' * 16)
+
+def test_batch():
+  rng = random.Random(2)
+  cubes = [native.algorithm(random_algorithm(rng, 10)) for _ in range(50)]
+  packed = native.pack(cubes)
+  assert packed.shape == (50, 16)
+  assert native.unpack(packed) == cubes
+
+  inverted = native.invert_batch(packed)
+  assert native.unpack(inverted) == [c.invert() for c in cubes]
+  solved = native.apply_batch(packed, inverted)
+  assert native.unpack(solved) == [native.Cube()] * len(cubes)
+
+  turned = native.apply_batch(packed, native.Rotation.R.pack())
+  assert native.unpack(turned) == [c.apply(native.Rotation.R) for c in cubes]
+
+  lines = "\n".join(["R U", "F2 B'"])
+  assert native.unpack(native.from_algorithm_lines(lines)) == [
+    native.algorithm("R U"), native.algorithm("F2 B'")]
+
+  with pytest.raises(ValueError):
+    native.apply_batch(packed, packed[:2])
+
+def test_search():
+  cube = native.algorithm("R U' F L2")
+  path = native.search(cube, 8)
+  assert len(path) == 5
+  for move in path:
+    cube = cube.apply(move)
+  assert cube == native.Cube()
+  assert native.search(cube, 3) == []
+  assert native.search(native.algorithm("R U' F L2"), 4) is None
+
+  cubes = native.pack([native.algorithm("R U' F L2"), native.Cube(),
+                       native.algorithm("R U F L D B")])
+  lengths, moves = native.search_batch(cubes, 5)
+  assert list(lengths) == [5, 0, -1]
+  assert native.algorithm(" ".join(native.MOVES[m] for m in moves[0])) == (
+    native.algorithm("R U' F L2").invert())
+  assert (moves[1:] == 255).all()
+
+def test_search_releases_gil():
+  cubes = np.repeat(native.pack([native.algorithm("R U F L2 D B")]), 8, axis=0)
+  results = [None] * 4
+  def run(i):
+    results[i] = native.search_batch(cubes, 8, threads=2)
+  threads = [threading.Thread(target=run, args=(i,)) for i in range(4)]
+  for t in threads:
+    t.start()
+  for t in threads:
+    t.join()
+  for lengths, moves in results:
+    assert (lengths == 7).all()
+    assert (moves == results[0][1]).all()